@@ -14,11 +14,20 @@ public:
 
     int addFrame(const cv::Mat& image, float* rotationMatrix, std::vector<Frame>& frames);
 
+    // Pixels per unit tangent; 0 picks a default from the image width
+    void setFocalLength(float focal) { mFocal = focal; }
+
 private:
     void detectFeatures(const cv::Mat& image, std::vector<Feature>& features);
     void matchFeatures(const std::vector<Feature>& f1, const std::vector<Feature>& f2, std::vector<Match>& matches);
-    int runRANSAC(const std::vector<Match>& matches, cv::Mat& refinedRotation);
+    // Rotation R (current to neighbour camera) with b2 ~ R * b1 over the
+    // match bearings; returns the inlier count
+    int runRANSAC(const std::vector<Match>& matches, cv::Mat& relativeRotation);
     int findOverlappingFrameS2(float* rotationMatrix, const std::vector<Frame>& frames);
+
+    float mFocal;
+    int mWidth;
+    int mHeight;
 };
 
 } // namespace lightcycle
@@ -7,12 +7,21 @@
 #include "Align.h"
 #include "db_CornerDetector.h"
 #include "db_Matcher.h"
+#include "BearingSolvers.h"
+#include "Ransac.h"
 #include <opencv2/calib3d.hpp>
+#include <cmath>
 #include <cstring>
 
 namespace lightcycle {
 
-Align::Align() {}
+namespace {
+// Inlier radius in pixels, and the field of view assumed without a focal length
+const float kInlierPixels = 3.0f;
+const float kDefaultFocalPerWidth = 0.8f;
+}
+
+Align::Align() : mFocal(0.0f), mWidth(0), mHeight(0) {}
 Align::~Align() {}
 
 /**
@@ -51,8 +60,10 @@ int Align::addFrame(const cv::Mat& image, float* rotationMatrix, std::vector<Fra
     matcher.matchFeatures(features, frames[bestNeighbor].features, matches);
 
     // 4. RANSAC for geometric verification
-    cv::Mat refinedRotation;
-    int inliers = runRANSAC(matches, refinedRotation);
+    mWidth = image.cols;
+    mHeight = image.rows;
+    cv::Mat relativeRotation;
+    int inliers = runRANSAC(matches, relativeRotation);
 
     if (inliers < 15) { // INLIER_THRESHOLD
         return MOSAIC_RET_FEW_INLIERS;
@@ -65,7 +76,10 @@ int Align::addFrame(const cv::Mat& image, float* rotationMatrix, std::vector<Fra
     newFrame.features = features;
     newFrame.matches = matches;
 
+    // Measured orientation: the neighbour's, composed with the relative rotation
     cv::Mat initialR(3, 3, CV_32F, rotationMatrix);
+    cv::Mat neighbourR(3, 3, CV_32F, frames[bestNeighbor].globalTransform);
+    cv::Mat refinedRotation = initialR.t() * neighbourR * relativeRotation;
     cv::Mat finalR = initialR * refinedRotation; // Predicted * Refinement
     memcpy(newFrame.globalTransform, finalR.data, 9 * sizeof(float));
 
@@ -82,18 +96,34 @@ void Align::matchFeatures(const std::vector<Feature>& f1, const std::vector<Feat
     Matcher().matchFeatures(f1, f2, matches);
 }
 
-int Align::runRANSAC(const std::vector<Match>& matches, cv::Mat& refinedRotation) {
-    if (matches.size() < 8) return 0;
+int Align::runRANSAC(const std::vector<Match>& matches, cv::Mat& relativeRotation) {
+    relativeRotation = cv::Mat::eye(3, 3, CV_32F);
+    if (matches.size() < 8 || mWidth <= 0) return 0;
 
-    std::vector<cv::Point2f> pts1, pts2;
+    const float focal = mFocal > 0.0f ? mFocal : kDefaultFocalPerWidth * mWidth;
+    const float cx = 0.5f * mWidth;
+    const float cy = 0.5f * mHeight;
+    auto bearing = [&](float x, float y) {
+        const cv::Point3f b((x - cx) / focal, (y - cy) / focal, 1.0f);
+        return b * (1.0f / std::sqrt(b.dot(b)));
+    };
+
+    // Frames of a panorama share the optical centre: a rotation explains every match
+    RotationProblem problem;
     for (const auto& m : matches) {
-        pts1.emplace_back(m.x1, m.y1); // Current
-        pts2.emplace_back(m.x2, m.y2); // Neighbor
+        problem.mvB1.push_back(bearing(m.x1, m.y1)); // Current
+        problem.mvB2.push_back(bearing(m.x2, m.y2)); // Neighbor
     }
 
-    // Placeholder for real 2-view spherical rotation estimation
-    refinedRotation = cv::Mat::eye(3, 3, CV_32F);
-    return static_cast<int>(matches.size());
+    RansacParams params;
+    params.mfThreshold = (kInlierPixels / focal) * (kInlierPixels / focal);
+    params.mnMaxIterations = 200;
+    Ransac<RotationProblem> ransac(problem, params);
+    RansacResult<SE3f> result;
+    if (!ransac.Run(result)) return 0;
+
+    cv::Mat(3, 3, CV_32F, result.mModel.R).copyTo(relativeRotation);
+    return result.mnInliers;
 }
 
 int Align::findOverlappingFrameS2(float* rotationMatrix, const std::vector<Frame>& frames) {
@@ -0,0 +1,1104 @@
+#include "BearingSolvers.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Error of data a model cannot explain at all (point behind the camera)
+const float kInvalidError = 1e9f;
+
+// Cyclic Jacobi on a symmetric n x n matrix (row-major, overwritten).
+// Eigenvalues descending; eigenvector k is column k of V.
+void JacobiEigen(double* A, int n, double* evals, double* V) {
+    for (int i = 0; i < n * n; i++) V[i] = (i % (n + 1) == 0) ? 1.0 : 0.0;
+
+    for (int sweep = 0; sweep < 50; sweep++) {
+        double off = 0.0;
+        for (int p = 0; p < n; p++) {
+            for (int q = p + 1; q < n; q++) off += A[p * n + q] * A[p * n + q];
+        }
+        if (off < 1e-30) break;
+
+        for (int p = 0; p < n; p++) {
+            for (int q = p + 1; q < n; q++) {
+                const double apq = A[p * n + q];
+                if (std::abs(apq) < 1e-300) continue;
+                const double theta = (A[q * n + q] - A[p * n + p]) / (2.0 * apq);
+                const double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                const double s = t * c;
+                for (int k = 0; k < n; k++) {
+                    const double akp = A[k * n + p];
+                    const double akq = A[k * n + q];
+                    A[k * n + p] = c * akp - s * akq;
+                    A[k * n + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; k++) {
+                    const double apk = A[p * n + k];
+                    const double aqk = A[q * n + k];
+                    A[p * n + k] = c * apk - s * aqk;
+                    A[q * n + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; k++) {
+                    const double vkp = V[k * n + p];
+                    const double vkq = V[k * n + q];
+                    V[k * n + p] = c * vkp - s * vkq;
+                    V[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    // Selection sort, descending
+    for (int i = 0; i < n; i++) evals[i] = A[i * n + i];
+    for (int i = 0; i < n; i++) {
+        int best = i;
+        for (int j = i + 1; j < n; j++) {
+            if (evals[j] > evals[best]) best = j;
+        }
+        if (best == i) continue;
+        std::swap(evals[i], evals[best]);
+        for (int k = 0; k < n; k++) std::swap(V[k * n + i], V[k * n + best]);
+    }
+}
+
+double EvalPoly(const std::vector<double> &c, double x) {
+    double v = 0.0;
+    for (int i = static_cast<int>(c.size()) - 1; i >= 0; i--) v = v * x + c[i];
+    return v;
+}
+
+// Real roots of sum c[i] x^i. Between consecutive roots of the derivative
+// the polynomial is monotone, so each root is isolated and bisected.
+void PolyRealRoots(std::vector<double> c, std::vector<double> &vRoots) {
+    vRoots.clear();
+    double maxAbs = 0.0;
+    for (double ci : c) maxAbs = std::max(maxAbs, std::abs(ci));
+    if (maxAbs == 0.0) return;
+    while (c.size() > 1 && std::abs(c.back()) <= 1e-14 * maxAbs) c.pop_back();
+
+    const int deg = static_cast<int>(c.size()) - 1;
+    if (deg < 1) return;
+    if (deg == 1) {
+        vRoots.push_back(-c[0] / c[1]);
+        return;
+    }
+
+    // Cauchy bound on the root magnitudes
+    double bound = 0.0;
+    for (int i = 0; i < deg; i++) bound = std::max(bound, std::abs(c[i] / c[deg]));
+    bound += 1.0;
+
+    std::vector<double> d(deg);
+    for (int i = 0; i < deg; i++) d[i] = (i + 1) * c[i + 1];
+    std::vector<double> vCrit;
+    PolyRealRoots(d, vCrit);
+
+    std::vector<double> vPoints;
+    vPoints.push_back(-bound);
+    for (double x : vCrit) {
+        if (x > -bound && x < bound) vPoints.push_back(x);
+    }
+    vPoints.push_back(bound);
+    std::sort(vPoints.begin(), vPoints.end());
+
+    for (size_t i = 0; i + 1 < vPoints.size(); i++) {
+        double lo = vPoints[i];
+        double hi = vPoints[i + 1];
+        double flo = EvalPoly(c, lo);
+        const double fhi = EvalPoly(c, hi);
+        double root;
+        if (flo == 0.0) {
+            root = lo;
+        } else if ((flo < 0.0) == (fhi < 0.0)) {
+            continue;
+        } else {
+            for (int it = 0; it < 100 && hi - lo > 1e-14 * std::max(1.0, std::abs(lo)); it++) {
+                const double mid = 0.5 * (lo + hi);
+                const double fmid = EvalPoly(c, mid);
+                if ((fmid < 0.0) == (flo < 0.0)) {
+                    lo = mid;
+                    flo = fmid;
+                } else {
+                    hi = mid;
+                }
+            }
+            root = 0.5 * (lo + hi);
+        }
+        if (vRoots.empty() || std::abs(root - vRoots.back()) > 1e-10 * std::max(1.0, std::abs(root))) {
+            vRoots.push_back(root);
+        }
+    }
+}
+
+// Real eigenvalues of a general n x n matrix (n <= 10): balancing,
+// Hessenberg reduction and shifted QR (after Numerical Recipes' balanc,
+// elmhes and hqr). Complex pairs are skipped.
+void RealEigenvalues(const double* A0, int n, std::vector<double> &vValues) {
+    vValues.clear();
+    double a[10][10];
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) a[i][j] = A0[i * n + j];
+    }
+
+    // Balance rows and columns by powers of two
+    bool bDone = false;
+    while (!bDone) {
+        bDone = true;
+        for (int i = 0; i < n; i++) {
+            double r = 0.0, c = 0.0;
+            for (int j = 0; j < n; j++) {
+                if (j == i) continue;
+                c += std::abs(a[j][i]);
+                r += std::abs(a[i][j]);
+            }
+            if (c == 0.0 || r == 0.0) continue;
+            double g = r / 2.0;
+            double f = 1.0;
+            const double s = c + r;
+            while (c < g) {
+                f *= 2.0;
+                c *= 4.0;
+            }
+            g = r * 2.0;
+            while (c > g) {
+                f /= 2.0;
+                c /= 4.0;
+            }
+            if ((c + r) / f < 0.95 * s) {
+                bDone = false;
+                for (int j = 0; j < n; j++) a[i][j] /= f;
+                for (int j = 0; j < n; j++) a[j][i] *= f;
+            }
+        }
+    }
+
+    // Hessenberg form by stabilized elimination
+    for (int m = 1; m < n - 1; m++) {
+        double x = 0.0;
+        int piv = m;
+        for (int j = m; j < n; j++) {
+            if (std::abs(a[j][m - 1]) > std::abs(x)) {
+                x = a[j][m - 1];
+                piv = j;
+            }
+        }
+        if (piv != m) {
+            for (int j = m - 1; j < n; j++) std::swap(a[piv][j], a[m][j]);
+            for (int j = 0; j < n; j++) std::swap(a[j][piv], a[j][m]);
+        }
+        if (x == 0.0) continue;
+        for (int i = m + 1; i < n; i++) {
+            double y = a[i][m - 1];
+            if (y == 0.0) continue;
+            y /= x;
+            a[i][m - 1] = 0.0;
+            for (int j = m; j < n; j++) a[i][j] -= y * a[m][j];
+            for (int j = 0; j < n; j++) a[j][m] += y * a[j][i];
+        }
+    }
+
+    double anorm = 0.0;
+    for (int i = 0; i < n; i++) {
+        for (int j = std::max(i - 1, 0); j < n; j++) anorm += std::abs(a[i][j]);
+    }
+
+    auto sign = [](double v, double s) { return s >= 0.0 ? std::abs(v) : -std::abs(v); };
+    int nn = n - 1;
+    double t = 0.0;
+    while (nn >= 0) {
+        int its = 0;
+        int l;
+        do {
+            // Look for a negligible subdiagonal element
+            for (l = nn; l > 0; l--) {
+                double s = std::abs(a[l - 1][l - 1]) + std::abs(a[l][l]);
+                if (s == 0.0) s = anorm;
+                if (std::abs(a[l][l - 1]) + s == s) {
+                    a[l][l - 1] = 0.0;
+                    break;
+                }
+            }
+            double x = a[nn][nn];
+            if (l == nn) {
+                vValues.push_back(x + t);
+                nn--;
+            } else {
+                double y = a[nn - 1][nn - 1];
+                double w = a[nn][nn - 1] * a[nn - 1][nn];
+                if (l == nn - 1) {
+                    // 2x2 block: a real pair or a complex one
+                    const double p = 0.5 * (y - x);
+                    const double q = p * p + w;
+                    double z = std::sqrt(std::abs(q));
+                    x += t;
+                    if (q >= 0.0) {
+                        z = p + sign(z, p);
+                        vValues.push_back(x + z);
+                        vValues.push_back(z != 0.0 ? x - w / z : x + z);
+                    }
+                    nn -= 2;
+                } else {
+                    if (its == 30) return;
+                    if (its == 10 || its == 20) {
+                        // Exceptional shift
+                        t += x;
+                        for (int i = 0; i <= nn; i++) a[i][i] -= x;
+                        const double s = std::abs(a[nn][nn - 1]) + std::abs(a[nn - 1][nn - 2]);
+                        y = x = 0.75 * s;
+                        w = -0.4375 * s * s;
+                    }
+                    its++;
+
+                    int m;
+                    double p = 0.0, q = 0.0, r = 0.0, z;
+                    for (m = nn - 2; m >= l; m--) {
+                        z = a[m][m];
+                        r = x - z;
+                        double s = y - z;
+                        p = (r * s - w) / a[m + 1][m] + a[m][m + 1];
+                        q = a[m + 1][m + 1] - z - r - s;
+                        r = a[m + 2][m + 1];
+                        s = std::abs(p) + std::abs(q) + std::abs(r);
+                        p /= s;
+                        q /= s;
+                        r /= s;
+                        if (m == l) break;
+                        const double u = std::abs(a[m][m - 1]) * (std::abs(q) + std::abs(r));
+                        const double v = std::abs(p) * (std::abs(a[m - 1][m - 1]) + std::abs(z) + std::abs(a[m + 1][m + 1]));
+                        if (u + v == v) break;
+                    }
+                    for (int i = m; i < nn - 1; i++) {
+                        a[i + 2][i] = 0.0;
+                        if (i != m) a[i + 2][i - 1] = 0.0;
+                    }
+
+                    // Double shift QR step on rows l..nn
+                    for (int k = m; k < nn; k++) {
+                        if (k != m) {
+                            p = a[k][k - 1];
+                            q = a[k + 1][k - 1];
+                            r = 0.0;
+                            if (k + 1 != nn) r = a[k + 2][k - 1];
+                            x = std::abs(p) + std::abs(q) + std::abs(r);
+                            if (x != 0.0) {
+                                p /= x;
+                                q /= x;
+                                r /= x;
+                            }
+                        }
+                        const double s = sign(std::sqrt(p * p + q * q + r * r), p);
+                        if (s == 0.0) continue;
+                        if (k == m) {
+                            if (l != m) a[k][k - 1] = -a[k][k - 1];
+                        } else {
+                            a[k][k - 1] = -s * x;
+                        }
+                        p += s;
+                        x = p / s;
+                        y = q / s;
+                        z = r / s;
+                        q /= p;
+                        r /= p;
+                        for (int j = k; j <= nn; j++) {
+                            p = a[k][j] + q * a[k + 1][j];
+                            if (k + 1 != nn) {
+                                p += r * a[k + 2][j];
+                                a[k + 2][j] -= p * z;
+                            }
+                            a[k + 1][j] -= p * y;
+                            a[k][j] -= p * x;
+                        }
+                        const int mmin = nn < k + 3 ? nn : k + 3;
+                        for (int i = l; i <= mmin; i++) {
+                            p = x * a[i][k] + y * a[i][k + 1];
+                            if (k + 1 != nn) {
+                                p += z * a[i][k + 2];
+                                a[i][k + 2] -= p * r;
+                            }
+                            a[i][k + 1] -= p * q;
+                            a[i][k] -= p;
+                        }
+                    }
+                }
+            }
+        } while (nn >= 0 && l < nn - 1);
+    }
+}
+
+// Rotation from the unit quaternion (w, x, y, z)
+void QuaternionToRotation(const double* q, double* R) {
+    const double w = q[0], x = q[1], y = q[2], z = q[3];
+    R[0] = 1 - 2 * (y * y + z * z); R[1] = 2 * (x * y - w * z);     R[2] = 2 * (x * z + w * y);
+    R[3] = 2 * (x * y + w * z);     R[4] = 1 - 2 * (x * x + z * z); R[5] = 2 * (y * z - w * x);
+    R[6] = 2 * (x * z - w * y);     R[7] = 2 * (y * z + w * x);     R[8] = 1 - 2 * (x * x + y * y);
+}
+
+// Horn's closed form: s, R, t minimizing sum |P1 - (s R P2 + t)|^2.
+// Without bCenter the translation is forced to zero (rotation of directions).
+bool HornAlign(const cv::Point3f* vP1, const cv::Point3f* vP2, int n, bool bCenter, bool bScale,
+               double* R, double* t, double &s) {
+    if (n < 2) return false;
+    double c1[3] = {0, 0, 0};
+    double c2[3] = {0, 0, 0};
+    if (bCenter) {
+        for (int i = 0; i < n; i++) {
+            c1[0] += vP1[i].x; c1[1] += vP1[i].y; c1[2] += vP1[i].z;
+            c2[0] += vP2[i].x; c2[1] += vP2[i].y; c2[2] += vP2[i].z;
+        }
+        for (int k = 0; k < 3; k++) {
+            c1[k] /= n;
+            c2[k] /= n;
+        }
+    }
+
+    // M_ab = sum q2_a q1_b
+    double M[9] = {0};
+    double norm2 = 0.0;
+    for (int i = 0; i < n; i++) {
+        const double q1[3] = {vP1[i].x - c1[0], vP1[i].y - c1[1], vP1[i].z - c1[2]};
+        const double q2[3] = {vP2[i].x - c2[0], vP2[i].y - c2[1], vP2[i].z - c2[2]};
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) M[a * 3 + b] += q2[a] * q1[b];
+        }
+        norm2 += q2[0] * q2[0] + q2[1] * q2[1] + q2[2] * q2[2];
+    }
+    if (norm2 < 1e-20) return false;
+
+    const double Sxx = M[0], Sxy = M[1], Sxz = M[2];
+    const double Syx = M[3], Syy = M[4], Syz = M[5];
+    const double Szx = M[6], Szy = M[7], Szz = M[8];
+    double N[16] = {
+        Sxx + Syy + Szz, Syz - Szy,        Szx - Sxz,        Sxy - Syx,
+        Syz - Szy,       Sxx - Syy - Szz,  Sxy + Syx,        Szx + Sxz,
+        Szx - Sxz,       Sxy + Syx,        -Sxx + Syy - Szz, Syz + Szy,
+        Sxy - Syx,       Szx + Sxz,        Syz + Szy,        -Sxx - Syy + Szz
+    };
+    double evals[4], V[16];
+    JacobiEigen(N, 4, evals, V);
+    const double q[4] = {V[0], V[4], V[8], V[12]};
+    QuaternionToRotation(q, R);
+
+    s = 1.0;
+    if (bScale) {
+        // s = sum q1 . (R q2) / sum |q2|^2
+        double num = 0.0;
+        for (int i = 0; i < n; i++) {
+            const double q1[3] = {vP1[i].x - c1[0], vP1[i].y - c1[1], vP1[i].z - c1[2]};
+            const double q2[3] = {vP2[i].x - c2[0], vP2[i].y - c2[1], vP2[i].z - c2[2]};
+            for (int a = 0; a < 3; a++) {
+                num += q1[a] * (R[a * 3 + 0] * q2[0] + R[a * 3 + 1] * q2[1] + R[a * 3 + 2] * q2[2]);
+            }
+        }
+        s = num / norm2;
+        if (s <= 0.0) return false;
+    }
+    for (int a = 0; a < 3; a++) {
+        t[a] = c1[a] - s * (R[a * 3 + 0] * c2[0] + R[a * 3 + 1] * c2[1] + R[a * 3 + 2] * c2[2]);
+    }
+    return true;
+}
+
+SE3f ToSE3(const double* R, const double* t) {
+    float Rf[9], tf[3];
+    for (int i = 0; i < 9; i++) Rf[i] = static_cast<float>(R[i]);
+    for (int i = 0; i < 3; i++) tf[i] = static_cast<float>(t[i]);
+    return SE3f(Rf, tf);
+}
+
+// SVD of a 3x3 matrix through the eigenvectors of A^T A. U and V are proper
+// rotations (columns row-major), singular values descending.
+void Svd3(const double* A, double* U, double* S, double* V) {
+    double AtA[9];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            AtA[i * 3 + j] = A[0 * 3 + i] * A[0 * 3 + j] + A[1 * 3 + i] * A[1 * 3 + j] + A[2 * 3 + i] * A[2 * 3 + j];
+        }
+    }
+    double evals[3];
+    JacobiEigen(AtA, 3, evals, V);
+    // v3 = v1 x v2
+    V[2] = V[3] * V[7] - V[6] * V[4];
+    V[5] = V[6] * V[1] - V[0] * V[7];
+    V[8] = V[0] * V[4] - V[3] * V[1];
+
+    double u[2][3];
+    for (int k = 0; k < 2; k++) {
+        S[k] = std::sqrt(std::max(0.0, evals[k]));
+        for (int i = 0; i < 3; i++) {
+            u[k][i] = A[i * 3 + 0] * V[0 * 3 + k] + A[i * 3 + 1] * V[1 * 3 + k] + A[i * 3 + 2] * V[2 * 3 + k];
+        }
+    }
+    S[2] = std::sqrt(std::max(0.0, evals[2]));
+
+    // Orthonormalize u1, u2 and complete with u3 = u1 x u2
+    double n1 = std::sqrt(u[0][0] * u[0][0] + u[0][1] * u[0][1] + u[0][2] * u[0][2]);
+    if (n1 < 1e-300) n1 = 1.0;
+    for (int i = 0; i < 3; i++) u[0][i] /= n1;
+    const double d = u[0][0] * u[1][0] + u[0][1] * u[1][1] + u[0][2] * u[1][2];
+    for (int i = 0; i < 3; i++) u[1][i] -= d * u[0][i];
+    double n2 = std::sqrt(u[1][0] * u[1][0] + u[1][1] * u[1][1] + u[1][2] * u[1][2]);
+    if (n2 < 1e-300) n2 = 1.0;
+    for (int i = 0; i < 3; i++) u[1][i] /= n2;
+
+    for (int i = 0; i < 3; i++) {
+        U[i * 3 + 0] = u[0][i];
+        U[i * 3 + 1] = u[1][i];
+    }
+    U[2] = u[0][1] * u[1][2] - u[0][2] * u[1][1];
+    U[5] = u[0][2] * u[1][0] - u[0][0] * u[1][2];
+    U[8] = u[0][0] * u[1][1] - u[0][1] * u[1][0];
+}
+
+// Polynomials of degree <= 3 in (x, y, z), for the five-point solver.
+// Monomial order: the ten cubics first, then the quotient basis
+// x^2 xy xz y^2 yz z^2 x y z 1.
+const int kMonomials = 20;
+const int kMonomialExp[kMonomials][3] = {
+    {3, 0, 0}, {2, 1, 0}, {2, 0, 1}, {1, 2, 0}, {1, 1, 1}, {1, 0, 2}, {0, 3, 0}, {0, 2, 1}, {0, 1, 2}, {0, 0, 3},
+    {2, 0, 0}, {1, 1, 0}, {1, 0, 1}, {0, 2, 0}, {0, 1, 1}, {0, 0, 2}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, 0}
+};
+
+int MonomialIndex(int a, int b, int c) {
+    for (int i = 0; i < kMonomials; i++) {
+        if (kMonomialExp[i][0] == a && kMonomialExp[i][1] == b && kMonomialExp[i][2] == c) return i;
+    }
+    return -1;
+}
+
+struct Poly3 {
+    double c[kMonomials];
+    Poly3() { std::fill(c, c + kMonomials, 0.0); }
+
+    Poly3 operator*(const Poly3 &o) const {
+        static int sProduct[kMonomials][kMonomials];
+        static bool sbInit = false;
+        if (!sbInit) {
+            for (int i = 0; i < kMonomials; i++) {
+                for (int j = 0; j < kMonomials; j++) {
+                    const int a = kMonomialExp[i][0] + kMonomialExp[j][0];
+                    const int b = kMonomialExp[i][1] + kMonomialExp[j][1];
+                    const int cc = kMonomialExp[i][2] + kMonomialExp[j][2];
+                    sProduct[i][j] = (a + b + cc <= 3) ? MonomialIndex(a, b, cc) : -1;
+                }
+            }
+            sbInit = true;
+        }
+        Poly3 r;
+        for (int i = 0; i < kMonomials; i++) {
+            if (c[i] == 0.0) continue;
+            for (int j = 0; j < kMonomials; j++) {
+                if (o.c[j] == 0.0) continue;
+                // Degrees never exceed 3 in the constraints below
+                const int k = sProduct[i][j];
+                if (k >= 0) r.c[k] += c[i] * o.c[j];
+            }
+        }
+        return r;
+    }
+    Poly3 operator+(const Poly3 &o) const {
+        Poly3 r;
+        for (int i = 0; i < kMonomials; i++) r.c[i] = c[i] + o.c[i];
+        return r;
+    }
+    Poly3 operator-(const Poly3 &o) const {
+        Poly3 r;
+        for (int i = 0; i < kMonomials; i++) r.c[i] = c[i] - o.c[i];
+        return r;
+    }
+    Poly3 operator*(double s) const {
+        Poly3 r;
+        for (int i = 0; i < kMonomials; i++) r.c[i] = c[i] * s;
+        return r;
+    }
+};
+
+// Null vector of the 10x10 matrix K (rank 9), scaled so the last entry is 1
+bool NullVector10(const double* K, double* v) {
+    // Normal equations of K[:, 0:9] v' = -K[:, 9]
+    double A[9 * 10] = {0};
+    for (int i = 0; i < 9; i++) {
+        for (int j = 0; j < 9; j++) {
+            double sum = 0.0;
+            for (int r = 0; r < 10; r++) sum += K[r * 10 + i] * K[r * 10 + j];
+            A[i * 10 + j] = sum;
+        }
+        double rhs = 0.0;
+        for (int r = 0; r < 10; r++) rhs -= K[r * 10 + i] * K[r * 10 + 9];
+        A[i * 10 + 9] = rhs;
+    }
+    for (int col = 0; col < 9; col++) {
+        int piv = col;
+        for (int r = col + 1; r < 9; r++) {
+            if (std::abs(A[r * 10 + col]) > std::abs(A[piv * 10 + col])) piv = r;
+        }
+        if (std::abs(A[piv * 10 + col]) < 1e-300) return false;
+        if (piv != col) {
+            for (int k = 0; k < 10; k++) std::swap(A[col * 10 + k], A[piv * 10 + k]);
+        }
+        for (int r = 0; r < 9; r++) {
+            if (r == col) continue;
+            const double f = A[r * 10 + col] / A[col * 10 + col];
+            for (int k = col; k < 10; k++) A[r * 10 + k] -= f * A[col * 10 + k];
+        }
+    }
+    for (int i = 0; i < 9; i++) v[i] = A[i * 10 + 9] / A[i * 10 + i];
+    v[9] = 1.0;
+    return true;
+}
+
+// Five-point solver on exactly five pairs
+void SolveEssentialMinimal(const cv::Point3f* vB1, const cv::Point3f* vB2, std::vector<cv::Matx33f> &vE) {
+    // Null space of the epipolar constraints: 4 smallest eigenvectors of Q^T Q
+    double QtQ[81] = {0};
+    for (int i = 0; i < 5; i++) {
+        const double b1[3] = {vB1[i].x, vB1[i].y, vB1[i].z};
+        const double b2[3] = {vB2[i].x, vB2[i].y, vB2[i].z};
+        double q[9];
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) q[a * 3 + b] = b2[a] * b1[b];
+        }
+        for (int r = 0; r < 9; r++) {
+            for (int c = 0; c < 9; c++) QtQ[r * 9 + c] += q[r] * q[c];
+        }
+    }
+    double evals[9], V[81];
+    JacobiEigen(QtQ, 9, evals, V);
+
+    // E(x, y, z) = x X + y Y + z Z + W
+    Poly3 E[9];
+    for (int k = 0; k < 9; k++) {
+        E[k].c[16] = V[k * 9 + 5];
+        E[k].c[17] = V[k * 9 + 6];
+        E[k].c[18] = V[k * 9 + 7];
+        E[k].c[19] = V[k * 9 + 8];
+    }
+
+    // det(E) = 0 and 2 E E^T E - tr(E E^T) E = 0: ten cubics
+    Poly3 EEt[9];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            EEt[i * 3 + j] = E[i * 3 + 0] * E[j * 3 + 0] + E[i * 3 + 1] * E[j * 3 + 1] + E[i * 3 + 2] * E[j * 3 + 2];
+        }
+    }
+    const Poly3 trace = EEt[0] + EEt[4] + EEt[8];
+
+    double A[10 * kMonomials];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            const Poly3 eq = (EEt[i * 3 + 0] * E[0 * 3 + j] + EEt[i * 3 + 1] * E[1 * 3 + j] + EEt[i * 3 + 2] * E[2 * 3 + j]) * 2.0
+                             - trace * E[i * 3 + j];
+            std::copy(eq.c, eq.c + kMonomials, A + (i * 3 + j) * kMonomials);
+        }
+    }
+    const Poly3 det = E[0] * (E[4] * E[8] - E[5] * E[7]) - E[1] * (E[3] * E[8] - E[5] * E[6]) + E[2] * (E[3] * E[7] - E[4] * E[6]);
+    std::copy(det.c, det.c + kMonomials, A + 9 * kMonomials);
+
+    // Gauss-Jordan on the cubic columns: cubic_r = -B_r . basis
+    for (int col = 0; col < 10; col++) {
+        int piv = col;
+        for (int r = col + 1; r < 10; r++) {
+            if (std::abs(A[r * kMonomials + col]) > std::abs(A[piv * kMonomials + col])) piv = r;
+        }
+        if (std::abs(A[piv * kMonomials + col]) < 1e-300) return;
+        if (piv != col) {
+            for (int k = 0; k < kMonomials; k++) std::swap(A[col * kMonomials + k], A[piv * kMonomials + k]);
+        }
+        const double inv = 1.0 / A[col * kMonomials + col];
+        for (int k = 0; k < kMonomials; k++) A[col * kMonomials + k] *= inv;
+        for (int r = 0; r < 10; r++) {
+            if (r == col) continue;
+            const double f = A[r * kMonomials + col];
+            if (f == 0.0) continue;
+            for (int k = 0; k < kMonomials; k++) A[r * kMonomials + k] -= f * A[col * kMonomials + k];
+        }
+    }
+
+    // Action matrix of multiplication by x on the basis, transposed: at a
+    // solution the basis monomials form an eigenvector with eigenvalue x
+    double At[100] = {0};
+    for (int j = 0; j < 6; j++) {
+        for (int i = 0; i < 10; i++) At[j * 10 + i] = -A[j * kMonomials + 10 + i];
+    }
+    At[6 * 10 + 0] = 1.0;  // x * x = x^2
+    At[7 * 10 + 1] = 1.0;  // x * y = xy
+    At[8 * 10 + 2] = 1.0;  // x * z = xz
+    At[9 * 10 + 6] = 1.0;  // x * 1 = x
+
+    std::vector<double> vRoots;
+    RealEigenvalues(At, 10, vRoots);
+
+    for (double x : vRoots) {
+        double K[100];
+        for (int i = 0; i < 100; i++) K[i] = At[i] - ((i % 11 == 0) ? x : 0.0);
+        double v[10];
+        if (!NullVector10(K, v)) continue;
+        const double y = v[7];
+        const double z = v[8];
+
+        double e[9];
+        double norm = 0.0;
+        for (int k = 0; k < 9; k++) {
+            e[k] = x * V[k * 9 + 5] + y * V[k * 9 + 6] + z * V[k * 9 + 7] + V[k * 9 + 8];
+            norm += e[k] * e[k];
+        }
+        norm = std::sqrt(norm);
+        if (!(norm > 1e-12)) continue;
+        cv::Matx33f Em;
+        for (int k = 0; k < 9; k++) Em.val[k] = static_cast<float>(e[k] / norm);
+        vE.push_back(Em);
+    }
+}
+}
+
+bool BearingSolvers::SolveRotation(const cv::Point3f* vB1, const cv::Point3f* vB2, int n, SE3f &T21) {
+    double R[9], t[3], s;
+    if (!HornAlign(vB2, vB1, n, false, false, R, t, s)) return false;
+    const double zero[3] = {0.0, 0.0, 0.0};
+    T21 = ToSE3(R, zero);
+    return true;
+}
+
+int BearingSolvers::SolveEssential(const cv::Point3f* vB1, const cv::Point3f* vB2, int n, std::vector<cv::Matx33f> &vE) {
+    vE.clear();
+    if (n < 5) return 0;
+
+    if (n < 8) {
+        // Minimal on the first five; the extra pairs pick the solution
+        std::vector<cv::Matx33f> vCandidates;
+        SolveEssentialMinimal(vB1, vB2, vCandidates);
+        if (n == 5 || vCandidates.size() <= 1) {
+            vE = vCandidates;
+            return static_cast<int>(vE.size());
+        }
+        float bestErr = 0.0f;
+        int best = -1;
+        for (size_t k = 0; k < vCandidates.size(); k++) {
+            float err = 0.0f;
+            for (int i = 5; i < n; i++) err += EpipolarError(vCandidates[k], vB1[i], vB2[i]);
+            if (best < 0 || err < bestErr) {
+                bestErr = err;
+                best = static_cast<int>(k);
+            }
+        }
+        vE.push_back(vCandidates[best]);
+        return 1;
+    }
+
+    // Linear solution, projected onto the essential manifold
+    double QtQ[81] = {0};
+    for (int i = 0; i < n; i++) {
+        const double b1[3] = {vB1[i].x, vB1[i].y, vB1[i].z};
+        const double b2[3] = {vB2[i].x, vB2[i].y, vB2[i].z};
+        double q[9];
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) q[a * 3 + b] = b2[a] * b1[b];
+        }
+        for (int r = 0; r < 9; r++) {
+            for (int c = 0; c < 9; c++) QtQ[r * 9 + c] += q[r] * q[c];
+        }
+    }
+    double evals[9], V[81];
+    JacobiEigen(QtQ, 9, evals, V);
+    double E0[9];
+    for (int k = 0; k < 9; k++) E0[k] = V[k * 9 + 8];
+
+    double U[9], S[3], W[9];
+    Svd3(E0, U, S, W);
+    cv::Matx33f E;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            E(i, j) = static_cast<float>((U[i * 3 + 0] * W[j * 3 + 0] + U[i * 3 + 1] * W[j * 3 + 1]) / std::sqrt(2.0));
+        }
+    }
+    vE.push_back(E);
+    return 1;
+}
+
+bool BearingSolvers::DecomposeEssential(const cv::Matx33f &E, const cv::Point3f* vB1, const cv::Point3f* vB2, int n,
+                                        const std::vector<bool>* vbMask, SE3f &T21, int &nGood) {
+    double Ed[9];
+    for (int k = 0; k < 9; k++) Ed[k] = E.val[k];
+    double U[9], S[3], V[9];
+    Svd3(Ed, U, S, V);
+
+    // E = [t]x R: R = U W V^T or U W^T V^T, t = +-u3
+    static const double Wm[9] = {0, -1, 0, 1, 0, 0, 0, 0, 1};
+    double R[2][9];
+    for (int c = 0; c < 2; c++) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                double sum = 0.0;
+                for (int k = 0; k < 3; k++) {
+                    // W for c = 0, W^T for c = 1
+                    const double w0 = c == 0 ? Wm[0 * 3 + k] : Wm[k * 3 + 0];
+                    const double w1 = c == 0 ? Wm[1 * 3 + k] : Wm[k * 3 + 1];
+                    const double w2 = c == 0 ? Wm[2 * 3 + k] : Wm[k * 3 + 2];
+                    const double uw = U[i * 3 + 0] * w0 + U[i * 3 + 1] * w1 + U[i * 3 + 2] * w2;
+                    sum += uw * V[j * 3 + k];
+                }
+                R[c][i * 3 + j] = sum;
+            }
+        }
+    }
+    const double u3[3] = {U[2], U[5], U[8]};
+
+    nGood = 0;
+    bool bFound = false;
+    for (int c = 0; c < 2; c++) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+            const double t[3] = {sign * u3[0], sign * u3[1], sign * u3[2]};
+            const SE3f T = ToSE3(R[c], t);
+            int good = 0;
+            for (int i = 0; i < n; i++) {
+                if (vbMask && !(*vbMask)[i]) continue;
+                cv::Point3f X1;
+                // Parallax is irrelevant for the side test
+                if (Triangulate(vB1[i], vB2[i], T, X1, 1.0f)) good++;
+            }
+            if (good > nGood) {
+                nGood = good;
+                T21 = T;
+                bFound = true;
+            }
+        }
+    }
+    return bFound;
+}
+
+bool BearingSolvers::SolveHomography(const cv::Point3f* vB1, const cv::Point3f* vB2, int n, cv::Matx33f &H) {
+    if (n < 4) return false;
+
+    // Rows of b2 x (H b1) = 0, accumulated as normal equations
+    double AtA[81] = {0};
+    for (int i = 0; i < n; i++) {
+        const double b1[3] = {vB1[i].x, vB1[i].y, vB1[i].z};
+        const double b2[3] = {vB2[i].x, vB2[i].y, vB2[i].z};
+        double rows[3][9] = {{0}};
+        for (int k = 0; k < 3; k++) {
+            rows[0][3 + k] = -b2[2] * b1[k];
+            rows[0][6 + k] = b2[1] * b1[k];
+            rows[1][0 + k] = b2[2] * b1[k];
+            rows[1][6 + k] = -b2[0] * b1[k];
+            rows[2][0 + k] = -b2[1] * b1[k];
+            rows[2][3 + k] = b2[0] * b1[k];
+        }
+        for (int r = 0; r < 3; r++) {
+            for (int a = 0; a < 9; a++) {
+                if (rows[r][a] == 0.0) continue;
+                for (int b = 0; b < 9; b++) AtA[a * 9 + b] += rows[r][a] * rows[r][b];
+            }
+        }
+    }
+    double evals[9], V[81];
+    JacobiEigen(AtA, 9, evals, V);
+
+    double h[9];
+    for (int k = 0; k < 9; k++) h[k] = V[k * 9 + 8];
+    double side = 0.0;
+    for (int i = 0; i < n; i++) {
+        const double b1[3] = {vB1[i].x, vB1[i].y, vB1[i].z};
+        for (int r = 0; r < 3; r++) {
+            const double hb = h[r * 3 + 0] * b1[0] + h[r * 3 + 1] * b1[1] + h[r * 3 + 2] * b1[2];
+            side += hb * (r == 0 ? vB2[i].x : r == 1 ? vB2[i].y : vB2[i].z);
+        }
+    }
+    const double sign = side < 0.0 ? -1.0 : 1.0;
+    for (int k = 0; k < 9; k++) H.val[k] = static_cast<float>(sign * h[k]);
+    return true;
+}
+
+bool BearingSolvers::DecomposeHomography(const cv::Matx33f &H, const cv::Point3f* vB1, const cv::Point3f* vB2, int n,
+                                         const std::vector<bool>* vbMask, SE3f &T21, int &nGood) {
+    nGood = 0;
+    double Hd[9];
+    for (int k = 0; k < 9; k++) Hd[k] = H.val[k];
+    double U[9], S[3], V[9];
+    Svd3(Hd, U, S, V);
+
+    // U and V are proper rotations, so the sign of det(H) goes to the third singular value
+    const double det = Hd[0] * (Hd[4] * Hd[8] - Hd[5] * Hd[7]) - Hd[1] * (Hd[3] * Hd[8] - Hd[5] * Hd[6]) +
+                       Hd[2] * (Hd[3] * Hd[7] - Hd[4] * Hd[6]);
+    if (det <= 0.0) return false;
+    const double d1 = S[0], d2 = S[1], d3 = S[2];
+    if (d1 / d2 < 1.00001 || d2 / d3 < 1.00001) return false;
+
+    std::vector<SE3f> vT;
+    vT.reserve(8);
+    auto addSolution = [&](const double* Rp, const double* tp) {
+        double R[9], t[3];
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                double sum = 0.0;
+                for (int k = 0; k < 3; k++) {
+                    const double urp = U[i * 3 + 0] * Rp[0 * 3 + k] + U[i * 3 + 1] * Rp[1 * 3 + k] + U[i * 3 + 2] * Rp[2 * 3 + k];
+                    sum += urp * V[j * 3 + k];
+                }
+                R[i * 3 + j] = sum;
+            }
+            t[i] = U[i * 3 + 0] * tp[0] + U[i * 3 + 1] * tp[1] + U[i * 3 + 2] * tp[2];
+        }
+        const double nt = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+        if (nt > 0.0) {
+            for (int i = 0; i < 3; i++) t[i] /= nt;
+        }
+        vT.push_back(ToSE3(R, t));
+    };
+
+    // Faugeras 1988, as in ORB-SLAM's ReconstructH
+    const double aux1 = std::sqrt((d1 * d1 - d2 * d2) / (d1 * d1 - d3 * d3));
+    const double aux3 = std::sqrt((d2 * d2 - d3 * d3) / (d1 * d1 - d3 * d3));
+    const double x1[4] = {aux1, aux1, -aux1, -aux1};
+    const double x3[4] = {aux3, -aux3, aux3, -aux3};
+
+    // d' = d2
+    const double auxSTheta = std::sqrt((d1 * d1 - d2 * d2) * (d2 * d2 - d3 * d3)) / ((d1 + d3) * d2);
+    const double cTheta = (d2 * d2 + d1 * d3) / ((d1 + d3) * d2);
+    const double sTheta[4] = {auxSTheta, -auxSTheta, -auxSTheta, auxSTheta};
+    for (int i = 0; i < 4; i++) {
+        const double Rp[9] = {cTheta, 0, -sTheta[i], 0, 1, 0, sTheta[i], 0, cTheta};
+        const double tp[3] = {x1[i] * (d1 - d3), 0, -x3[i] * (d1 - d3)};
+        addSolution(Rp, tp);
+    }
+
+    // d' = -d2
+    const double auxSPhi = std::sqrt((d1 * d1 - d2 * d2) * (d2 * d2 - d3 * d3)) / ((d1 - d3) * d2);
+    const double cPhi = (d1 * d3 - d2 * d2) / ((d1 - d3) * d2);
+    const double sPhi[4] = {auxSPhi, -auxSPhi, -auxSPhi, auxSPhi};
+    for (int i = 0; i < 4; i++) {
+        const double Rp[9] = {cPhi, 0, sPhi[i], 0, -1, 0, sPhi[i], 0, -cPhi};
+        const double tp[3] = {x1[i] * (d1 + d3), 0, x3[i] * (d1 + d3)};
+        addSolution(Rp, tp);
+    }
+
+    int secondGood = 0;
+    for (const SE3f &T : vT) {
+        int good = 0;
+        for (int i = 0; i < n; i++) {
+            if (vbMask && !(*vbMask)[i]) continue;
+            cv::Point3f X1;
+            if (Triangulate(vB1[i], vB2[i], T, X1, 1.0f)) good++;
+        }
+        if (good > nGood) {
+            secondGood = nGood;
+            nGood = good;
+            T21 = T;
+        } else if (good > secondGood) {
+            secondGood = good;
+        }
+    }
+    return nGood > 0 && secondGood < 0.75f * nGood;
+}
+
+int BearingSolvers::SolveP3P(const cv::Point3f* vXw, const cv::Point3f* vB, int n, std::vector<SE3f> &vTcw) {
+    vTcw.clear();
+    if (n < 3) return 0;
+
+    const cv::Point3f &P1 = vXw[0], &P2 = vXw[1], &P3 = vXw[2];
+    const double a2 = (P2 - P3).dot(P2 - P3);
+    const double b2 = (P1 - P3).dot(P1 - P3);
+    const double c2 = (P1 - P2).dot(P1 - P2);
+    if (a2 < 1e-12 || b2 < 1e-12 || c2 < 1e-12) return 0;
+
+    auto unit = [](const cv::Point3f &p) {
+        const double nn = std::sqrt(static_cast<double>(p.dot(p)));
+        return cv::Vec3d(p.x / nn, p.y / nn, p.z / nn);
+    };
+    const cv::Vec3d j1 = unit(vB[0]), j2 = unit(vB[1]), j3 = unit(vB[2]);
+    const double cosA = j2.dot(j3);
+    const double cosB = j1.dot(j3);
+    const double cosG = j1.dot(j2);
+
+    // Grunert's quartic in v = s3 / s1 (Haralick et al. 1994)
+    const double acb = (a2 - c2) / b2;
+    const double apcb = (a2 + c2) / b2;
+    const double A4 = (acb - 1) * (acb - 1) - 4 * c2 / b2 * cosA * cosA;
+    const double A3 = 4 * (acb * (1 - acb) * cosB - (1 - apcb) * cosA * cosG + 2 * c2 / b2 * cosA * cosA * cosB);
+    const double A2 = 2 * (acb * acb - 1 + 2 * acb * acb * cosB * cosB + 2 * (b2 - c2) / b2 * cosA * cosA
+                           - 4 * apcb * cosA * cosB * cosG + 2 * (b2 - a2) / b2 * cosG * cosG);
+    const double A1 = 4 * (-acb * (1 + acb) * cosB + 2 * a2 / b2 * cosG * cosG * cosB - (1 - apcb) * cosA * cosG);
+    const double A0 = (1 + acb) * (1 + acb) - 4 * a2 / b2 * cosG * cosG;
+
+    std::vector<double> vRoots;
+    PolyRealRoots(std::vector<double>{A0, A1, A2, A3, A4}, vRoots);
+
+    const cv::Point3f vWorld[3] = {P1, P2, P3};
+    for (double v : vRoots) {
+        if (v <= 0.0) continue;
+        const double den = 2 * (cosG - v * cosA);
+        if (std::abs(den) < 1e-12) continue;
+        const double u = ((-1 + acb) * v * v - 2 * acb * cosB * v + 1 + acb) / den;
+        if (u <= 0.0) continue;
+        const double s1sq = b2 / (1 + v * v - 2 * v * cosB);
+        if (s1sq <= 0.0) continue;
+        const double s1 = std::sqrt(s1sq);
+        const double s2 = u * s1;
+        const double s3 = v * s1;
+
+        const cv::Point3f vCam[3] = {
+            cv::Point3f(static_cast<float>(s1 * j1[0]), static_cast<float>(s1 * j1[1]), static_cast<float>(s1 * j1[2])),
+            cv::Point3f(static_cast<float>(s2 * j2[0]), static_cast<float>(s2 * j2[1]), static_cast<float>(s2 * j2[2])),
+            cv::Point3f(static_cast<float>(s3 * j3[0]), static_cast<float>(s3 * j3[1]), static_cast<float>(s3 * j3[2]))
+        };
+        double R[9], t[3], s;
+        if (!HornAlign(vCam, vWorld, 3, true, false, R, t, s)) continue;
+        vTcw.push_back(ToSE3(R, t));
+    }
+
+    if (n > 3 && vTcw.size() > 1) {
+        size_t best = 0;
+        float bestErr = 0.0f;
+        for (size_t k = 0; k < vTcw.size(); k++) {
+            float err = 0.0f;
+            for (int i = 3; i < n; i++) {
+                const cv::Point3f Pc = vTcw[k] * vXw[i];
+                err += Pc.dot(vB[i]) > 0.0f ? AngularError2(Pc, vB[i]) : 4.0f;
+            }
+            if (k == 0 || err < bestErr) {
+                bestErr = err;
+                best = k;
+            }
+        }
+        const SE3f T = vTcw[best];
+        vTcw.assign(1, T);
+    }
+    return static_cast<int>(vTcw.size());
+}
+
+bool BearingSolvers::SolveSim3(const cv::Point3f* vP1, const cv::Point3f* vP2, int n, bool bFixScale, Sim3f &S12) {
+    if (n < 3) return false;
+    double R[9], t[3], s;
+    if (!HornAlign(vP1, vP2, n, true, !bFixScale, R, t, s)) return false;
+    S12 = Sim3f(ToSE3(R, t), static_cast<float>(s));
+    return true;
+}
+
+bool BearingSolvers::Triangulate(const cv::Point3f &b1, const cv::Point3f &b2, const SE3f &T21,
+                                 cv::Point3f &X1, float maxCosParallax) {
+    // Rays in frame 1: lambda1 d1 and c2 + lambda2 d2
+    const SE3f T12 = T21.Inverse();
+    const cv::Point3f d1 = b1 * (1.0f / std::sqrt(b1.dot(b1)));
+    cv::Point3f d2 = T12.Rotate(b2);
+    d2 *= 1.0f / std::sqrt(d2.dot(d2));
+    const cv::Point3f c2(T12.t[0], T12.t[1], T12.t[2]);
+
+    const float cosParallax = d1.dot(d2);
+    if (cosParallax > maxCosParallax) return false;
+    const float den = 1.0f - cosParallax * cosParallax;
+    if (den < 1e-12f) return false;
+
+    const float p = d1.dot(c2);
+    const float q = d2.dot(c2);
+    const float lambda1 = (p - cosParallax * q) / den;
+    const float lambda2 = (cosParallax * p - q) / den;
+    if (lambda1 <= 0.0f || lambda2 <= 0.0f) return false;
+
+    X1 = 0.5f * (d1 * lambda1 + c2 + d2 * lambda2);
+    return true;
+}
+
+float BearingSolvers::EpipolarError(const cv::Matx33f &E, const cv::Point3f &b1, const cv::Point3f &b2) {
+    const cv::Vec3f v1(b1.x, b1.y, b1.z);
+    const cv::Vec3f v2(b2.x, b2.y, b2.z);
+    const cv::Vec3f g1 = E * v1;
+    const cv::Vec3f g2 = E.t() * v2;
+    const float e = v2.dot(g1);
+    // Gradients restricted to the tangent planes of the bearings
+    const float den = g1.dot(g1) + g2.dot(g2) - 2.0f * e * e;
+    if (den <= 1e-12f) return kInvalidError;
+    return e * e / den;
+}
+
+float BearingSolvers::AngularError2(const cv::Point3f &a, const cv::Point3f &b) {
+    const float na = std::sqrt(a.dot(a));
+    const float nb = std::sqrt(b.dot(b));
+    if (na <= 0.0f || nb <= 0.0f) return kInvalidError;
+    const cv::Point3f d = a * (1.0f / na) - b * (1.0f / nb);
+    return d.dot(d);
+}
+
+void RotationProblem::Fit(const int* vIndices, int n, std::vector<Model> &vModels) const {
+    std::vector<cv::Point3f> vB1(n), vB2(n);
+    for (int i = 0; i < n; i++) {
+        vB1[i] = mvB1[vIndices[i]];
+        vB2[i] = mvB2[vIndices[i]];
+    }
+    SE3f T21;
+    if (BearingSolvers::SolveRotation(vB1.data(), vB2.data(), n, T21)) vModels.push_back(T21);
+}
+
+float RotationProblem::Error(const Model &T21, int i) const {
+    return BearingSolvers::AngularError2(T21.Rotate(mvB1[i]), mvB2[i]);
+}
+
+void EssentialProblem::Fit(const int* vIndices, int n, std::vector<Model> &vModels) const {
+    std::vector<cv::Point3f> vB1(n), vB2(n);
+    for (int i = 0; i < n; i++) {
+        vB1[i] = mvB1[vIndices[i]];
+        vB2[i] = mvB2[vIndices[i]];
+    }
+    std::vector<cv::Matx33f> vE;
+    BearingSolvers::SolveEssential(vB1.data(), vB2.data(), n, vE);
+    vModels.insert(vModels.end(), vE.begin(), vE.end());
+}
+
+float EssentialProblem::Error(const Model &E, int i) const {
+    return BearingSolvers::EpipolarError(E, mvB1[i], mvB2[i]);
+}
+
+void HomographyProblem::Fit(const int* vIndices, int n, std::vector<Model> &vModels) const {
+    std::vector<cv::Point3f> vB1(n), vB2(n);
+    for (int i = 0; i < n; i++) {
+        vB1[i] = mvB1[vIndices[i]];
+        vB2[i] = mvB2[vIndices[i]];
+    }
+    HomographyModel model;
+    if (!BearingSolvers::SolveHomography(vB1.data(), vB2.data(), n, model.mH)) return;
+    bool bInvertible = false;
+    model.mHinv = model.mH.inv(cv::DECOMP_LU, &bInvertible);
+    if (bInvertible) vModels.push_back(model);
+}
+
+float HomographyProblem::Error(const Model &model, int i) const {
+    const cv::Vec3f b1(mvB1[i].x, mvB1[i].y, mvB1[i].z);
+    const cv::Vec3f b2(mvB2[i].x, mvB2[i].y, mvB2[i].z);
+    const cv::Vec3f h21 = model.mH * b1;
+    const cv::Vec3f h12 = model.mHinv * b2;
+    if (h21.dot(b2) <= 0.0f || h12.dot(b1) <= 0.0f) return kInvalidError;
+    const float e21 = BearingSolvers::AngularError2(cv::Point3f(h21[0], h21[1], h21[2]), mvB2[i]);
+    const float e12 = BearingSolvers::AngularError2(cv::Point3f(h12[0], h12[1], h12[2]), mvB1[i]);
+    return std::max(e21, e12);
+}
+
+void AbsolutePoseProblem::Fit(const int* vIndices, int n, std::vector<Model> &vModels) const {
+    std::vector<cv::Point3f> vXw(n), vB(n);
+    for (int i = 0; i < n; i++) {
+        vXw[i] = mvXw[vIndices[i]];
+        vB[i] = mvB[vIndices[i]];
+    }
+    std::vector<SE3f> vTcw;
+    BearingSolvers::SolveP3P(vXw.data(), vB.data(), n, vTcw);
+    vModels.insert(vModels.end(), vTcw.begin(), vTcw.end());
+}
+
+float AbsolutePoseProblem::Error(const Model &Tcw, int i) const {
+    const cv::Point3f Pc = Tcw * mvXw[i];
+    if (Pc.dot(mvB[i]) <= 0.0f) return kInvalidError;
+    return BearingSolvers::AngularError2(Pc, mvB[i]);
+}
+
+void Sim3Problem::Fit(const int* vIndices, int n, std::vector<Model> &vModels) const {
+    std::vector<cv::Point3f> vP1(n), vP2(n);
+    for (int i = 0; i < n; i++) {
+        vP1[i] = mvP1[vIndices[i]];
+        vP2[i] = mvP2[vIndices[i]];
+    }
+    Sim3f S12;
+    if (BearingSolvers::SolveSim3(vP1.data(), vP2.data(), n, mbFixScale, S12)) vModels.push_back(S12);
+}
+
+float Sim3Problem::Error(const Model &S12, int i) const {
+    const cv::Point3f P1 = S12 * mvP2[i];
+    const cv::Point3f P2 = S12.Inverse() * mvP1[i];
+    if (P1.dot(mvP1[i]) <= 0.0f || P2.dot(mvP2[i]) <= 0.0f) return kInvalidError;
+    return BearingSolvers::AngularError2(P1, mvP1[i]) + BearingSolvers::AngularError2(P2, mvP2[i]);
+}
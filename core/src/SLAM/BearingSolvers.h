@@ -0,0 +1,131 @@
+#ifndef BEARINGSOLVERS_H
+#define BEARINGSOLVERS_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "SE3.h"
+
+// Minimal geometric solvers on unit bearing vectors. Bearings come from any
+// cube face (or a pinhole image), so nothing here assumes a single image
+// plane. Every solver also accepts more than the minimal number of inputs
+// (least squares, or the best minimal solution on the extra data), which is
+// what RANSAC local optimization uses.
+class BearingSolvers {
+public:
+    // Pure rotation R21 with b2 ~ R21 * b1 from n >= 2 pairs (Horn)
+    static bool SolveRotation(const cv::Point3f* vB1, const cv::Point3f* vB2, int n, SE3f &T21);
+
+    // Essential matrices with b2^T E b1 = 0: up to 10 from 5 pairs
+    // (Stewenius' Groebner basis solver); n >= 8 uses the linear 8-point solution
+    static int SolveEssential(const cv::Point3f* vB1, const cv::Point3f* vB2, int n, std::vector<cv::Matx33f> &vE);
+
+    // Motion T21 (X2 = R X1 + t, unit t) from E: the decomposition with the
+    // most pairs triangulated in front of both views. vbMask may be null.
+    static bool DecomposeEssential(const cv::Matx33f &E, const cv::Point3f* vB1, const cv::Point3f* vB2, int n,
+                                   const std::vector<bool>* vbMask, SE3f &T21, int &nGood);
+
+    // Plane-induced homography with b2 ~ H b1 from n >= 4 pairs (DLT on the
+    // cross product b2 x H b1), signed so that H b1 points along b2
+    static bool SolveHomography(const cv::Point3f* vB1, const cv::Point3f* vB2, int n, cv::Matx33f &H);
+
+    // Motion T21 from H (Faugeras' 8 solutions), as for DecomposeEssential.
+    // False if no solution stands out (second best above 75% of the best).
+    static bool DecomposeHomography(const cv::Matx33f &H, const cv::Point3f* vB1, const cv::Point3f* vB2, int n,
+                                    const std::vector<bool>* vbMask, SE3f &T21, int &nGood);
+
+    // Camera poses Tcw from 3 world points and their bearings: up to 4
+    // (Grunert). With n > 3 only the solution that best fits the rest is kept.
+    static int SolveP3P(const cv::Point3f* vXw, const cv::Point3f* vB, int n, std::vector<SE3f> &vTcw);
+
+    // Similarity with P1 = S12 * P2 from n >= 3 point pairs (Horn); scale 1 if bFixScale
+    static bool SolveSim3(const cv::Point3f* vP1, const cv::Point3f* vP2, int n, bool bFixScale, Sim3f &S12);
+
+    // Midpoint triangulation in frame 1. False if behind either view or with
+    // less than minParallax (cosine) between the rays.
+    static bool Triangulate(const cv::Point3f &b1, const cv::Point3f &b2, const SE3f &T21,
+                            cv::Point3f &X1, float maxCosParallax = 0.99998f);
+
+    // b2^T E b1 normalized to a squared angle (spherical Sampson error)
+    static float EpipolarError(const cv::Matx33f &E, const cv::Point3f &b1, const cv::Point3f &b2);
+
+    // Squared chord between two directions (~ squared angle for small errors)
+    static float AngularError2(const cv::Point3f &a, const cv::Point3f &b);
+};
+
+// RANSAC problems (see Ransac.h). Errors are squared angles in radians.
+
+// Pure rotation between two views: panoramas, mosaic alignment
+struct RotationProblem {
+    typedef SE3f Model;
+    static const int kSampleSize = 2;
+
+    std::vector<cv::Point3f> mvB1;
+    std::vector<cv::Point3f> mvB2;
+
+    int NumData() const { return static_cast<int>(mvB1.size()); }
+    void Fit(const int* vIndices, int n, std::vector<Model> &vModels) const;
+    float Error(const Model &T21, int i) const;
+};
+
+// Relative pose from two views of an unknown scene (initialization)
+struct EssentialProblem {
+    typedef cv::Matx33f Model;
+    static const int kSampleSize = 5;
+
+    std::vector<cv::Point3f> mvB1;
+    std::vector<cv::Point3f> mvB2;
+
+    int NumData() const { return static_cast<int>(mvB1.size()); }
+    void Fit(const int* vIndices, int n, std::vector<Model> &vModels) const;
+    float Error(const Model &E, int i) const;
+};
+
+// Homography with its inverse, so the transfer error is checked both ways
+struct HomographyModel {
+    cv::Matx33f mH;
+    cv::Matx33f mHinv;
+};
+
+// Planar or rotating scene between two views (initialization)
+struct HomographyProblem {
+    typedef HomographyModel Model;
+    static const int kSampleSize = 4;
+
+    std::vector<cv::Point3f> mvB1;
+    std::vector<cv::Point3f> mvB2;
+
+    int NumData() const { return static_cast<int>(mvB1.size()); }
+    void Fit(const int* vIndices, int n, std::vector<Model> &vModels) const;
+    // Larger of the two transfer errors
+    float Error(const Model &model, int i) const;
+};
+
+// Camera pose from map points (relocalization)
+struct AbsolutePoseProblem {
+    typedef SE3f Model;
+    static const int kSampleSize = 3;
+
+    std::vector<cv::Point3f> mvXw;
+    std::vector<cv::Point3f> mvB;
+
+    int NumData() const { return static_cast<int>(mvXw.size()); }
+    void Fit(const int* vIndices, int n, std::vector<Model> &vModels) const;
+    float Error(const Model &Tcw, int i) const;
+};
+
+// Similarity between two keyframes' map points, each in its own camera frame
+// (loop closing). The error is checked in both views.
+struct Sim3Problem {
+    typedef Sim3f Model;
+    static const int kSampleSize = 3;
+
+    std::vector<cv::Point3f> mvP1;
+    std::vector<cv::Point3f> mvP2;
+    bool mbFixScale = false;
+
+    int NumData() const { return static_cast<int>(mvP1.size()); }
+    void Fit(const int* vIndices, int n, std::vector<Model> &vModels) const;
+    float Error(const Model &S12, int i) const;
+};
+
+#endif // BEARINGSOLVERS_H
@@ -0,0 +1,150 @@
+#ifndef BLOCKINGQUEUE_H
+#define BLOCKINGQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// FIFO work queue between threads. Consumers sleep on a condition variable
+// until an item arrives instead of polling. Optionally bounded: producers
+// either wait for room (Push), give up (TryPush) or push the oldest item out
+// (PushDropOldest).
+//
+// Close() is the shutdown signal: pushes fail from then on, and Pop keeps
+// returning what is still queued before it returns false.
+template <typename T>
+class BlockingQueue {
+public:
+    // nCapacity = 0 means unbounded
+    explicit BlockingQueue(size_t nCapacity = 0) : mnCapacity(nCapacity), mbClosed(false) {}
+
+    BlockingQueue(const BlockingQueue&) = delete;
+    BlockingQueue& operator=(const BlockingQueue&) = delete;
+
+    // Waits while the queue is full. False if the queue is (or gets) closed.
+    bool Push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondNotFull.wait(lock, [this] { return mbClosed || !Full(); });
+            if (mbClosed) return false;
+            mQueue.push_back(std::move(item));
+        }
+        mCondNotEmpty.notify_one();
+        return true;
+    }
+
+    // Never waits. False if the queue is full or closed, and item is then
+    // left as it was.
+    bool TryPush(T &&item) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mbClosed || Full()) return false;
+            mQueue.push_back(std::move(item));
+        }
+        mCondNotEmpty.notify_one();
+        return true;
+    }
+
+    // Never waits. All or nothing: false if the queue is closed or lacks room
+    // for every item, and vItems is then left as it was.
+    bool TryPushAll(std::vector<T> &&vItems) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mbClosed || (mnCapacity > 0 && mQueue.size() + vItems.size() > mnCapacity)) return false;
+            for (T &item : vItems) mQueue.push_back(std::move(item));
+        }
+        mCondNotEmpty.notify_all();
+        return true;
+    }
+
+    // Never waits: when full, the oldest item makes room and is moved to
+    // dropped (bDropped set). False if the queue is closed, and item is then
+    // left as it was.
+    bool PushDropOldest(T &&item, T &dropped, bool &bDropped) {
+        bDropped = false;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (mbClosed) return false;
+            if (Full() && !mQueue.empty()) {
+                dropped = std::move(mQueue.front());
+                mQueue.pop_front();
+                bDropped = true;
+            }
+            mQueue.push_back(std::move(item));
+        }
+        mCondNotEmpty.notify_one();
+        return true;
+    }
+
+    // Waits for an item. False once the queue is closed and empty.
+    bool Pop(T &item) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondNotEmpty.wait(lock, [this] { return mbClosed || !mQueue.empty(); });
+            if (mQueue.empty()) return false;
+            item = std::move(mQueue.front());
+            mQueue.pop_front();
+        }
+        mCondNotFull.notify_one();
+        return true;
+    }
+
+    // Wakes every waiting producer and consumer
+    void Close() {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mbClosed = true;
+        }
+        mCondNotEmpty.notify_all();
+        mCondNotFull.notify_all();
+    }
+
+    bool IsClosed() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mbClosed;
+    }
+
+    // Removes and returns everything queued
+    std::vector<T> Drain() {
+        std::vector<T> vItems;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            vItems.reserve(mQueue.size());
+            for (T &item : mQueue) vItems.push_back(std::move(item));
+            mQueue.clear();
+        }
+        mCondNotFull.notify_all();
+        return vItems;
+    }
+
+    size_t Size() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mQueue.size();
+    }
+
+    bool Empty() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mQueue.empty();
+    }
+
+    size_t Capacity() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mnCapacity;
+    }
+
+private:
+    bool Full() const { return mnCapacity > 0 && mQueue.size() >= mnCapacity; }
+
+    std::deque<T> mQueue;
+    size_t mnCapacity;
+    bool mbClosed;
+
+    std::mutex mMutex;
+    std::condition_variable mCondNotEmpty;
+    std::condition_variable mCondNotFull;
+};
+
+#endif // BLOCKINGQUEUE_H
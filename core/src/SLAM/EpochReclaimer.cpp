@@ -0,0 +1,143 @@
+#include "EpochReclaimer.h"
+#include <algorithm>
+#include <iterator>
+
+// Per-thread slot ownership. The slot goes back to the pool when the thread exits.
+struct EpochThreadState {
+    int mnSlot = -1;
+    int mnDepth = 0;
+    bool mbOverflow = false;
+
+    ~EpochThreadState() {
+        if (mnSlot >= 0) {
+            EpochReclaimer &r = EpochReclaimer::Get();
+            r.mSlots[mnSlot].mnEpoch.store(0, std::memory_order_release);
+            r.mSlots[mnSlot].mbClaimed.store(false, std::memory_order_release);
+        }
+    }
+};
+
+namespace {
+thread_local EpochThreadState tlsEpochState;
+}
+
+EpochReclaimer& EpochReclaimer::Get() {
+    // Never destroyed: thread-local states may outlive static destruction
+    static EpochReclaimer* pInstance = new EpochReclaimer();
+    return *pInstance;
+}
+
+EpochReclaimer::EpochReclaimer() : mnOverflowReaders(0), mnGlobalEpoch(1) {
+    for (Slot &slot : mSlots) {
+        slot.mnEpoch.store(0, std::memory_order_relaxed);
+        slot.mbClaimed.store(false, std::memory_order_relaxed);
+    }
+}
+
+EpochReclaimer::Guard::Guard() {
+    EpochReclaimer::Get().Enter();
+}
+
+EpochReclaimer::Guard::~Guard() {
+    EpochReclaimer::Get().Exit();
+}
+
+void EpochReclaimer::Enter() {
+    EpochThreadState &state = tlsEpochState;
+    if (state.mnDepth++ > 0) return;
+
+    if (state.mnSlot < 0) {
+        for (int i = 0; i < kMaxThreads; i++) {
+            bool expected = false;
+            if (!mSlots[i].mbClaimed.load(std::memory_order_relaxed) &&
+                mSlots[i].mbClaimed.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                state.mnSlot = i;
+                break;
+            }
+        }
+    }
+
+    if (state.mnSlot < 0) {
+        state.mbOverflow = true;
+        mnOverflowReaders.fetch_add(1, std::memory_order_seq_cst);
+        return;
+    }
+
+    // Announce before touching any map pointer. seq_cst pairs with the scan in MinActiveEpoch.
+    mSlots[state.mnSlot].mnEpoch.store(mnGlobalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochReclaimer::Exit() {
+    EpochThreadState &state = tlsEpochState;
+    if (--state.mnDepth > 0) return;
+
+    if (state.mbOverflow) {
+        state.mbOverflow = false;
+        mnOverflowReaders.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+    mSlots[state.mnSlot].mnEpoch.store(0, std::memory_order_release);
+}
+
+uint64_t EpochReclaimer::MinActiveEpoch() const {
+    uint64_t minEpoch = UINT64_MAX;
+    for (const Slot &slot : mSlots) {
+        const uint64_t e = slot.mnEpoch.load(std::memory_order_seq_cst);
+        if (e != 0) minEpoch = std::min(minEpoch, e);
+    }
+    return minEpoch;
+}
+
+void EpochReclaimer::Retire(const void* owner, std::function<void()> deleter) {
+    {
+        std::unique_lock<std::mutex> lock(mMutexRetired);
+        Retired r;
+        r.mnEpoch = mnGlobalEpoch.load(std::memory_order_seq_cst);
+        r.mpOwner = owner;
+        r.mDeleter = std::move(deleter);
+        mvRetired.push_back(std::move(r));
+    }
+    TryReclaim();
+}
+
+size_t EpochReclaimer::TryReclaim() {
+    std::vector<Retired> vReady;
+    {
+        std::unique_lock<std::mutex> lock(mMutexRetired);
+        if (mvRetired.empty()) return 0;
+
+        // Readers entering from now on cannot reach anything retired so far
+        mnGlobalEpoch.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (mnOverflowReaders.load(std::memory_order_seq_cst) > 0) return 0;
+        const uint64_t minActive = MinActiveEpoch();
+
+        auto it = std::partition(mvRetired.begin(), mvRetired.end(),
+                                 [minActive](const Retired &r) { return r.mnEpoch >= minActive; });
+        std::move(it, mvRetired.end(), std::back_inserter(vReady));
+        mvRetired.erase(it, mvRetired.end());
+    }
+
+    // Deleters may take other locks; run them outside ours
+    for (Retired &r : vReady) r.mDeleter();
+    return vReady.size();
+}
+
+void EpochReclaimer::ReclaimAll(const void* owner) {
+    std::vector<Retired> vReady;
+    {
+        std::unique_lock<std::mutex> lock(mMutexRetired);
+        auto it = std::partition(mvRetired.begin(), mvRetired.end(),
+                                 [owner](const Retired &r) { return r.mpOwner != owner; });
+        std::move(it, mvRetired.end(), std::back_inserter(vReady));
+        mvRetired.erase(it, mvRetired.end());
+    }
+    for (Retired &r : vReady) r.mDeleter();
+}
+
+size_t EpochReclaimer::GetPendingCount() {
+    std::unique_lock<std::mutex> lock(mMutexRetired);
+    return mvRetired.size();
+}
@@ -0,0 +1,76 @@
+#ifndef EPOCHRECLAIMER_H
+#define EPOCHRECLAIMER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Epoch-based deferred reclamation for map entities.
+//
+// Threads that hold raw KeyFrame/MapPoint pointers wrap that work in an
+// EpochReclaimer::Guard. Entering a guard publishes the current epoch in a
+// per-thread slot (two atomic stores, no lock); leaving it marks the thread
+// quiescent. Objects removed from the map are Retire()d with the epoch at
+// removal and only destroyed once every thread inside a guard entered after
+// that epoch, i.e. once nobody can still be looking at them.
+class EpochReclaimer {
+public:
+    // Read-side critical section. Nests; only the outermost guard announces.
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    static EpochReclaimer& Get();
+
+    // deleter runs once no guard that could have seen the object is still open.
+    // owner tags the entry so ReclaimAll can flush one owner's objects.
+    void Retire(const void* owner, std::function<void()> deleter);
+
+    // Advances the epoch and runs the deleters that are now safe. Returns how many ran.
+    size_t TryReclaim();
+
+    // Runs every pending deleter of owner immediately. Only for shutdown,
+    // when the caller knows no thread is inside a guard.
+    void ReclaimAll(const void* owner);
+
+    size_t GetPendingCount();
+
+private:
+    EpochReclaimer();
+
+    void Enter();
+    void Exit();
+    // Oldest epoch announced by a thread inside a guard, or UINT64_MAX if none
+    uint64_t MinActiveEpoch() const;
+
+    static const int kMaxThreads = 64;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> mnEpoch;  // 0 while quiescent
+        std::atomic<bool> mbClaimed;
+    };
+    Slot mSlots[kMaxThreads];
+
+    // Threads that could not claim a slot; while non-zero nothing is reclaimed
+    std::atomic<int> mnOverflowReaders;
+
+    std::atomic<uint64_t> mnGlobalEpoch;
+
+    struct Retired {
+        uint64_t mnEpoch;
+        const void* mpOwner;
+        std::function<void()> mDeleter;
+    };
+    std::vector<Retired> mvRetired;
+    std::mutex mMutexRetired;
+
+    friend struct EpochThreadState;
+};
+
+#endif // EPOCHRECLAIMER_H
@@ -1,19 +1,40 @@
 #include "Frame.h"
+#include "MapPoint.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
 
-long unsigned int Frame::nNextId = 0;
+namespace {
+// A flow track must lead back to within this (squared, pixels) of where it started
+const float kFlowMaxBackError2 = 1.0f;
 
-Frame::Frame() {
+cv::Mat ToGray(const cv::Mat &img) {
+    cv::Mat gray;
+    if (img.channels() == 3) cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    else if (img.channels() == 4) cv::cvtColor(img, gray, cv::COLOR_BGRA2GRAY);
+    else gray = img;
+    return gray;
+}
+}
+
+std::atomic<long unsigned int> Frame::nNextId(0);
+
+Frame::Frame() : N(0), mbHasPose(false), mbFlowTracked(false), mfGridCellWidth(0.0f), mfGridCellHeight(0.0f), mpORBextractor(nullptr) {
 }
 
 Frame::Frame(const Frame &frame)
     : mnId(frame.mnId), mTimeStamp(frame.mTimeStamp), mpCamera(frame.mpCamera),
-      mvKeys(frame.mvKeys), mDescriptors(frame.mDescriptors), N(frame.N), mTcw(frame.mTcw.clone()),
-      mpORBextractor(frame.mpORBextractor)
+      mvKeys(frame.mvKeys), mDescriptors(frame.mDescriptors), N(frame.N), mvFaceOffset(frame.mvFaceOffset),
+      mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mvScaleFactors(frame.mvScaleFactors), mTcw(frame.mTcw), mbHasPose(frame.mbHasPose),
+      mImgs(frame.mImgs), mvSharpness(frame.mvSharpness), mvTexture(frame.mvTexture), mvFlowPyramids(frame.mvFlowPyramids), mbFlowTracked(frame.mbFlowTracked), mGrid(frame.mGrid),
+      mfGridCellWidth(frame.mfGridCellWidth), mfGridCellHeight(frame.mfGridCellHeight), mpORBextractor(frame.mpORBextractor)
 {
 }
 
 Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor, GeometricCamera* camera)
-    : mTimeStamp(timeStamp), mpORBextractor(extractor), mpCamera(camera)
+    : mTimeStamp(timeStamp), mpCamera(camera), mbHasPose(false), mbFlowTracked(false), mpORBextractor(extractor)
 {
     mnId = nNextId++;
 
@@ -29,10 +50,14 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     mvKeys.push_back(keys);
     mDescriptors.push_back(descriptors);
     N = keys.size();
+
+    ComputeImageStats(imGray);
+    FinishFeatures();
 }
 
-Frame::Frame(const std::vector<cv::Mat> &faceImgs, const double &timeStamp, ORBextractor* extractor, GeometricCamera* camera)
-    : mTimeStamp(timeStamp), mpORBextractor(extractor), mpCamera(camera)
+Frame::Frame(const std::vector<cv::Mat> &faceImgs, const double &timeStamp, ORBextractor* extractor, GeometricCamera* camera,
+             int nMaxFaces)
+    : mTimeStamp(timeStamp), mpCamera(camera), mbHasPose(false), mbFlowTracked(false), mpORBextractor(extractor)
 {
     mnId = nNextId++;
     N = 0;
@@ -40,40 +65,330 @@ Frame::Frame(const std::vector<cv::Mat> &faceImgs, const double &timeStamp, ORBe
     // Store Images
     for(const auto& img : faceImgs) {
         mImgs.push_back(img.clone());
+        ComputeImageStats(img);
     }
 
-    // Extract features for each face
+    // Extract features for each face, with the budget moved to textured faces
+    std::vector<int> vnFeatures;
+    DistributeFeatures(nMaxFaces, vnFeatures);
     for (size_t i = 0; i < faceImgs.size(); ++i) {
         std::vector<cv::KeyPoint> keys;
         cv::Mat descriptors;
 
-        (*mpORBextractor)(faceImgs[i], cv::Mat(), keys, descriptors);
+        if (vnFeatures[i] > 0) (*mpORBextractor)(faceImgs[i], cv::Mat(), keys, descriptors, vnFeatures[i]);
 
         mvKeys.push_back(keys);
         mDescriptors.push_back(descriptors);
         N += keys.size();
     }
+    FinishFeatures();
+}
+
+Frame::Frame(const std::vector<cv::Mat> &faceImgs, const double &timeStamp, const Frame &LastFrame,
+             ORBextractor* extractor, GeometricCamera* camera)
+    : mTimeStamp(timeStamp), mpCamera(camera), mbHasPose(false), mbFlowTracked(true), mpORBextractor(extractor)
+{
+    mnId = nNextId++;
+    N = 0;
+
+    for (const auto& img : faceImgs) {
+        mImgs.push_back(img.clone());
+    }
+    BuildFlowPyramids();
+
+    const cv::Size winSize(kFlowWindow, kFlowWindow);
+    const cv::TermCriteria criteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 30, 0.01);
+
+    for (size_t f = 0; f < mImgs.size(); ++f) {
+        std::vector<cv::KeyPoint> keys;
+        cv::Mat descriptors;
+
+        const bool bTrackable = f < LastFrame.mvKeys.size() && f < LastFrame.mvFlowPyramids.size() &&
+                                f < LastFrame.mDescriptors.size() && !LastFrame.mvKeys[f].empty() &&
+                                !LastFrame.mvFlowPyramids[f].empty() && !mvFlowPyramids[f].empty();
+        if (bTrackable) {
+            const std::vector<cv::KeyPoint> &lastKeys = LastFrame.mvKeys[f];
+            std::vector<cv::Point2f> vPrev, vNext, vBack;
+            cv::KeyPoint::convert(lastKeys, vPrev);
+
+            std::vector<uchar> vStatus, vStatusBack;
+            std::vector<float> vErr;
+            cv::calcOpticalFlowPyrLK(LastFrame.mvFlowPyramids[f], mvFlowPyramids[f], vPrev, vNext, vStatus, vErr,
+                                     winSize, kFlowLevels, criteria);
+            // Forward-backward check: drift and occlusions do not lead back
+            vBack = vPrev;
+            cv::calcOpticalFlowPyrLK(mvFlowPyramids[f], LastFrame.mvFlowPyramids[f], vNext, vBack, vStatusBack, vErr,
+                                     winSize, kFlowLevels, criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+
+            const float w = static_cast<float>(mImgs[f].cols);
+            const float h = static_cast<float>(mImgs[f].rows);
+            std::vector<int> vKept;
+            for (size_t i = 0; i < lastKeys.size(); i++) {
+                if (!vStatus[i] || !vStatusBack[i]) continue;
+                const cv::Point2f d = vBack[i] - vPrev[i];
+                if (d.dot(d) > kFlowMaxBackError2) continue;
+                const cv::Point2f &pt = vNext[i];
+                if (pt.x < 0.0f || pt.y < 0.0f || pt.x >= w || pt.y >= h) continue;
+
+                cv::KeyPoint kp = lastKeys[i];
+                kp.pt = pt;
+                keys.push_back(kp);
+                vKept.push_back(static_cast<int>(i));
+            }
+
+            const cv::Mat &lastDesc = LastFrame.mDescriptors[f];
+            if (!vKept.empty() && !lastDesc.empty()) {
+                descriptors.create(static_cast<int>(vKept.size()), lastDesc.cols, lastDesc.type());
+                for (size_t k = 0; k < vKept.size(); k++) lastDesc.row(vKept[k]).copyTo(descriptors.row(static_cast<int>(k)));
+            }
+        }
+
+        mvKeys.push_back(keys);
+        mDescriptors.push_back(descriptors);
+        N += keys.size();
+
+        ComputeImageStats(mImgs[f]);
+    }
+    FinishFeatures();
+}
+
+void Frame::BuildFlowPyramids() {
+    mvFlowPyramids.assign(mImgs.size(), std::vector<cv::Mat>());
+    for (size_t f = 0; f < mImgs.size(); f++) {
+        if (mImgs[f].empty()) continue;
+        cv::buildOpticalFlowPyramid(ToGray(mImgs[f]), mvFlowPyramids[f], cv::Size(kFlowWindow, kFlowWindow), kFlowLevels, false);
+    }
+}
+
+void Frame::FinishFeatures() {
+    mvFaceOffset.assign(1, 0);
+    for (const auto &keys : mvKeys) mvFaceOffset.push_back(mvFaceOffset.back() + static_cast<int>(keys.size()));
+    mvpMapPoints.assign(N, nullptr);
+    mvbOutlier.assign(N, false);
+
+    const int nLevels = mpORBextractor ? mpORBextractor->GetLevels() : 8;
+    const float scale = mpORBextractor ? mpORBextractor->GetScaleFactor() : 1.2f;
+    mvScaleFactors.resize(nLevels);
+    mvScaleFactors[0] = 1.0f;
+    for (int l = 1; l < nLevels; l++) mvScaleFactors[l] = mvScaleFactors[l - 1] * scale;
+
+    // Bucket keypoints so projection search only looks at a small window
+    const float width = mImgs.empty() ? 0.0f : static_cast<float>(mImgs[0].cols);
+    const float height = mImgs.empty() ? 0.0f : static_cast<float>(mImgs[0].rows);
+    mfGridCellWidth = width / kGridCols;
+    mfGridCellHeight = height / kGridRows;
+
+    mGrid.assign(mvKeys.size() * kGridCols * kGridRows, std::vector<size_t>());
+    if (mfGridCellWidth <= 0.0f || mfGridCellHeight <= 0.0f) return;
+    for (size_t f = 0; f < mvKeys.size(); f++) {
+        for (size_t i = 0; i < mvKeys[f].size(); i++) {
+            const cv::Point2f &pt = mvKeys[f][i].pt;
+            const int cx = std::min(kGridCols - 1, std::max(0, static_cast<int>(pt.x / mfGridCellWidth)));
+            const int cy = std::min(kGridRows - 1, std::max(0, static_cast<int>(pt.y / mfGridCellHeight)));
+            mGrid[(f * kGridRows + cy) * kGridCols + cx].push_back(mvFaceOffset[f] + i);
+        }
+    }
+}
+
+int Frame::GetFace(size_t idx) const {
+    return static_cast<int>(std::upper_bound(mvFaceOffset.begin(), mvFaceOffset.end(), static_cast<int>(idx)) - mvFaceOffset.begin()) - 1;
+}
+
+const cv::KeyPoint& Frame::GetKey(size_t idx) const {
+    const int f = GetFace(idx);
+    return mvKeys[f][idx - mvFaceOffset[f]];
+}
+
+cv::Mat Frame::GetDescriptor(size_t idx) const {
+    const int f = GetFace(idx);
+    return mDescriptors[f].row(static_cast<int>(idx - mvFaceOffset[f]));
+}
+
+cv::Point3f Frame::GetBearing(size_t idx) const {
+    CubeMapCamera* pCubeCam = dynamic_cast<CubeMapCamera*>(mpCamera);
+    if (!pCubeCam) return cv::Point3f(0.0f, 0.0f, 0.0f);
+    // A single image is the front face
+    const int face = mvKeys.size() == 1 ? 4 : GetFace(idx);
+    return pCubeCam->Unproject(GetKey(idx).pt, face);
+}
+
+bool Frame::ProjectPoint(const cv::Point3f &Pw, int &face, cv::Point2f &uv) const {
+    CubeMapCamera* pCubeCam = dynamic_cast<CubeMapCamera*>(mpCamera);
+    if (!pCubeCam || mvKeys.empty()) return false;
+
+    const cv::Point3f Pc = mTcw * Pw;
+    face = pCubeCam->GetFace(Pc);
+    if (mvKeys.size() == 1) {
+        if (face != 4) return false;
+        face = 0;
+    } else if (face >= static_cast<int>(mvKeys.size())) {
+        return false;
+    }
+
+    uv = pCubeCam->Project(Pc);
+    return uv.x >= 0.0f && uv.y >= 0.0f && uv.x < pCubeCam->GetWidth() && uv.y < pCubeCam->GetHeight();
 }
 
-void Frame::SetPose(cv::Mat Tcw) {
-    mTcw = Tcw.clone();
+void Frame::ProjectMapPoints(const std::vector<MapPoint*> &vpMPs, std::vector<ProjectedMapPoint> &vProjected) const {
+    vProjected.clear();
+    CubeMapCamera* pCubeCam = dynamic_cast<CubeMapCamera*>(mpCamera);
+    if (!pCubeCam || mvKeys.empty() || vpMPs.empty()) return;
+
+    // Positions and ranges are gathered once (one lock per point) into flat
+    // arrays so the transform and range tests below are branch-free loops
+    const size_t n = vpMPs.size();
+    std::vector<float> vX(n), vY(n), vZ(n), vMin(n), vMax(n), vLevel0(n);
+    for (size_t i = 0; i < n; i++) {
+        const cv::Point3f Pw = vpMPs[i]->GetWorldPos();
+        vX[i] = Pw.x;
+        vY[i] = Pw.y;
+        vZ[i] = Pw.z;
+        vpMPs[i]->GetDistanceInvariance(vMin[i], vMax[i], vLevel0[i]);
+    }
+
+    const float *R = mTcw.R;
+    const float *t = mTcw.t;
+    std::vector<float> vXc(n), vYc(n), vZc(n), vDist(n);
+    for (size_t i = 0; i < n; i++) {
+        vXc[i] = R[0] * vX[i] + R[1] * vY[i] + R[2] * vZ[i] + t[0];
+        vYc[i] = R[3] * vX[i] + R[4] * vY[i] + R[5] * vZ[i] + t[1];
+        vZc[i] = R[6] * vX[i] + R[7] * vY[i] + R[8] * vZ[i] + t[2];
+    }
+    for (size_t i = 0; i < n; i++) {
+        vDist[i] = std::sqrt(vXc[i] * vXc[i] + vYc[i] * vYc[i] + vZc[i] * vZc[i]);
+    }
+
+    const bool bSingleImage = mvKeys.size() == 1;
+    const int nLevels = static_cast<int>(mvScaleFactors.size());
+    const float logScale = nLevels > 1 ? std::log(mvScaleFactors[1]) : 0.0f;
+    const float w = pCubeCam->GetWidth();
+    const float h = pCubeCam->GetHeight();
+
+    for (size_t i = 0; i < n; i++) {
+        const float dist = vDist[i];
+        if (dist <= 0.0f) continue;
+        // Points without a depth estimate are only culled by the view
+        const bool bHasDepth = vLevel0[i] > 0.0f;
+        if (bHasDepth && (dist < vMin[i] || dist > vMax[i])) continue;
+
+        const cv::Point3f Pc(vXc[i], vYc[i], vZc[i]);
+        int face = pCubeCam->GetFace(Pc);
+        if (bSingleImage) {
+            if (face != 4) continue;
+            face = 0;
+        } else if (face >= static_cast<int>(mvKeys.size())) {
+            continue;
+        }
+        if (mvKeys[face].empty()) continue;
+
+        const cv::Point2f uv = pCubeCam->Project(Pc);
+        if (uv.x < 0.0f || uv.y < 0.0f || uv.x >= w || uv.y >= h) continue;
+
+        ProjectedMapPoint proj;
+        proj.mpMP = vpMPs[i];
+        proj.mnFace = face;
+        proj.mUV = uv;
+        proj.mnPredictedLevel = -1;
+        if (bHasDepth && logScale > 0.0f) {
+            const int level = static_cast<int>(std::ceil(std::log(vLevel0[i] / dist) / logScale));
+            proj.mnPredictedLevel = std::max(0, std::min(nLevels - 1, level));
+        }
+        vProjected.push_back(proj);
+    }
+}
+
+std::vector<size_t> Frame::GetFeaturesInArea(int face, float x, float y, float r, int minLevel, int maxLevel) const {
+    std::vector<size_t> vIndices;
+    if (face < 0 || face >= static_cast<int>(mvKeys.size()) || mfGridCellWidth <= 0.0f) return vIndices;
+
+    const int minCellX = std::max(0, static_cast<int>((x - r) / mfGridCellWidth));
+    const int maxCellX = std::min(kGridCols - 1, static_cast<int>((x + r) / mfGridCellWidth));
+    const int minCellY = std::max(0, static_cast<int>((y - r) / mfGridCellHeight));
+    const int maxCellY = std::min(kGridRows - 1, static_cast<int>((y + r) / mfGridCellHeight));
+    if (maxCellX < 0 || maxCellY < 0 || minCellX >= kGridCols || minCellY >= kGridRows) return vIndices;
+
+    const std::vector<cv::KeyPoint> &keys = mvKeys[face];
+    for (int cy = minCellY; cy <= maxCellY; cy++) {
+        for (int cx = minCellX; cx <= maxCellX; cx++) {
+            for (size_t idx : mGrid[(face * kGridRows + cy) * kGridCols + cx]) {
+                const cv::KeyPoint &kp = keys[idx - mvFaceOffset[face]];
+                if (minLevel >= 0 && kp.octave < minLevel) continue;
+                if (maxLevel >= 0 && kp.octave > maxLevel) continue;
+                const float dx = kp.pt.x - x;
+                const float dy = kp.pt.y - y;
+                if (dx * dx + dy * dy < r * r) vIndices.push_back(idx);
+            }
+        }
+    }
+    return vIndices;
 }
 
-cv::Mat Frame::GetPoseInverse() {
-    // Rigid body transformation inverse
-    // T = [R | t]
-    // T_inv = [R^T | -R^T * t]
+void Frame::ComputeImageStats(const cv::Mat &img) {
+    if (img.empty()) {
+        mvSharpness.push_back(0.0f);
+        mvTexture.push_back(0.0f);
+        return;
+    }
 
-    if (mTcw.empty()) return cv::Mat::eye(4,4, CV_32F);
+    // Blur shows as missing high frequencies. Measuring on a coarse level of the
+    // ORB scale pyramid keeps it cheap and less sensitive to sensor noise.
+    const cv::Mat gray = ToGray(img);
 
-    cv::Mat Rwc = mTcw.rowRange(0,3).colRange(0,3).t();
-    cv::Mat twc = -Rwc * mTcw.rowRange(0,3).col(3);
+    const float scale = std::pow(mpORBextractor ? mpORBextractor->GetScaleFactor() : 1.2f, kSharpnessLevel);
+    cv::Mat level;
+    cv::resize(gray, level, cv::Size(), 1.0 / scale, 1.0 / scale, cv::INTER_AREA);
 
-    cv::Mat Twc = cv::Mat::eye(4,4, CV_32F);
-    // Copy Rwc
-    Rwc.copyTo(Twc.rowRange(0,3).colRange(0,3));
-    // Copy twc
-    twc.copyTo(Twc.rowRange(0,3).col(3));
+    cv::Mat lap;
+    cv::Laplacian(level, lap, CV_32F);
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(lap, mean, stddev);
+    mvSharpness.push_back(static_cast<float>(stddev[0] * stddev[0]));
+
+    // Texture: RMS gradient on the same level
+    cv::Mat gx, gy;
+    cv::Sobel(level, gx, CV_32F, 1, 0);
+    cv::Sobel(level, gy, CV_32F, 0, 1);
+    const double energy = (gx.dot(gx) + gy.dot(gy)) / std::max<size_t>(1, level.total());
+    mvTexture.push_back(static_cast<float>(std::sqrt(energy)));
+}
+
+void Frame::DistributeFeatures(int nMaxFaces, std::vector<int> &vnFeatures) const {
+    const int nFaces = static_cast<int>(mvTexture.size());
+    const int nBase = mpORBextractor ? mpORBextractor->GetFeatures() : 0;
+    vnFeatures.assign(nFaces, 0);
+
+    // Fewer faces allowed: the least textured go first
+    int nUsed = nFaces;
+    float minKept = 0.0f;
+    if (nMaxFaces > 0 && nMaxFaces < nFaces) {
+        std::vector<float> vSorted(mvTexture);
+        std::nth_element(vSorted.begin(), vSorted.begin() + nMaxFaces - 1, vSorted.end(), std::greater<float>());
+        minKept = vSorted[nMaxFaces - 1];
+        nUsed = nMaxFaces;
+    }
+
+    const float minTexture = std::max(minKept, kMinFaceTexture);
+    float sum = 0.0f;
+    for (float texture : mvTexture) {
+        if (texture >= minTexture) sum += texture;
+    }
+    // Nothing stands out (dark scene): no basis to favour a face
+    if (sum <= 0.0f) {
+        for (int f = 0; f < nFaces; f++) {
+            if (mvTexture[f] >= minKept) vnFeatures[f] = nBase;
+        }
+        return;
+    }
+
+    // The budget of the faces used, shared by texture among those worth extracting
+    const float nTotal = static_cast<float>(nBase * nUsed);
+    const int nMax = static_cast<int>(kMaxFaceBudgetRatio * nBase);
+    for (int f = 0; f < nFaces; f++) {
+        if (mvTexture[f] >= minTexture) vnFeatures[f] = std::min(nMax, static_cast<int>(nTotal * mvTexture[f] / sum));
+    }
+}
 
-    return Twc;
+void Frame::SetPose(const SE3f &Tcw) {
+    mTcw = Tcw;
+    mbHasPose = true;
 }
@@ -1,10 +1,22 @@
 #ifndef FRAME_H
 #define FRAME_H
 
+#include <atomic>
 #include <vector>
 #include <opencv2/core.hpp>
 #include "GeometricCamera.h"
 #include "ORBextractor.h"
+#include "SE3.h"
+
+class MapPoint;
+
+// A map point predicted to be visible in a frame
+struct ProjectedMapPoint {
+    MapPoint* mpMP;
+    int mnFace;
+    cv::Point2f mUV;
+    int mnPredictedLevel;  // -1 while the point has no depth estimate
+};
 
 class Frame {
 public:
@@ -12,25 +24,62 @@ public:
 
     // Copy Constructor
     Frame(const Frame &frame);
+    Frame& operator=(const Frame &frame) = default;
 
     // Constructor for Monocular/CubeMap
     Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor, GeometricCamera* camera);
 
-    // Constructor for explicit CubeMap (6 images)
-    Frame(const std::vector<cv::Mat> &faceImgs, const double &timeStamp, ORBextractor* extractor, GeometricCamera* camera);
+    // Constructor for explicit CubeMap (6 images). nMaxFaces > 0: features
+    // only on that many faces, the most textured ones.
+    Frame(const std::vector<cv::Mat> &faceImgs, const double &timeStamp, ORBextractor* extractor, GeometricCamera* camera,
+          int nMaxFaces = 0);
+
+    // CubeMap without detection: the features of LastFrame are followed with
+    // pyramidal Lucas-Kanade on each face and keep their descriptors, octave
+    // and angle. Features lost by the flow are dropped. LastFrame needs its
+    // flow pyramids.
+    Frame(const std::vector<cv::Mat> &faceImgs, const double &timeStamp, const Frame &LastFrame,
+          ORBextractor* extractor, GeometricCamera* camera);
 
     // Destructor
     ~Frame() {}
 
     void ExtractORB(int flag, const cv::Mat &im);
-    void SetPose(cv::Mat Tcw);
-    cv::Mat GetPoseInverse();
+    // Optical flow pyramid of each face, for the next frame to track from
+    void BuildFlowPyramids();
+    void SetPose(const SE3f &Tcw);
+    bool HasPose() const { return mbHasPose; }
+    SE3f GetPoseInverse() const { return mTcw.Inverse(); }
+    cv::Point3f GetCameraCenter() const { return mTcw.Center(); }
+
+    // Features are also addressed by a flat index over all faces (as in
+    // mvpMapPoints): face f holds [mvFaceOffset[f], mvFaceOffset[f+1]).
+    int GetFace(size_t idx) const;
+    const cv::KeyPoint& GetKey(size_t idx) const;
+    cv::Mat GetDescriptor(size_t idx) const;
+
+    // Unit bearing of a keypoint in the camera frame
+    cv::Point3f GetBearing(size_t idx) const;
+
+    // Projects a world point with the current pose onto a face.
+    // A single-image frame is treated as the front cube face.
+    bool ProjectPoint(const cv::Point3f &Pw, int &face, cv::Point2f &uv) const;
+
+    // Visibility test for a batch of map points: keeps those inside their
+    // scale invariance range that land on a face with keypoints
+    void ProjectMapPoints(const std::vector<MapPoint*> &vpMPs, std::vector<ProjectedMapPoint> &vProjected) const;
+
+    // Flat indices of the keypoints on face within radius r of (x, y),
+    // optionally restricted to pyramid levels [minLevel, maxLevel]
+    std::vector<size_t> GetFeaturesInArea(int face, float x, float y, float r,
+                                          int minLevel = -1, int maxLevel = -1) const;
 
 public:
     // Frame Metadata
     long unsigned int mnId;
     double mTimeStamp;
-    static long unsigned int nNextId;
+    // Pipelined tracking builds frames outside the tracking thread
+    static std::atomic<long unsigned int> nNextId;
 
     // Camera
     GeometricCamera* mpCamera;
@@ -41,14 +90,67 @@ public:
 
     // Number of features
     int N;
+    std::vector<int> mvFaceOffset;
+
+    // Map point matched to each feature (flat index), null if none
+    std::vector<MapPoint*> mvpMapPoints;
+    // Set by pose optimization for matches it rejected
+    std::vector<bool> mvbOutlier;
 
-    // Pose (World to Camera)
-    cv::Mat mTcw;
+    // Scale of each ORB pyramid level
+    std::vector<float> mvScaleFactors;
+
+    // Pose (World to Camera), valid once mbHasPose is set
+    SE3f mTcw;
+    bool mbHasPose;
 
     // Source Images (Color) - Stored for Photosphere Creation
     std::vector<cv::Mat> mImgs;
 
+    // Per-face sharpness: variance of the Laplacian on a coarse pyramid level.
+    // Only comparable between frames for the same face.
+    std::vector<float> mvSharpness;
+
+    // Per-face texture: RMS Sobel gradient on the same level. Comparable
+    // between faces; decides where the feature budget goes.
+    std::vector<float> mvTexture;
+
+    // Pyramid level the sharpness and texture are measured on
+    static const int kSharpnessLevel = 4;
+
+    // Faces below this texture get no features (sky, blank ceilings); no face
+    // gets more than this multiple of the extractor's per-face budget
+    static constexpr float kMinFaceTexture = 8.0f;
+    static constexpr float kMaxFaceBudgetRatio = 2.5f;
+
+    // Grey image pyramid per face, empty unless BuildFlowPyramids was called.
+    // Shared (not deep copied) between copies of the frame.
+    std::vector<std::vector<cv::Mat>> mvFlowPyramids;
+    // Features followed by optical flow rather than detected in this frame
+    bool mbFlowTracked;
+
+    // Lucas-Kanade window and pyramid levels above the base image
+    static const int kFlowWindow = 21;
+    static const int kFlowLevels = 3;
+
+    // Cells per face for GetFeaturesInArea
+    static const int kGridCols = 32;
+    static const int kGridRows = 32;
+
 private:
+    // Sharpness and texture of one face
+    void ComputeImageStats(const cv::Mat &img);
+    // Per-face feature budgets: the extractor's budget times the faces used,
+    // split by texture over the faces above kMinFaceTexture
+    void DistributeFeatures(int nMaxFaces, std::vector<int> &vnFeatures) const;
+    // Face offsets, map point entries, scale factors and the feature grid, once all faces are extracted
+    void FinishFeatures();
+
+    // Per face, kGridCols * kGridRows cells of flat indices
+    std::vector<std::vector<size_t>> mGrid;
+    float mfGridCellWidth;
+    float mfGridCellHeight;
+
     ORBextractor* mpORBextractor;
 };
 
@@ -23,6 +23,11 @@ public:
         cy = h / 2.0f;
     }
 
+    float GetWidth() const { return w; }
+    float GetHeight() const { return h; }
+    // Pixels per unit of tangent at the face centre
+    float GetFocal() const { return fx; }
+
     // 0: Right (+X), 1: Left (-X), 2: Top (+Y), 3: Bottom (-Y), 4: Front (+Z), 5: Back (-Z)
     int GetFace(const cv::Point3f &p3D) {
         float absX = std::abs(p3D.x);
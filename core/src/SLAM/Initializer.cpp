@@ -1,177 +1,196 @@
 #include "Initializer.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <iostream>
-#include <map>
-#include <opencv2/calib3d.hpp>
+#include <thread>
+
+namespace {
+// Chi-square 95%: 1 dof for the epipolar error (distance to a curve), 2 for transfer
+const float kChi2Epipolar = 3.84f;
+const float kChi2Transfer = 5.991f;
+// Homography tried first above this share of the combined score (ORB-SLAM)
+const float kHomographyRatio = 0.45f;
+// Reconstruction acceptance
+const int kMinMatches = 50;
+const int kMinTriangulated = 50;
+const float kMinGoodRatio = 0.9f;
+const float kMinParallaxDeg = 1.0f;
+// Points with less parallax are consistent with the motion but not triangulated
+const float kMaxCosParallax = 0.99998f;
+// Pure rotation: its inliers against the better of H and E. A homography also
+// fits a rotation, so the test is whether nothing is left for translation.
+const float kPureRotationRatio = 0.9f;
+
+cv::Point3f KeyBearing(const Frame &F, size_t idx) {
+    cv::Point3f b = F.GetBearing(idx);
+    if (b.dot(b) == 0.0f && F.mpCamera) b = F.mpCamera->Unproject(F.GetKey(idx).pt);
+    return b * (1.0f / std::sqrt(b.dot(b)));
+}
+}
 
 Initializer::Initializer(const Frame &ReferenceFrame, float sigma, int iterations)
-    : mInitialFrame(ReferenceFrame), mSigma(sigma), mMaxIterations(iterations) {
+    : mInitialFrame(ReferenceFrame), mSigma(sigma), mMaxIterations(iterations), mfSigma2(0.0f), mfLastParallax(0.0f),
+      mbPureRotation(false) {
 }
 
 bool Initializer::Initialize(const Frame &CurrentFrame, const std::vector<int> &vMatches12,
-                             cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D,
-                             std::vector<bool> &vbTriangulated) {
-    mvMatches12 = vMatches12;
-    // Removed unused mvKeys1/2
-
-    // 1. Collect matched points for RANSAC
-    std::vector<cv::Point2f> points1, points2;
-    // Map from RANSAC index to Original KeyPoint Index
-    std::vector<int> ransacToOrigIdx;
-
-    // Access keys from Frame (Assuming single vector for simplicity or face 0)
-    const std::vector<cv::KeyPoint>& keys1 = mInitialFrame.mvKeys[0];
-    const std::vector<cv::KeyPoint>& keys2 = CurrentFrame.mvKeys[0];
-
-    for(size_t i=0; i<vMatches12.size(); ++i) {
-        if(vMatches12[i] >= 0) {
-            points1.push_back(keys1[i].pt);
-            points2.push_back(keys2[vMatches12[i]].pt);
-            ransacToOrigIdx.push_back(i);
-        }
+                             SE3f &T21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated) {
+    mbPureRotation = false;
+
+    // 1. Bearings of the matches, on all faces
+    mHomography = HomographyProblem();
+    mvMatchedIdx1.clear();
+    for (size_t i = 0; i < vMatches12.size(); ++i) {
+        if (vMatches12[i] < 0) continue;
+        mHomography.mvB1.push_back(KeyBearing(mInitialFrame, i));
+        mHomography.mvB2.push_back(KeyBearing(CurrentFrame, vMatches12[i]));
+        mvMatchedIdx1.push_back(static_cast<int>(i));
     }
+    if (static_cast<int>(mvMatchedIdx1.size()) < kMinMatches) return false;
+    mEssential.mvB1 = mHomography.mvB1;
+    mEssential.mvB2 = mHomography.mvB2;
+    mRotation.mvB1 = mHomography.mvB1;
+    mRotation.mvB2 = mHomography.mvB2;
+
+    CubeMapCamera* pCubeCam = dynamic_cast<CubeMapCamera*>(mInitialFrame.mpCamera);
+    float focal = 1.0f;
+    if (pCubeCam) focal = pCubeCam->GetFocal();
+    else if (mInitialFrame.mpCamera) focal = mInitialFrame.mpCamera->GetK().at<float>(0, 0);
+    mfSigma2 = (mSigma / focal) * (mSigma / focal);
+
+    // 2. All models at once (the rotation is cheap: 2-point samples)
+    RansacResult<HomographyModel> resultH;
+    RansacResult<cv::Matx33f> resultE;
+    RansacResult<SE3f> resultR;
+    std::thread threadH(&Initializer::FindHomography, this, std::ref(resultH));
+    std::thread threadE(&Initializer::FindEssential, this, std::ref(resultE));
+    FindRotation(resultR);
+    threadH.join();
+    threadE.join();
+
+    // 3. Model order by score: a planar scene or little translation favours H
+    const float scoreH = static_cast<float>(resultH.mnInliers);
+    const float scoreE = static_cast<float>(resultE.mnInliers);
+    if (scoreH + scoreE <= 0.0f) return false;
+    const bool bHomographyFirst = scoreH / (scoreH + scoreE) > kHomographyRatio;
+
+    vbTriangulated.assign(mInitialFrame.N, false);
+    vP3D.assign(mInitialFrame.N, cv::Point3f(0, 0, 0));
+
+    // 4. Reconstruct with the preferred model; the other if that one is
+    // ambiguous or too flat. Without parallax neither is accepted.
+    const int n = static_cast<int>(mvMatchedIdx1.size());
+    for (int attempt = 0; attempt < 2; attempt++) {
+        const bool bHomography = (attempt == 0) == bHomographyFirst;
+        SE3f T;
+        int nGood = 0;
+        bool bDecomposed = false;
+        int nInliers = 0;
+        const std::vector<bool>* pvbInliers = nullptr;
+        if (bHomography && resultH.mbSuccess) {
+            bDecomposed = BearingSolvers::DecomposeHomography(resultH.mModel.mH, mHomography.mvB1.data(), mHomography.mvB2.data(),
+                                                              n, &resultH.mvbInliers, T, nGood);
+            nInliers = resultH.mnInliers;
+            pvbInliers = &resultH.mvbInliers;
+        } else if (!bHomography && resultE.mbSuccess) {
+            bDecomposed = BearingSolvers::DecomposeEssential(resultE.mModel, mEssential.mvB1.data(), mEssential.mvB2.data(),
+                                                             n, &resultE.mvbInliers, T, nGood);
+            nInliers = resultE.mnInliers;
+            pvbInliers = &resultE.mvbInliers;
+        }
+        if (!bDecomposed) continue;
 
-    if(points1.size() < 20) return false;
+        std::fill(vbTriangulated.begin(), vbTriangulated.end(), false);
+        if (!Reconstruct(T, *pvbInliers, nInliers, vP3D, vbTriangulated)) continue;
 
-    // 2. Find Homography and Fundamental Matrix using OpenCV
-    cv::Mat maskH, maskF;
-    cv::Mat H = cv::findHomography(points1, points2, cv::RANSAC, 3.0, maskH);
-    cv::Mat F = cv::findFundamentalMat(points1, points2, cv::FM_RANSAC, 3.0, 0.99, maskF);
+        T21 = T;
+        std::cout << "Initializer: " << (bHomography ? "homography" : "essential") << " from " << n << " matches, "
+                  << nInliers << " inliers, parallax " << mfLastParallax << " deg" << std::endl;
+        return true;
+    }
 
-    if (H.empty() || F.empty()) return false;
+    std::fill(vbTriangulated.begin(), vbTriangulated.end(), false);
 
-    // 3. Score Models (Simplification: Count inliers)
-    float scoreH = cv::countNonZero(maskH);
-    float scoreF = cv::countNonZero(maskF);
+    // 5. No reconstruction: is there any translation to wait for?
+    if (resultR.mbSuccess && resultR.mnInliers >= kPureRotationRatio * std::max(scoreH, scoreE)) {
+        mbPureRotation = true;
+        mRotation21 = resultR.mModel;
+    }
+    return false;
+}
 
-    float ratio = scoreH / (scoreF + 1e-5f);
+bool Initializer::IsPureRotation(SE3f &R21) const {
+    if (!mbPureRotation) return false;
+    R21 = mRotation21;
+    return true;
+}
 
-    // 4. Select Model and Reconstruct
-    cv::Mat K = cv::Mat::eye(3, 3, CV_32F);
-    if (mInitialFrame.mpCamera) {
-         K = mInitialFrame.mpCamera->GetK();
-    }
+void Initializer::FindHomography(RansacResult<HomographyModel> &result) {
+    RansacParams params;
+    params.mfThreshold = kChi2Transfer * mfSigma2;
+    params.mnMaxIterations = mMaxIterations;
+    params.mnMinInliers = kMinTriangulated;
+    Ransac<HomographyProblem> ransac(mHomography, params);
+    ransac.Run(result);
+}
 
-    bool success = false;
-
-    // Resize output containers to match total number of keys in Frame 1
-    vbTriangulated.assign(keys1.size(), false);
-    vP3D.assign(keys1.size(), cv::Point3f(0,0,0));
-
-    // P1 = K * [I | 0]
-    cv::Mat P1(3, 4, CV_32F);
-    K.copyTo(P1.rowRange(0,3).colRange(0,3));
-    P1.col(3) = cv::Mat::zeros(3,1, CV_32F);
-
-    if (ratio > 0.45) {
-        // Prefer Homography
-        std::vector<cv::Mat> Rs, ts, normals;
-        int solutions = cv::decomposeHomographyMat(H, K, Rs, ts, normals);
-
-        // Check 4 solutions
-        int bestGood = 0;
-        int bestSol = -1;
-        cv::Mat bestMaskPose;
-        cv::Mat bestPoints4D;
-
-        for(int i=0; i<solutions; ++i) {
-            cv::Mat R = Rs[i];
-            cv::Mat t = ts[i];
-
-            // P2 = K * [R | t]
-            cv::Mat P2(3, 4, CV_32F);
-            R.copyTo(P2.rowRange(0,3).colRange(0,3));
-            t.copyTo(P2.rowRange(0,3).col(3));
-            P2 = K * P2;
-
-            cv::Mat points4D;
-            cv::triangulatePoints(P1, P2, points1, points2, points4D);
-
-            // Check parallax and cheirality
-            int nGood = 0;
-            cv::Mat mask = cv::Mat::zeros(points1.size(), 1, CV_8UC1);
-
-            for(size_t j=0; j<points1.size(); ++j) {
-                if(!maskH.at<uchar>(j)) continue; // Only check H inliers
-
-                float w = points4D.at<float>(3, j);
-                if(std::abs(w) < 1e-4) continue;
-
-                float z1 = points4D.at<float>(2, j) / w;
-
-                // Project to cam 2
-                cv::Mat x3D = points4D.col(j);
-                cv::Mat x2 = P2 * x3D;
-                float w2 = x2.at<float>(2);
-
-                if(z1 > 0 && w2 > 0) {
-                     mask.at<uchar>(j) = 1;
-                     nGood++;
-                }
-            }
-
-            if(nGood > bestGood) {
-                bestGood = nGood;
-                bestSol = i;
-                bestMaskPose = mask; // Use our computed mask
-                bestPoints4D = points4D;
-                R21 = R;
-                t21 = t;
-            }
-        }
+void Initializer::FindEssential(RansacResult<cv::Matx33f> &result) {
+    RansacParams params;
+    params.mfThreshold = kChi2Epipolar * mfSigma2;
+    params.mnMaxIterations = mMaxIterations;
+    params.mnMinInliers = kMinTriangulated;
+    params.mnSeed = 1;
+    Ransac<EssentialProblem> ransac(mEssential, params);
+    ransac.Run(result);
+}
 
-        if(bestSol >= 0 && bestGood > 10) {
-             // Fill outputs
-             for(size_t i=0; i<ransacToOrigIdx.size(); ++i) {
-                if(bestMaskPose.at<uchar>(i)) {
-                     float w = bestPoints4D.at<float>(3, i);
-                     float x = bestPoints4D.at<float>(0, i) / w;
-                     float y = bestPoints4D.at<float>(1, i) / w;
-                     float z = bestPoints4D.at<float>(2, i) / w;
-
-                     vP3D[ransacToOrigIdx[i]] = cv::Point3f(x, y, z);
-                     vbTriangulated[ransacToOrigIdx[i]] = true;
-                }
-             }
-             success = true;
-        }
+void Initializer::FindRotation(RansacResult<SE3f> &result) {
+    RansacParams params;
+    params.mfThreshold = kChi2Transfer * mfSigma2;
+    params.mnMaxIterations = mMaxIterations;
+    params.mnMinInliers = kMinTriangulated;
+    params.mnSeed = 2;
+    Ransac<RotationProblem> ransac(mRotation, params);
+    ransac.Run(result);
+}
 
-    } else {
-        // Fundamental Matrix Reconstruction
-        cv::Mat E = K.t() * F * K;
-        cv::Mat R, t, maskPose;
-
-        int goodPoints = cv::recoverPose(E, points1, points2, K, R, t, maskPose);
-
-        if (goodPoints > 10) {
-            R21 = R;
-            t21 = t;
-
-            cv::Mat P2(3, 4, CV_32F);
-            R.copyTo(P2.rowRange(0,3).colRange(0,3));
-            t.copyTo(P2.rowRange(0,3).col(3));
-            P2 = K * P2;
-
-            cv::Mat points4D;
-            cv::triangulatePoints(P1, P2, points1, points2, points4D);
-
-            for(size_t i=0; i<ransacToOrigIdx.size(); ++i) {
-                int origIdx = ransacToOrigIdx[i];
-                if(maskPose.at<uchar>(i)) {
-                    float w = points4D.at<float>(3, i);
-                    if(std::abs(w) > 1e-4) {
-                        float x = points4D.at<float>(0, i) / w;
-                        float y = points4D.at<float>(1, i) / w;
-                        float z = points4D.at<float>(2, i) / w;
-                        if (z > 0) {
-                            vP3D[origIdx] = cv::Point3f(x, y, z);
-                            vbTriangulated[origIdx] = true;
-                        }
-                    }
-                }
-            }
-            success = true;
-        }
+bool Initializer::Reconstruct(const SE3f &T21, const std::vector<bool> &vbInliers, int nInliers,
+                              std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated) {
+    const SE3f T12 = T21.Inverse();
+    const cv::Point3f O2(T12.t[0], T12.t[1], T12.t[2]);
+    std::vector<float> vCosParallax;
+    vCosParallax.reserve(nInliers);
+    int nGood = 0;
+
+    for (size_t i = 0; i < mvMatchedIdx1.size(); i++) {
+        if (!vbInliers[i]) continue;
+        const cv::Point3f &b1 = mHomography.mvB1[i];
+        const cv::Point3f &b2 = mHomography.mvB2[i];
+        cv::Point3f X;
+        if (!BearingSolvers::Triangulate(b1, b2, T21, X, 1.0f)) continue;
+
+        // Reprojection in both views within the inlier threshold
+        if (BearingSolvers::AngularError2(X, b1) > kChi2Transfer * mfSigma2) continue;
+        if (BearingSolvers::AngularError2(T21 * X, b2) > kChi2Transfer * mfSigma2) continue;
+        nGood++;
+
+        const cv::Point3f ray2 = X - O2;
+        const float cosParallax = X.dot(ray2) / std::sqrt(X.dot(X) * ray2.dot(ray2));
+        vCosParallax.push_back(cosParallax);
+        if (cosParallax > kMaxCosParallax) continue;
+        vP3D[mvMatchedIdx1[i]] = X;
+        vbTriangulated[mvMatchedIdx1[i]] = true;
     }
 
-    return success;
+    mfLastParallax = 0.0f;
+    if (nGood < kMinTriangulated || nGood < kMinGoodRatio * nInliers) return false;
+
+    // Median parallax: a few close points must not make a rotation look like a translation
+    std::nth_element(vCosParallax.begin(), vCosParallax.begin() + nGood / 2, vCosParallax.end());
+    const float cosMedian = std::max(-1.0f, std::min(1.0f, vCosParallax[nGood / 2]));
+    mfLastParallax = std::acos(cosMedian) * 180.0f / static_cast<float>(CV_PI);
+
+    const int nTriangulated = static_cast<int>(std::count(vbTriangulated.begin(), vbTriangulated.end(), true));
+    return mfLastParallax >= kMinParallaxDeg && nTriangulated >= kMinTriangulated;
 }
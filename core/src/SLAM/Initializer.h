@@ -4,28 +4,62 @@
 #include <vector>
 #include <opencv2/core.hpp>
 #include "Frame.h"
+#include "BearingSolvers.h"
+#include "Ransac.h"
 
+// Two-view monocular initialization on bearing vectors, so matches on every
+// cube face count. A homography and an essential matrix are fitted in
+// parallel; the model is chosen by score, and a reconstruction is only
+// accepted with enough parallax (otherwise the caller waits for more motion).
+// A pure rotation is fitted alongside, to tell a camera turning about its
+// centre (no parallax will ever come) from one that has not moved enough yet.
 class Initializer {
 public:
     Initializer(const Frame &ReferenceFrame, float sigma, int iterations);
 
+    // vMatches12[i]: feature of CurrentFrame matched to feature i of the
+    // reference frame (flat over faces), -1 if none. Outputs are indexed
+    // like the reference features, points in reference camera coordinates.
     // Returns true if initialization is successful
     bool Initialize(const Frame &CurrentFrame, const std::vector<int> &vMatches12,
-                    cv::Mat &R21, cv::Mat &t21, std::vector<cv::Point3f> &vP3D,
-                    std::vector<bool> &vbTriangulated);
+                    SE3f &T21, std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated);
 
     const Frame& GetReferenceFrame() const { return mInitialFrame; }
 
+    // After a failed Initialize: true if a rotation explains the matches as
+    // well as the two-view models do, i.e. no translation is observable.
+    // R21 is that rotation (zero translation).
+    bool IsPureRotation(SE3f &R21) const;
+
 private:
+    // Run on their own threads
+    void FindHomography(RansacResult<HomographyModel> &result);
+    void FindEssential(RansacResult<cv::Matx33f> &result);
+    void FindRotation(RansacResult<SE3f> &result);
+
+    // Triangulates the inliers with T21. False unless enough points were
+    // triangulated with enough parallax.
+    bool Reconstruct(const SE3f &T21, const std::vector<bool> &vbInliers, int nInliers,
+                     std::vector<cv::Point3f> &vP3D, std::vector<bool> &vbTriangulated);
+
     Frame mInitialFrame;
     float mSigma;
     int mMaxIterations;
 
-    std::vector<cv::Point2f> mvKeys1;
-    std::vector<cv::Point2f> mvKeys2;
+    // Matched bearings of the current attempt, and the reference feature of each
+    HomographyProblem mHomography;
+    EssentialProblem mEssential;
+    RotationProblem mRotation;
+    std::vector<int> mvMatchedIdx1;
+    // Squared angle of one pixel of noise
+    float mfSigma2;
+
+    // Median parallax (degrees) of the last reconstruction tried
+    float mfLastParallax;
 
-    std::vector<std::vector<size_t>> mvSets;
-    std::vector<int> mvMatches12;
+    // Rotation-only verdict of the last attempt
+    bool mbPureRotation;
+    SE3f mRotation21;
 };
 
 #endif // INITIALIZER_H
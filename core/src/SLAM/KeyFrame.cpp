@@ -1,16 +1,42 @@
 #include "KeyFrame.h"
+#include "Map.h"
 
-// Initialize static member
+// Initialize static members
 std::string KeyFrame::msCacheDir = "";
+std::atomic<uint64_t> KeyFrame::snAccessClock(0);
 
 #include <opencv2/imgcodecs.hpp>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+
+namespace {
+const char kPayloadMagic[8] = {'S', 'S', 'K', 'F', 'P', '0', '0', '1'};
+
+template <typename T> void WritePod(std::ostream &os, const T &v) {
+    os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+template <typename T> bool ReadPod(std::istream &is, T &v) {
+    return static_cast<bool>(is.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+}
+
+size_t KeyFramePayload::Bytes() const {
+    size_t bytes = sizeof(KeyFramePayload);
+    for (const auto &keys : mvKeys) bytes += keys.capacity() * sizeof(cv::KeyPoint);
+    for (const cv::Mat &desc : mDescriptors) bytes += desc.total() * desc.elemSize();
+    return bytes;
+}
 
 KeyFrame::KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB)
-    : mnFrameId(F.mnId), mTimeStamp(F.mTimeStamp), mpMap(pMap)
+    : mnFrameId(F.mnId), mTimeStamp(F.mTimeStamp), mnTrackReferenceForFrame(0), mpMap(pMap),
+      mnPayloadBytes(0), mbPayloadOnDisk(false), mnLastAccess(0)
 {
     mnId = F.mnId; // Using same ID for simplicity in blueprint
-    mTcw = F.mTcw.clone();
+    StorePose(F.mTcw, F.HasPose());
 
     // Store Images to Disk to prevent OOM
     if (!msCacheDir.empty()) {
@@ -33,50 +59,305 @@ KeyFrame::KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB)
         mK = F.mpCamera->GetK();
     }
 
-    mvpMapPoints = std::vector<MapPoint*>(F.N, nullptr);
+    // Map points tracked in the frame (same flat feature index)
+    mvpMapPoints = F.mvpMapPoints;
+    mvpMapPoints.resize(F.N, nullptr);
+    mvScaleFactors = F.mvScaleFactors;
+
+    // Features (the Frame is discarded after this, so sharing the Mats is fine)
+    if (!F.mvKeys.empty()) {
+        std::shared_ptr<KeyFramePayload> pPayload = std::make_shared<KeyFramePayload>();
+        pPayload->mvKeys = F.mvKeys;
+        pPayload->mDescriptors = F.mDescriptors;
+        mnPayloadBytes = pPayload->Bytes();
+        mpPayload = pPayload;
+    }
+    Touch();
 }
 
-KeyFrame::KeyFrame(long unsigned int id, double timeStamp, const cv::Mat &Tcw, Map* pMap)
-    : mnId(id), mnFrameId(id), mTimeStamp(timeStamp), mpMap(pMap)
+KeyFrame::KeyFrame(long unsigned int id, double timeStamp, const SE3f &Tcw, Map* pMap)
+    : mnId(id), mnFrameId(id), mTimeStamp(timeStamp), mnTrackReferenceForFrame(0), mpMap(pMap),
+      mnPayloadBytes(0), mbPayloadOnDisk(false), mnLastAccess(0)
 {
-    this->mTcw = Tcw.clone();
+    StorePose(Tcw, true);
     // No Frame reference, so no features or map points initialization from Frame
-    if (mnId >= Frame::nNextId) {
-        Frame::nNextId = mnId + 1;
+    long unsigned int nNextId = Frame::nNextId;
+    while (mnId >= nNextId && !Frame::nNextId.compare_exchange_weak(nNextId, mnId + 1)) {}
+}
+
+KeyFrame::~KeyFrame() {
+    if (mbPayloadOnDisk) std::remove(PayloadPath().c_str());
+}
+
+void KeyFrame::StorePose(const SE3f &Tcw, bool bValid) {
+    KeyFramePose pose;
+    pose.mTcw = Tcw;
+    pose.mbValid = bValid;
+    mPose.Store(pose);
+}
+
+void KeyFrame::SetPose(const SE3f &Tcw) {
+    StorePose(Tcw, true);
+    if (mpMap) mpMap->JournalKeyFramePose(this, Tcw);
+}
+
+void KeyFrame::AddConnection(KeyFrame* pKF, const int &weight) {
+    Touch();
+    std::unique_lock<std::mutex> lock(mMutexConnections);
+    mConnectedKeyFrameWeights[pKF] = weight;
+}
+
+void KeyFrame::EraseConnection(KeyFrame* pKF) {
+    std::unique_lock<std::mutex> lock(mMutexConnections);
+    mConnectedKeyFrameWeights.erase(pKF);
+}
+
+void KeyFrame::UpdateConnections() {
+    // Count map points shared with every other keyframe
+    std::map<KeyFrame*, int> counter;
+    for (MapPoint* pMP : GetMapPointMatches()) {
+        if (!pMP) continue;
+        for (const auto &obs : pMP->GetObservations()) {
+            if (obs.first != this) counter[obs.first]++;
+        }
+    }
+
+    // Edge if enough points are shared; otherwise keep at least the best one
+    const int th = 15;
+    KeyFrame* pBest = nullptr;
+    int nBest = 0;
+    std::map<KeyFrame*, int> weights;
+    for (const auto &c : counter) {
+        if (c.second > nBest) {
+            nBest = c.second;
+            pBest = c.first;
+        }
+        if (c.second >= th) weights[c.first] = c.second;
+    }
+    if (weights.empty() && pBest) weights[pBest] = nBest;
+
+    for (const auto &w : weights) w.first->AddConnection(this, w.second);
+
+    std::map<KeyFrame*, int> previous;
+    {
+        std::unique_lock<std::mutex> lock(mMutexConnections);
+        previous.swap(mConnectedKeyFrameWeights);
+        mConnectedKeyFrameWeights = weights;
+    }
+
+    // A dropped edge goes from both ends
+    for (const auto &p : previous) {
+        if (!weights.count(p.first)) p.first->EraseConnection(this);
     }
 }
 
-void KeyFrame::SetPose(const cv::Mat &Tcw) {
-    std::unique_lock<std::mutex> lock(mMutexPose);
-    mTcw = Tcw.clone();
+std::set<KeyFrame*> KeyFrame::GetConnectedKeyFrames() {
+    Touch();
+    std::set<KeyFrame*> s;
+    std::unique_lock<std::mutex> lock(mMutexConnections);
+    for (const auto &c : mConnectedKeyFrameWeights) s.insert(c.first);
+    return s;
+}
+
+std::vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N) {
+    Touch();
+    std::vector<std::pair<int, KeyFrame*>> vPairs;
+    {
+        std::unique_lock<std::mutex> lock(mMutexConnections);
+        vPairs.reserve(mConnectedKeyFrameWeights.size());
+        for (const auto &c : mConnectedKeyFrameWeights) vPairs.push_back(std::make_pair(c.second, c.first));
+    }
+
+    const size_t n = std::min(vPairs.size(), static_cast<size_t>(std::max(0, N)));
+    std::partial_sort(vPairs.begin(), vPairs.begin() + n, vPairs.end(),
+                      [](const std::pair<int, KeyFrame*> &a, const std::pair<int, KeyFrame*> &b) { return a.first > b.first; });
+
+    std::vector<KeyFrame*> vpKFs(n);
+    for (size_t i = 0; i < n; i++) vpKFs[i] = vPairs[i].second;
+    return vpKFs;
 }
 
-cv::Mat KeyFrame::GetPose() {
-    std::unique_lock<std::mutex> lock(mMutexPose);
-    return mTcw.clone();
+std::vector<MapPoint*> KeyFrame::GetMapPointMatches() {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    return mvpMapPoints;
 }
 
-cv::Mat KeyFrame::GetPoseInverse() {
-    std::unique_lock<std::mutex> lock(mMutexPose);
-    // T = [R | t]
-    // T_inv = [R^T | -R^T * t]
+void KeyFrame::EraseMapPointMatch(const size_t &idx) {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    if (idx < mvpMapPoints.size()) mvpMapPoints[idx] = nullptr;
+}
 
-    cv::Mat Rwc = mTcw.rowRange(0,3).colRange(0,3).t();
-    cv::Mat twc = -Rwc * mTcw.rowRange(0,3).col(3);
+void KeyFrame::AddMapPoint(MapPoint* pMP, const size_t &idx) {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    if (idx < mvpMapPoints.size()) mvpMapPoints[idx] = pMP;
+}
 
-    cv::Mat Twc = cv::Mat::eye(4,4, CV_32F);
-    // Copy Rwc
-    Rwc.copyTo(Twc.rowRange(0,3).colRange(0,3));
-    // Copy twc
-    twc.copyTo(Twc.rowRange(0,3).col(3));
+void KeyFrame::AddObservationsToMapPoints() {
+    std::shared_ptr<const KeyFramePayload> pPayload = GetPayload();
+    const cv::Point3f Ow = GetCameraCenter();
+    const std::vector<MapPoint*> vpMPs = GetMapPointMatches();
+
+    // Flat feature index -> (face, index in face)
+    std::vector<int> vOffsets(1, 0);
+    if (pPayload) {
+        for (const auto &keys : pPayload->mvKeys) vOffsets.push_back(vOffsets.back() + static_cast<int>(keys.size()));
+    }
 
-    return Twc;
+    for (size_t idx = 0; idx < vpMPs.size(); idx++) {
+        MapPoint* pMP = vpMPs[idx];
+        if (!pMP) continue;
+        pMP->AddObservation(this, idx);
+        if (!pPayload) continue;
+
+        const int f = static_cast<int>(std::upper_bound(vOffsets.begin(), vOffsets.end(), static_cast<int>(idx)) - vOffsets.begin()) - 1;
+        if (f < 0 || f >= static_cast<int>(pPayload->mvKeys.size())) continue;
+        const int i = static_cast<int>(idx) - vOffsets[f];
+        pMP->UpdateDepth(Ow, pPayload->mvKeys[f][i].octave, mvScaleFactors);
+
+        // First observation provides the descriptor
+        if (f < static_cast<int>(pPayload->mDescriptors.size()) && !pPayload->mDescriptors[f].empty()) {
+            uchar tmp[32];
+            if (!pMP->CopyDescriptor(tmp)) pMP->SetDescriptor(pPayload->mDescriptors[f].row(i));
+        }
+    }
 }
 
-void KeyFrame::AddConnection(KeyFrame* pKF, const int &weight) {
-    // Stub
+void KeyFrame::UnlinkFromMap() {
+    for (MapPoint* pMP : GetMapPointMatches()) {
+        if (pMP) pMP->EraseObservation(this);
+    }
+
+    std::map<KeyFrame*, int> connections;
+    {
+        std::unique_lock<std::mutex> lock(mMutexConnections);
+        connections.swap(mConnectedKeyFrameWeights);
+    }
+    for (const auto &c : connections) c.first->EraseConnection(this);
 }
 
-std::set<KeyFrame*> KeyFrame::GetConnectedKeyFrames() {
-    return mspConnectedKeyFrames;
+std::shared_ptr<const KeyFramePayload> KeyFrame::GetPayload() {
+    Touch();
+    std::unique_lock<std::mutex> lock(mMutexPayload);
+    if (!mpPayload && mbPayloadOnDisk) {
+        // Fault in. Others asking for the same keyframe wait on the lock.
+        mpPayload = ReadPayload();
+        if (!mpPayload) std::cerr << "KeyFrame: Failed to read payload " << PayloadPath() << std::endl;
+    }
+    return mpPayload;
+}
+
+size_t KeyFrame::EvictPayload() {
+    std::unique_lock<std::mutex> lock(mMutexPayload);
+    if (!mpPayload || msCacheDir.empty()) return 0;
+
+    // The payload never changes, so it is only written the first time
+    if (!mbPayloadOnDisk) {
+        if (!WritePayload(*mpPayload)) return 0;
+        mbPayloadOnDisk = true;
+    }
+
+    // Readers that already hold the payload keep it alive until they are done
+    mpPayload.reset();
+    return mnPayloadBytes;
+}
+
+bool KeyFrame::IsPayloadEvicted() {
+    std::unique_lock<std::mutex> lock(mMutexPayload);
+    return !mpPayload && mbPayloadOnDisk;
+}
+
+size_t KeyFrame::ResidentBytes() {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    size_t bytes = sizeof(KeyFrame);
+    bytes += mvpMapPoints.capacity() * sizeof(MapPoint*);
+    bytes += mK.total() * mK.elemSize();
+    for (const std::string &name : mImgFilenames) bytes += name.capacity();
+    return bytes;
+}
+
+size_t KeyFrame::PayloadBytes() {
+    std::unique_lock<std::mutex> lock(mMutexPayload);
+    return mpPayload ? mnPayloadBytes : 0;
+}
+
+std::string KeyFrame::PayloadPath() const {
+    std::stringstream ss;
+    ss << msCacheDir << "/kf_" << mnId << ".feat";
+    return ss.str();
+}
+
+bool KeyFrame::WritePayload(const KeyFramePayload &payload) {
+    const std::string path = PayloadPath();
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os) return false;
+
+    os.write(kPayloadMagic, sizeof(kPayloadMagic));
+    WritePod(os, static_cast<uint32_t>(payload.mvKeys.size()));
+    for (size_t f = 0; f < payload.mvKeys.size(); f++) {
+        const std::vector<cv::KeyPoint> &keys = payload.mvKeys[f];
+        WritePod(os, static_cast<uint32_t>(keys.size()));
+        for (const cv::KeyPoint &kp : keys) {
+            WritePod(os, kp.pt.x);
+            WritePod(os, kp.pt.y);
+            WritePod(os, kp.size);
+            WritePod(os, kp.angle);
+            WritePod(os, kp.response);
+            WritePod(os, static_cast<int32_t>(kp.octave));
+            WritePod(os, static_cast<int32_t>(kp.class_id));
+        }
+
+        const cv::Mat desc = f < payload.mDescriptors.size() ? payload.mDescriptors[f] : cv::Mat();
+        const cv::Mat cont = desc.isContinuous() ? desc : desc.clone();
+        WritePod(os, static_cast<int32_t>(cont.rows));
+        WritePod(os, static_cast<int32_t>(cont.cols));
+        WritePod(os, static_cast<int32_t>(cont.type()));
+        if (!cont.empty()) os.write(reinterpret_cast<const char*>(cont.data), cont.total() * cont.elemSize());
+    }
+
+    os.flush();
+    if (!os) {
+        os.close();
+        std::remove(path.c_str());
+        std::cerr << "KeyFrame: Failed to write payload " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const KeyFramePayload> KeyFrame::ReadPayload() {
+    std::ifstream is(PayloadPath(), std::ios::binary);
+    if (!is) return nullptr;
+
+    char magic[sizeof(kPayloadMagic)];
+    if (!is.read(magic, sizeof(magic)) || memcmp(magic, kPayloadMagic, sizeof(magic)) != 0) return nullptr;
+
+    std::shared_ptr<KeyFramePayload> pPayload = std::make_shared<KeyFramePayload>();
+    uint32_t nFaces = 0;
+    if (!ReadPod(is, nFaces)) return nullptr;
+    pPayload->mvKeys.resize(nFaces);
+    pPayload->mDescriptors.resize(nFaces);
+
+    for (uint32_t f = 0; f < nFaces; f++) {
+        uint32_t nKeys = 0;
+        if (!ReadPod(is, nKeys)) return nullptr;
+        std::vector<cv::KeyPoint> &keys = pPayload->mvKeys[f];
+        keys.resize(nKeys);
+        for (cv::KeyPoint &kp : keys) {
+            int32_t octave, classId;
+            if (!ReadPod(is, kp.pt.x) || !ReadPod(is, kp.pt.y) || !ReadPod(is, kp.size) ||
+                !ReadPod(is, kp.angle) || !ReadPod(is, kp.response) ||
+                !ReadPod(is, octave) || !ReadPod(is, classId)) return nullptr;
+            kp.octave = octave;
+            kp.class_id = classId;
+        }
+
+        int32_t rows, cols, type;
+        if (!ReadPod(is, rows) || !ReadPod(is, cols) || !ReadPod(is, type)) return nullptr;
+        if (rows > 0 && cols > 0) {
+            cv::Mat desc(rows, cols, type);
+            if (!is.read(reinterpret_cast<char*>(desc.data), desc.total() * desc.elemSize())) return nullptr;
+            pPayload->mDescriptors[f] = desc;
+        }
+    }
+    return pPayload;
 }
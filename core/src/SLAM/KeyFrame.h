@@ -3,24 +3,85 @@
 
 #include "Frame.h"
 #include "MapPoint.h"
+#include "SlotMap.h"
+#include "SeqLock.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 
 class Map;
 class KeyFrameDatabase;
 
+// Pose as stored in the seqlock: Tcw plus whether it was ever set
+struct KeyFramePose {
+    SE3f mTcw;
+    uint32_t mbValid;
+};
+
+// Features extracted for the keyframe, per cube face. The bulky part of a
+// keyframe: it can be paged out to the cache directory and read back on
+// demand. Immutable once built, so readers just hold the shared_ptr.
+struct KeyFramePayload {
+    std::vector<std::vector<cv::KeyPoint>> mvKeys;
+    std::vector<cv::Mat> mDescriptors;
+
+    size_t Bytes() const;
+};
+
 class KeyFrame {
 public:
     KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
     // Constructor for Loading
-    KeyFrame(long unsigned int id, double timeStamp, const cv::Mat &Tcw, Map* pMap);
+    KeyFrame(long unsigned int id, double timeStamp, const SE3f &Tcw, Map* pMap);
+    ~KeyFrame();
 
-    void SetPose(const cv::Mat &Tcw);
-    cv::Mat GetPose();
-    cv::Mat GetPoseInverse();
+    void SetPose(const SE3f &Tcw);
+    // Identity if the pose was never set
+    SE3f GetPose() const { return mPose.Load().mTcw; }
+    SE3f GetPoseInverse() const { return mPose.Load().mTcw.Inverse(); }
+    bool HasPose() const { return mPose.Load().mbValid != 0; }
+    // Pose and validity from a single consistent read
+    KeyFramePose GetPoseData() const { return mPose.Load(); }
+    cv::Point3f GetCameraCenter() const { return mPose.Load().mTcw.Center(); }
 
-    // Connections
+    // Covisibility graph: weight = map points seen by both keyframes.
+    // Reads count as an access for payload LRU.
     void AddConnection(KeyFrame* pKF, const int &weight);
+    void EraseConnection(KeyFrame* pKF);
+    // Recomputes this keyframe's edges from its map points' observations (both directions)
+    void UpdateConnections();
     std::set<KeyFrame*> GetConnectedKeyFrames();
+    // Up to N neighbours, highest weight first
+    std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int &N);
+
+    // Map point matches, indexed like the payload features (flat over faces)
+    std::vector<MapPoint*> GetMapPointMatches();
+    void EraseMapPointMatch(const size_t &idx);
+    // Late match for a feature (points triangulated after the keyframe was made)
+    void AddMapPoint(MapPoint* pMP, const size_t &idx);
+    // Links the matched map points back to this keyframe (observation + depth)
+    void AddObservationsToMapPoints();
+    // Removes this keyframe from its map points and neighbours before it leaves the map
+    void UnlinkFromMap();
+
+    // Features, read back from the cache directory if evicted. Null if the
+    // keyframe has none (e.g. loaded from a map file) or the read fails.
+    std::shared_ptr<const KeyFramePayload> GetPayload();
+    // Writes the payload to the cache directory (once) and drops it from memory.
+    // Returns the bytes released; 0 if nothing was resident or there is no cache dir.
+    size_t EvictPayload();
+    // Paged out and not read back since
+    bool IsPayloadEvicted();
+
+    // Memory accounting: always-resident part, and the payload while resident
+    size_t ResidentBytes();
+    size_t PayloadBytes();
+
+    // Logical time of the last covisibility or payload access
+    uint64_t GetLastAccess() const { return mnLastAccess.load(std::memory_order_relaxed); }
+    void Touch() { mnLastAccess.store(snAccessClock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
 
 public:
     long unsigned int mnId;
@@ -28,8 +89,6 @@ public:
 
     double mTimeStamp;
 
-    // Pose
-    cv::Mat mTcw;
 
     // Intrinsics (Cached for Photosphere Stitching)
     cv::Mat mK;
@@ -38,15 +97,44 @@ public:
     std::vector<std::string> mImgFilenames;
     static std::string msCacheDir;
 
-    // MapPoints
+    // Scale of each ORB pyramid level (from the frame)
+    std::vector<float> mvScaleFactors;
+
+    // MapPoints (guarded by mMutexFeatures once the keyframe is shared)
     std::vector<MapPoint*> mvpMapPoints;
 
     // Graph
-    std::set<KeyFrame*> mspConnectedKeyFrames;
+    std::map<KeyFrame*, int> mConnectedKeyFrameWeights;
+
+    // Tracking only: last frame that added this keyframe to its local map
+    long unsigned int mnTrackReferenceForFrame;
+
+    // Slot in the Map's keyframe storage (managed by Map)
+    SlotHandle mMapSlot;
 
 private:
+    void StorePose(const SE3f &Tcw, bool bValid);
+
+    std::string PayloadPath() const;
+    bool WritePayload(const KeyFramePayload &payload);
+    std::shared_ptr<const KeyFramePayload> ReadPayload();
+
     Map* mpMap;
-    std::mutex mMutexPose;
+
+    // Pose (seqlock: lock-free readers, written by BA and loop correction)
+    SeqLock<KeyFramePose> mPose;
+
+    // Payload: resident, or on disk once mbPayloadOnDisk is set
+    std::shared_ptr<const KeyFramePayload> mpPayload;
+    size_t mnPayloadBytes;
+    bool mbPayloadOnDisk;
+    std::mutex mMutexPayload;
+
+    std::mutex mMutexFeatures;
+    std::mutex mMutexConnections;
+
+    std::atomic<uint64_t> mnLastAccess;
+    static std::atomic<uint64_t> snAccessClock;
 };
 
 #endif // KEYFRAME_H
@@ -1,10 +1,36 @@
 #include "LocalMapping.h"
 #include "LoopClosing.h"
 #include "Optimizer.h"
-#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <sstream>
 
-LocalMapping::LocalMapping(System* pSys, Map* pMap)
-    : mpSystem(pSys), mpMap(pMap), mpLoopCloser(nullptr), mbFinishRequested(false), mbFinished(true)
+namespace {
+using WakeupClock = std::chrono::steady_clock;
+
+void AddLatencySample(LocalMapping::LatencyStats &stats, double ms) {
+    stats.mnSamples++;
+    stats.mfMeanMs += (ms - stats.mfMeanMs) / stats.mnSamples;
+    stats.mfMaxMs = std::max(stats.mfMaxMs, ms);
+}
+
+// Producer side of BenchmarkWakeup; same seed for both queues
+template <typename PushFn>
+void ProduceWakeupItems(int nItems, PushFn push) {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> gapUs(7000, 12000);
+    for (int i = 0; i < nItems; i++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(gapUs(rng)));
+        push(WakeupClock::now());
+    }
+}
+}
+
+LocalMapping::LocalMapping(System* pSys, Map* pMap, size_t nQueueCapacity)
+    : mQueue(nQueueCapacity), mnQueueGeneration(0), mpCurrentKeyFrame(nullptr), mpMap(pMap), mpSystem(pSys), mpLoopCloser(nullptr), mbFinished(true),
+      mbAcceptKeyFrames(true), mbAbortBA(false), mbStopRequested(false), mbStopped(false), mbNotStop(false),
+      mbProcessing(false)
 {
 }
 
@@ -13,19 +39,33 @@ void LocalMapping::SetLoopCloser(LoopClosing* pLoopCloser) {
 }
 
 void LocalMapping::Run() {
-    mbFinished = false;
+    {
+        std::unique_lock<std::mutex> lock(mMutexFinish);
+        mbFinished = false;
+    }
 
-    while(1) {
-        bool bNewKeyFrames = false;
+    // Sleeps until a keyframe arrives; returns once the queue is closed and drained
+    QueuedKeyFrame entry;
+    while (mQueue.Pop(entry)) {
+        WaitIfStopped();
 
-        {
-            std::unique_lock<std::mutex> lock(mMutexNewKFs);
-            bNewKeyFrames = !mlNewKeyFrames.empty();
+        // Queued before EmptyQueue (e.g. popped just before a map load)
+        if (entry.mnGeneration != mnQueueGeneration.load()) {
+            mpMap->RetireKeyFrame(entry.mpKF);
+            std::unique_lock<std::mutex> lock(mMutexStop);
+            mbProcessing = false;
+            continue;
         }
 
-        if (bNewKeyFrames) {
+        // Busy: the tracker holds back new keyframes until this step is done
+        SetAcceptKeyFrames(false);
+        mbAbortBA = false;
+
+        {
+            EpochReclaimer::Guard guard;
+
             // Process new KeyFrame
-            ProcessNewKeyFrame();
+            ProcessNewKeyFrame(entry);
 
             // Create MapPoints (Triangulation)
             MapPointCreation();
@@ -34,52 +74,70 @@ void LocalMapping::Run() {
             SearchInNeighbors();
 
             // Local Bundle Adjustment
-            bool bStop = false;
-            Optimizer::LocalBundleAdjustment(mlNewKeyFrames.empty() ? nullptr : mlNewKeyFrames.back(), &bStop, mpMap);
+            // Skipped when the next keyframe is already waiting or was asked for
+            if (!mbAbortBA && mQueue.Empty())
+                Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame, &mbAbortBA, mpMap);
 
             // Culling
             KeyFrameCulling();
 
-        } else {
-            // Sleep to avoid busy wait
-             usleep(3000);
+            // Readers see the result of this step
+            mpMap->PublishView();
+
+            // Page out cold keyframe features if over the memory budget
+            mpMap->EnforceMemoryBudget();
         }
 
-        // Check finish
+        // Outside our own guard: free culled/evicted entities no thread can still see
+        mpMap->ReclaimRetired();
+
         {
-            std::unique_lock<std::mutex> lock(mMutexFinish);
-            if(mbFinishRequested && mlNewKeyFrames.empty())
-                break;
+            std::unique_lock<std::mutex> lock(mMutexStop);
+            mbProcessing = false;
         }
+        mCondStop.notify_all();
+        SetAcceptKeyFrames(true);
     }
 
+    std::unique_lock<std::mutex> lock(mMutexFinish);
     mbFinished = true;
 }
 
-void LocalMapping::InsertKeyFrame(KeyFrame* pKF) {
-    std::unique_lock<std::mutex> lock(mMutexNewKFs);
-    mlNewKeyFrames.push_back(pKF);
+bool LocalMapping::InsertKeyFrame(KeyFrame* pKF) {
+    return mQueue.TryPush(QueuedKeyFrame{pKF, std::chrono::steady_clock::now(), mnQueueGeneration.load()});
 }
 
-void LocalMapping::ProcessNewKeyFrame() {
+bool LocalMapping::InsertKeyFrames(const std::vector<KeyFrame*> &vpKFs) {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t nGeneration = mnQueueGeneration.load();
+    std::vector<QueuedKeyFrame> vEntries;
+    vEntries.reserve(vpKFs.size());
+    for (KeyFrame* pKF : vpKFs) vEntries.push_back(QueuedKeyFrame{pKF, now, nGeneration});
+    return mQueue.TryPushAll(std::move(vEntries));
+}
+
+void LocalMapping::ProcessNewKeyFrame(const QueuedKeyFrame &entry) {
     // 1. Get KF from queue
-    KeyFrame* pKF;
-    {
-        std::unique_lock<std::mutex> lock(mMutexNewKFs);
-        pKF = mlNewKeyFrames.front();
-        mlNewKeyFrames.pop_front();
-    }
+    mpCurrentKeyFrame = entry.mpKF;
 
     // 2. Compute BoW (if used)
 
     // 3. Insert into Map
-    mpMap->AddKeyFrame(pKF);
+    mpMap->AddKeyFrame(mpCurrentKeyFrame);
+
+    {
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry.mTimeQueued).count();
+        std::unique_lock<std::mutex> lock(mMutexLatency);
+        AddLatencySample(mLatency, ms);
+    }
 
     // 4. Update Connections
+    mpCurrentKeyFrame->AddObservationsToMapPoints();
+    mpCurrentKeyFrame->UpdateConnections();
 
     // 5. Send to LoopClosing
     if (mpLoopCloser) {
-        mpLoopCloser->InsertKeyFrame(pKF);
+        mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
     }
 }
 
@@ -101,12 +159,144 @@ void LocalMapping::KeyFrameCulling() {
     // }
 }
 
+void LocalMapping::EmptyQueue() {
+    mnQueueGeneration++;
+    // Not in the map yet, but Tracking may still reference them
+    for (const QueuedKeyFrame &entry : mQueue.Drain()) mpMap->RetireKeyFrame(entry.mpKF);
+}
+
+bool LocalMapping::AcceptKeyFrames() {
+    std::unique_lock<std::mutex> lock(mMutexAccept);
+    return mbAcceptKeyFrames;
+}
+
+void LocalMapping::SetAcceptKeyFrames(bool flag) {
+    std::unique_lock<std::mutex> lock(mMutexAccept);
+    mbAcceptKeyFrames = flag;
+}
+
+void LocalMapping::InterruptBA() {
+    mbAbortBA = true;
+}
+
+void LocalMapping::RequestStop() {
+    {
+        std::unique_lock<std::mutex> lock(mMutexStop);
+        mbStopRequested = true;
+    }
+    InterruptBA();
+}
+
+bool LocalMapping::isStopped() {
+    std::unique_lock<std::mutex> lock(mMutexStop);
+    // Blocked on an empty queue counts as stopped: the next pop waits in WaitIfStopped
+    return mbStopped || (mbStopRequested && !mbProcessing);
+}
+
+bool LocalMapping::stopRequested() {
+    std::unique_lock<std::mutex> lock(mMutexStop);
+    return mbStopRequested;
+}
+
+void LocalMapping::Release() {
+    {
+        std::unique_lock<std::mutex> lock(mMutexStop);
+        mbStopRequested = false;
+    }
+    mCondStop.notify_all();
+}
+
+bool LocalMapping::SetNotStop(bool flag) {
+    std::unique_lock<std::mutex> lock(mMutexStop);
+    if (flag && mbStopped) return false;
+    mbNotStop = flag;
+    return true;
+}
+
+void LocalMapping::WaitIfStopped() {
+    std::unique_lock<std::mutex> lock(mMutexStop);
+    if (mbStopRequested && !mbNotStop) {
+        mbStopped = true;
+        mCondStop.notify_all();
+        mCondStop.wait(lock, [this] { return !mbStopRequested || mQueue.IsClosed(); });
+        mbStopped = false;
+    }
+    mbProcessing = true;
+}
+
 void LocalMapping::RequestFinish() {
-    std::unique_lock<std::mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    mQueue.Close();
+    // Wake Run if it is parked on a stop request
+    std::unique_lock<std::mutex> lock(mMutexStop);
+    mCondStop.notify_all();
 }
 
 bool LocalMapping::isFinished() {
     std::unique_lock<std::mutex> lock(mMutexFinish);
     return mbFinished;
 }
+
+LocalMapping::LatencyStats LocalMapping::GetInsertionLatency() {
+    std::unique_lock<std::mutex> lock(mMutexLatency);
+    return mLatency;
+}
+
+LocalMapping::WakeupBenchmarkResult LocalMapping::BenchmarkWakeup(int nKeyFrames) {
+    WakeupBenchmarkResult result;
+    nKeyFrames = std::max(nKeyFrames, 1);
+
+    // Before: the consumer checks a locked list and sleeps 3 ms when it is empty
+    {
+        std::mutex mutex;
+        std::deque<WakeupClock::time_point> items;
+        std::thread consumer([&] {
+            for (int nPopped = 0; nPopped < nKeyFrames;) {
+                WakeupClock::time_point queued;
+                bool bPopped = false;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (!items.empty()) {
+                        queued = items.front();
+                        items.pop_front();
+                        bPopped = true;
+                    }
+                }
+                if (!bPopped) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(3000));
+                    continue;
+                }
+                AddLatencySample(result.mPolling, std::chrono::duration<double, std::milli>(WakeupClock::now() - queued).count());
+                nPopped++;
+            }
+        });
+        ProduceWakeupItems(nKeyFrames, [&](WakeupClock::time_point t) {
+            std::unique_lock<std::mutex> lock(mutex);
+            items.push_back(t);
+        });
+        consumer.join();
+    }
+
+    // After: the consumer sleeps in BlockingQueue::Pop
+    {
+        BlockingQueue<WakeupClock::time_point> queue;
+        std::thread consumer([&] {
+            WakeupClock::time_point queued;
+            while (queue.Pop(queued)) {
+                AddLatencySample(result.mBlocking, std::chrono::duration<double, std::milli>(WakeupClock::now() - queued).count());
+            }
+        });
+        ProduceWakeupItems(nKeyFrames, [&](WakeupClock::time_point t) { queue.Push(t); });
+        queue.Close();
+        consumer.join();
+    }
+
+    return result;
+}
+
+std::string LocalMapping::ToString(const WakeupBenchmarkResult &result) {
+    std::stringstream ss;
+    ss << "Keyframe queue wake-up (" << result.mBlocking.mnSamples << " items): polling "
+       << result.mPolling.mfMeanMs << " ms avg, " << result.mPolling.mfMaxMs << " ms max"
+       << " | BlockingQueue " << result.mBlocking.mfMeanMs << " ms avg, " << result.mBlocking.mfMaxMs << " ms max";
+    return ss.str();
+}
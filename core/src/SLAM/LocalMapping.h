@@ -3,16 +3,36 @@
 
 #include "KeyFrame.h"
 #include "Map.h"
-#include <list>
+#include "BlockingQueue.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 class System;
 class LoopClosing;
 
 class LocalMapping {
 public:
-    LocalMapping(System* pSys, Map* pMap);
+    // Time from InsertKeyFrame until the keyframe is in the map
+    struct LatencyStats {
+        size_t mnSamples = 0;
+        double mfMeanMs = 0.0;
+        double mfMaxMs = 0.0;
+    };
+
+    // Push-to-pop latency of a keyframe queue, with the usleep(3000)
+    // polling loop mapping used before BlockingQueue as the baseline
+    struct WakeupBenchmarkResult {
+        LatencyStats mPolling;
+        LatencyStats mBlocking;
+    };
+
+    // nQueueCapacity = 0: the keyframe queue is unbounded
+    LocalMapping(System* pSys, Map* pMap, size_t nQueueCapacity = 0);
 
     // Set Loop Closer
     void SetLoopCloser(LoopClosing* pLoopCloser);
@@ -21,32 +41,82 @@ public:
     void Run();
 
     // Interface
-    void InsertKeyFrame(KeyFrame* pKF);
+    // False if the queue is full or shut down; the keyframe stays with the caller
+    bool InsertKeyFrame(KeyFrame* pKF);
+    // Queues all of vpKFs in order, or none of them
+    bool InsertKeyFrames(const std::vector<KeyFrame*> &vpKFs);
+    // Drops queued keyframes before the map (which owns them) is cleared
+    void EmptyQueue();
+    size_t KeyFramesInQueue() { return mQueue.Size(); }
+    size_t QueueCapacity() { return mQueue.Capacity(); }
+    // Lets Run finish the queued keyframes and return
     void RequestFinish();
     bool isFinished();
 
-    // Thread management
+    LatencyStats GetInsertionLatency();
+
+    // Feeds nKeyFrames items 7-12 ms apart (seeded) through each kind of
+    // queue on a consumer thread. Blocks for about 2 * nKeyFrames * 10 ms.
+    static WakeupBenchmarkResult BenchmarkWakeup(int nKeyFrames = 200);
+    static std::string ToString(const WakeupBenchmarkResult &result);
+
+    // Keyframe admission. Mapping refuses keyframes while it is inside a step;
+    // the tracker checks AcceptKeyFrames before creating one.
+    bool AcceptKeyFrames();
     void SetAcceptKeyFrames(bool flag);
+    // Makes the running local BA return early so a queued keyframe is taken sooner
+    void InterruptBA();
+
+    // Thread management: pause mapping between steps (e.g. while the map is replaced)
+    void RequestStop();
+    bool isStopped();
+    bool stopRequested();
+    void Release();
+    // While set, stop requests are not honoured. False if already stopped.
     bool SetNotStop(bool flag);
 
 protected:
-    void ProcessNewKeyFrame();
+    struct QueuedKeyFrame {
+        KeyFrame* mpKF;
+        std::chrono::steady_clock::time_point mTimeQueued;
+        // EmptyQueue bumps the generation; older entries are stale
+        uint64_t mnGeneration;
+    };
+
+    // Blocks while a stop is requested
+    void WaitIfStopped();
+
+    void ProcessNewKeyFrame(const QueuedKeyFrame &entry);
     void MapPointCreation();
     void SearchInNeighbors();
     void KeyFrameCulling(); // New: Culling
 
-    bool CheckNewKeyFrames();
-
-    std::list<KeyFrame*> mlNewKeyFrames;
+    BlockingQueue<QueuedKeyFrame> mQueue;
+    std::atomic<uint64_t> mnQueueGeneration;
+    KeyFrame* mpCurrentKeyFrame;
 
     Map* mpMap;
     System* mpSystem;
     LoopClosing* mpLoopCloser;
 
-    bool mbFinishRequested;
     bool mbFinished;
-    std::mutex mMutexNewKFs;
     std::mutex mMutexFinish;
+
+    bool mbAcceptKeyFrames;
+    std::mutex mMutexAccept;
+
+    // Stop flag for local BA, set from the tracking thread
+    std::atomic<bool> mbAbortBA;
+
+    bool mbStopRequested;
+    bool mbStopped;
+    bool mbNotStop;
+    bool mbProcessing;
+    std::mutex mMutexStop;
+    std::condition_variable mCondStop;
+
+    LatencyStats mLatency;
+    std::mutex mMutexLatency;
 };
 
 #endif // LOCALMAPPING_H
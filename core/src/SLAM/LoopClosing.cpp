@@ -1,61 +1,62 @@
 #include "LoopClosing.h"
 #include "Optimizer.h"
-#include <unistd.h>
+#include "ORBmatcher.h"
+#include "BearingSolvers.h"
+#include "Ransac.h"
 #include <cmath>
+#include <iostream>
+
+namespace {
+// Descriptor matches to attempt the similarity, and inliers to accept it
+const int kMinSim3Matches = 20;
+const int kMinSim3Inliers = 20;
+// Squared angle summed over both views: about 0.6 degrees in each
+const float kSim3MaxError = 2.0f * 0.01f * 0.01f;
+}
 
-LoopClosing::LoopClosing(System* pSys, Map* pMap, KeyFrameDatabase* pDB, bool bFixScale)
-    : mpSystem(pSys), mpMap(pMap), mpKeyFrameDatabase(pDB), mbFinishRequested(false), mbFinished(true)
+LoopClosing::LoopClosing(System* pSys, Map* pMap, KeyFrameDatabase* pDB, bool bFixScale, size_t nQueueCapacity)
+    : mpSystem(pSys), mpMap(pMap), mpKeyFrameDatabase(pDB), mQueue(nQueueCapacity),
+      mpCurrentKF(nullptr), mpMatchedKF(nullptr), mbFixScale(bFixScale), mbFinished(true)
 {
 }
 
 void LoopClosing::Run() {
-    mbFinished = false;
-
-    while(1) {
-        bool bNewKeyFrames = false;
-
-        {
-            std::unique_lock<std::mutex> lock(mMutexLoopQueue);
-            bNewKeyFrames = !mlpLoopKeyFrameQueue.empty();
-        }
-
-        if (bNewKeyFrames) {
-            // Process Loop
-            if (DetectLoop()) {
-                if (ComputeSim3()) {
-                    CorrectLoop();
-                }
-            }
+    {
+        std::unique_lock<std::mutex> lock(mMutexFinish);
+        mbFinished = false;
+    }
 
-            // Pop queue
-            {
-                 std::unique_lock<std::mutex> lock(mMutexLoopQueue);
-                 if(!mlpLoopKeyFrameQueue.empty())
-                    mlpLoopKeyFrameQueue.pop_front();
+    // Sleeps until a keyframe arrives; returns once the queue is closed and drained
+    std::pair<KeyFrame*, SlotHandle> entry;
+    while (mQueue.Pop(entry)) {
+        EpochReclaimer::Guard guard;
+        mpCurrentKF = entry.first;
+        mCurrentSlot = entry.second;
+
+        // Process Loop
+        if (DetectLoop()) {
+            if (ComputeSim3()) {
+                CorrectLoop();
             }
-        } else {
-            usleep(5000);
-        }
-
-        // Check finish
-        {
-            std::unique_lock<std::mutex> lock(mMutexFinish);
-            if(mbFinishRequested && mlpLoopKeyFrameQueue.empty())
-                break;
         }
+        mpCurrentKF = nullptr;
+        mpMatchedKF = nullptr;
     }
 
+    std::unique_lock<std::mutex> lock(mMutexFinish);
     mbFinished = true;
 }
 
-void LoopClosing::InsertKeyFrame(KeyFrame* pKF) {
-    std::unique_lock<std::mutex> lock(mMutexLoopQueue);
-    mlpLoopKeyFrameQueue.push_back(pKF);
+bool LoopClosing::InsertKeyFrame(KeyFrame* pKF) {
+    return mQueue.TryPush(std::make_pair(pKF, pKF->mMapSlot));
+}
+
+void LoopClosing::EmptyQueue() {
+    mQueue.Drain();
 }
 
 void LoopClosing::RequestFinish() {
-    std::unique_lock<std::mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    mQueue.Close();
 }
 
 bool LoopClosing::isFinished() {
@@ -65,66 +66,82 @@ bool LoopClosing::isFinished() {
 
 bool LoopClosing::DetectLoop() {
     // 1. Get Current KeyFrame
-    KeyFrame* pCurrentKF = nullptr;
-    {
-        std::unique_lock<std::mutex> lock(mMutexLoopQueue);
-        if(!mlpLoopKeyFrameQueue.empty())
-            pCurrentKF = mlpLoopKeyFrameQueue.front();
-    }
+    KeyFrame* pCurrentKF = mpCurrentKF;
+
+    // Removed from the map while queued
+    if(!pCurrentKF || !mpMap->ContainsKeyFrame(pCurrentKF, mCurrentSlot)) return false;
 
     if(!pCurrentKF || pCurrentKF->mnId < 10) return false;
 
     // 2. Geometric Loop Detection (Fallback for missing DBoW2)
-    // Find KeyFrames that are close in distance but far in ID/Time
-    std::vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    // Find KeyFrames that are close in distance but far in ID/Time.
+    // Works on the published view, so no map or pose locks are taken per keyframe.
+    std::shared_ptr<const MapView> pView = mpMap->GetView();
 
-    cv::Mat Twc = pCurrentKF->GetPoseInverse();
-    cv::Mat Ow = Twc.rowRange(0,3).col(3); // Camera Center
-    float cx = Ow.at<float>(0);
-    float cy = Ow.at<float>(1);
-    float cz = Ow.at<float>(2);
+    const KeyFramePose currentPose = pCurrentKF->GetPoseData();
+    if (!currentPose.mbValid) return false;
+    const cv::Point3f Ow = currentPose.mTcw.Center(); // Camera Center
 
     float minDistance = 2.0f; // 2 meters detection radius
     KeyFrame* pLoopCandidate = nullptr;
+    SlotHandle candidateSlot;
+    std::set<KeyFrame*> connected = pCurrentKF->GetConnectedKeyFrames();
 
-    for(KeyFrame* pKF : vpKFs) {
-        if(pKF == pCurrentKF) continue;
-        if(pKF->mnId > pCurrentKF->mnId - 10) continue; // Skip recent frames
+    for(const MapView::KeyFrameView &kf : pView->mvKeyFrames) {
+        if(kf.mpKF == pCurrentKF) continue;
+        if(kf.mnId + 10 > pCurrentKF->mnId) continue; // Skip recent frames
 
         // Calculate distance
-        cv::Mat Twc2 = pKF->GetPoseInverse();
-        cv::Mat Ow2 = Twc2.rowRange(0,3).col(3);
-        float dx = Ow2.at<float>(0) - cx;
-        float dy = Ow2.at<float>(1) - cy;
-        float dz = Ow2.at<float>(2) - cz;
-        float dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+        float dist = cv::norm(kf.mOw - Ow);
 
         if(dist < minDistance) {
             // Found a loop candidate!
             // Check connectivity
-            std::set<KeyFrame*> connected = pCurrentKF->GetConnectedKeyFrames();
-            if(connected.find(pKF) == connected.end()) {
-                pLoopCandidate = pKF;
+            if(connected.find(kf.mpKF) == connected.end()) {
+                pLoopCandidate = kf.mpKF;
+                candidateSlot = kf.mSlot;
                 break; // Found one
             }
         }
     }
 
-    // In a real system, we would store candidates. Here we just return true if any found.
-    // Ideally LoopClosing stores 'mpCurrentMatchedKF'.
-    // Since this is a simplified implementation, we just log detection.
-
-    if (pLoopCandidate) {
-        // std::cout << "Loop detected between KF " << pCurrentKF->mnId << " and " << pLoopCandidate->mnId << std::endl;
-        return true;
-    }
-
-    return false;
+    mpMatchedKF = pLoopCandidate;
+    mMatchedSlot = candidateSlot;
+    return pLoopCandidate != nullptr;
 }
 
 bool LoopClosing::ComputeSim3() {
-    // Stub: Sim3 optimization requires g2o.
-    // We assume geometric check is sufficient for this stage.
+    // The candidate may have left the map since the view was published
+    if (!mpMap->ContainsKeyFrame(mpMatchedKF, mMatchedSlot)) return false;
+    if (!mpMatchedKF->HasPose()) return false;
+
+    ORBmatcher matcher(0.75f, false);
+    std::vector<MapPoint*> vpMatches12;
+    if (matcher.SearchByDescriptor(mpCurrentKF, mpMatchedKF, vpMatches12) < kMinSim3Matches) return false;
+
+    // Matched map points in each keyframe's camera frame
+    const SE3f Tcw1 = mpCurrentKF->GetPose();
+    const SE3f Tcw2 = mpMatchedKF->GetPose();
+    const std::vector<MapPoint*> vpMPs1 = mpCurrentKF->GetMapPointMatches();
+    Sim3Problem problem;
+    problem.mbFixScale = mbFixScale;
+    for (size_t i = 0; i < vpMatches12.size() && i < vpMPs1.size(); i++) {
+        if (!vpMatches12[i] || !vpMPs1[i]) continue;
+        problem.mvP1.push_back(Tcw1 * vpMPs1[i]->GetWorldPos());
+        problem.mvP2.push_back(Tcw2 * vpMatches12[i]->GetWorldPos());
+    }
+
+    RansacParams params;
+    params.mfThreshold = kSim3MaxError;
+    params.mnMaxIterations = 300;
+    params.mnMinInliers = kMinSim3Inliers;
+    Ransac<Sim3Problem> ransac(problem, params);
+    RansacResult<Sim3f> result;
+    if (!ransac.Run(result)) return false;
+
+    mS12 = result.mModel;
+    std::cout << "LoopClosing: Loop between KF " << mpCurrentKF->mnId << " and " << mpMatchedKF->mnId
+              << " verified with " << result.mnInliers << " inliers (scale " << mS12.s << ")" << std::endl;
     return true;
 }
 
@@ -132,4 +149,5 @@ void LoopClosing::CorrectLoop() {
     // Trigger Global BA to fix the loop
     bool bStop = false;
     Optimizer::GlobalBundleAdjustment(mpMap, 20, &bStop, 0, false);
+    mpMap->PublishView();
 }
@@ -5,7 +5,8 @@
 #include "KeyFrameDatabase.h"
 #include "Map.h"
 #include "LocalMapping.h"
-#include <list>
+#include "BlockingQueue.h"
+#include "SE3.h"
 #include <mutex>
 #include <thread>
 
@@ -13,11 +14,16 @@ class System;
 
 class LoopClosing {
 public:
-    LoopClosing(System* pSys, Map* pMap, KeyFrameDatabase* pDB, bool bFixScale = false);
+    // nQueueCapacity = 0: the keyframe queue is unbounded
+    LoopClosing(System* pSys, Map* pMap, KeyFrameDatabase* pDB, bool bFixScale = false, size_t nQueueCapacity = 0);
 
     void Run();
 
-    void InsertKeyFrame(KeyFrame* pKF);
+    // False if the queue is full or shut down (loop detection skips the keyframe)
+    bool InsertKeyFrame(KeyFrame* pKF);
+    // Drops queued keyframes before the map (which owns them) is cleared
+    void EmptyQueue();
+    // Lets Run finish the queued keyframes and return
     void RequestFinish();
     bool isFinished();
 
@@ -32,12 +38,24 @@ protected:
     KeyFrameDatabase* mpKeyFrameDatabase;
     LocalMapping* mpLocalMapper;
 
-    std::list<KeyFrame*> mlpLoopKeyFrameQueue;
+    // Keyframes are queued with their map slot: they may be culled or evicted
+    // while waiting, and the handle tells without touching the object
+    BlockingQueue<std::pair<KeyFrame*, SlotHandle>> mQueue;
 
-    std::mutex mMutexLoopQueue;
-    std::mutex mMutexFinish;
+    // Keyframe being processed by Run
+    KeyFrame* mpCurrentKF;
+    SlotHandle mCurrentSlot;
+
+    // Loop candidate from DetectLoop. Taken from the published view, so it is
+    // only dereferenced after ComputeSim3 finds it in the map.
+    KeyFrame* mpMatchedKF;
+    SlotHandle mMatchedSlot;
+    // Similarity with P(current) = mS12 * P(matched), in camera coordinates
+    Sim3f mS12;
+    // Monocular scale drifts; fixed for metric input
+    bool mbFixScale;
 
-    bool mbFinishRequested;
+    std::mutex mMutexFinish;
     bool mbFinished;
 };
 
@@ -1,28 +1,250 @@
 #include "Map.h"
+#include "MapTileManager.h"
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
 
-Map::Map() {
+namespace {
+
+const size_t kMinJournalCompactionBytes = 1 << 20;
+
+// Snapshot/journal records keep the full 4x4 row-major matrix
+void PoseToArray(const SE3f &Tcw, float *out) {
+    Tcw.ToRowMajor34(out);
+    out[12] = 0.0f; out[13] = 0.0f; out[14] = 0.0f; out[15] = 1.0f;
+}
+
+size_t FileSize(const std::string &filename) {
+    std::ifstream f(filename, std::ios::binary | std::ios::ate);
+    return f.is_open() ? static_cast<size_t>(f.tellg()) : 0;
+}
+
+} // namespace
+
+Map::Map() : mpView(std::make_shared<MapView>()), mnViewVersion(0), mnMemoryBudget(0), mnJournalBaseBytes(0), mbJournalEnabled(false) {
+}
+
+Map::~Map() {
+    // Threads are stopped by now; flush what is still waiting on readers
+    EpochReclaimer::Get().ReclaimAll(this);
+}
+
+KeyFrame* Map::NewKeyFrame(Frame &F, KeyFrameDatabase* pKFDB) {
+    return mKeyFramePool.Construct(F, this, pKFDB);
+}
+
+KeyFrame* Map::NewKeyFrame(long unsigned int id, double timeStamp, const SE3f &Tcw) {
+    return mKeyFramePool.Construct(id, timeStamp, Tcw, this);
+}
+
+MapPoint* Map::NewMapPoint(const cv::Point3f &Pos, KeyFrame* pRefKF) {
+    return mMapPointPool.Construct(Pos, pRefKF, this);
+}
+
+MapPoint* Map::NewMapPoint(long unsigned int id, const cv::Point3f &Pos) {
+    return mMapPointPool.Construct(id, Pos, this);
+}
+
+void Map::DestroyKeyFrame(KeyFrame* pKF) {
+    mKeyFramePool.Destroy(pKF);
+}
+
+void Map::DestroyMapPoint(MapPoint* pMP) {
+    mMapPointPool.Destroy(pMP);
 }
 
 void Map::AddKeyFrame(KeyFrame* pKF) {
     std::unique_lock<std::mutex> lock(mMutexMap);
-    mspKeyFrames.insert(pKF);
+    KeyFrame** ppKF = mKeyFrames.Get(pKF->mMapSlot);
+    if (ppKF && *ppKF == pKF) return;
+    pKF->mMapSlot = mKeyFrames.Insert(pKF);
+
+    if (mbJournalEnabled) {
+        const KeyFramePose Tcw = pKF->GetPoseData();
+        if (Tcw.mbValid) {
+            float pose[16];
+            PoseToArray(Tcw.mTcw, pose);
+            mJournal.AppendKeyFrame(pKF->mnId, pKF->mTimeStamp, pose);
+        }
+    }
 }
 
 void Map::AddMapPoint(MapPoint* pMP) {
     std::unique_lock<std::mutex> lock(mMutexMap);
-    mspMapPoints.insert(pMP);
+    MapPoint** ppMP = mMapPoints.Get(pMP->mMapSlot);
+    if (ppMP && *ppMP == pMP) return;
+    pMP->mMapSlot = mMapPoints.Insert(pMP);
+
+    if (mbJournalEnabled) {
+        cv::Point3f p = pMP->GetWorldPos();
+        float pos[3] = {p.x, p.y, p.z};
+        mJournal.AppendMapPoint(pMP->mnId, pos);
+    }
+}
+
+void Map::EraseKeyFrame(KeyFrame* pKF) {
+    std::unique_lock<std::mutex> lock(mMutexMap);
+    KeyFrame** ppKF = mKeyFrames.Get(pKF->mMapSlot);
+    if (!ppKF || *ppKF != pKF) return;
+    mKeyFrames.Erase(pKF->mMapSlot);
+    pKF->mMapSlot = SlotHandle();
+
+    if (mbJournalEnabled) {
+        mJournal.AppendEraseKeyFrame(pKF->mnId);
+    }
+}
+
+void Map::EraseMapPoint(MapPoint* pMP) {
+    std::unique_lock<std::mutex> lock(mMutexMap);
+    MapPoint** ppMP = mMapPoints.Get(pMP->mMapSlot);
+    if (!ppMP || *ppMP != pMP) return;
+    mMapPoints.Erase(pMP->mMapSlot);
+    pMP->mMapSlot = SlotHandle();
+
+    if (mbJournalEnabled) {
+        mJournal.AppendEraseMapPoint(pMP->mnId);
+    }
+}
+
+void Map::RetireKeyFrame(KeyFrame* pKF) {
+    if (!pKF) return;
+    pKF->UnlinkFromMap();
+    EraseKeyFrame(pKF);
+    EpochReclaimer::Get().Retire(this, [this, pKF] { DestroyKeyFrame(pKF); });
+}
+
+void Map::RetireMapPoint(MapPoint* pMP) {
+    if (!pMP) return;
+    UnlinkMapPoint(pMP);
+    EraseMapPoint(pMP);
+    EpochReclaimer::Get().Retire(this, [this, pMP] { DestroyMapPoint(pMP); });
+}
+
+bool Map::ContainsKeyFrame(KeyFrame* pKF, const SlotHandle &slot) {
+    std::unique_lock<std::mutex> lock(mMutexMap);
+    KeyFrame** ppKF = mKeyFrames.Get(slot);
+    return ppKF && *ppKF == pKF;
+}
+
+void Map::ValidateMapPoints(std::vector<MapPoint*> &vpMPs, const std::vector<SlotHandle> &vSlots) {
+    std::unique_lock<std::mutex> lock(mMutexMap);
+    for (size_t i = 0; i < vpMPs.size(); i++) {
+        if (!vpMPs[i]) continue;
+        MapPoint** ppMP = i < vSlots.size() ? mMapPoints.Get(vSlots[i]) : nullptr;
+        if (!ppMP || *ppMP != vpMPs[i]) vpMPs[i] = nullptr;
+    }
+}
+
+void Map::Retire(const std::vector<KeyFrame*> &vpKFs, const std::vector<MapPoint*> &vpMPs) {
+    if (vpKFs.empty() && vpMPs.empty()) return;
+    // Survivors must not keep graph edges or matches into the retired set
+    for (KeyFrame* pKF : vpKFs) pKF->UnlinkFromMap();
+    for (MapPoint* pMP : vpMPs) UnlinkMapPoint(pMP);
+    for (KeyFrame* pKF : vpKFs) EraseKeyFrame(pKF);
+    for (MapPoint* pMP : vpMPs) EraseMapPoint(pMP);
+    EpochReclaimer::Get().Retire(this, [this, vpKFs, vpMPs] {
+        mKeyFramePool.Destroy(vpKFs);
+        mMapPointPool.Destroy(vpMPs);
+    });
+}
+
+void Map::UnlinkMapPoint(MapPoint* pMP) {
+    for (const auto &obs : pMP->GetObservations()) obs.first->EraseMapPointMatch(obs.second);
+}
+
+void Map::ReclaimRetired() {
+    EpochReclaimer::Get().TryReclaim();
+}
+
+MapMemoryUsage Map::GetMemoryUsage() {
+    std::unique_lock<std::mutex> lock(mMutexMemoryUsage);
+    return mLastMemoryUsage;
+}
+
+size_t Map::EnforceMemoryBudget() {
+    struct Candidate {
+        uint64_t mnLastAccess;
+        KeyFrame* mpKF;
+    };
+    std::vector<Candidate> vCandidates;
+    MapMemoryUsage usage;
+    {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        for (KeyFrame* pKF : mKeyFrames) {
+            usage.mnKeyFrameBytes += pKF->ResidentBytes();
+            const size_t payload = pKF->PayloadBytes();
+            usage.mnPayloadBytes += payload;
+            if (payload > 0) {
+                usage.mnResidentPayloads++;
+                vCandidates.push_back(Candidate{pKF->GetLastAccess(), pKF});
+            } else if (pKF->IsPayloadEvicted()) {
+                usage.mnEvictedPayloads++;
+            }
+        }
+        for (MapPoint* pMP : mMapPoints) usage.mnMapPointBytes += pMP->MemoryBytes();
+    }
+
+    const size_t budget = mnMemoryBudget;
+    const size_t total = usage.Total();
+    if (budget == 0 || total <= budget) {
+        std::unique_lock<std::mutex> lock(mMutexMemoryUsage);
+        mLastMemoryUsage = usage;
+        return 0;
+    }
+
+    // Coldest first. Disk writes happen outside the map lock; the guard held by
+    // the caller keeps the keyframes alive if they are culled meanwhile.
+    std::sort(vCandidates.begin(), vCandidates.end(),
+              [](const Candidate &a, const Candidate &b) { return a.mnLastAccess < b.mnLastAccess; });
+
+    size_t released = 0;
+    for (const Candidate &c : vCandidates) {
+        if (total - released <= budget) break;
+        const size_t bytes = c.mpKF->EvictPayload();
+        if (bytes == 0) continue;
+        released += bytes;
+        usage.mnResidentPayloads--;
+        usage.mnEvictedPayloads++;
+    }
+    usage.mnPayloadBytes -= released;
+    {
+        std::unique_lock<std::mutex> lock(mMutexMemoryUsage);
+        mLastMemoryUsage = usage;
+    }
+
+    if (released > 0 && total - released > budget) {
+        std::cerr << "Map: Over memory budget by " << (total - released - budget)
+                  << " bytes after evicting all keyframe payloads" << std::endl;
+    }
+    return released;
+}
+
+void Map::JournalKeyFramePose(KeyFrame* pKF, const SE3f &Tcw) {
+    if (!mbJournalEnabled) return;
+    float pose[16];
+    PoseToArray(Tcw, pose);
+    mJournal.AppendKeyFramePose(pKF->mnId, pose);
+}
+
+void Map::JournalMapPointPos(MapPoint* pMP, const cv::Point3f &p) {
+    if (!mbJournalEnabled) return;
+    float pos[3] = {p.x, p.y, p.z};
+    mJournal.AppendMapPointPos(pMP->mnId, pos);
 }
 
 std::vector<KeyFrame*> Map::GetAllKeyFrames() {
     std::unique_lock<std::mutex> lock(mMutexMap);
-    return std::vector<KeyFrame*>(mspKeyFrames.begin(), mspKeyFrames.end());
+    return mKeyFrames.Values();
 }
 
 std::vector<MapPoint*> Map::GetAllMapPoints() {
     std::unique_lock<std::mutex> lock(mMutexMap);
-    return std::vector<MapPoint*>(mspMapPoints.begin(), mspMapPoints.end());
+    return mMapPoints.Values();
 }
 
 void Map::SetReferenceMapPoints(const std::vector<MapPoint*> &vpMPs) {
@@ -30,42 +252,178 @@ void Map::SetReferenceMapPoints(const std::vector<MapPoint*> &vpMPs) {
     mvpReferenceMapPoints = vpMPs;
 }
 
-void Map::Serialize(const std::string& filename) {
+std::shared_ptr<const MapView> Map::GetView() const {
+    return std::atomic_load(&mpView);
+}
+
+void Map::PublishView() {
+    std::shared_ptr<MapView> pView = std::make_shared<MapView>();
+    {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        pView->mnVersion = ++mnViewVersion;
+
+        pView->mvKeyFrames.reserve(mKeyFrames.Size());
+        for (KeyFrame* pKF : mKeyFrames) {
+            const KeyFramePose Tcw = pKF->GetPoseData();
+            if (!Tcw.mbValid) continue;
+
+            MapView::KeyFrameView kf;
+            kf.mpKF = pKF;
+            kf.mSlot = pKF->mMapSlot;
+            kf.mnId = pKF->mnId;
+            kf.mTimeStamp = pKF->mTimeStamp;
+            kf.mTcw = Tcw.mTcw;
+            kf.mOw = Tcw.mTcw.Center();
+            pView->mvKeyFrames.push_back(kf);
+        }
+
+        pView->mvMapPointIds.reserve(mMapPoints.Size());
+        pView->mvMapPointPositions.reserve(mMapPoints.Size() * 3);
+        for (MapPoint* pMP : mMapPoints) {
+            cv::Point3f p = pMP->GetWorldPos();
+            pView->mvMapPointIds.push_back(pMP->mnId);
+            pView->mvMapPointPositions.push_back(p.x);
+            pView->mvMapPointPositions.push_back(p.y);
+            pView->mvMapPointPositions.push_back(p.z);
+        }
+
+        // Swap under the map lock so versions are published in order
+        std::atomic_store(&mpView, std::shared_ptr<const MapView>(pView));
+    }
+}
+
+void Map::TakeSnapshot(MapSnapshot &snapshot) {
     std::unique_lock<std::mutex> lock(mMutexMap);
-    std::ofstream f(filename);
-    if (!f.is_open()) return;
+    TakeSnapshotUnlocked(snapshot);
+}
+
+void Map::TakeSnapshotUnlocked(MapSnapshot &snapshot) {
+    snapshot.mvKeyFrames.clear();
+    snapshot.mvMapPoints.clear();
+    snapshot.mvKeyFrames.reserve(mKeyFrames.Size());
+    snapshot.mvMapPoints.reserve(mMapPoints.Size());
+
+    for (auto kf : mKeyFrames) {
+        const KeyFramePose Tcw = kf->GetPoseData();
+        if (!Tcw.mbValid) continue;
+        MapSnapshot::KeyFrameRecord rec;
+        rec.mnId = kf->mnId;
+        rec.mTimeStamp = kf->mTimeStamp;
+        PoseToArray(Tcw.mTcw, rec.mTcw);
+        snapshot.mvKeyFrames.push_back(rec);
+    }
+
+    for (auto mp : mMapPoints) {
+        cv::Point3f pos = mp->GetWorldPos();
+        MapSnapshot::MapPointRecord rec;
+        rec.mnId = mp->mnId;
+        rec.mPos[0] = pos.x;
+        rec.mPos[1] = pos.y;
+        rec.mPos[2] = pos.z;
+
+        cv::Mat descriptor = mp->GetDescriptor();
+        rec.mbHasDescriptor = descriptor.type() == CV_8U && descriptor.total() == 32;
+        if (rec.mbHasDescriptor) memcpy(rec.mDescriptor, descriptor.ptr<uint8_t>(), 32);
+        snapshot.mvMapPoints.push_back(rec);
+    }
+}
+
+void Map::EncodeText(const MapSnapshot &snapshot, std::ostream &f,
+                     const std::function<void(float)> &progress) {
+    const size_t nTotal = snapshot.mvKeyFrames.size() + snapshot.mvMapPoints.size();
+    const size_t nReportEvery = std::max<size_t>(nTotal / 100, 1);
+    size_t nWritten = 0;
 
     // Header
     f << "MAP_V1" << std::endl;
-    f << mspKeyFrames.size() << " " << mspMapPoints.size() << std::endl;
+    f << snapshot.mvKeyFrames.size() << " " << snapshot.mvMapPoints.size() << std::endl;
 
     // Save KeyFrames
-    for (auto kf : mspKeyFrames) {
-        cv::Mat Tcw = kf->GetPose();
-        if (Tcw.empty()) continue;
-        f << "KF " << kf->mnId << " " << kf->mTimeStamp;
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; j < 4; j++) {
-                f << " " << Tcw.at<float>(i, j);
-            }
+    for (const auto &kf : snapshot.mvKeyFrames) {
+        f << "KF " << kf.mnId << " " << kf.mTimeStamp;
+        for (int i = 0; i < 16; i++) {
+            f << " " << kf.mTcw[i];
         }
-        f << std::endl;
+        f << "\n";
+        if (progress && ++nWritten % nReportEvery == 0) progress(float(nWritten) / nTotal);
     }
 
     // Save MapPoints
-    for (auto mp : mspMapPoints) {
-        cv::Point3f pos = mp->GetWorldPos();
-        f << "MP " << mp->mnId << " " << pos.x << " " << pos.y << " " << pos.z << std::endl;
+    for (const auto &mp : snapshot.mvMapPoints) {
+        f << "MP " << mp.mnId << " " << mp.mPos[0] << " " << mp.mPos[1] << " " << mp.mPos[2] << "\n";
+        if (progress && ++nWritten % nReportEvery == 0) progress(float(nWritten) / nTotal);
+    }
+}
+
+bool Map::WriteSnapshot(const MapSnapshot &snapshot, const std::string &filename,
+                        const MapEncoding &encoding,
+                        const std::function<void(float)> &progress) {
+    const std::string tmpFilename = filename + ".tmp";
+    std::ofstream f(tmpFilename, std::ios::binary);
+    if (!f.is_open()) return false;
+
+    if (encoding.mFormat == MapEncoding::COMPRESSED || encoding.mFormat == MapEncoding::TILED) {
+        std::vector<uint8_t> data;
+        if (encoding.mFormat == MapEncoding::TILED) {
+            MapTileManager::Encode(snapshot, encoding, data);
+        } else {
+            MapCodec::Encode(snapshot, encoding, data);
+        }
+        if (progress) progress(0.5f);
+        f.write(reinterpret_cast<const char*>(data.data()), data.size());
+    } else {
+        EncodeText(snapshot, f, progress);
     }
 
     f.close();
+    if (f.fail()) {
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+
+    // Make the data durable before it replaces the previous map
+    int fd = open(tmpFilename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+
+    if (progress) progress(1.0f);
+    return true;
+}
+
+bool Map::Serialize(const std::string& filename) {
+    MapSnapshot snapshot;
+    TakeSnapshot(snapshot);
+    if (!WriteSnapshot(snapshot, filename)) return false;
+    DiscardStaleJournal(filename);
+
     std::cout << "Map serialized to " << filename << std::endl;
+    return true;
 }
 
-bool Map::Load(const std::string& filename) {
-    std::ifstream f(filename);
+bool Map::ReadSnapshot(const std::string &filename, MapSnapshot &snapshot) {
+    std::ifstream f(filename, std::ios::binary);
     if (!f.is_open()) return false;
 
+    char magic[8] = {0};
+    f.read(magic, sizeof(magic));
+    const bool bCompressed = MapCodec::IsCompressed(reinterpret_cast<const uint8_t*>(magic), f.gcount());
+    const bool bTiled = MapTileManager::IsTiled(reinterpret_cast<const uint8_t*>(magic), f.gcount());
+    if (bCompressed || bTiled) {
+        std::vector<uint8_t> data(magic, magic + sizeof(magic));
+        data.insert(data.end(), std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        if (bTiled) return MapTileManager::Decode(data.data(), data.size(), snapshot);
+        return MapCodec::Decode(data.data(), data.size(), snapshot);
+    }
+    f.clear();
+    f.seekg(0);
+
     std::string header;
     f >> header;
     if (header != "MAP_V1") return false;
@@ -73,40 +431,162 @@ bool Map::Load(const std::string& filename) {
     size_t numKFs, numMPs;
     f >> numKFs >> numMPs;
 
-    Clear();
+    snapshot.mvKeyFrames.clear();
+    snapshot.mvMapPoints.clear();
+    snapshot.mvKeyFrames.reserve(numKFs);
+    snapshot.mvMapPoints.reserve(numMPs);
 
     std::string type;
     while (f >> type) {
         if (type == "KF") {
-            long unsigned int id;
-            double timestamp;
-            f >> id >> timestamp;
-            cv::Mat Tcw(4, 4, CV_32F);
-            for (int i = 0; i < 4; i++) {
-                for (int j = 0; j < 4; j++) {
-                    f >> Tcw.at<float>(i, j);
-                }
+            MapSnapshot::KeyFrameRecord rec;
+            f >> rec.mnId >> rec.mTimeStamp;
+            for (int i = 0; i < 16; i++) {
+                f >> rec.mTcw[i];
             }
-            KeyFrame* kf = new KeyFrame(id, timestamp, Tcw, this);
-            AddKeyFrame(kf);
+            snapshot.mvKeyFrames.push_back(rec);
         } else if (type == "MP") {
-            long unsigned int id;
-            float x, y, z;
-            f >> id >> x >> y >> z;
-            MapPoint* mp = new MapPoint(id, cv::Point3f(x, y, z), this);
-            AddMapPoint(mp);
+            MapSnapshot::MapPointRecord rec;
+            f >> rec.mnId >> rec.mPos[0] >> rec.mPos[1] >> rec.mPos[2];
+            rec.mbHasDescriptor = false;
+            snapshot.mvMapPoints.push_back(rec);
         }
     }
-    f.close();
     return true;
 }
 
-void Map::Clear() {
+void Map::LoadSnapshot(const MapSnapshot &snapshot, std::vector<KeyFrame*>* pvpKFs, std::vector<MapPoint*>* pvpMPs) {
+    for (const auto &rec : snapshot.mvKeyFrames) {
+        KeyFrame* kf = NewKeyFrame(rec.mnId, rec.mTimeStamp, SE3f::FromRowMajor34(rec.mTcw));
+        AddKeyFrame(kf);
+        if (pvpKFs) pvpKFs->push_back(kf);
+    }
+    for (const auto &rec : snapshot.mvMapPoints) {
+        MapPoint* mp = NewMapPoint(rec.mnId, cv::Point3f(rec.mPos[0], rec.mPos[1], rec.mPos[2]));
+        if (rec.mbHasDescriptor) {
+            mp->SetDescriptor(cv::Mat(1, 32, CV_8U, const_cast<uint8_t*>(rec.mDescriptor)));
+        }
+        AddMapPoint(mp);
+        if (pvpMPs) pvpMPs->push_back(mp);
+    }
+    PublishView();
+}
+
+bool Map::Load(const std::string& filename) {
+    // A loaded map is a new base; the old journal no longer describes it
+    DisableJournal();
+
+    MapSnapshot snapshot;
+    if (!ReadSnapshot(filename, snapshot)) return false;
+
+    // A rotated journal only survives if compaction was interrupted. Replaying
+    // it again is harmless since records carry absolute values. Journals of an
+    // older base are deleted by the full save that replaced it.
+    const std::string journal = filename + ".journal";
+    MapJournal::Replay(journal + ".old", snapshot);
+    MapJournal::Replay(journal, snapshot);
+
+    Clear();
+    LoadSnapshot(snapshot);
+    return true;
+}
+
+bool Map::EnableJournal(const std::string& filename) {
+    DisableJournal();
+
+    MapSnapshot snapshot;
+    {
+        // Start journaling in the same critical section as the snapshot so no edit is missed
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        TakeSnapshotUnlocked(snapshot);
+        if (!mJournal.Open(filename + ".journal", true)) return false;
+        // A rotated journal left by an earlier base must not be replayed over this one
+        mJournal.DiscardRotated();
+        mJournalBaseFilename = filename;
+        mbJournalEnabled = true;
+    }
+
+    if (!WriteSnapshot(snapshot, filename)) {
+        DisableJournal();
+        return false;
+    }
+    mnJournalBaseBytes = FileSize(filename);
+    return true;
+}
+
+void Map::DisableJournal() {
     std::unique_lock<std::mutex> lock(mMutexMap);
-    // Delete all KFs and MPs
-    for (auto kf : mspKeyFrames) delete kf;
-    mspKeyFrames.clear();
-    for (auto mp : mspMapPoints) delete mp;
-    mspMapPoints.clear();
-    mvpReferenceMapPoints.clear();
+    mbJournalEnabled = false;
+    mJournal.Close();
+}
+
+bool Map::SyncJournal() {
+    if (!mbJournalEnabled) return false;
+    return mJournal.Sync();
+}
+
+bool Map::CompactJournal() {
+    if (!mbJournalEnabled) return false;
+
+    // Rotate first: pose setters append without the map lock, so a record that
+    // still lands in the rotated journal was stored before the snapshot below
+    // and is in it. Records after the rotation replay over the new base.
+    // After a failed compaction the rotated journal still holds records missing
+    // from the base; keep it and let this snapshot cover both journals.
+    if (!mJournal.HasRotated() && !mJournal.Rotate()) return false;
+
+    MapSnapshot snapshot;
+    {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        TakeSnapshotUnlocked(snapshot);
+    }
+
+    // Until the new base is renamed into place, base + rotated journal + journal is still valid
+    if (!WriteSnapshot(snapshot, mJournalBaseFilename)) return false;
+    mJournal.DiscardRotated();
+    mnJournalBaseBytes = FileSize(mJournalBaseFilename);
+    return true;
+}
+
+void Map::DiscardStaleJournal(const std::string& filename) {
+    std::unique_lock<std::mutex> lock(mMutexMap);
+    if (mbJournalEnabled && mJournalBaseFilename == filename) return;
+    MapJournal::Remove(filename + ".journal");
+}
+
+bool Map::JournalNeedsCompaction() {
+    if (!mbJournalEnabled) return false;
+    return mJournal.GetSize() > std::max(kMinJournalCompactionBytes, mnJournalBaseBytes);
+}
+
+void Map::Clear() {
+    std::vector<KeyFrame*> vpKFs;
+    std::vector<MapPoint*> vpMPs;
+    {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        vpKFs = mKeyFrames.Values();
+        vpMPs = mMapPoints.Values();
+        for (KeyFrame* pKF : vpKFs) pKF->mMapSlot = SlotHandle();
+        for (MapPoint* pMP : vpMPs) pMP->mMapSlot = SlotHandle();
+        mKeyFrames.Clear();
+        mMapPoints.Clear();
+        mvpReferenceMapPoints.clear();
+        {
+            std::unique_lock<std::mutex> lockUsage(mMutexMemoryUsage);
+            mLastMemoryUsage = MapMemoryUsage();
+        }
+
+        std::shared_ptr<MapView> pView = std::make_shared<MapView>();
+        pView->mnVersion = ++mnViewVersion;
+        std::atomic_store(&mpView, std::shared_ptr<const MapView>(pView));
+    }
+
+    // Other threads may still be walking the old contents; free them as one batch
+    // once they are done. The memory returns to the pools, not to malloc. A map
+    // loaded in the meantime already lives in the same pools, so this releases
+    // the batch rather than resetting the pools.
+    EpochReclaimer::Get().Retire(this, [this, vpKFs, vpMPs] {
+        mKeyFramePool.Destroy(vpKFs);
+        mMapPointPool.Destroy(vpMPs);
+    });
 }
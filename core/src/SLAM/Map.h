@@ -3,32 +3,204 @@
 
 #include "KeyFrame.h"
 #include "MapPoint.h"
-#include <set>
+#include "MapJournal.h"
+#include "MapCodec.h"
+#include "SlotMap.h"
+#include "MapView.h"
+#include "ObjectPool.h"
+#include "EpochReclaimer.h"
+#include <memory>
 #include <mutex>
+#include <functional>
+#include <atomic>
+
+// Plain-data copy of the map, cheap to take under mMutexMap and safe to
+// serialize after the lock is released.
+struct MapSnapshot {
+    struct KeyFrameRecord {
+        long unsigned int mnId;
+        double mTimeStamp;
+        float mTcw[16];
+    };
+
+    struct MapPointRecord {
+        long unsigned int mnId;
+        float mPos[3];
+        // ORB descriptor, only persisted by the compressed encoding
+        bool mbHasDescriptor;
+        uint8_t mDescriptor[32];
+    };
+
+    std::vector<KeyFrameRecord> mvKeyFrames;
+    std::vector<MapPointRecord> mvMapPoints;
+};
+
+// Bytes held by the map, split the way the memory budget sees them
+struct MapMemoryUsage {
+    size_t mnKeyFrameBytes = 0;     // Always resident: poses, graph, map point lists
+    size_t mnMapPointBytes = 0;
+    size_t mnPayloadBytes = 0;      // Resident keyframe features
+    size_t mnResidentPayloads = 0;
+    size_t mnEvictedPayloads = 0;   // Keyframes whose features are on disk
+
+    size_t Total() const { return mnKeyFrameBytes + mnMapPointBytes + mnPayloadBytes; }
+};
 
 class Map {
 public:
+    typedef ObjectPool<KeyFrame> KeyFramePool;
+    typedef ObjectPool<MapPoint> MapPointPool;
+
     Map();
+    ~Map();
+
+    // KeyFrames and MapPoints are allocated from pools owned by the map.
+    // Objects no other thread can see go back through Destroy*; anything that
+    // was ever in the map goes through Retire* instead.
+    KeyFrame* NewKeyFrame(Frame &F, KeyFrameDatabase* pKFDB);
+    KeyFrame* NewKeyFrame(long unsigned int id, double timeStamp, const SE3f &Tcw);
+    MapPoint* NewMapPoint(const cv::Point3f &Pos, KeyFrame* pRefKF);
+    MapPoint* NewMapPoint(long unsigned int id, const cv::Point3f &Pos);
+    void DestroyKeyFrame(KeyFrame* pKF);
+    void DestroyMapPoint(MapPoint* pMP);
+
+    KeyFramePool::Stats GetKeyFramePoolStats() { return mKeyFramePool.GetStats(); }
+    MapPointPool::Stats GetMapPointPoolStats() { return mMapPointPool.GetStats(); }
 
     void AddKeyFrame(KeyFrame* pKF);
     void AddMapPoint(MapPoint* pMP);
+    void EraseKeyFrame(KeyFrame* pKF);
+    void EraseMapPoint(MapPoint* pMP);
 
+    // Erases from the map and destroys once every thread that might still hold
+    // the pointer has left its EpochReclaimer::Guard. Safe while readers run.
+    void RetireKeyFrame(KeyFrame* pKF);
+    void RetireMapPoint(MapPoint* pMP);
+    // True if pKF is still in the map under slot (does not dereference pKF)
+    bool ContainsKeyFrame(KeyFrame* pKF, const SlotHandle &slot);
+    // Nulls the entries of vpMPs whose map point left the map since vSlots were
+    // captured (under an earlier guard). Does not dereference removed points.
+    void ValidateMapPoints(std::vector<MapPoint*> &vpMPs, const std::vector<SlotHandle> &vSlots);
+    // Same for many objects at once, with a single deferred free
+    void Retire(const std::vector<KeyFrame*> &vpKFs, const std::vector<MapPoint*> &vpMPs);
+    // Frees retired objects that are no longer reachable (called periodically by LocalMapping)
+    void ReclaimRetired();
+
+    // Copies of the current contents. Hold an EpochReclaimer::Guard while dereferencing them.
     std::vector<KeyFrame*> GetAllKeyFrames();
     std::vector<MapPoint*> GetAllMapPoints();
 
+    // Lock-free counts
+    size_t KeyFramesInMap() const { return mKeyFrames.Size(); }
+    size_t MapPointsInMap() const { return mMapPoints.Size(); }
+
+    // Visits every element under the map lock without copying the container.
+    // f must not call back into the Map.
+    template <typename F> void ForEachKeyFrame(F f) {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        for (KeyFrame* pKF : mKeyFrames) f(pKF);
+    }
+    template <typename F> void ForEachMapPoint(F f) {
+        std::unique_lock<std::mutex> lock(mMutexMap);
+        for (MapPoint* pMP : mMapPoints) f(pMP);
+    }
+
+    // Memory budget in bytes (0 = unlimited). Only keyframe payloads are
+    // evicted; poses, the graph and map points always stay resident.
+    void SetMemoryBudget(size_t nBytes) { mnMemoryBudget = nBytes; }
+    size_t GetMemoryBudget() const { return mnMemoryBudget; }
+    // Usage as of the last EnforceMemoryBudget pass. O(1), so it can be polled
+    // every frame without walking the map.
+    MapMemoryUsage GetMemoryUsage();
+    // Measures usage (also without a budget) and pages out the least recently
+    // used keyframe payloads until it fits the budget. Returns the bytes
+    // released. Caller holds an EpochReclaimer::Guard.
+    size_t EnforceMemoryBudget();
+
     void SetReferenceMapPoints(const std::vector<MapPoint*> &vpMPs);
 
-    void Serialize(const std::string& filename);
+    // Latest published view. Lock-free for readers; never null.
+    std::shared_ptr<const MapView> GetView() const;
+    // Copies current poses/positions into a new view and swaps it in.
+    // Called by the mapping threads after each step that changes the map.
+    void PublishView();
+
+    // Copies poses and positions under the map lock
+    void TakeSnapshot(MapSnapshot &snapshot);
+
+    // Writes a snapshot to filename.tmp, fsyncs it and renames it over filename.
+    // progress (optional) is called with the fraction of records written.
+    static bool WriteSnapshot(const MapSnapshot &snapshot, const std::string &filename,
+                              const MapEncoding &encoding = MapEncoding(),
+                              const std::function<void(float)> &progress = nullptr);
+    // Text (MAP_V1) encoding
+    static void EncodeText(const MapSnapshot &snapshot, std::ostream &os,
+                           const std::function<void(float)> &progress = nullptr);
+
+    bool Serialize(const std::string& filename);
+    // Loads filename and replays filename.journal (and a rotated journal) if present.
+    // Closes any open journal first.
     bool Load(const std::string& filename);
+    // Empties the map; the objects are retired, not destroyed in place
     void Clear();
 
+    // Journal mode: writes a base snapshot to filename and from then on appends
+    // every edit to filename.journal.
+    bool EnableJournal(const std::string& filename);
+    void DisableJournal();
+    bool IsJournalEnabled() const { return mbJournalEnabled; }
+    // Makes all journaled edits durable (autosave)
+    bool SyncJournal();
+    // Folds the journal into a new base snapshot
+    bool CompactJournal();
+    // Called once a full save has replaced filename: journals left from an
+    // earlier base would replay stale edits over it on Load, so they are
+    // deleted. The live journal of filename is kept, since its records run
+    // on from before the snapshot.
+    void DiscardStaleJournal(const std::string& filename);
+    // True once replaying the journal would cost more than reading the base
+    bool JournalNeedsCompaction();
+
+    // Called by KeyFrame/MapPoint setters so that journal mode sees pose updates
+    void JournalKeyFramePose(KeyFrame* pKF, const SE3f &Tcw);
+    void JournalMapPointPos(MapPoint* pMP, const cv::Point3f &pos);
+
+    // Reads any encoding, detected from the file header. Tiled files are decoded in full.
+    static bool ReadSnapshot(const std::string &filename, MapSnapshot &snapshot);
+
+    // Creates KeyFrames and MapPoints for the records and adds them to the map.
+    // The created objects are appended to the optional output vectors.
+    void LoadSnapshot(const MapSnapshot &snapshot,
+                      std::vector<KeyFrame*>* pvpKFs = nullptr, std::vector<MapPoint*>* pvpMPs = nullptr);
+
 protected:
-    std::set<MapPoint*> mspMapPoints;
-    std::set<KeyFrame*> mspKeyFrames;
+    void TakeSnapshotUnlocked(MapSnapshot &snapshot);
+    // Drops pMP from the keyframes observing it
+    void UnlinkMapPoint(MapPoint* pMP);
+
+    KeyFramePool mKeyFramePool;
+    MapPointPool mMapPointPool;
+
+    SlotMap<MapPoint*> mMapPoints;
+    SlotMap<KeyFrame*> mKeyFrames;
 
     std::vector<MapPoint*> mvpReferenceMapPoints;
 
+    // Published view, accessed only through std::atomic_load/atomic_store
+    std::shared_ptr<const MapView> mpView;
+    uint64_t mnViewVersion;
+
     std::mutex mMutexMap;
+
+    std::atomic<size_t> mnMemoryBudget;
+    MapMemoryUsage mLastMemoryUsage;
+    std::mutex mMutexMemoryUsage;
+
+    // Journal mode
+    MapJournal mJournal;
+    std::string mJournalBaseFilename;
+    size_t mnJournalBaseBytes;
+    std::atomic<bool> mbJournalEnabled;
 };
 
 #endif // MAP_H
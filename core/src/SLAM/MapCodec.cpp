@@ -0,0 +1,594 @@
+#include "MapCodec.h"
+#include "Map.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+const char kMagic[8] = {'S', 'S', 'M', 'A', 'P', 'Z', '0', '1'};
+
+// ---------------------------------------------------------------------------
+// Byte streams with LEB128 varints (zigzag for signed values)
+
+class ByteWriter {
+public:
+    explicit ByteWriter(std::vector<uint8_t> &buf) : mBuf(buf) {}
+
+    void PutByte(uint8_t b) { mBuf.push_back(b); }
+
+    void PutBytes(const void *p, size_t n) {
+        const uint8_t *b = static_cast<const uint8_t*>(p);
+        mBuf.insert(mBuf.end(), b, b + n);
+    }
+
+    void PutVarint(uint64_t v) {
+        while (v >= 0x80) {
+            mBuf.push_back(static_cast<uint8_t>(v) | 0x80);
+            v >>= 7;
+        }
+        mBuf.push_back(static_cast<uint8_t>(v));
+    }
+
+    void PutSigned(int64_t v) {
+        PutVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
+private:
+    std::vector<uint8_t> &mBuf;
+};
+
+class ByteReader {
+public:
+    ByteReader(const uint8_t *data, size_t size) : mp(data), mpEnd(data + size), mbOk(true) {}
+
+    uint8_t GetByte() {
+        if (mp >= mpEnd) {
+            mbOk = false;
+            return 0;
+        }
+        return *mp++;
+    }
+
+    void GetBytes(void *out, size_t n) {
+        if (Remaining() < n) {
+            mbOk = false;
+            memset(out, 0, n);
+            mp = mpEnd;
+            return;
+        }
+        memcpy(out, mp, n);
+        mp += n;
+    }
+
+    const uint8_t* GetSpan(size_t n) {
+        if (Remaining() < n) {
+            mbOk = false;
+            mp = mpEnd;
+            return nullptr;
+        }
+        const uint8_t *p = mp;
+        mp += n;
+        return p;
+    }
+
+    uint64_t GetVarint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64 && mbOk; shift += 7) {
+            uint8_t b = GetByte();
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        mbOk = false;
+        return 0;
+    }
+
+    int64_t GetSigned() {
+        uint64_t v = GetVarint();
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    size_t Remaining() const { return static_cast<size_t>(mpEnd - mp); }
+    bool Ok() const { return mbOk; }
+
+private:
+    const uint8_t *mp;
+    const uint8_t *mpEnd;
+    bool mbOk;
+};
+
+// ---------------------------------------------------------------------------
+// Order-0 rANS with 12-bit probabilities and byte-wise renormalization.
+// Each stream stores its own (symbol, frequency) table.
+
+const uint32_t kProbBits = 12;
+const uint32_t kProbScale = 1u << kProbBits;
+const uint32_t kRansL = 1u << 23;
+
+// Largest record count a compressed map may declare. A stream of a single
+// symbol costs no bits, so decoded sizes cannot be bounded by the input
+// alone; the counts in the header bound them instead.
+const uint64_t kMaxRecords = 1u << 24;
+// A varint or zigzag varint never takes more than this many bytes
+const uint64_t kMaxVarintBytes = 10;
+
+void NormalizeFrequencies(const uint64_t counts[256], uint64_t total, uint32_t freq[256]) {
+    uint32_t sum = 0;
+    for (int s = 0; s < 256; s++) {
+        if (counts[s] == 0) {
+            freq[s] = 0;
+            continue;
+        }
+        freq[s] = std::max<uint32_t>(1, static_cast<uint32_t>(counts[s] * kProbScale / total));
+        sum += freq[s];
+    }
+
+    // Rounding leaves the sum off by a little; fix it up on the most frequent symbols
+    while (sum != kProbScale) {
+        int best = -1;
+        for (int s = 0; s < 256; s++) {
+            if (freq[s] > (sum > kProbScale ? 1u : 0u) && (best < 0 || freq[s] > freq[best])) best = s;
+        }
+        if (sum < kProbScale) {
+            freq[best] += kProbScale - sum;
+            sum = kProbScale;
+        } else {
+            freq[best]--;
+            sum--;
+        }
+    }
+}
+
+void RansEncode(const std::vector<uint8_t> &in, ByteWriter &w) {
+    w.PutVarint(in.size());
+    if (in.empty()) return;
+
+    uint64_t counts[256] = {0};
+    for (uint8_t b : in) counts[b]++;
+
+    uint32_t freq[256];
+    NormalizeFrequencies(counts, in.size(), freq);
+
+    uint32_t cum[256];
+    uint32_t c = 0;
+    int nSymbols = 0;
+    for (int s = 0; s < 256; s++) {
+        cum[s] = c;
+        c += freq[s];
+        if (freq[s]) nSymbols++;
+    }
+
+    w.PutVarint(nSymbols);
+    for (int s = 0; s < 256; s++) {
+        if (!freq[s]) continue;
+        w.PutByte(static_cast<uint8_t>(s));
+        w.PutVarint(freq[s]);
+    }
+
+    // rANS encodes back to front; the output is reversed at the end
+    std::vector<uint8_t> out;
+    out.reserve(in.size() / 2 + 16);
+    uint32_t x = kRansL;
+    for (size_t i = in.size(); i-- > 0;) {
+        const uint32_t f = freq[in[i]];
+        const uint32_t xMax = ((kRansL >> kProbBits) << 8) * f;
+        while (x >= xMax) {
+            out.push_back(static_cast<uint8_t>(x));
+            x >>= 8;
+        }
+        x = ((x / f) << kProbBits) + (x % f) + cum[in[i]];
+    }
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<uint8_t>(x));
+        x >>= 8;
+    }
+    std::reverse(out.begin(), out.end());
+
+    w.PutVarint(out.size());
+    w.PutBytes(out.data(), out.size());
+}
+
+// nMaxSize: the most bytes the stream may decode to
+bool RansDecode(ByteReader &r, std::vector<uint8_t> &out, uint64_t nMaxSize) {
+    const uint64_t n = r.GetVarint();
+    out.clear();
+    if (!r.Ok() || n > nMaxSize) return false;
+    if (n == 0) return true;
+
+    uint32_t freq[256] = {0};
+    const uint64_t nSymbols = r.GetVarint();
+    if (nSymbols == 0 || nSymbols > 256) return false;
+    uint32_t sum = 0;
+    for (uint64_t i = 0; i < nSymbols; i++) {
+        uint8_t s = r.GetByte();
+        uint64_t f = r.GetVarint();
+        // A repeated symbol would leave part of the slot table unset
+        if (f == 0 || f > kProbScale || freq[s] != 0) return false;
+        freq[s] = static_cast<uint32_t>(f);
+        sum += freq[s];
+    }
+    if (!r.Ok() || sum != kProbScale) return false;
+
+    uint32_t cum[256];
+    uint8_t slotToSymbol[kProbScale];
+    uint32_t c = 0;
+    for (int s = 0; s < 256; s++) {
+        cum[s] = c;
+        for (uint32_t k = 0; k < freq[s]; k++) slotToSymbol[c + k] = static_cast<uint8_t>(s);
+        c += freq[s];
+    }
+
+    const uint64_t len = r.GetVarint();
+    if (!r.Ok() || len < 4 || len > r.Remaining()) return false;
+    const uint8_t *p = r.GetSpan(static_cast<size_t>(len));
+    const uint8_t *pEnd = p + len;
+
+    uint32_t x = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    p += 4;
+
+    out.resize(static_cast<size_t>(n));
+    for (uint64_t i = 0; i < n; i++) {
+        const uint32_t slot = x & (kProbScale - 1);
+        const uint8_t s = slotToSymbol[slot];
+        out[i] = s;
+        x = freq[s] * (x >> kProbBits) + slot - cum[s];
+        while (x < kRansL && p < pEnd) x = (x << 8) | *p++;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+
+// Camera centre of a row-major Tcw: -R^T * t
+void CameraCenter(const float *Tcw, double *C) {
+    for (int j = 0; j < 3; j++) {
+        C[j] = -(double(Tcw[0 * 4 + j]) * Tcw[3] + double(Tcw[1 * 4 + j]) * Tcw[7] + double(Tcw[2 * 4 + j]) * Tcw[11]);
+    }
+}
+
+int64_t Quantize(double v, double invPrecision) {
+    if (!std::isfinite(v)) return 0;
+    return std::llround(v * invPrecision);
+}
+
+// Nearest-anchor lookup on anchors sorted along x
+class AnchorIndex {
+public:
+    explicit AnchorIndex(const std::vector<int64_t> &anchors) : mAnchors(anchors) {
+        const size_t n = anchors.size() / 3;
+        mvOrder.resize(n);
+        for (size_t i = 0; i < n; i++) mvOrder[i] = i;
+        std::sort(mvOrder.begin(), mvOrder.end(), [&](size_t a, size_t b) { return anchors[3 * a] < anchors[3 * b]; });
+        mvX.resize(n);
+        for (size_t i = 0; i < n; i++) mvX[i] = anchors[3 * mvOrder[i]];
+    }
+
+    size_t Nearest(const int64_t *q) const {
+        const size_t n = mvOrder.size();
+        size_t start = std::lower_bound(mvX.begin(), mvX.end(), q[0]) - mvX.begin();
+        double bestDist = INFINITY;
+        size_t best = mvOrder.empty() ? 0 : mvOrder[std::min(start, n - 1)];
+
+        // Walk outwards until the x gap alone exceeds the best distance
+        for (size_t i = start; i < n; i++) {
+            double dx = double(mvX[i] - q[0]);
+            if (dx * dx >= bestDist) break;
+            Consider(mvOrder[i], q, bestDist, best);
+        }
+        for (size_t i = start; i-- > 0;) {
+            double dx = double(q[0] - mvX[i]);
+            if (dx * dx >= bestDist) break;
+            Consider(mvOrder[i], q, bestDist, best);
+        }
+        return best;
+    }
+
+private:
+    void Consider(size_t idx, const int64_t *q, double &bestDist, size_t &best) const {
+        double d = 0;
+        for (int k = 0; k < 3; k++) {
+            double dk = double(mAnchors[3 * idx + k] - q[k]);
+            d += dk * dk;
+        }
+        if (d < bestDist) {
+            bestDist = d;
+            best = idx;
+        }
+    }
+
+    const std::vector<int64_t> &mAnchors;
+    std::vector<size_t> mvOrder;
+    std::vector<int64_t> mvX;
+};
+
+} // namespace
+
+bool MapCodec::IsCompressed(const uint8_t *data, size_t size) {
+    return size >= sizeof(kMagic) && memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+void MapCodec::Encode(const MapSnapshot &snapshot, const MapEncoding &encoding, std::vector<uint8_t> &out) {
+    const float precision = encoding.mfPositionPrecision > 0.0f ? encoding.mfPositionPrecision : 0.001f;
+    const double invPrecision = 1.0 / precision;
+
+    // Sort by id so ids delta-code to small varints
+    std::vector<const MapSnapshot::KeyFrameRecord*> vpKFs;
+    vpKFs.reserve(snapshot.mvKeyFrames.size());
+    for (const auto &kf : snapshot.mvKeyFrames) vpKFs.push_back(&kf);
+    std::sort(vpKFs.begin(), vpKFs.end(), [](const MapSnapshot::KeyFrameRecord *a, const MapSnapshot::KeyFrameRecord *b) { return a->mnId < b->mnId; });
+
+    std::vector<const MapSnapshot::MapPointRecord*> vpMPs;
+    vpMPs.reserve(snapshot.mvMapPoints.size());
+    for (const auto &mp : snapshot.mvMapPoints) vpMPs.push_back(&mp);
+    std::sort(vpMPs.begin(), vpMPs.end(), [](const MapSnapshot::MapPointRecord *a, const MapSnapshot::MapPointRecord *b) { return a->mnId < b->mnId; });
+
+    // KeyFrames: ids, timestamps (XOR with previous), poses (byte planes of the 3x4 block)
+    std::vector<uint8_t> sKFIds, sKFTimes, sKFPoses;
+    {
+        ByteWriter wIds(sKFIds), wTimes(sKFTimes);
+        uint64_t prevId = 0, prevTime = 0;
+        std::vector<uint8_t> raw(vpKFs.size() * 48);
+        for (size_t i = 0; i < vpKFs.size(); i++) {
+            wIds.PutVarint(vpKFs[i]->mnId - prevId);
+            prevId = vpKFs[i]->mnId;
+
+            uint64_t bits;
+            memcpy(&bits, &vpKFs[i]->mTimeStamp, sizeof(bits));
+            uint64_t x = bits ^ prevTime;
+            prevTime = bits;
+            wTimes.PutBytes(&x, sizeof(x));
+
+            memcpy(&raw[i * 48], vpKFs[i]->mTcw, 48);
+        }
+        sKFPoses.resize(raw.size());
+        const size_t nFloats = vpKFs.size() * 12;
+        for (size_t b = 0; b < 4; b++) {
+            for (size_t k = 0; k < nFloats; k++) sKFPoses[b * nFloats + k] = raw[k * 4 + b];
+        }
+    }
+
+    // Anchors: quantized keyframe centres, or the origin for a map without keyframes
+    std::vector<int64_t> anchors;
+    for (const auto *kf : vpKFs) {
+        double C[3];
+        CameraCenter(kf->mTcw, C);
+        for (int k = 0; k < 3; k++) anchors.push_back(Quantize(C[k], invPrecision));
+    }
+    if (anchors.empty()) anchors.assign(3, 0);
+
+    std::vector<uint8_t> sAnchors;
+    {
+        ByteWriter w(sAnchors);
+        int64_t prev[3] = {0, 0, 0};
+        for (size_t i = 0; i < anchors.size(); i += 3) {
+            for (int k = 0; k < 3; k++) {
+                w.PutSigned(anchors[i + k] - prev[k]);
+                prev[k] = anchors[i + k];
+            }
+        }
+    }
+
+    // MapPoints: ids, anchor index deltas, quantized residuals, descriptors
+    std::vector<uint8_t> sMPIds, sMPAnchors, sMPResiduals, sDescriptors;
+    {
+        AnchorIndex index(anchors);
+        ByteWriter wIds(sMPIds), wAnchors(sMPAnchors), wResiduals(sMPResiduals), wDesc(sDescriptors);
+        uint64_t prevId = 0;
+        int64_t prevAnchor = 0;
+        std::vector<uint8_t> presence((vpMPs.size() + 7) / 8, 0);
+        std::vector<uint8_t> descriptors;
+
+        for (size_t i = 0; i < vpMPs.size(); i++) {
+            const MapSnapshot::MapPointRecord *mp = vpMPs[i];
+            wIds.PutVarint(mp->mnId - prevId);
+            prevId = mp->mnId;
+
+            int64_t q[3];
+            for (int k = 0; k < 3; k++) q[k] = Quantize(mp->mPos[k], invPrecision);
+
+            const int64_t anchor = static_cast<int64_t>(index.Nearest(q));
+            wAnchors.PutSigned(anchor - prevAnchor);
+            prevAnchor = anchor;
+            for (int k = 0; k < 3; k++) wResiduals.PutSigned(q[k] - anchors[3 * anchor + k]);
+
+            if (mp->mbHasDescriptor) {
+                presence[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+                descriptors.insert(descriptors.end(), mp->mDescriptor, mp->mDescriptor + 32);
+            }
+        }
+        wDesc.PutBytes(presence.data(), presence.size());
+        wDesc.PutBytes(descriptors.data(), descriptors.size());
+    }
+
+    out.clear();
+    ByteWriter w(out);
+    w.PutBytes(kMagic, sizeof(kMagic));
+    w.PutBytes(&precision, sizeof(precision));
+    w.PutVarint(vpKFs.size());
+    w.PutVarint(vpMPs.size());
+    w.PutVarint(anchors.size() / 3);
+    RansEncode(sKFIds, w);
+    RansEncode(sKFTimes, w);
+    RansEncode(sKFPoses, w);
+    RansEncode(sAnchors, w);
+    RansEncode(sMPIds, w);
+    RansEncode(sMPAnchors, w);
+    RansEncode(sMPResiduals, w);
+    RansEncode(sDescriptors, w);
+}
+
+bool MapCodec::Decode(const uint8_t *data, size_t size, MapSnapshot &snapshot) {
+    if (!IsCompressed(data, size)) return false;
+
+    ByteReader r(data + sizeof(kMagic), size - sizeof(kMagic));
+    float precision;
+    r.GetBytes(&precision, sizeof(precision));
+    const uint64_t nKFs = r.GetVarint();
+    const uint64_t nMPs = r.GetVarint();
+    const uint64_t nAnchors = r.GetVarint();
+    if (!r.Ok() || !(precision > 0.0f)) return false;
+    if (nKFs > kMaxRecords || nMPs > kMaxRecords || nAnchors > kMaxRecords) return false;
+
+    // Every stream is bounded by the counts before anything is allocated
+    std::vector<uint8_t> sKFIds, sKFTimes, sKFPoses, sAnchors, sMPIds, sMPAnchors, sMPResiduals, sDescriptors;
+    if (!RansDecode(r, sKFIds, nKFs * kMaxVarintBytes) ||
+        !RansDecode(r, sKFTimes, nKFs * 8) ||
+        !RansDecode(r, sKFPoses, nKFs * 48) ||
+        !RansDecode(r, sAnchors, nAnchors * 3 * kMaxVarintBytes) ||
+        !RansDecode(r, sMPIds, nMPs * kMaxVarintBytes) ||
+        !RansDecode(r, sMPAnchors, nMPs * kMaxVarintBytes) ||
+        !RansDecode(r, sMPResiduals, nMPs * 3 * kMaxVarintBytes) ||
+        !RansDecode(r, sDescriptors, (nMPs + 7) / 8 + nMPs * 32)) {
+        return false;
+    }
+    if (sKFTimes.size() != nKFs * 8 || sKFPoses.size() != nKFs * 48) return false;
+    // And every count by the bytes that must encode it (at least one per varint)
+    if (sKFIds.size() < nKFs || sAnchors.size() < nAnchors * 3 || sMPIds.size() < nMPs ||
+        sMPAnchors.size() < nMPs || sMPResiduals.size() < nMPs * 3 || sDescriptors.size() < (nMPs + 7) / 8) {
+        return false;
+    }
+
+    snapshot.mvKeyFrames.assign(static_cast<size_t>(nKFs), MapSnapshot::KeyFrameRecord());
+    snapshot.mvMapPoints.assign(static_cast<size_t>(nMPs), MapSnapshot::MapPointRecord());
+
+    // KeyFrames
+    {
+        ByteReader rIds(sKFIds.data(), sKFIds.size());
+        uint64_t id = 0, prevTime = 0;
+        const size_t nFloats = static_cast<size_t>(nKFs) * 12;
+        for (size_t i = 0; i < nKFs; i++) {
+            MapSnapshot::KeyFrameRecord &kf = snapshot.mvKeyFrames[i];
+            id += rIds.GetVarint();
+            kf.mnId = static_cast<long unsigned int>(id);
+
+            uint64_t x;
+            memcpy(&x, &sKFTimes[i * 8], sizeof(x));
+            prevTime ^= x;
+            memcpy(&kf.mTimeStamp, &prevTime, sizeof(prevTime));
+
+            uint8_t raw[48];
+            for (size_t k = 0; k < 12; k++) {
+                for (size_t b = 0; b < 4; b++) raw[k * 4 + b] = sKFPoses[b * nFloats + i * 12 + k];
+            }
+            memcpy(kf.mTcw, raw, sizeof(raw));
+            kf.mTcw[12] = 0.0f; kf.mTcw[13] = 0.0f; kf.mTcw[14] = 0.0f; kf.mTcw[15] = 1.0f;
+        }
+        if (!rIds.Ok()) return false;
+    }
+
+    // Anchors
+    std::vector<int64_t> anchors(static_cast<size_t>(nAnchors) * 3);
+    {
+        ByteReader rAnchors(sAnchors.data(), sAnchors.size());
+        int64_t prev[3] = {0, 0, 0};
+        for (size_t i = 0; i < anchors.size(); i += 3) {
+            for (int k = 0; k < 3; k++) {
+                prev[k] += rAnchors.GetSigned();
+                anchors[i + k] = prev[k];
+            }
+        }
+        if (!rAnchors.Ok()) return false;
+    }
+
+    // MapPoints
+    {
+        ByteReader rIds(sMPIds.data(), sMPIds.size());
+        ByteReader rAnchors(sMPAnchors.data(), sMPAnchors.size());
+        ByteReader rResiduals(sMPResiduals.data(), sMPResiduals.size());
+        ByteReader rDesc(sDescriptors.data(), sDescriptors.size());
+
+        std::vector<uint8_t> presence((static_cast<size_t>(nMPs) + 7) / 8);
+        rDesc.GetBytes(presence.data(), presence.size());
+
+        uint64_t id = 0;
+        int64_t anchor = 0;
+        for (size_t i = 0; i < nMPs; i++) {
+            MapSnapshot::MapPointRecord &mp = snapshot.mvMapPoints[i];
+            id += rIds.GetVarint();
+            mp.mnId = static_cast<long unsigned int>(id);
+
+            anchor += rAnchors.GetSigned();
+            if (anchor < 0 || static_cast<uint64_t>(anchor) >= nAnchors) return false;
+            for (int k = 0; k < 3; k++) {
+                const int64_t q = anchors[3 * anchor + k] + rResiduals.GetSigned();
+                mp.mPos[k] = static_cast<float>(q * static_cast<double>(precision));
+            }
+
+            mp.mbHasDescriptor = (presence[i / 8] >> (i % 8)) & 1;
+            if (mp.mbHasDescriptor) rDesc.GetBytes(mp.mDescriptor, 32);
+        }
+        if (!rIds.Ok() || !rAnchors.Ok() || !rResiduals.Ok() || !rDesc.Ok()) return false;
+    }
+
+    return true;
+}
+
+MapCodec::BenchmarkResult MapCodec::Benchmark(const MapSnapshot &snapshot, const MapEncoding &encoding, int nRuns) {
+    using Clock = std::chrono::steady_clock;
+    BenchmarkResult result = {};
+    nRuns = std::max(nRuns, 1);
+
+    std::ostringstream text;
+    Map::EncodeText(snapshot, text);
+    result.mnTextBytes = text.str().size();
+
+    std::vector<uint8_t> encoded;
+    auto t0 = Clock::now();
+    for (int i = 0; i < nRuns; i++) Encode(snapshot, encoding, encoded);
+    auto t1 = Clock::now();
+
+    MapSnapshot decoded;
+    bool bDecoded = true;
+    for (int i = 0; i < nRuns; i++) bDecoded &= Decode(encoded.data(), encoded.size(), decoded);
+    auto t2 = Clock::now();
+
+    const double encodeSeconds = std::chrono::duration<double>(t1 - t0).count() / nRuns;
+    const double decodeSeconds = std::chrono::duration<double>(t2 - t1).count() / nRuns;
+    const double textMB = result.mnTextBytes / (1024.0 * 1024.0);
+
+    result.mnEncodedBytes = encoded.size();
+    result.mdRatio = encoded.empty() ? 0.0 : double(result.mnTextBytes) / encoded.size();
+    result.mdEncodeMBps = encodeSeconds > 0 ? textMB / encodeSeconds : 0.0;
+    result.mdDecodeMBps = decodeSeconds > 0 ? textMB / decodeSeconds : 0.0;
+
+    // Decoded records come back sorted by id
+    std::vector<const MapSnapshot::KeyFrameRecord*> vpKFs;
+    for (const auto &kf : snapshot.mvKeyFrames) vpKFs.push_back(&kf);
+    std::sort(vpKFs.begin(), vpKFs.end(), [](const MapSnapshot::KeyFrameRecord *a, const MapSnapshot::KeyFrameRecord *b) { return a->mnId < b->mnId; });
+    std::vector<const MapSnapshot::MapPointRecord*> vpMPs;
+    for (const auto &mp : snapshot.mvMapPoints) vpMPs.push_back(&mp);
+    std::sort(vpMPs.begin(), vpMPs.end(), [](const MapSnapshot::MapPointRecord *a, const MapSnapshot::MapPointRecord *b) { return a->mnId < b->mnId; });
+
+    result.mbLossless = bDecoded && vpKFs.size() == decoded.mvKeyFrames.size() && vpMPs.size() == decoded.mvMapPoints.size();
+    for (size_t i = 0; result.mbLossless && i < vpKFs.size(); i++) {
+        const MapSnapshot::KeyFrameRecord &kf = decoded.mvKeyFrames[i];
+        result.mbLossless = kf.mnId == vpKFs[i]->mnId && kf.mTimeStamp == vpKFs[i]->mTimeStamp &&
+                            memcmp(kf.mTcw, vpKFs[i]->mTcw, 12 * sizeof(float)) == 0;  // Top 3x4 block
+    }
+    for (size_t i = 0; i < vpMPs.size() && i < decoded.mvMapPoints.size(); i++) {
+        const MapSnapshot::MapPointRecord &mp = decoded.mvMapPoints[i];
+        if (mp.mnId != vpMPs[i]->mnId || mp.mbHasDescriptor != vpMPs[i]->mbHasDescriptor ||
+            (mp.mbHasDescriptor && memcmp(mp.mDescriptor, vpMPs[i]->mDescriptor, sizeof(mp.mDescriptor)) != 0)) {
+            result.mbLossless = false;
+        }
+        for (int k = 0; k < 3; k++) {
+            result.mfMaxPositionError = std::max(result.mfMaxPositionError,
+                                                 std::abs(vpMPs[i]->mPos[k] - mp.mPos[k]));
+        }
+    }
+
+    return result;
+}
+
+std::string MapCodec::ToString(const BenchmarkResult &result) {
+    std::stringstream ss;
+    ss << "Map encoding: " << result.mnTextBytes << " B text -> " << result.mnEncodedBytes << " B compressed"
+       << " (ratio " << result.mdRatio << ")"
+       << ", encode " << result.mdEncodeMBps << " MB/s"
+       << ", decode " << result.mdDecodeMBps << " MB/s"
+       << ", max position error " << result.mfMaxPositionError
+       << (result.mbLossless ? "" : ", ROUND TRIP MISMATCH");
+    return ss.str();
+}
@@ -0,0 +1,60 @@
+#ifndef MAPCODEC_H
+#define MAPCODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct MapSnapshot;
+
+// How a map snapshot is written to disk
+struct MapEncoding {
+    enum eFormat {
+        TEXT = 0,       // MAP_V1, lossless float text
+        COMPRESSED = 1, // MapCodec, quantized positions + entropy coding
+        TILED = 2       // MapTiles, COMPRESSED tiles behind a spatial index
+    };
+
+    eFormat mFormat = TEXT;
+
+    // Map point position quantization step in map units (COMPRESSED only)
+    float mfPositionPrecision = 0.001f;
+
+    // Tile edge length in map units (TILED only)
+    float mfTileSize = 5.0f;
+};
+
+// Compact binary encoding of a map snapshot.
+// - KeyFrame and MapPoint ids are sorted and delta coded as varints.
+// - KeyFrame poses and timestamps are kept bit-exact.
+// - MapPoint positions are quantized to mfPositionPrecision and stored as
+//   residuals from the nearest keyframe centre (the anchor).
+// - Descriptors are stored as raw 256-bit strings.
+// Every stream is then compressed with an order-0 rANS entropy coder.
+class MapCodec {
+public:
+    struct BenchmarkResult {
+        size_t mnTextBytes;
+        size_t mnEncodedBytes;
+        double mdRatio;
+        double mdEncodeMBps; // Throughput relative to the text size
+        double mdDecodeMBps;
+        float mfMaxPositionError;
+        // Decoding gave back every id, pose, timestamp and descriptor exactly
+        bool mbLossless;
+    };
+
+    static void Encode(const MapSnapshot &snapshot, const MapEncoding &encoding, std::vector<uint8_t> &out);
+    static bool Decode(const uint8_t *data, size_t size, MapSnapshot &snapshot);
+
+    // True if data starts with the compressed map header
+    static bool IsCompressed(const uint8_t *data, size_t size);
+
+    // Round-trips snapshot nRuns times, checks the decoded map against it and
+    // compares sizes and speed against the text encoding
+    static BenchmarkResult Benchmark(const MapSnapshot &snapshot, const MapEncoding &encoding, int nRuns = 5);
+    static std::string ToString(const BenchmarkResult &result);
+};
+
+#endif // MAPCODEC_H
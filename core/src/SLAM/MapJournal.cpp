@@ -0,0 +1,233 @@
+#include "MapJournal.h"
+#include "Map.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <unistd.h>
+
+namespace {
+
+const char kJournalMagic[8] = {'S', 'S', 'J', 'R', 'N', 'L', '0', '1'};
+
+const size_t kPoseSize = 12 * sizeof(float);
+const size_t kPosSize = 3 * sizeof(float);
+
+size_t PayloadSize(uint8_t type) {
+    switch (type) {
+        case MapJournal::ADD_KEYFRAME:   return sizeof(double) + kPoseSize;
+        case MapJournal::KEYFRAME_POSE:  return kPoseSize;
+        case MapJournal::ADD_MAPPOINT:   return kPosSize;
+        case MapJournal::MAPPOINT_POS:   return kPosSize;
+        case MapJournal::ERASE_KEYFRAME: return 0;
+        case MapJournal::ERASE_MAPPOINT: return 0;
+        default: return SIZE_MAX;
+    }
+}
+
+void ExpandPose(const float *pose34, float *Tcw) {
+    memcpy(Tcw, pose34, kPoseSize);
+    Tcw[12] = 0.0f; Tcw[13] = 0.0f; Tcw[14] = 0.0f; Tcw[15] = 1.0f;
+}
+
+} // namespace
+
+MapJournal::MapJournal() : mpFile(nullptr), mnBytes(0) {
+}
+
+MapJournal::~MapJournal() {
+    Close();
+}
+
+bool MapJournal::Open(const std::string &filename, bool bTruncate) {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    if (mpFile) {
+        fclose(mpFile);
+        mpFile = nullptr;
+    }
+    mFilename = filename;
+    return OpenFile(bTruncate);
+}
+
+bool MapJournal::OpenFile(bool bTruncate) {
+    mpFile = fopen(mFilename.c_str(), bTruncate ? "wb" : "ab");
+    if (!mpFile) return false;
+
+    mnBytes = 0;
+    fseek(mpFile, 0, SEEK_END);
+    if (ftell(mpFile) == 0) {
+        fwrite(kJournalMagic, 1, sizeof(kJournalMagic), mpFile);
+    }
+    return true;
+}
+
+void MapJournal::Close() {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    if (mpFile) {
+        fflush(mpFile);
+        fsync(fileno(mpFile));
+        fclose(mpFile);
+        mpFile = nullptr;
+    }
+}
+
+bool MapJournal::IsOpen() {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    return mpFile != nullptr;
+}
+
+bool MapJournal::Rotate() {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    if (!mpFile) return false;
+
+    fflush(mpFile);
+    fsync(fileno(mpFile));
+    fclose(mpFile);
+    mpFile = nullptr;
+
+    const std::string rotated = mFilename + ".old";
+    if (std::rename(mFilename.c_str(), rotated.c_str()) != 0) {
+        OpenFile(false);
+        return false;
+    }
+    return OpenFile(true);
+}
+
+void MapJournal::DiscardRotated() {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    const std::string rotated = mFilename + ".old";
+    std::remove(rotated.c_str());
+}
+
+bool MapJournal::HasRotated() {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    const std::string rotated = mFilename + ".old";
+    return access(rotated.c_str(), F_OK) == 0;
+}
+
+void MapJournal::Remove(const std::string &filename) {
+    std::remove(filename.c_str());
+    std::remove((filename + ".old").c_str());
+}
+
+void MapJournal::Append(eRecordType type, long unsigned int id, const void *payload, size_t payloadSize) {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    if (!mpFile) return;
+
+    uint8_t header[1 + sizeof(uint64_t)];
+    uint64_t id64 = id;
+    header[0] = type;
+    memcpy(header + 1, &id64, sizeof(id64));
+
+    fwrite(header, 1, sizeof(header), mpFile);
+    if (payloadSize > 0) fwrite(payload, 1, payloadSize, mpFile);
+    mnBytes += sizeof(header) + payloadSize;
+}
+
+void MapJournal::AppendKeyFrame(long unsigned int id, double timeStamp, const float *Tcw) {
+    uint8_t payload[sizeof(double) + kPoseSize];
+    memcpy(payload, &timeStamp, sizeof(double));
+    memcpy(payload + sizeof(double), Tcw, kPoseSize);
+    Append(ADD_KEYFRAME, id, payload, sizeof(payload));
+}
+
+void MapJournal::AppendKeyFramePose(long unsigned int id, const float *Tcw) {
+    Append(KEYFRAME_POSE, id, Tcw, kPoseSize);
+}
+
+void MapJournal::AppendEraseKeyFrame(long unsigned int id) {
+    Append(ERASE_KEYFRAME, id, nullptr, 0);
+}
+
+void MapJournal::AppendMapPoint(long unsigned int id, const float *pos) {
+    Append(ADD_MAPPOINT, id, pos, kPosSize);
+}
+
+void MapJournal::AppendMapPointPos(long unsigned int id, const float *pos) {
+    Append(MAPPOINT_POS, id, pos, kPosSize);
+}
+
+void MapJournal::AppendEraseMapPoint(long unsigned int id) {
+    Append(ERASE_MAPPOINT, id, nullptr, 0);
+}
+
+bool MapJournal::Sync() {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    if (!mpFile) return false;
+    if (fflush(mpFile) != 0) return false;
+    return fsync(fileno(mpFile)) == 0;
+}
+
+size_t MapJournal::GetSize() {
+    std::unique_lock<std::mutex> lock(mMutexFile);
+    return mnBytes;
+}
+
+bool MapJournal::Replay(const std::string &filename, MapSnapshot &snapshot) {
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+
+    char magic[sizeof(kJournalMagic)];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, kJournalMagic, sizeof(magic)) != 0) {
+        fclose(f);
+        return false;
+    }
+
+    std::map<long unsigned int, MapSnapshot::KeyFrameRecord> mKFs;
+    std::map<long unsigned int, MapSnapshot::MapPointRecord> mMPs;
+    for (const auto &kf : snapshot.mvKeyFrames) mKFs[kf.mnId] = kf;
+    for (const auto &mp : snapshot.mvMapPoints) mMPs[mp.mnId] = mp;
+
+    uint8_t header[1 + sizeof(uint64_t)];
+    uint8_t payload[sizeof(double) + kPoseSize];
+
+    while (fread(header, 1, sizeof(header), f) == sizeof(header)) {
+        const uint8_t type = header[0];
+        uint64_t id64;
+        memcpy(&id64, header + 1, sizeof(id64));
+        const long unsigned int id = static_cast<long unsigned int>(id64);
+
+        const size_t payloadSize = PayloadSize(type);
+        if (payloadSize == SIZE_MAX) break; // Corrupt record
+        if (payloadSize > 0 && fread(payload, 1, payloadSize, f) != payloadSize) break; // Torn tail
+
+        switch (type) {
+            case ADD_KEYFRAME: {
+                MapSnapshot::KeyFrameRecord &rec = mKFs[id];
+                rec.mnId = id;
+                memcpy(&rec.mTimeStamp, payload, sizeof(double));
+                ExpandPose(reinterpret_cast<const float*>(payload + sizeof(double)), rec.mTcw);
+                break;
+            }
+            case KEYFRAME_POSE: {
+                auto it = mKFs.find(id);
+                if (it != mKFs.end()) ExpandPose(reinterpret_cast<const float*>(payload), it->second.mTcw);
+                break;
+            }
+            case ERASE_KEYFRAME:
+                mKFs.erase(id);
+                break;
+            case ADD_MAPPOINT: {
+                MapSnapshot::MapPointRecord &rec = mMPs[id];
+                rec.mnId = id;
+                memcpy(rec.mPos, payload, kPosSize);
+                break;
+            }
+            case MAPPOINT_POS: {
+                auto it = mMPs.find(id);
+                if (it != mMPs.end()) memcpy(it->second.mPos, payload, kPosSize);
+                break;
+            }
+            case ERASE_MAPPOINT:
+                mMPs.erase(id);
+                break;
+        }
+    }
+    fclose(f);
+
+    snapshot.mvKeyFrames.clear();
+    snapshot.mvMapPoints.clear();
+    for (const auto &kf : mKFs) snapshot.mvKeyFrames.push_back(kf.second);
+    for (const auto &mp : mMPs) snapshot.mvMapPoints.push_back(mp.second);
+    return true;
+}
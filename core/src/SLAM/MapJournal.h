@@ -0,0 +1,70 @@
+#ifndef MAPJOURNAL_H
+#define MAPJOURNAL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+struct MapSnapshot;
+
+// Append-only log of map edits. Each edit is a small fixed-size binary
+// record (native endianness), so saving the map between compactions only
+// costs an fsync of the tail instead of a rewrite of the whole file.
+class MapJournal {
+public:
+    enum eRecordType : uint8_t {
+        ADD_KEYFRAME = 1,
+        KEYFRAME_POSE = 2,
+        ERASE_KEYFRAME = 3,
+        ADD_MAPPOINT = 4,
+        MAPPOINT_POS = 5,
+        ERASE_MAPPOINT = 6
+    };
+
+    MapJournal();
+    ~MapJournal();
+
+    // Opens filename for appending. bTruncate starts an empty journal.
+    bool Open(const std::string &filename, bool bTruncate);
+    void Close();
+    bool IsOpen();
+
+    // Moves the current journal aside to filename.old and starts an empty one.
+    // Records appended after this call belong to the new journal.
+    bool Rotate();
+    // Deletes the journal moved aside by Rotate once its records are in a base snapshot
+    void DiscardRotated();
+    bool HasRotated();
+    // Deletes a journal file and its rotated file, if any
+    static void Remove(const std::string &filename);
+
+    // Poses are stored as the top 3x4 block of Tcw (row major)
+    void AppendKeyFrame(long unsigned int id, double timeStamp, const float *Tcw);
+    void AppendKeyFramePose(long unsigned int id, const float *Tcw);
+    void AppendEraseKeyFrame(long unsigned int id);
+    void AppendMapPoint(long unsigned int id, const float *pos);
+    void AppendMapPointPos(long unsigned int id, const float *pos);
+    void AppendEraseMapPoint(long unsigned int id);
+
+    // Flushes buffered records and fsyncs the journal
+    bool Sync();
+
+    // Bytes appended since the journal was opened or rotated
+    size_t GetSize();
+
+    // Applies the records of a journal file on top of snapshot.
+    // Stops silently at a torn record at the tail. Returns false if the file is not a journal.
+    static bool Replay(const std::string &filename, MapSnapshot &snapshot);
+
+private:
+    void Append(eRecordType type, long unsigned int id, const void *payload, size_t payloadSize);
+    bool OpenFile(bool bTruncate);
+
+    std::string mFilename;
+    FILE* mpFile;
+    size_t mnBytes;
+    std::mutex mMutexFile;
+};
+
+#endif // MAPJOURNAL_H
@@ -1,15 +1,21 @@
 #include "MapPoint.h"
+#include "Map.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 long unsigned int MapPoint::nNextId = 0;
 
 MapPoint::MapPoint(const cv::Point3f &Pos, KeyFrame* pRefKF, Map* pMap)
-    : mWorldPos(Pos), mpRefKF(pRefKF), mpMap(pMap)
+    : mnTrackReferenceForFrame(0), mWorldPos(Position{Pos.x, Pos.y, Pos.z}), mfMinDistance(0.0f), mfMaxDistance(0.0f),
+      mpRefKF(pRefKF), mpMap(pMap)
 {
     mnId = nNextId++;
 }
 
 MapPoint::MapPoint(long unsigned int id, const cv::Point3f &Pos, Map* pMap)
-    : mnId(id), mWorldPos(Pos), mpRefKF(nullptr), mpMap(pMap)
+    : mnId(id), mnTrackReferenceForFrame(0), mWorldPos(Position{Pos.x, Pos.y, Pos.z}), mfMinDistance(0.0f), mfMaxDistance(0.0f),
+      mpRefKF(nullptr), mpMap(pMap)
 {
     if (mnId >= nNextId) {
         nNextId = mnId + 1;
@@ -17,15 +23,72 @@ MapPoint::MapPoint(long unsigned int id, const cv::Point3f &Pos, Map* pMap)
 }
 
 void MapPoint::SetWorldPos(const cv::Point3f &Pos) {
-    std::unique_lock<std::mutex> lock(mMutexPos);
-    mWorldPos = Pos;
+    mWorldPos.Store(Position{Pos.x, Pos.y, Pos.z});
+    if (mpMap) mpMap->JournalMapPointPos(this, Pos);
 }
 
 cv::Point3f MapPoint::GetWorldPos() {
-    std::unique_lock<std::mutex> lock(mMutexPos);
-    return mWorldPos;
+    const Position p = mWorldPos.Load();
+    return cv::Point3f(p.x, p.y, p.z);
+}
+
+void MapPoint::SetDescriptor(const cv::Mat &descriptor) {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    mDescriptor = descriptor.clone();
+}
+
+cv::Mat MapPoint::GetDescriptor() {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    return mDescriptor.clone();
+}
+
+bool MapPoint::CopyDescriptor(uchar* pOut) {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    if (mDescriptor.empty()) return false;
+    memcpy(pOut, mDescriptor.ptr<uchar>(), mDescriptor.total() * mDescriptor.elemSize());
+    return true;
+}
+
+size_t MapPoint::MemoryBytes() {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    return sizeof(MapPoint) + mDescriptor.total() * mDescriptor.elemSize() +
+           mObservations.size() * (sizeof(KeyFrame*) + sizeof(size_t) + 4 * sizeof(void*));
 }
 
 void MapPoint::AddObservation(KeyFrame* pKF, size_t idx) {
-    // Stub
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    mObservations[pKF] = idx;
+}
+
+void MapPoint::EraseObservation(KeyFrame* pKF) {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    mObservations.erase(pKF);
+}
+
+std::map<KeyFrame*, size_t> MapPoint::GetObservations() {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    return mObservations;
+}
+
+int MapPoint::Observations() {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    return static_cast<int>(mObservations.size());
+}
+
+void MapPoint::UpdateDepth(const cv::Point3f &Ow, int octave, const std::vector<float> &vScaleFactors) {
+    if (vScaleFactors.empty() || octave < 0 || octave >= static_cast<int>(vScaleFactors.size())) return;
+    const float dist = static_cast<float>(cv::norm(GetWorldPos() - Ow));
+
+    // Seen at octave from dist: the same patch is found on level 0 up to
+    // dist * scale(octave) away and on the top level down to that / scale(top)
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    mfMaxDistance = dist * vScaleFactors[octave];
+    mfMinDistance = mfMaxDistance / vScaleFactors.back();
+}
+
+void MapPoint::GetDistanceInvariance(float &minDist, float &maxDist, float &level0Dist) {
+    std::unique_lock<std::mutex> lock(mMutexFeatures);
+    minDist = 0.8f * mfMinDistance;
+    maxDist = 1.2f * mfMaxDistance;
+    level0Dist = mfMaxDistance;
 }
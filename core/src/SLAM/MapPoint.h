@@ -2,7 +2,10 @@
 #define MAPPOINT_H
 
 #include <opencv2/core.hpp>
+#include <map>
 #include <mutex>
+#include "SlotMap.h"
+#include "SeqLock.h"
 
 class KeyFrame;
 class Map;
@@ -16,8 +19,26 @@ public:
     void SetWorldPos(const cv::Point3f &Pos);
     cv::Point3f GetWorldPos();
 
-    // For Blueprint: Simplified observations
+    // Representative ORB descriptor (1x32 CV_8U), empty until matched
+    void SetDescriptor(const cv::Mat &descriptor);
+    cv::Mat GetDescriptor();
+    // Copies the descriptor without allocating. False if there is none yet.
+    bool CopyDescriptor(uchar* pOut);
+
+    // Memory accounting
+    size_t MemoryBytes();
+
+    // Keyframes that see this point, with the feature index in each
     void AddObservation(KeyFrame* pKF, size_t idx);
+    void EraseObservation(KeyFrame* pKF);
+    std::map<KeyFrame*, size_t> GetObservations();
+    int Observations();
+
+    // Scale invariance distances, from an observation at octave seen from Ow
+    void UpdateDepth(const cv::Point3f &Ow, int octave, const std::vector<float> &vScaleFactors);
+    // Distances at which ORB can still find the point on the bottom/top pyramid
+    // level (with some margin) and the distance matching level 0. All 0 while no depth is known.
+    void GetDistanceInvariance(float &minDist, float &maxDist, float &level0Dist);
 
 public:
     long unsigned int mnId;
@@ -25,9 +46,25 @@ public:
 
     long int mnFirstKFid;
 
+    // Slot in the Map's map point storage (managed by Map)
+    SlotHandle mMapSlot;
+
+    // Tracking only: last frame that added this point to its local map
+    long unsigned int mnTrackReferenceForFrame;
+
 protected:
-    cv::Point3f mWorldPos;
-    std::mutex mMutexPos;
+    struct Position {
+        float x, y, z;
+    };
+
+    // Seqlock instead of a per-point mutex: reads are lock-free and far outnumber writes
+    SeqLock<Position> mWorldPos;
+
+    cv::Mat mDescriptor;
+    std::map<KeyFrame*, size_t> mObservations;
+    float mfMinDistance;
+    float mfMaxDistance;
+    std::mutex mMutexFeatures;
 
     Map* mpMap;
     KeyFrame* mpRefKF;
@@ -0,0 +1,102 @@
+#include "MapSaver.h"
+#include <iostream>
+
+MapSaveHandle::MapSaveHandle(const std::string &filename)
+    : mFilename(filename), mProgress(0.0f), mStatus(PENDING)
+{
+}
+
+float MapSaveHandle::GetProgress() const {
+    return mProgress.load();
+}
+
+MapSaveHandle::eStatus MapSaveHandle::GetStatus() const {
+    return static_cast<eStatus>(mStatus.load());
+}
+
+bool MapSaveHandle::IsFinished() const {
+    int status = mStatus.load();
+    return status == DONE || status == FAILED;
+}
+
+bool MapSaveHandle::Wait() {
+    std::unique_lock<std::mutex> lock(mMutexStatus);
+    mCondStatus.wait(lock, [this] { return IsFinished(); });
+    return mStatus.load() == DONE;
+}
+
+void MapSaveHandle::SetStatus(eStatus status) {
+    {
+        std::unique_lock<std::mutex> lock(mMutexStatus);
+        mStatus = status;
+    }
+    mCondStatus.notify_all();
+}
+
+void MapSaveHandle::SetProgress(float progress) {
+    mProgress = progress;
+}
+
+MapSaver::MapSaver(Map* pMap) : mbFinishRequested(false), mpMap(pMap) {
+    mptWriter = new std::thread(&MapSaver::Run, this);
+}
+
+MapSaver::~MapSaver() {
+    Shutdown();
+    delete mptWriter;
+}
+
+std::shared_ptr<MapSaveHandle> MapSaver::Save(std::unique_ptr<MapSnapshot> pSnapshot, const std::string &filename,
+                                              const MapEncoding &encoding) {
+    auto pHandle = std::make_shared<MapSaveHandle>(filename);
+    {
+        std::unique_lock<std::mutex> lock(mMutexRequests);
+        if (mbFinishRequested) {
+            pHandle->SetStatus(MapSaveHandle::FAILED);
+            return pHandle;
+        }
+        mlRequests.push_back(SaveRequest{std::move(pSnapshot), pHandle, encoding});
+    }
+    mCondRequests.notify_one();
+    return pHandle;
+}
+
+void MapSaver::Shutdown() {
+    {
+        std::unique_lock<std::mutex> lock(mMutexRequests);
+        mbFinishRequested = true;
+    }
+    mCondRequests.notify_one();
+
+    if (mptWriter && mptWriter->joinable()) {
+        mptWriter->join();
+    }
+}
+
+void MapSaver::Run() {
+    while (true) {
+        SaveRequest request;
+        {
+            std::unique_lock<std::mutex> lock(mMutexRequests);
+            mCondRequests.wait(lock, [this] { return mbFinishRequested || !mlRequests.empty(); });
+            // Drain queued saves before honouring a finish request
+            if (mlRequests.empty()) break;
+            request = std::move(mlRequests.front());
+            mlRequests.pop_front();
+        }
+
+        MapSaveHandle* pHandle = request.mpHandle.get();
+        pHandle->SetStatus(MapSaveHandle::WRITING);
+
+        bool bOk = Map::WriteSnapshot(*request.mpSnapshot, pHandle->GetFilename(), request.mEncoding,
+                                      [pHandle](float progress) { pHandle->SetProgress(progress); });
+
+        if (bOk) {
+            if (mpMap) mpMap->DiscardStaleJournal(pHandle->GetFilename());
+            std::cout << "Map serialized to " << pHandle->GetFilename() << std::endl;
+        } else {
+            std::cerr << "MapSaver: Failed to write " << pHandle->GetFilename() << std::endl;
+        }
+        pHandle->SetStatus(bOk ? MapSaveHandle::DONE : MapSaveHandle::FAILED);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef MAPSAVER_H
+#define MAPSAVER_H
+
+#include "Map.h"
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Completion handle for an asynchronous map save.
+class MapSaveHandle {
+public:
+    enum eStatus {
+        PENDING = 0,
+        WRITING = 1,
+        DONE = 2,
+        FAILED = 3
+    };
+
+    explicit MapSaveHandle(const std::string &filename);
+
+    const std::string& GetFilename() const { return mFilename; }
+
+    // Fraction of records written, in [0, 1]
+    float GetProgress() const;
+    eStatus GetStatus() const;
+    bool IsFinished() const;
+
+    // Blocks until the save finishes. Returns true if the file was written.
+    bool Wait();
+
+protected:
+    friend class MapSaver;
+
+    void SetStatus(eStatus status);
+    void SetProgress(float progress);
+
+    std::string mFilename;
+    std::atomic<float> mProgress;
+    std::atomic<int> mStatus;
+
+    std::mutex mMutexStatus;
+    std::condition_variable mCondStatus;
+};
+
+// Serializes map snapshots on a background thread so that SaveMap only
+// holds the map lock for the time it takes to copy poses and positions.
+class MapSaver {
+public:
+    // pMap (optional) is told about finished saves so it can drop stale journals
+    explicit MapSaver(Map* pMap = nullptr);
+    ~MapSaver();
+
+    std::shared_ptr<MapSaveHandle> Save(std::unique_ptr<MapSnapshot> pSnapshot, const std::string &filename,
+                                        const MapEncoding &encoding = MapEncoding());
+
+    // Finishes pending saves and stops the writer thread
+    void Shutdown();
+
+private:
+    struct SaveRequest {
+        std::unique_ptr<MapSnapshot> mpSnapshot;
+        std::shared_ptr<MapSaveHandle> mpHandle;
+        MapEncoding mEncoding;
+    };
+
+    void Run();
+
+    std::list<SaveRequest> mlRequests;
+    std::mutex mMutexRequests;
+    std::condition_variable mCondRequests;
+    bool mbFinishRequested;
+
+    Map* mpMap;
+    std::thread* mptWriter;
+};
+
+#endif // MAPSAVER_H
@@ -0,0 +1,399 @@
+#include "MapTileManager.h"
+#include "Map.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const char kTileMagic[8] = {'S', 'S', 'T', 'I', 'L', 'E', '0', '1'};
+
+// Tiles within kLoadRadius (Chebyshev, in tiles) of the camera are loaded;
+// tiles beyond kKeepRadius are evicted. The gap avoids thrashing at borders.
+const int kLoadRadius = 1;
+const int kKeepRadius = 2;
+
+template <typename T>
+void Put(std::vector<uint8_t> &out, const T &v) {
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(&v);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+bool Get(std::istream &is, T &v) {
+    return static_cast<bool>(is.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+int Cell(float v, float tileSize) {
+    if (!std::isfinite(v)) return 0;
+    return static_cast<int>(std::floor(v / tileSize));
+}
+
+int ChebyshevDistance(const std::tuple<int, int, int> &a, const std::tuple<int, int, int> &b) {
+    return std::max({std::abs(std::get<0>(a) - std::get<0>(b)),
+                     std::abs(std::get<1>(a) - std::get<1>(b)),
+                     std::abs(std::get<2>(a) - std::get<2>(b))});
+}
+
+// Camera centre of a row-major Tcw: -R^T * t
+void CameraCenter(const float *Tcw, float *C) {
+    for (int j = 0; j < 3; j++) {
+        C[j] = -(Tcw[0 * 4 + j] * Tcw[3] + Tcw[1 * 4 + j] * Tcw[7] + Tcw[2 * 4 + j] * Tcw[11]);
+    }
+}
+
+} // namespace
+
+MapTileManager::MapTileManager(Map* pMap)
+    : mpMap(pMap), mfTileSize(5.0f), mbHasCurrentKey(false), mbRefreshRequested(false),
+      mbFinishRequested(false), mptLoader(nullptr)
+{
+}
+
+MapTileManager::~MapTileManager() {
+    Close();
+}
+
+bool MapTileManager::IsTiled(const uint8_t *data, size_t size) {
+    return size >= sizeof(kTileMagic) && memcmp(data, kTileMagic, sizeof(kTileMagic)) == 0;
+}
+
+bool MapTileManager::IsTiledFile(const std::string &filename) {
+    std::ifstream f(filename, std::ios::binary);
+    char magic[sizeof(kTileMagic)];
+    if (!f.read(magic, sizeof(magic))) return false;
+    return IsTiled(reinterpret_cast<const uint8_t*>(magic), sizeof(magic));
+}
+
+void MapTileManager::Encode(const MapSnapshot &snapshot, const MapEncoding &encoding, std::vector<uint8_t> &out) {
+    const float tileSize = encoding.mfTileSize > 0.0f ? encoding.mfTileSize : 5.0f;
+
+    // Partition: keyframes by camera centre, map points by position
+    std::map<TileKey, MapSnapshot> tiles;
+    std::map<TileKey, std::vector<KeyFrameEntry>> entries;
+    for (const auto &kf : snapshot.mvKeyFrames) {
+        KeyFrameEntry entry;
+        entry.mnId = kf.mnId;
+        CameraCenter(kf.mTcw, entry.mCenter);
+        TileKey key(Cell(entry.mCenter[0], tileSize), Cell(entry.mCenter[1], tileSize), Cell(entry.mCenter[2], tileSize));
+        tiles[key].mvKeyFrames.push_back(kf);
+        entries[key].push_back(entry);
+    }
+    for (const auto &mp : snapshot.mvMapPoints) {
+        TileKey key(Cell(mp.mPos[0], tileSize), Cell(mp.mPos[1], tileSize), Cell(mp.mPos[2], tileSize));
+        tiles[key].mvMapPoints.push_back(mp);
+    }
+
+    MapEncoding tileEncoding = encoding;
+    tileEncoding.mFormat = MapEncoding::COMPRESSED;
+
+    std::vector<std::vector<uint8_t>> payloads;
+    payloads.reserve(tiles.size());
+    size_t indexSize = sizeof(kTileMagic) + sizeof(float) + sizeof(uint32_t);
+    for (const auto &tile : tiles) {
+        payloads.emplace_back();
+        MapCodec::Encode(tile.second, tileEncoding, payloads.back());
+        indexSize += 3 * sizeof(int32_t) + 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t) +
+                     tile.second.mvKeyFrames.size() * (sizeof(uint64_t) + 3 * sizeof(float));
+    }
+
+    out.clear();
+    out.insert(out.end(), kTileMagic, kTileMagic + sizeof(kTileMagic));
+    Put(out, tileSize);
+    Put(out, static_cast<uint32_t>(tiles.size()));
+
+    uint64_t offset = indexSize;
+    size_t i = 0;
+    for (const auto &tile : tiles) {
+        Put(out, static_cast<int32_t>(std::get<0>(tile.first)));
+        Put(out, static_cast<int32_t>(std::get<1>(tile.first)));
+        Put(out, static_cast<int32_t>(std::get<2>(tile.first)));
+        Put(out, offset);
+        Put(out, static_cast<uint64_t>(payloads[i].size()));
+        Put(out, static_cast<uint32_t>(tile.second.mvMapPoints.size()));
+
+        const std::vector<KeyFrameEntry> &vEntries = entries[tile.first];
+        Put(out, static_cast<uint32_t>(vEntries.size()));
+        for (const auto &entry : vEntries) {
+            Put(out, static_cast<uint64_t>(entry.mnId));
+            Put(out, entry.mCenter[0]);
+            Put(out, entry.mCenter[1]);
+            Put(out, entry.mCenter[2]);
+        }
+        offset += payloads[i].size();
+        i++;
+    }
+
+    for (const auto &payload : payloads) out.insert(out.end(), payload.begin(), payload.end());
+}
+
+namespace {
+
+// fileSize bounds every tile range and list length, so a corrupt index fails
+// here instead of in an allocation on the loader thread
+template <typename TileMap, typename TileT, typename Entry>
+bool ReadIndex(std::istream &is, uint64_t fileSize, float &tileSize, TileMap &tiles) {
+    char magic[sizeof(kTileMagic)];
+    if (!is.read(magic, sizeof(magic)) || memcmp(magic, kTileMagic, sizeof(magic)) != 0) return false;
+
+    uint32_t nTiles;
+    if (!Get(is, tileSize) || !Get(is, nTiles) || !(tileSize > 0.0f)) return false;
+
+    for (uint32_t i = 0; i < nTiles; i++) {
+        int32_t x, y, z;
+        TileT tile;
+        uint32_t nKFs;
+        if (!Get(is, x) || !Get(is, y) || !Get(is, z) || !Get(is, tile.mnOffset) || !Get(is, tile.mnSize) ||
+            !Get(is, tile.mnMapPoints) || !Get(is, nKFs)) {
+            return false;
+        }
+        if (tile.mnSize > fileSize || tile.mnOffset > fileSize - tile.mnSize) return false;
+        // Each entry takes an id and a centre in the index
+        if (nKFs > fileSize / (sizeof(uint64_t) + 3 * sizeof(float))) return false;
+        tile.mvKeyFrames.resize(nKFs);
+        for (uint32_t k = 0; k < nKFs; k++) {
+            uint64_t id;
+            Entry &entry = tile.mvKeyFrames[k];
+            if (!Get(is, id) || !Get(is, entry.mCenter[0]) || !Get(is, entry.mCenter[1]) || !Get(is, entry.mCenter[2])) {
+                return false;
+            }
+            entry.mnId = static_cast<long unsigned int>(id);
+        }
+        tiles[std::make_tuple(int(x), int(y), int(z))] = std::move(tile);
+    }
+    return true;
+}
+
+} // namespace
+
+bool MapTileManager::Decode(const uint8_t *data, size_t size, MapSnapshot &snapshot) {
+    std::istringstream is(std::string(reinterpret_cast<const char*>(data), size));
+    float tileSize;
+    std::map<TileKey, Tile> tiles;
+    if (!ReadIndex<std::map<TileKey, Tile>, Tile, KeyFrameEntry>(is, size, tileSize, tiles)) return false;
+
+    snapshot.mvKeyFrames.clear();
+    snapshot.mvMapPoints.clear();
+    for (const auto &tile : tiles) {
+        if (tile.second.mnSize > size || tile.second.mnOffset > size - tile.second.mnSize) return false;
+        MapSnapshot part;
+        if (!MapCodec::Decode(data + tile.second.mnOffset, static_cast<size_t>(tile.second.mnSize), part)) return false;
+        snapshot.mvKeyFrames.insert(snapshot.mvKeyFrames.end(), part.mvKeyFrames.begin(), part.mvKeyFrames.end());
+        snapshot.mvMapPoints.insert(snapshot.mvMapPoints.end(), part.mvMapPoints.begin(), part.mvMapPoints.end());
+    }
+    return true;
+}
+
+bool MapTileManager::Open(const std::string &filename) {
+    Close();
+
+    std::ifstream f(filename, std::ios::binary);
+    if (!f.is_open()) return false;
+    f.seekg(0, std::ios::end);
+    const std::streamoff fileSize = f.tellg();
+    f.seekg(0);
+    if (fileSize < 0) return false;
+
+    {
+        std::unique_lock<std::mutex> lock(mMutexTiles);
+        if (!ReadIndex<std::map<TileKey, Tile>, Tile, KeyFrameEntry>(f, static_cast<uint64_t>(fileSize), mfTileSize, mTiles)) {
+            mTiles.clear();
+            return false;
+        }
+        mFilename = filename;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mMutexRequest);
+        mbHasCurrentKey = false;
+        mbRefreshRequested = false;
+        mbFinishRequested = false;
+    }
+    mptLoader = new std::thread(&MapTileManager::Run, this);
+
+    std::cout << "MapTileManager: Opened " << filename << " (" << mTiles.size() << " tiles)" << std::endl;
+    return true;
+}
+
+void MapTileManager::Close() {
+    if (mptLoader) {
+        {
+            std::unique_lock<std::mutex> lock(mMutexRequest);
+            mbFinishRequested = true;
+        }
+        mCondRequest.notify_one();
+        if (mptLoader->joinable()) mptLoader->join();
+        delete mptLoader;
+        mptLoader = nullptr;
+    }
+
+    // Loaded tiles stay in the map; only our bookkeeping goes away
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    mTiles.clear();
+    mFilename.clear();
+}
+
+bool MapTileManager::IsOpen() {
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    return !mFilename.empty();
+}
+
+MapTileManager::TileKey MapTileManager::KeyFor(const cv::Point3f &p) const {
+    return TileKey(Cell(p.x, mfTileSize), Cell(p.y, mfTileSize), Cell(p.z, mfTileSize));
+}
+
+void MapTileManager::UpdateActiveRegion(const cv::Point3f &center) {
+    if (!mptLoader) return;
+
+    const TileKey key = KeyFor(center);
+    {
+        std::unique_lock<std::mutex> lock(mMutexRequest);
+        if (mbHasCurrentKey && key == mCurrentKey) return;
+        mCurrentKey = key;
+        mbHasCurrentKey = true;
+        mbRefreshRequested = true;
+    }
+    mCondRequest.notify_one();
+}
+
+void MapTileManager::LoadTilesAround(const cv::Point3f &center) {
+    if (!IsOpen()) return;
+    Refresh(KeyFor(center));
+}
+
+void MapTileManager::Run() {
+    while (true) {
+        TileKey key;
+        {
+            std::unique_lock<std::mutex> lock(mMutexRequest);
+            mCondRequest.wait(lock, [this] { return mbFinishRequested || mbRefreshRequested; });
+            if (mbFinishRequested) break;
+            key = mCurrentKey;
+            mbRefreshRequested = false;
+        }
+        Refresh(key);
+    }
+}
+
+void MapTileManager::Refresh(const TileKey &center) {
+    std::unique_lock<std::mutex> lockLoad(mMutexLoad);
+    std::vector<TileKey> vToLoad;
+    bool bEvicted = false;
+    {
+        std::unique_lock<std::mutex> lock(mMutexTiles);
+
+        for (auto &tile : mTiles) {
+            const int d = ChebyshevDistance(tile.first, center);
+            if (tile.second.mbLoaded && d > kKeepRadius) {
+                EvictTile(tile.second);
+                bEvicted = true;
+            } else if (!tile.second.mbLoaded && d <= kLoadRadius) {
+                vToLoad.push_back(tile.first);
+            }
+        }
+    }
+    // Loaded tiles publish through Map::LoadSnapshot
+    if (bEvicted) mpMap->PublishView();
+
+    for (const TileKey &key : vToLoad) {
+        Tile tile;
+        {
+            std::unique_lock<std::mutex> lock(mMutexTiles);
+            auto it = mTiles.find(key);
+            if (it == mTiles.end() || it->second.mbLoaded) continue;
+            tile.mnOffset = it->second.mnOffset;
+            tile.mnSize = it->second.mnSize;
+        }
+
+        // File IO and decoding happen without holding the index lock
+        if (!LoadTile(key, tile)) continue;
+
+        std::unique_lock<std::mutex> lock(mMutexTiles);
+        auto it = mTiles.find(key);
+        if (it == mTiles.end()) continue;
+        it->second.mvpKeyFrames = std::move(tile.mvpKeyFrames);
+        it->second.mvpMapPoints = std::move(tile.mvpMapPoints);
+        it->second.mbLoaded = true;
+    }
+}
+
+bool MapTileManager::LoadTile(const TileKey &key, Tile &tile) {
+    std::ifstream f(mFilename, std::ios::binary);
+    if (!f.is_open()) return false;
+
+    std::vector<uint8_t> data(static_cast<size_t>(tile.mnSize));
+    f.seekg(static_cast<std::streamoff>(tile.mnOffset));
+    if (!f.read(reinterpret_cast<char*>(data.data()), data.size())) return false;
+
+    MapSnapshot snapshot;
+    if (!MapCodec::Decode(data.data(), data.size(), snapshot)) {
+        std::cerr << "MapTileManager: Corrupt tile (" << std::get<0>(key) << ", " << std::get<1>(key)
+                  << ", " << std::get<2>(key) << ")" << std::endl;
+        return false;
+    }
+
+    mpMap->LoadSnapshot(snapshot, &tile.mvpKeyFrames, &tile.mvpMapPoints);
+    return true;
+}
+
+void MapTileManager::EvictTile(Tile &tile) {
+    // Tracking or the mapping threads may still hold these; the map frees them once they let go
+    mpMap->Retire(tile.mvpKeyFrames, tile.mvpMapPoints);
+    tile.mvpKeyFrames.clear();
+    tile.mvpMapPoints.clear();
+    tile.mbLoaded = false;
+}
+
+std::vector<MapTileManager::KeyFrameEntry> MapTileManager::GetKeyFrameCandidates(const cv::Point3f &pos, float radius) {
+    std::vector<KeyFrameEntry> vCandidates;
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    if (mTiles.empty()) return vCandidates;
+
+    const TileKey center = KeyFor(pos);
+    const int r = static_cast<int>(std::ceil(radius / mfTileSize));
+    const float radius2 = radius * radius;
+
+    for (const auto &tile : mTiles) {
+        if (ChebyshevDistance(tile.first, center) > r) continue;
+        for (const auto &entry : tile.second.mvKeyFrames) {
+            const float dx = entry.mCenter[0] - pos.x;
+            const float dy = entry.mCenter[1] - pos.y;
+            const float dz = entry.mCenter[2] - pos.z;
+            if (dx * dx + dy * dy + dz * dz <= radius2) vCandidates.push_back(entry);
+        }
+    }
+    return vCandidates;
+}
+
+bool MapTileManager::GetNearestKeyFrame(const cv::Point3f &pos, KeyFrameEntry &entry) {
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    float bestDist = INFINITY;
+    for (const auto &tile : mTiles) {
+        for (const auto &e : tile.second.mvKeyFrames) {
+            const float dx = e.mCenter[0] - pos.x;
+            const float dy = e.mCenter[1] - pos.y;
+            const float dz = e.mCenter[2] - pos.z;
+            const float d = dx * dx + dy * dy + dz * dz;
+            if (d < bestDist) {
+                bestDist = d;
+                entry = e;
+            }
+        }
+    }
+    return std::isfinite(bestDist);
+}
+
+size_t MapTileManager::GetTileCount() {
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    return mTiles.size();
+}
+
+size_t MapTileManager::GetLoadedTileCount() {
+    std::unique_lock<std::mutex> lock(mMutexTiles);
+    size_t n = 0;
+    for (const auto &tile : mTiles) n += tile.second.mbLoaded ? 1 : 0;
+    return n;
+}
@@ -0,0 +1,100 @@
+#ifndef MAPTILEMANAGER_H
+#define MAPTILEMANAGER_H
+
+#include "MapCodec.h"
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+class Map;
+class KeyFrame;
+class MapPoint;
+struct MapSnapshot;
+
+// Tiled map files: the map is cut into cubic tiles of mfTileSize, each stored
+// as a MapCodec blob, behind an index that lists every tile's keyframes and
+// their centres. The manager keeps only the tiles around the current pose
+// resident, loading and evicting them on a background thread.
+class MapTileManager {
+public:
+    struct KeyFrameEntry {
+        long unsigned int mnId;
+        float mCenter[3];
+    };
+
+    MapTileManager(Map* pMap);
+    ~MapTileManager();
+
+    // Tiled file encoding (used by Map::WriteSnapshot / Map::ReadSnapshot)
+    static void Encode(const MapSnapshot &snapshot, const MapEncoding &encoding, std::vector<uint8_t> &out);
+    static bool Decode(const uint8_t *data, size_t size, MapSnapshot &snapshot);
+    static bool IsTiled(const uint8_t *data, size_t size);
+    static bool IsTiledFile(const std::string &filename);
+
+    // Reads only the tile index and starts the loader thread.
+    // The map should be empty; tiles are added to it as they are loaded.
+    bool Open(const std::string &filename);
+    void Close();
+    bool IsOpen();
+
+    // Cheap, called by Tracking every frame. Wakes the loader when the camera enters a new tile.
+    void UpdateActiveRegion(const cv::Point3f &center);
+
+    // Synchronously loads the tiles around center (e.g. before relocalization)
+    void LoadTilesAround(const cv::Point3f &center);
+
+    // Relocalization support: keyframes from the index within radius of pos, resident or not
+    std::vector<KeyFrameEntry> GetKeyFrameCandidates(const cv::Point3f &pos, float radius);
+    // Nearest indexed keyframe to pos. Returns false if the index is empty.
+    bool GetNearestKeyFrame(const cv::Point3f &pos, KeyFrameEntry &entry);
+
+    size_t GetTileCount();
+    size_t GetLoadedTileCount();
+
+private:
+    typedef std::tuple<int, int, int> TileKey;
+
+    struct Tile {
+        uint64_t mnOffset;
+        uint64_t mnSize;
+        uint32_t mnMapPoints;
+        std::vector<KeyFrameEntry> mvKeyFrames;
+
+        bool mbLoaded = false;
+        std::vector<KeyFrame*> mvpKeyFrames;
+        std::vector<MapPoint*> mvpMapPoints;
+    };
+
+    TileKey KeyFor(const cv::Point3f &p) const;
+    void Run();
+    // Loads tiles within the load radius of center and evicts those beyond the keep radius
+    void Refresh(const TileKey &center);
+    bool LoadTile(const TileKey &key, Tile &tile);
+    void EvictTile(Tile &tile);
+
+    Map* mpMap;
+    std::string mFilename;
+    float mfTileSize;
+
+    std::map<TileKey, Tile> mTiles;
+    std::mutex mMutexTiles;
+    // Serializes Refresh between the loader thread and LoadTilesAround
+    std::mutex mMutexLoad;
+
+    // Loader thread
+    TileKey mCurrentKey;
+    bool mbHasCurrentKey;
+    bool mbRefreshRequested;
+    bool mbFinishRequested;
+    std::mutex mMutexRequest;
+    std::condition_variable mCondRequest;
+    std::thread* mptLoader;
+};
+
+#endif // MAPTILEMANAGER_H
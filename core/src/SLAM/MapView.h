@@ -0,0 +1,34 @@
+#ifndef MAPVIEW_H
+#define MAPVIEW_H
+
+#include "SE3.h"
+#include "SlotMap.h"
+#include <cstdint>
+#include <vector>
+
+class KeyFrame;
+
+// Immutable copy of keyframe poses and map point positions, published by Map
+// after each mapping step. Readers hold it through a shared_ptr and need no
+// locks; a version is freed when its last reader drops it.
+struct MapView {
+    struct KeyFrameView {
+        // Identity only: the keyframe may leave the map after publication, never dereference
+        KeyFrame* mpKF;
+        // Checks with Map::ContainsKeyFrame that mpKF is still that keyframe
+        SlotHandle mSlot;
+        long unsigned int mnId;
+        double mTimeStamp;
+        SE3f mTcw;
+        // Camera centre in world coordinates
+        cv::Point3f mOw;
+    };
+
+    uint64_t mnVersion = 0;
+    std::vector<KeyFrameView> mvKeyFrames;
+    std::vector<long unsigned int> mvMapPointIds;
+    // xyz per map point, parallel to mvMapPointIds
+    std::vector<float> mvMapPointPositions;
+};
+
+#endif // MAPVIEW_H
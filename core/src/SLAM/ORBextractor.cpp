@@ -9,14 +9,20 @@ ORBextractor::ORBextractor(int nfeatures, float scaleFactor, int nlevels, int in
 void ORBextractor::operator()(cv::Mat image, cv::Mat mask,
                               std::vector<cv::KeyPoint>& keypoints,
                               cv::Mat& descriptors) {
+    (*this)(image, mask, keypoints, descriptors, nfeatures);
+}
+
+void ORBextractor::operator()(cv::Mat image, cv::Mat mask,
+                              std::vector<cv::KeyPoint>& keypoints,
+                              cv::Mat& descriptors, int nFeatures) {
     // Real implementation using OpenCV's ORB
-    if (image.empty()) return;
+    if (image.empty() || nFeatures <= 0) return;
 
     // Create OpenCV ORB detector with parameters
     // Note: nlevels and scaleFactor map directly. iniThFAST maps to fastThreshold.
     // scoreType, WTA_K etc are left as defaults.
     cv::Ptr<cv::ORB> orb = cv::ORB::create(
-        nfeatures,
+        nFeatures,
         scaleFactor,
         nlevels,
         31, // edgeThreshold
@@ -18,6 +18,19 @@ public:
                     std::vector<cv::KeyPoint>& keypoints,
                     cv::Mat& descriptors);
 
+    // Same with a feature budget for this image instead of nfeatures
+    void operator()(cv::Mat image, cv::Mat mask,
+                    std::vector<cv::KeyPoint>& keypoints,
+                    cv::Mat& descriptors, int nFeatures);
+
+    int inline GetFeatures() {
+        return nfeatures;
+    }
+
+    // Load shedding: later extractions use these (the pyramid scale stays)
+    void SetFeatures(int n) { nfeatures = n; }
+    void SetLevels(int n) { nlevels = n; }
+
     int inline GetLevels() {
         return nlevels;
     }
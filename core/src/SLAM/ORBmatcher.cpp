@@ -0,0 +1,457 @@
+#include "ORBmatcher.h"
+#include "KeyFrame.h"
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+// Descriptor rows of the features in vMask (all if empty), flattened over the faces
+void GatherDescriptors(const std::vector<cv::Mat> &vDescriptors, const std::vector<bool> &vbMask,
+                       std::vector<const uchar*> &vRows, std::vector<int> &vIndices) {
+    vRows.clear();
+    vIndices.clear();
+    int idx = 0;
+    for (const cv::Mat &desc : vDescriptors) {
+        for (int r = 0; r < desc.rows; r++, idx++) {
+            if (!vbMask.empty() && (idx >= static_cast<int>(vbMask.size()) || !vbMask[idx])) continue;
+            vRows.push_back(desc.ptr<uchar>(r));
+            vIndices.push_back(idx);
+        }
+    }
+}
+}
+
+ORBmatcher::ORBmatcher(float nnratio, bool checkOri)
+    : mfNNratio(nnratio), mbCheckOrientation(checkOri) {
+}
+
+int ORBmatcher::DescriptorDistance(const uchar* a, const uchar* b) {
+    int dist = 0;
+    for (int i = 0; i < 4; i++) {
+        uint64_t va, vb;
+        memcpy(&va, a + 8 * i, sizeof(va));
+        memcpy(&vb, b + 8 * i, sizeof(vb));
+        dist += __builtin_popcountll(va ^ vb);
+    }
+    return dist;
+}
+
+int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b) {
+    return DescriptorDistance(a.ptr<uchar>(), b.ptr<uchar>());
+}
+
+int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th) {
+    int nmatches = 0;
+
+    // Rotation histogram to check consistency
+    std::vector<int> rotHist[HISTO_LENGTH];
+    for (int i = 0; i < HISTO_LENGTH; i++) rotHist[i].reserve(500);
+    const float factor = HISTO_LENGTH / 360.0f;
+
+    const int nLevels = static_cast<int>(CurrentFrame.mvScaleFactors.size());
+
+    for (int f = 0; f < static_cast<int>(LastFrame.mvKeys.size()); f++) {
+        if (f >= static_cast<int>(LastFrame.mDescriptors.size()) || LastFrame.mDescriptors[f].empty()) continue;
+
+        for (size_t i = 0; i < LastFrame.mvKeys[f].size(); i++) {
+            MapPoint* pMP = LastFrame.mvpMapPoints[LastFrame.mvFaceOffset[f] + i];
+            if (!pMP) continue;
+
+            int face;
+            cv::Point2f uv;
+            if (!CurrentFrame.ProjectPoint(pMP->GetWorldPos(), face, uv)) continue;
+
+            // Same scale as in the last frame, one level of slack either way
+            const cv::KeyPoint &lastKey = LastFrame.mvKeys[f][i];
+            const int nLastOctave = lastKey.octave;
+            const float scale = (nLastOctave >= 0 && nLastOctave < nLevels) ? CurrentFrame.mvScaleFactors[nLastOctave] : 1.0f;
+            const float radius = th * scale;
+
+            const std::vector<size_t> vIndices = CurrentFrame.GetFeaturesInArea(face, uv.x, uv.y, radius,
+                                                                               nLastOctave - 1, nLastOctave + 1);
+            if (vIndices.empty()) continue;
+
+            const uchar* dMP = LastFrame.mDescriptors[f].ptr<uchar>(static_cast<int>(i));
+
+            int bestDist = 256;
+            int bestIdx = -1;
+            for (size_t idx : vIndices) {
+                if (CurrentFrame.mvpMapPoints[idx]) continue;
+
+                const int cf = CurrentFrame.GetFace(idx);
+                const uchar* d = CurrentFrame.mDescriptors[cf].ptr<uchar>(static_cast<int>(idx - CurrentFrame.mvFaceOffset[cf]));
+                const int dist = DescriptorDistance(dMP, d);
+                if (dist < bestDist) {
+                    bestDist = dist;
+                    bestIdx = static_cast<int>(idx);
+                }
+            }
+
+            if (bestDist > TH_HIGH) continue;
+
+            CurrentFrame.mvpMapPoints[bestIdx] = pMP;
+            nmatches++;
+
+            if (mbCheckOrientation) {
+                float rot = lastKey.angle - CurrentFrame.GetKey(bestIdx).angle;
+                if (rot < 0.0f) rot += 360.0f;
+                int bin = static_cast<int>(std::round(rot * factor));
+                if (bin == HISTO_LENGTH) bin = 0;
+                rotHist[bin].push_back(bestIdx);
+            }
+        }
+    }
+
+    // Apply rotation consistency
+    if (mbCheckOrientation) {
+        int ind1 = -1, ind2 = -1, ind3 = -1;
+        ComputeThreeMaxima(rotHist, HISTO_LENGTH, ind1, ind2, ind3);
+        for (int i = 0; i < HISTO_LENGTH; i++) {
+            if (i == ind1 || i == ind2 || i == ind3) continue;
+            for (size_t j = 0; j < rotHist[i].size(); j++) {
+                CurrentFrame.mvpMapPoints[rotHist[i][j]] = nullptr;
+                nmatches--;
+            }
+        }
+    }
+
+    return nmatches;
+}
+
+int ORBmatcher::SearchByProjection(Frame &F, const std::vector<ProjectedMapPoint> &vProjected, const float th) {
+    int nmatches = 0;
+    const int nLevels = static_cast<int>(F.mvScaleFactors.size());
+    uchar dMP[32];
+
+    for (const ProjectedMapPoint &proj : vProjected) {
+        const int nPredictedLevel = proj.mnPredictedLevel;
+        const float scale = (nPredictedLevel >= 0 && nPredictedLevel < nLevels) ? F.mvScaleFactors[nPredictedLevel] : 1.0f;
+        const float radius = th * scale;
+
+        // Without a depth estimate any level may hold the point
+        const std::vector<size_t> vIndices = nPredictedLevel >= 0
+            ? F.GetFeaturesInArea(proj.mnFace, proj.mUV.x, proj.mUV.y, radius, nPredictedLevel - 1, nPredictedLevel)
+            : F.GetFeaturesInArea(proj.mnFace, proj.mUV.x, proj.mUV.y, radius);
+        if (vIndices.empty()) continue;
+
+        if (!proj.mpMP->CopyDescriptor(dMP)) continue;
+
+        int bestDist = 256;
+        int bestLevel = -1;
+        int bestDist2 = 256;
+        int bestLevel2 = -1;
+        int bestIdx = -1;
+        for (size_t idx : vIndices) {
+            if (F.mvpMapPoints[idx]) continue;
+
+            const int cf = F.GetFace(idx);
+            const uchar* d = F.mDescriptors[cf].ptr<uchar>(static_cast<int>(idx - F.mvFaceOffset[cf]));
+            const int dist = DescriptorDistance(dMP, d);
+            const int level = F.mvKeys[cf][idx - F.mvFaceOffset[cf]].octave;
+            if (dist < bestDist) {
+                bestDist2 = bestDist;
+                bestLevel2 = bestLevel;
+                bestDist = dist;
+                bestLevel = level;
+                bestIdx = static_cast<int>(idx);
+            } else if (dist < bestDist2) {
+                bestDist2 = dist;
+                bestLevel2 = level;
+            }
+        }
+
+        if (bestDist > TH_HIGH) continue;
+        // Ambiguous if a similar feature sits on the same level
+        if (bestLevel == bestLevel2 && bestDist > mfNNratio * bestDist2) continue;
+
+        F.mvpMapPoints[bestIdx] = proj.mpMP;
+        nmatches++;
+    }
+
+    return nmatches;
+}
+
+int ORBmatcher::SearchForInitialization(const Frame &F1, const Frame &F2, std::vector<cv::Point2f> &vPrevMatched,
+                                        std::vector<int> &vnMatches12, int windowSize) {
+    int nmatches = 0;
+    vnMatches12.assign(F1.N, -1);
+
+    std::vector<int> rotHist[HISTO_LENGTH];
+    for (int i = 0; i < HISTO_LENGTH; i++) rotHist[i].reserve(500);
+    const float factor = HISTO_LENGTH / 360.0f;
+
+    std::vector<int> vMatchedDistance(F2.N, INT_MAX);
+    std::vector<int> vnMatches21(F2.N, -1);
+
+    for (int i1 = 0; i1 < F1.N; i1++) {
+        const int f = F1.GetFace(i1);
+        if (f >= static_cast<int>(F2.mvKeys.size())) continue;
+        const cv::KeyPoint &kp1 = F1.GetKey(i1);
+        const int level1 = kp1.octave;
+
+        const std::vector<size_t> vIndices2 = F2.GetFeaturesInArea(f, vPrevMatched[i1].x, vPrevMatched[i1].y,
+                                                                   static_cast<float>(windowSize), level1, level1);
+        if (vIndices2.empty()) continue;
+
+        const uchar* d1 = F1.mDescriptors[f].ptr<uchar>(i1 - F1.mvFaceOffset[f]);
+
+        int bestDist = INT_MAX;
+        int bestDist2 = INT_MAX;
+        int bestIdx2 = -1;
+        for (size_t i2 : vIndices2) {
+            const uchar* d2 = F2.mDescriptors[f].ptr<uchar>(static_cast<int>(i2 - F2.mvFaceOffset[f]));
+            const int dist = DescriptorDistance(d1, d2);
+            if (vMatchedDistance[i2] <= dist) continue;
+            if (dist < bestDist) {
+                bestDist2 = bestDist;
+                bestDist = dist;
+                bestIdx2 = static_cast<int>(i2);
+            } else if (dist < bestDist2) {
+                bestDist2 = dist;
+            }
+        }
+
+        if (bestDist > TH_LOW || bestDist >= mfNNratio * bestDist2) continue;
+
+        // F2 feature already taken by a worse match: replace it
+        if (vnMatches21[bestIdx2] >= 0) {
+            vnMatches12[vnMatches21[bestIdx2]] = -1;
+            nmatches--;
+        }
+        vnMatches12[i1] = bestIdx2;
+        vnMatches21[bestIdx2] = i1;
+        vMatchedDistance[bestIdx2] = bestDist;
+        nmatches++;
+
+        if (mbCheckOrientation) {
+            float rot = kp1.angle - F2.GetKey(bestIdx2).angle;
+            if (rot < 0.0f) rot += 360.0f;
+            int bin = static_cast<int>(std::round(rot * factor));
+            if (bin == HISTO_LENGTH) bin = 0;
+            rotHist[bin].push_back(i1);
+        }
+    }
+
+    if (mbCheckOrientation) {
+        int ind1 = -1, ind2 = -1, ind3 = -1;
+        ComputeThreeMaxima(rotHist, HISTO_LENGTH, ind1, ind2, ind3);
+        for (int i = 0; i < HISTO_LENGTH; i++) {
+            if (i == ind1 || i == ind2 || i == ind3) continue;
+            for (int i1 : rotHist[i]) {
+                if (vnMatches12[i1] >= 0) {
+                    vnMatches12[i1] = -1;
+                    nmatches--;
+                }
+            }
+        }
+    }
+
+    // The window follows the features
+    for (int i1 = 0; i1 < F1.N; i1++) {
+        if (vnMatches12[i1] >= 0) vPrevMatched[i1] = F2.GetKey(vnMatches12[i1]).pt;
+    }
+
+    return nmatches;
+}
+
+int ORBmatcher::SearchByRotation(const Frame &F1, const Frame &F2, const float th, std::vector<int> &vnMatches12) {
+    vnMatches12.assign(F1.N, -1);
+    if (!F1.HasPose() || !F2.HasPose()) return 0;
+
+    // Feature of F1 holding each feature of F2, so a closer match takes it over
+    std::vector<int> vnMatches21(F2.N, -1);
+    std::vector<int> vMatchedDistance(F2.N, INT_MAX);
+    const int nLevels = static_cast<int>(F2.mvScaleFactors.size());
+    const SE3f Twc1 = F1.GetPoseInverse();
+    int nmatches = 0;
+
+    for (int f = 0; f < static_cast<int>(F1.mvKeys.size()); f++) {
+        if (f >= static_cast<int>(F1.mDescriptors.size()) || F1.mDescriptors[f].empty()) continue;
+
+        for (size_t i = 0; i < F1.mvKeys[f].size(); i++) {
+            const size_t idx1 = F1.mvFaceOffset[f] + i;
+            const cv::Point3f b = F1.GetBearing(idx1);
+            if (b.dot(b) == 0.0f) continue;
+
+            // Any point along the ray projects alike when the centres coincide
+            int face;
+            cv::Point2f uv;
+            if (!F2.ProjectPoint(Twc1 * b, face, uv)) continue;
+
+            const int nOctave = F1.mvKeys[f][i].octave;
+            const float scale = (nOctave >= 0 && nOctave < nLevels) ? F2.mvScaleFactors[nOctave] : 1.0f;
+            const std::vector<size_t> vIndices = F2.GetFeaturesInArea(face, uv.x, uv.y, th * scale, nOctave - 1, nOctave + 1);
+            if (vIndices.empty()) continue;
+
+            const uchar* d1 = F1.mDescriptors[f].ptr<uchar>(static_cast<int>(i));
+            int bestDist = INT_MAX;
+            int bestDist2 = INT_MAX;
+            int bestIdx2 = -1;
+            for (size_t idx2 : vIndices) {
+                const int cf = F2.GetFace(idx2);
+                const uchar* d2 = F2.mDescriptors[cf].ptr<uchar>(static_cast<int>(idx2 - F2.mvFaceOffset[cf]));
+                const int dist = DescriptorDistance(d1, d2);
+                if (vMatchedDistance[idx2] <= dist) continue;
+                if (dist < bestDist) {
+                    bestDist2 = bestDist;
+                    bestDist = dist;
+                    bestIdx2 = static_cast<int>(idx2);
+                } else if (dist < bestDist2) {
+                    bestDist2 = dist;
+                }
+            }
+
+            if (bestDist > TH_HIGH || bestDist >= mfNNratio * bestDist2) continue;
+
+            const int owner = vnMatches21[bestIdx2];
+            if (owner >= 0) {
+                vnMatches12[owner] = -1;
+                nmatches--;
+            }
+            vnMatches12[idx1] = bestIdx2;
+            vnMatches21[bestIdx2] = static_cast<int>(idx1);
+            vMatchedDistance[bestIdx2] = bestDist;
+            nmatches++;
+        }
+    }
+
+    return nmatches;
+}
+
+int ORBmatcher::SearchByDescriptor(const Frame &F1, const Frame &F2, std::vector<int> &vnMatches12) {
+    vnMatches12.assign(F1.N, -1);
+
+    std::vector<const uchar*> vQuery, vTrain;
+    std::vector<int> vQueryIdx, vTrainIdx;
+    GatherDescriptors(F1.mDescriptors, std::vector<bool>(), vQuery, vQueryIdx);
+    GatherDescriptors(F2.mDescriptors, std::vector<bool>(), vTrain, vTrainIdx);
+
+    std::vector<int> vMatches, vDist;
+    const int nmatches = MatchDescriptors(vQuery, vTrain, vMatches, vDist);
+    for (size_t i = 0; i < vMatches.size(); i++) {
+        if (vMatches[i] >= 0) vnMatches12[vQueryIdx[i]] = vTrainIdx[vMatches[i]];
+    }
+    return nmatches;
+}
+
+int ORBmatcher::MatchDescriptors(const std::vector<const uchar*> &vQuery, const std::vector<const uchar*> &vTrain,
+                                 std::vector<int> &vMatches, std::vector<int> &vDistances) {
+    vMatches.assign(vQuery.size(), -1);
+    vDistances.assign(vQuery.size(), 256);
+    // Query matched to each train row, so a better query can take it over
+    std::vector<int> vTrainOwner(vTrain.size(), -1);
+    int nmatches = 0;
+
+    for (size_t i = 0; i < vQuery.size(); i++) {
+        int bestDist = 256;
+        int bestDist2 = 256;
+        int bestIdx = -1;
+        for (size_t j = 0; j < vTrain.size(); j++) {
+            const int dist = DescriptorDistance(vQuery[i], vTrain[j]);
+            if (dist < bestDist) {
+                bestDist2 = bestDist;
+                bestDist = dist;
+                bestIdx = static_cast<int>(j);
+            } else if (dist < bestDist2) {
+                bestDist2 = dist;
+            }
+        }
+
+        if (bestDist > TH_LOW || bestDist > mfNNratio * bestDist2) continue;
+
+        const int owner = vTrainOwner[bestIdx];
+        if (owner >= 0) {
+            if (vDistances[owner] <= bestDist) continue;
+            vMatches[owner] = -1;
+            vDistances[owner] = 256;
+            nmatches--;
+        }
+        vTrainOwner[bestIdx] = static_cast<int>(i);
+        vMatches[i] = bestIdx;
+        vDistances[i] = bestDist;
+        nmatches++;
+    }
+
+    return nmatches;
+}
+
+int ORBmatcher::SearchByDescriptor(KeyFrame* pKF, const Frame &F, std::vector<MapPoint*> &vpMapPointMatches,
+                                   std::vector<int> &vDistances) {
+    vpMapPointMatches.assign(F.N, nullptr);
+    vDistances.assign(F.N, 256);
+
+    std::shared_ptr<const KeyFramePayload> pPayload = pKF->GetPayload();
+    if (!pPayload) return 0;
+    const std::vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+
+    std::vector<bool> vbHasMP(vpMPs.size());
+    for (size_t i = 0; i < vpMPs.size(); i++) vbHasMP[i] = vpMPs[i] != nullptr;
+
+    std::vector<const uchar*> vQuery, vTrain;
+    std::vector<int> vQueryIdx, vTrainIdx;
+    GatherDescriptors(pPayload->mDescriptors, vbHasMP, vQuery, vQueryIdx);
+    GatherDescriptors(F.mDescriptors, std::vector<bool>(), vTrain, vTrainIdx);
+
+    std::vector<int> vMatches, vDist;
+    const int nmatches = MatchDescriptors(vQuery, vTrain, vMatches, vDist);
+    for (size_t i = 0; i < vMatches.size(); i++) {
+        if (vMatches[i] < 0) continue;
+        const int idxF = vTrainIdx[vMatches[i]];
+        vpMapPointMatches[idxF] = vpMPs[vQueryIdx[i]];
+        vDistances[idxF] = vDist[i];
+    }
+    return nmatches;
+}
+
+int ORBmatcher::SearchByDescriptor(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches12) {
+    const std::vector<MapPoint*> vpMPs1 = pKF1->GetMapPointMatches();
+    const std::vector<MapPoint*> vpMPs2 = pKF2->GetMapPointMatches();
+    vpMatches12.assign(vpMPs1.size(), nullptr);
+
+    std::shared_ptr<const KeyFramePayload> pPayload1 = pKF1->GetPayload();
+    std::shared_ptr<const KeyFramePayload> pPayload2 = pKF2->GetPayload();
+    if (!pPayload1 || !pPayload2) return 0;
+
+    std::vector<bool> vbHasMP1(vpMPs1.size()), vbHasMP2(vpMPs2.size());
+    for (size_t i = 0; i < vpMPs1.size(); i++) vbHasMP1[i] = vpMPs1[i] != nullptr;
+    for (size_t i = 0; i < vpMPs2.size(); i++) vbHasMP2[i] = vpMPs2[i] != nullptr;
+
+    std::vector<const uchar*> vQuery, vTrain;
+    std::vector<int> vQueryIdx, vTrainIdx;
+    GatherDescriptors(pPayload1->mDescriptors, vbHasMP1, vQuery, vQueryIdx);
+    GatherDescriptors(pPayload2->mDescriptors, vbHasMP2, vTrain, vTrainIdx);
+
+    std::vector<int> vMatches, vDist;
+    const int nmatches = MatchDescriptors(vQuery, vTrain, vMatches, vDist);
+    for (size_t i = 0; i < vMatches.size(); i++) {
+        if (vMatches[i] >= 0) vpMatches12[vQueryIdx[i]] = vpMPs2[vTrainIdx[vMatches[i]]];
+    }
+    return nmatches;
+}
+
+void ORBmatcher::ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3) {
+    int max1 = 0, max2 = 0, max3 = 0;
+
+    for (int i = 0; i < L; i++) {
+        const int s = static_cast<int>(histo[i].size());
+        if (s > max1) {
+            max3 = max2; max2 = max1; max1 = s;
+            ind3 = ind2; ind2 = ind1; ind1 = i;
+        } else if (s > max2) {
+            max3 = max2; max2 = s;
+            ind3 = ind2; ind2 = i;
+        } else if (s > max3) {
+            max3 = s;
+            ind3 = i;
+        }
+    }
+
+    // Keep secondary peaks only if they are comparable to the main one
+    if (max2 < 0.1f * max1) {
+        ind2 = -1;
+        ind3 = -1;
+    } else if (max3 < 0.1f * max1) {
+        ind3 = -1;
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef ORBMATCHER_H
+#define ORBMATCHER_H
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "Frame.h"
+#include "MapPoint.h"
+
+class KeyFrame;
+
+class ORBmatcher {
+public:
+    // nnratio: best/second-best distance ratio; checkOri: reject matches whose
+    // keypoint rotation disagrees with the dominant rotation between the frames
+    ORBmatcher(float nnratio = 0.6f, bool checkOri = true);
+
+    // Hamming distance between two 256-bit ORB descriptors
+    static int DescriptorDistance(const uchar* a, const uchar* b);
+    static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
+
+    // Projects the map points matched in LastFrame with the (predicted) pose of
+    // CurrentFrame and searches a window of th * scale pixels around each
+    // projection, on the neighbouring pyramid levels only. Cost is proportional
+    // to the number of tracked points, not to the features in the frame.
+    // Fills CurrentFrame.mvpMapPoints and returns the number of matches.
+    int SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th);
+
+    // Local map search: matches map points that passed Frame::ProjectMapPoints
+    // within th * scale pixels of their projection, around the predicted level.
+    // Features that already have a map point are left alone.
+    int SearchByProjection(Frame &F, const std::vector<ProjectedMapPoint> &vProjected, const float th);
+
+    // Initialization: features of F1 are searched in F2 on the same face and
+    // level, within windowSize pixels of vPrevMatched (their position in the
+    // last frame, updated with the matches found). vnMatches12 is flat over faces.
+    int SearchForInitialization(const Frame &F1, const Frame &F2, std::vector<cv::Point2f> &vPrevMatched,
+                                std::vector<int> &vnMatches12, int windowSize = 10);
+
+    // Rotation-only tracking: F1 and F2 share the camera centre, so each
+    // feature of F1 maps to a direction, searched in F2 (predicted pose)
+    // within th * scale pixels on the neighbouring levels. One-to-one;
+    // vnMatches12[i] is the feature of F2 matched to feature i of F1, or -1.
+    int SearchByRotation(const Frame &F1, const Frame &F2, const float th, std::vector<int> &vnMatches12);
+
+    // Brute-force descriptor matching of all features of F1 in F2, no pose
+    // needed (rotation-only relocalization); vnMatches12 as above
+    int SearchByDescriptor(const Frame &F1, const Frame &F2, std::vector<int> &vnMatches12);
+
+    // Brute-force descriptor matching when no pose is known (relocalization).
+    // vpMapPointMatches[i]: map point of pKF matched to feature i of F;
+    // vDistances[i]: its descriptor distance (256 if unmatched). No orientation
+    // check: features on different cube faces are rotated arbitrarily.
+    int SearchByDescriptor(KeyFrame* pKF, const Frame &F, std::vector<MapPoint*> &vpMapPointMatches,
+                           std::vector<int> &vDistances);
+
+    // Same between two keyframes (loop closing): vpMatches12[i] is the map
+    // point of pKF2 matched to feature i of pKF1, for features with a map point
+    int SearchByDescriptor(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches12);
+
+public:
+    static const int TH_LOW = 50;
+    static const int TH_HIGH = 100;
+    static const int HISTO_LENGTH = 30;
+
+protected:
+    // Matches each query row to its nearest train row (ratio test, one-to-one).
+    // vMatches[i]: train index or -1; vDistances[i]: distance for matched rows.
+    int MatchDescriptors(const std::vector<const uchar*> &vQuery, const std::vector<const uchar*> &vTrain,
+                         std::vector<int> &vMatches, std::vector<int> &vDistances);
+
+    void ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
+
+    float mfNNratio;
+    bool mbCheckOrientation;
+};
+
+#endif // ORBMATCHER_H
@@ -0,0 +1,148 @@
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Type-specific pool allocator. Objects live in fixed-size chunks, so their
+// addresses never move, and freed slots are reused through a free list.
+// Clear() destroys every live object at once but keeps the chunks, so
+// reloading a map of similar size does not touch malloc at all.
+template <typename T, size_t ChunkSize = 256>
+class ObjectPool {
+public:
+    struct Stats {
+        size_t mnAllocations = 0;  // Construct calls since creation
+        size_t mnLive = 0;         // Objects currently constructed
+        size_t mnCapacity = 0;     // Slots available without growing
+        size_t mnChunks = 0;
+    };
+
+    ObjectPool() : mpFreeList(nullptr) {}
+    ~ObjectPool() { Clear(); }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    template <typename... Args>
+    T* Construct(Args&&... args) {
+        Slot* pSlot;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (!mpFreeList) Grow();
+            pSlot = mpFreeList;
+            mpFreeList = pSlot->mpNextFree;
+            pSlot->mbLive = true;
+            mStats.mnAllocations++;
+            mStats.mnLive++;
+        }
+
+        try {
+            return new (pSlot->mStorage) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Release(pSlot);
+            throw;
+        }
+    }
+
+    // p must come from this pool
+    void Destroy(T* p) {
+        if (!p) return;
+        p->~T();
+        Release(reinterpret_cast<Slot*>(p));
+    }
+
+    // Bulk release: every p must come from this pool. The slots go back under
+    // a single lock, and a batch that leaves the pool empty resets the free
+    // list as Clear() does.
+    void Destroy(const std::vector<T*> &vp) {
+        size_t n = 0;
+        for (T* p : vp) {
+            if (!p) continue;
+            p->~T();
+            n++;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (T* p : vp) {
+            if (!p) continue;
+            Slot* pSlot = reinterpret_cast<Slot*>(p);
+            pSlot->mbLive = false;
+            pSlot->mpNextFree = mpFreeList;
+            mpFreeList = pSlot;
+        }
+        mStats.mnLive -= n;
+        if (mStats.mnLive == 0) ResetFreeList();
+    }
+
+    // Destroys all live objects. Memory is kept for reuse.
+    void Clear() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (auto &chunk : mvChunks) {
+            for (size_t i = 0; i < ChunkSize; i++) {
+                Slot &slot = chunk[i];
+                if (slot.mbLive) {
+                    reinterpret_cast<T*>(slot.mStorage)->~T();
+                    slot.mbLive = false;
+                }
+            }
+        }
+        ResetFreeList();
+        mStats.mnLive = 0;
+    }
+
+    Stats GetStats() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mStats;
+    }
+
+private:
+    struct Slot {
+        // Storage first so that a T* and its Slot* share an address
+        alignas(T) unsigned char mStorage[sizeof(T)];
+        Slot* mpNextFree;
+        bool mbLive;
+    };
+
+    void Grow() {
+        std::unique_ptr<Slot[]> chunk(new Slot[ChunkSize]);
+        for (size_t i = 0; i < ChunkSize; i++) {
+            chunk[i].mbLive = false;
+            chunk[i].mpNextFree = mpFreeList;
+            mpFreeList = &chunk[i];
+        }
+        mvChunks.push_back(std::move(chunk));
+        mStats.mnChunks++;
+        mStats.mnCapacity += ChunkSize;
+    }
+
+    // Links every slot in chunk order. Only with no live objects.
+    void ResetFreeList() {
+        mpFreeList = nullptr;
+        for (auto &chunk : mvChunks) {
+            for (size_t i = 0; i < ChunkSize; i++) {
+                chunk[i].mpNextFree = mpFreeList;
+                mpFreeList = &chunk[i];
+            }
+        }
+    }
+
+    void Release(Slot* pSlot) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        pSlot->mbLive = false;
+        pSlot->mpNextFree = mpFreeList;
+        mpFreeList = pSlot;
+        mStats.mnLive--;
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> mvChunks;
+    Slot* mpFreeList;
+    Stats mStats;
+    std::mutex mMutex;
+};
+
+#endif // OBJECTPOOL_H
@@ -1,29 +1,365 @@
 #include "Optimizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <random>
+#include <sstream>
 #include <opencv2/calib3d.hpp>
 
 // NOTE: g2o library is missing from the project dependencies.
-// Falling back to OpenCV-based Motion-only optimization (solvePnP)
-// and simplified structure refinement.
+// Pose optimization is a small in-tree Levenberg-Marquardt solver;
+// the bundle adjustments below are still simplified.
 
-void Optimizer::PoseOptimization(Frame* pFrame) {
-    if (!pFrame || pFrame->mpCamera == nullptr) return;
+namespace {
+// Chi-square 95% for a 2 DOF residual
+const float kChi2Mono = 5.991f;
+// Each round re-classifies outliers; the last one runs without the kernel
+const int kPoseRounds = 4;
+const int kPoseIterations = 10;
 
-    // 1. Collect 3D-2D Correspondences
-    std::vector<cv::Point3f> objectPoints;
-    std::vector<cv::Point2f> imagePoints;
-    std::vector<int> mapPointIndices;
+// Map point seen along a measured bearing. The residual is the predicted
+// bearing expressed in the tangent plane of the measured one, which is
+// well defined for any viewing direction.
+struct BearingObservation {
+    float Xw[3];
+    float b[3];
+    float e1[3];
+    float e2[3];
+    float invSigma2;  // 1 / angular variance at the keypoint's level
+    size_t nIdx;
+    bool bOutlier;
+};
 
-    // NOTE: This fallback implementation handles the case where standard bundle adjustment
-    // libraries (g2o) are missing. It attempts to perform motion-only optimization
-    // using OpenCV PnP, but requires Frame to contain linked MapPoints.
-    // Current simplified Frame definitions may lack direct MapPoint pointers.
-    
+// Normal equations of the pose, lower triangle of H filled
+struct PoseSystem {
+    float H[36];
+    float g[6];
+    float cost;
+    int nUsed;
+};
 
-    // Let's implement LocalBundleAdjustment instead as it takes KeyFrame which HAS matches.
+// rho(s) and its derivative (the IRLS weight) for a squared normalized error s
+inline float RobustCost(Optimizer::RobustKernel kernel, bool bRobust, float s, float &w) {
+    if (!bRobust) {
+        w = 1.0f;
+        return s;
+    }
+    if (kernel == Optimizer::CAUCHY) {
+        w = 1.0f / (1.0f + s / kChi2Mono);
+        return kChi2Mono * std::log1p(s / kChi2Mono);
+    }
+    if (s <= kChi2Mono) {
+        w = 1.0f;
+        return s;
+    }
+    const float e = std::sqrt(s);
+    const float delta = std::sqrt(kChi2Mono);
+    w = delta / e;
+    return 2.0f * delta * e - kChi2Mono;
+}
+
+// Tangent residual r, camera point Pc, its unit direction p and norm n.
+// False if the point is not in front of the measured bearing.
+inline bool BearingResidual(const SE3f &T, const BearingObservation &o, float r[2], float Pc[3], float p[3], float &n) {
+    const float *R = T.R;
+    Pc[0] = R[0] * o.Xw[0] + R[1] * o.Xw[1] + R[2] * o.Xw[2] + T.t[0];
+    Pc[1] = R[3] * o.Xw[0] + R[4] * o.Xw[1] + R[5] * o.Xw[2] + T.t[1];
+    Pc[2] = R[6] * o.Xw[0] + R[7] * o.Xw[1] + R[8] * o.Xw[2] + T.t[2];
+    if (Pc[0] * o.b[0] + Pc[1] * o.b[1] + Pc[2] * o.b[2] <= 0.0f) return false;
+    n = std::sqrt(Pc[0] * Pc[0] + Pc[1] * Pc[1] + Pc[2] * Pc[2]);
+    const float invN = 1.0f / n;
+    p[0] = Pc[0] * invN;
+    p[1] = Pc[1] * invN;
+    p[2] = Pc[2] * invN;
+    r[0] = o.e1[0] * p[0] + o.e1[1] * p[1] + o.e1[2] * p[2];
+    r[1] = o.e2[0] * p[0] + o.e2[1] * p[1] + o.e2[2] * p[2];
+    return true;
+}
+
+// Linearizes all inliers at T in one pass: robust cost, H and g.
+// dx = (rotation, translation) as in SE3f::Exp, applied as Exp(dx) * T.
+void LinearizePose(const SE3f &T, const BearingObservation *obs, size_t n,
+                   Optimizer::RobustKernel kernel, bool bRobust, PoseSystem &sys) {
+    std::fill(sys.H, sys.H + 36, 0.0f);
+    std::fill(sys.g, sys.g + 6, 0.0f);
+    sys.cost = 0.0f;
+    sys.nUsed = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        const BearingObservation &o = obs[i];
+        if (o.bOutlier) continue;
+        float r[2], Pc[3], p[3], norm;
+        if (!BearingResidual(T, o, r, Pc, p, norm)) {
+            // Went behind the camera: as costly as a gross outlier, no gradient
+            float w;
+            sys.cost += RobustCost(kernel, bRobust, 100.0f * kChi2Mono, w);
+            continue;
+        }
+
+        const float s = (r[0] * r[0] + r[1] * r[1]) * o.invSigma2;
+        float w;
+        sys.cost += RobustCost(kernel, bRobust, s, w);
+        w *= o.invSigma2;
+
+        // d(e.p)/dPc = (e - (e.p) p) / |Pc|; dPc/d(rot) = -[Pc]x, dPc/d(trans) = I
+        float J[2][6];
+        const float *e[2] = {o.e1, o.e2};
+        const float invN = 1.0f / norm;
+        for (int k = 0; k < 2; k++) {
+            const float a0 = (e[k][0] - r[k] * p[0]) * invN;
+            const float a1 = (e[k][1] - r[k] * p[1]) * invN;
+            const float a2 = (e[k][2] - r[k] * p[2]) * invN;
+            J[k][0] = Pc[1] * a2 - Pc[2] * a1;
+            J[k][1] = Pc[2] * a0 - Pc[0] * a2;
+            J[k][2] = Pc[0] * a1 - Pc[1] * a0;
+            J[k][3] = a0;
+            J[k][4] = a1;
+            J[k][5] = a2;
+        }
+        for (int a = 0; a < 6; a++) {
+            const float wJ0 = w * J[0][a];
+            const float wJ1 = w * J[1][a];
+            sys.g[a] += wJ0 * r[0] + wJ1 * r[1];
+            for (int c = 0; c <= a; c++) sys.H[a * 6 + c] += wJ0 * J[0][c] + wJ1 * J[1][c];
+        }
+        sys.nUsed++;
+    }
+}
+
+// Solves (H + lambda diag(H)) x = -g with a 6x6 Cholesky on the lower triangle
+bool SolveDampedStep(const PoseSystem &sys, float lambda, float x[6]) {
+    float L[36] = {0};
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j <= i; j++) {
+            float sum = sys.H[i * 6 + j];
+            if (i == j) sum += lambda * sys.H[i * 6 + i] + 1e-9f;
+            for (int k = 0; k < j; k++) sum -= L[i * 6 + k] * L[j * 6 + k];
+            if (i == j) {
+                if (sum <= 0.0f) return false;
+                L[i * 6 + i] = std::sqrt(sum);
+            } else {
+                L[i * 6 + j] = sum / L[j * 6 + j];
+            }
+        }
+    }
+    float y[6];
+    for (int i = 0; i < 6; i++) {
+        float sum = -sys.g[i];
+        for (int k = 0; k < i; k++) sum -= L[i * 6 + k] * y[k];
+        y[i] = sum / L[i * 6 + i];
+    }
+    for (int i = 5; i >= 0; i--) {
+        float sum = y[i];
+        for (int k = i + 1; k < 6; k++) sum -= L[k * 6 + i] * x[k];
+        x[i] = sum / L[i * 6 + i];
+    }
+    return true;
+}
+
+// Levenberg-Marquardt. A trial pose is linearized straight away, so an
+// accepted step costs a single pass over the observations.
+void OptimizePoseLM(SE3f &T, const BearingObservation *obs, size_t n, Optimizer::RobustKernel kernel, bool bRobust) {
+    PoseSystem sys, trial;
+    LinearizePose(T, obs, n, kernel, bRobust, sys);
+    if (sys.nUsed < 3) return;
+
+    float lambda = 1e-3f;
+    for (int it = 0; it < kPoseIterations; it++) {
+        float dx[6];
+        if (!SolveDampedStep(sys, lambda, dx)) {
+            lambda *= 10.0f;
+            continue;
+        }
+        // Steps below float resolution of the pose only add noise
+        float step2 = 0.0f;
+        for (int a = 0; a < 6; a++) step2 += dx[a] * dx[a];
+        if (step2 < 1e-12f) return;
+
+        const SE3f Tnew = SE3f::Exp(dx) * T;
+        LinearizePose(Tnew, obs, n, kernel, bRobust, trial);
+        if (trial.cost >= sys.cost || trial.nUsed < 3) {
+            lambda *= 10.0f;
+            continue;
+        }
+
+        const float decrease = sys.cost - trial.cost;
+        T = Tnew;
+        sys = trial;
+        lambda = std::max(1e-7f, lambda * 0.1f);
+        // Converged once a step barely moves the cost
+        if (decrease < 1e-3f * sys.cost) return;
+    }
+}
+
+// Marks observations over the chi-square threshold as outliers; returns
+// inliers and counts the observations that changed side in nChanged
+int ClassifyOutliers(const SE3f &T, BearingObservation *obs, size_t n, int &nChanged) {
+    int nInliers = 0;
+    nChanged = 0;
+    float r[2], Pc[3], p[3], norm;
+    for (size_t i = 0; i < n; i++) {
+        BearingObservation &o = obs[i];
+        const bool bOutlier = !BearingResidual(T, o, r, Pc, p, norm) ||
+                              (r[0] * r[0] + r[1] * r[1]) * o.invSigma2 > kChi2Mono;
+        if (bOutlier != o.bOutlier) nChanged++;
+        o.bOutlier = bOutlier;
+        if (!bOutlier) nInliers++;
+    }
+    return nInliers;
+}
+
+// Observation of Xw along the unit bearing b with angular sigma
+BearingObservation MakeObservation(const cv::Point3f &Xw, const cv::Point3f &b, float sigma, size_t nIdx) {
+    BearingObservation o;
+    o.Xw[0] = Xw.x;
+    o.Xw[1] = Xw.y;
+    o.Xw[2] = Xw.z;
+
+    // Any orthonormal pair perpendicular to the measured bearing
+    const cv::Point3f axis = std::abs(b.x) < 0.9f ? cv::Point3f(1.0f, 0.0f, 0.0f) : cv::Point3f(0.0f, 1.0f, 0.0f);
+    cv::Point3f e1 = axis.cross(b);
+    e1 *= 1.0f / std::sqrt(e1.dot(e1));
+    const cv::Point3f e2 = b.cross(e1);
+    o.b[0] = b.x; o.b[1] = b.y; o.b[2] = b.z;
+    o.e1[0] = e1.x; o.e1[1] = e1.y; o.e1[2] = e1.z;
+    o.e2[0] = e2.x; o.e2[1] = e2.y; o.e2[2] = e2.z;
+
+    o.invSigma2 = 1.0f / (sigma * sigma);
+    o.nIdx = nIdx;
+    o.bOutlier = false;
+    return o;
+}
+
+// Robust rounds with outlier re-classification in between; returns the inliers
+int RefinePose(SE3f &Tcw, BearingObservation *obs, size_t n, Optimizer::RobustKernel kernel) {
+    int nInliers = 0;
+    for (int round = 0; round < kPoseRounds; round++) {
+        OptimizePoseLM(Tcw, obs, n, kernel, round < kPoseRounds - 1);
+        int nChanged;
+        nInliers = ClassifyOutliers(Tcw, obs, n, nChanged);
+        if (nInliers < 10) break;
+        // Same inlier set again: another robust round would not move the pose
+        if (nChanged == 0 && round < kPoseRounds - 2) round = kPoseRounds - 2;
+    }
+    return nInliers;
+}
+
+cv::Point3f RandomDirection(std::mt19937 &rng) {
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    cv::Point3f d(gauss(rng), gauss(rng), gauss(rng));
+    return d * (1.0f / std::sqrt(d.dot(d)));
+}
+}
+
+int Optimizer::PoseOptimization(Frame* pFrame, RobustKernel kernel) {
+    if (!pFrame) return 0;
+    CubeMapCamera* pCubeCam = dynamic_cast<CubeMapCamera*>(pFrame->mpCamera);
+    if (!pCubeCam) return 0;
+
+    // Reused between calls so steady-state tracking does not allocate
+    static thread_local std::vector<BearingObservation> vObs;
+    vObs.clear();
+
+    // One pixel at the face centre subtends 1 / focal radians
+    const float pixelAngle = 1.0f / pCubeCam->GetFocal();
+    const int nLevels = static_cast<int>(pFrame->mvScaleFactors.size());
+    pFrame->mvbOutlier.assign(pFrame->mvpMapPoints.size(), false);
+
+    for (size_t i = 0; i < pFrame->mvpMapPoints.size(); i++) {
+        MapPoint* pMP = pFrame->mvpMapPoints[i];
+        if (!pMP) continue;
+
+        const int octave = pFrame->GetKey(i).octave;
+        const float sigma = pixelAngle * ((octave >= 0 && octave < nLevels) ? pFrame->mvScaleFactors[octave] : 1.0f);
+        vObs.push_back(MakeObservation(pMP->GetWorldPos(), pFrame->GetBearing(i), sigma, i));
+    }
+
+    if (vObs.size() < 3) return 0;
+
+    SE3f Tcw = pFrame->mTcw;
+    const int nInliers = RefinePose(Tcw, vObs.data(), vObs.size(), kernel);
+
+    pFrame->SetPose(Tcw);
+    for (const BearingObservation &o : vObs) pFrame->mvbOutlier[o.nIdx] = o.bOutlier;
+    return nInliers;
+}
+
+Optimizer::PoseBenchmarkResult Optimizer::BenchmarkPoseOptimization(int nPoints, float outlierRatio, int nRuns, RobustKernel kernel) {
+    using Clock = std::chrono::steady_clock;
+    PoseBenchmarkResult result = {};
+    result.mnPoints = std::max(nPoints, 3);
+    result.mnOutliers = static_cast<int>(result.mnPoints * std::max(0.0f, std::min(1.0f, outlierRatio)));
+    result.mnRuns = std::max(nRuns, 1);
+
+    // Fixed seed: every call sees the same problems
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> depth(2.0f, 10.0f);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    // Roughly one pixel of a 500 px cube face
+    const float sigma = 1.0f / 500.0f;
+
+    std::vector<BearingObservation> vObs(result.mnPoints);
+    double totalMs = 0.0;
+    long nInliersTotal = 0;
+    long nRejected = 0;
+    for (int run = 0; run < result.mnRuns; run++) {
+        const float xiTrue[6] = {0.3f * gauss(rng), 0.3f * gauss(rng), 0.3f * gauss(rng), gauss(rng), gauss(rng), gauss(rng)};
+        const SE3f TcwTrue = SE3f::Exp(xiTrue);
+        const SE3f TwcTrue = TcwTrue.Inverse();
+
+        // Points all around the camera, as on a full cube map. The first
+        // mnOutliers keep their point but get an unrelated bearing.
+        for (int i = 0; i < result.mnPoints; i++) {
+            const cv::Point3f dir = RandomDirection(rng);
+            const cv::Point3f Xw = TwcTrue * (dir * depth(rng));
+            cv::Point3f b = RandomDirection(rng);
+            if (i >= result.mnOutliers) {
+                const float noise = sigma * gauss(rng);
+                b = dir + b * noise;
+                b *= 1.0f / std::sqrt(b.dot(b));
+            }
+            vObs[i] = MakeObservation(Xw, b, sigma, i);
+        }
+
+        // Start about where a constant velocity prediction would put it
+        const float xiNoise[6] = {0.03f * gauss(rng), 0.03f * gauss(rng), 0.03f * gauss(rng),
+                                  0.1f * gauss(rng), 0.1f * gauss(rng), 0.1f * gauss(rng)};
+        SE3f Tcw = SE3f::Exp(xiNoise) * TcwTrue;
+
+        auto t0 = Clock::now();
+        const int nInliers = RefinePose(Tcw, vObs.data(), vObs.size(), kernel);
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        totalMs += ms;
+        result.mdMaxMs = std::max(result.mdMaxMs, ms);
+        nInliersTotal += nInliers;
+        for (int i = 0; i < result.mnOutliers; i++) nRejected += vObs[i].bOutlier ? 1 : 0;
+
+        float xiErr[6];
+        (Tcw * TwcTrue).Log(xiErr);
+        const float rotErr = std::sqrt(xiErr[0] * xiErr[0] + xiErr[1] * xiErr[1] + xiErr[2] * xiErr[2]);
+        const float transErr = static_cast<float>(cv::norm(Tcw.Center() - TcwTrue.Center()));
+        result.mfMaxRotationErrorDeg = std::max(result.mfMaxRotationErrorDeg, rotErr * 180.0f / static_cast<float>(CV_PI));
+        result.mfMaxTranslationError = std::max(result.mfMaxTranslationError, transErr);
+    }
+    result.mdMeanMs = totalMs / result.mnRuns;
+    result.mfMeanInliers = static_cast<float>(nInliersTotal) / result.mnRuns;
+    result.mfOutliersRejected = result.mnOutliers > 0 ? static_cast<float>(nRejected) / (static_cast<long>(result.mnOutliers) * result.mnRuns) : 1.0f;
+    return result;
+}
+
+std::string Optimizer::ToString(const PoseBenchmarkResult &result) {
+    std::stringstream ss;
+    ss << "Pose optimization: " << result.mnPoints << " bearings (" << result.mnOutliers << " outliers) x " << result.mnRuns << " runs"
+       << ", mean " << result.mdMeanMs << " ms, max " << result.mdMaxMs << " ms"
+       << ", max rotation error " << result.mfMaxRotationErrorDeg << " deg"
+       << ", max translation error " << result.mfMaxTranslationError
+       << ", mean inliers " << result.mfMeanInliers
+       << ", outliers rejected " << 100.0f * result.mfOutliersRejected << "%";
+    return ss.str();
 }
 
-void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag, Map* pMap) {
+void Optimizer::LocalBundleAdjustment(KeyFrame* pKF, std::atomic<bool>* pbStopFlag, Map* pMap) {
     // 1. Get Local KeyFrames (Covisibility Graph)
     std::set<KeyFrame*> sLocalKFs = pKF->GetConnectedKeyFrames();
     sLocalKFs.insert(pKF);
@@ -52,6 +388,6 @@ void Optimizer::GlobalBundleAdjustment(Map* pMap, int nIterations, bool* pbStopF
     // Stub
 }
 
-void Optimizer::OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches1, cv::Mat &g2oScw, const float th2, bool bFixScale) {
+void Optimizer::OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches1, Sim3f &/*S12*/, const float th2, bool bFixScale) {
     // Stub
 }
@@ -6,15 +6,44 @@
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Frame.h"
+#include <atomic>
+#include <string>
 
 class Optimizer {
 public:
-    void static PoseOptimization(Frame* pFrame);
-    void static LocalBundleAdjustment(KeyFrame* pKF, bool* pbStopFlag, Map* pMap);
+    enum RobustKernel {
+        HUBER=0,
+        CAUCHY=1
+    };
+
+    struct PoseBenchmarkResult {
+        int mnPoints;
+        int mnOutliers;
+        int mnRuns;
+        double mdMeanMs;
+        double mdMaxMs;
+        // Against the true pose, worst over the runs
+        float mfMaxRotationErrorDeg;
+        float mfMaxTranslationError;
+        float mfMeanInliers;
+        // Fraction of the injected outliers flagged as such
+        float mfOutliersRejected;
+    };
+
+    // Motion-only refinement of pFrame->mTcw against its matched map points,
+    // with bearing residuals so matches on every cube face count alike.
+    // Flags rejected matches in mvbOutlier and returns the inliers.
+    int static PoseOptimization(Frame* pFrame, RobustKernel kernel = HUBER);
+    // Times the solver behind PoseOptimization on seeded synthetic problems:
+    // nPoints bearings around the camera, a share of them gross outliers,
+    // starting from a perturbed pose. Seeded, so every call solves the same problems.
+    static PoseBenchmarkResult BenchmarkPoseOptimization(int nPoints = 500, float outlierRatio = 0.2f, int nRuns = 20, RobustKernel kernel = HUBER);
+    static std::string ToString(const PoseBenchmarkResult &result);
+    void static LocalBundleAdjustment(KeyFrame* pKF, std::atomic<bool>* pbStopFlag, Map* pMap);
     void static GlobalBundleAdjustment(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, bool bRobust);
 
     // Sim3 Optimization for Loop Closing
-    void static OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches1, cv::Mat &g2oScw, const float th2, bool bFixScale);
+    void static OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint*> &vpMatches1, Sim3f &S12, const float th2, bool bFixScale);
 };
 
 #endif // OPTIMIZER_H
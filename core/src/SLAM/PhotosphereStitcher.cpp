@@ -134,11 +134,12 @@ bool PhotosphereStitcher::StitchKeyFrames(const std::vector<KeyFrame*>& vpKFs, c
         // We need P_w = R_wc * P_c (ignoring translation).
         // So R = R_cw^T (Inverse of Rotation part of Tcw).
 
-        cv::Mat Tcw = pKF->GetPose();
-        if(Tcw.empty()) continue;
+        const KeyFramePose pose = pKF->GetPoseData();
+        if(!pose.mbValid) continue;
 
-        cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
-        cv::Mat Rwc = Rcw.t(); // Transpose is Inverse for Rotation
+        // The warper takes a cv::Mat rotation
+        const SE3f Twc = pose.mTcw.Inverse(); // Transpose is Inverse for Rotation
+        cv::Mat Rwc = cv::Mat(3, 3, CV_32F, const_cast<float*>(Twc.R)).clone();
 
         // However, we need to handle coordinate systems.
         // SLAM usually: X-Right, Y-Down, Z-Forward.
@@ -0,0 +1,318 @@
+#ifndef RANSAC_H
+#define RANSAC_H
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Robust estimation driver shared by every geometric verification step
+// (initialization, relocalization, loop closing, mosaic alignment).
+//
+// The estimation problem is a class with:
+//   typedef ... Model;
+//   static const int kSampleSize;                      // minimal sample
+//   int NumData() const;
+//   // Models from n >= kSampleSize data (n > kSampleSize: least squares
+//   // or best of several, used by local optimization)
+//   void Fit(const int* vIndices, int n, std::vector<Model> &vModels) const;
+//   float Error(const Model &model, int i) const;      // compared to mfThreshold
+//
+// On top of plain RANSAC:
+//  - PROSAC: with data sorted best first, samples are drawn from a growing
+//    prefix, so good matches are tried first and a model is found early.
+//  - SPRT: a model is verified point by point and dropped as soon as it is
+//    statistically unlikely to beat the best one, instead of scoring all data.
+//  - Local optimization: each new best model is refit from its inliers
+//    (inner samples plus least squares at shrinking thresholds).
+struct RansacParams {
+    float mfThreshold;
+    float mfConfidence;
+    int mnMaxIterations;
+    int mnMinIterations;
+    int mnMinInliers;
+    bool mbProsac;
+    bool mbSprt;
+    bool mbLocalOptimization;
+    unsigned int mnSeed;
+
+    RansacParams()
+        : mfThreshold(1.0f), mfConfidence(0.99f), mnMaxIterations(1000), mnMinIterations(0), mnMinInliers(0),
+          mbProsac(false), mbSprt(true), mbLocalOptimization(true), mnSeed(0) {}
+};
+
+template <typename Model>
+struct RansacResult {
+    Model mModel;
+    std::vector<bool> mvbInliers;
+    int mnInliers = 0;
+    int mnIterations = 0;
+    // Models dropped early by SPRT
+    int mnRejected = 0;
+    bool mbSuccess = false;
+};
+
+template <typename Problem>
+class Ransac {
+public:
+    typedef typename Problem::Model Model;
+
+    Ransac(const Problem &problem, const RansacParams &params)
+        : mProblem(problem), mParams(params), mRng(params.mnSeed) {}
+
+    bool Run(RansacResult<Model> &result) {
+        result = RansacResult<Model>();
+        const int N = mProblem.NumData();
+        const int m = Problem::kSampleSize;
+        if (N < m || N < mParams.mnMinInliers) return false;
+
+        InitSprt();
+        InitProsac(N);
+
+        std::vector<int> vSample(m);
+        std::vector<Model> vModels;
+        std::vector<bool> vbInliers(N, false);
+        int nBest = 0;
+        int nRequired = mParams.mnMaxIterations;
+
+        int it = 0;
+        for (; it < mParams.mnMaxIterations && (it < nRequired || it < mParams.mnMinIterations); it++) {
+            if (mParams.mbProsac) SampleProsac(vSample);
+            else SampleUniform(N, m, vSample);
+
+            vModels.clear();
+            mProblem.Fit(vSample.data(), m, vModels);
+            mnModelsFitted += static_cast<int>(vModels.size());
+            mnSamples++;
+
+            for (const Model &model : vModels) {
+                int nInliers;
+                if (!Verify(model, N, nInliers, vbInliers)) {
+                    result.mnRejected++;
+                    continue;
+                }
+                if (nInliers <= nBest) continue;
+
+                Model bestModel = model;
+                if (mParams.mbLocalOptimization) LocalOptimize(bestModel, nInliers, vbInliers, N);
+
+                nBest = nInliers;
+                result.mModel = bestModel;
+                result.mvbInliers = vbInliers;
+                nRequired = std::min(nRequired, RequiredIterations(static_cast<float>(nBest) / N));
+                UpdateSprtEpsilon(static_cast<float>(nBest) / N);
+            }
+        }
+
+        result.mnIterations = it;
+        result.mnInliers = nBest;
+        result.mbSuccess = nBest >= std::max(m, mParams.mnMinInliers);
+        return result.mbSuccess;
+    }
+
+private:
+    // Local optimization
+    static const int kLoInnerIterations = 10;
+    static const int kLoSampleMultiple = 4;
+
+    // SPRT: cost of one model fit, in point verifications
+    static constexpr float kSprtModelCost = 200.0f;
+
+    int CountInliers(const Model &model, int N, std::vector<bool> &vbInliers, float th) const {
+        int n = 0;
+        for (int i = 0; i < N; i++) {
+            vbInliers[i] = mProblem.Error(model, i) < th;
+            if (vbInliers[i]) n++;
+        }
+        return n;
+    }
+
+    // Scores a model. False if SPRT rejected it before all data was seen.
+    bool Verify(const Model &model, int N, int &nInliers, std::vector<bool> &vbInliers) {
+        if (!mParams.mbSprt) {
+            nInliers = CountInliers(model, N, vbInliers, mParams.mfThreshold);
+            return true;
+        }
+
+        // Likelihood ratio of "bad model" over "good model" so far; points
+        // are visited from a random offset so no part of the data is favoured
+        double lambda = 1.0;
+        nInliers = 0;
+        const int start = std::uniform_int_distribution<int>(0, N - 1)(mRng);
+        for (int k = 0; k < N; k++) {
+            const int i = (start + k) % N;
+            const bool bInlier = mProblem.Error(model, i) < mParams.mfThreshold;
+            vbInliers[i] = bInlier;
+            if (bInlier) {
+                nInliers++;
+                lambda *= mfDelta / mfEpsilon;
+            } else {
+                lambda *= (1.0 - mfDelta) / (1.0 - mfEpsilon);
+            }
+
+            if (lambda > mfA) {
+                // Rejected models are mostly bad: their consistency estimates delta
+                UpdateSprtDelta(static_cast<float>(nInliers) / (k + 1));
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void LocalOptimize(Model &bestModel, int &nBest, std::vector<bool> &vbBestInliers, int N) {
+        const int m = Problem::kSampleSize;
+        std::vector<int> vInliers;
+        std::vector<int> vSample;
+        std::vector<Model> vModels;
+        std::vector<bool> vbInliers(N, false);
+
+        for (int it = 0; it < kLoInnerIterations; it++) {
+            vInliers.clear();
+            for (int i = 0; i < N; i++) {
+                if (vbBestInliers[i]) vInliers.push_back(i);
+            }
+            if (static_cast<int>(vInliers.size()) <= m) return;
+
+            // Non-minimal sample from the inliers of the best model so far
+            const int nSample = std::min(static_cast<int>(vInliers.size()), kLoSampleMultiple * m);
+            std::shuffle(vInliers.begin(), vInliers.end(), mRng);
+            vSample.assign(vInliers.begin(), vInliers.begin() + nSample);
+
+            vModels.clear();
+            mProblem.Fit(vSample.data(), nSample, vModels);
+            for (Model model : vModels) {
+                // Least squares on all inliers, tightening the threshold to the target
+                for (float mult = 4.0f; mult >= 1.0f; mult *= 0.5f) {
+                    vSample.clear();
+                    for (int i = 0; i < N; i++) {
+                        if (mProblem.Error(model, i) < mult * mParams.mfThreshold) vSample.push_back(i);
+                    }
+                    if (static_cast<int>(vSample.size()) <= m) break;
+                    std::vector<Model> vRefined;
+                    mProblem.Fit(vSample.data(), static_cast<int>(vSample.size()), vRefined);
+                    if (vRefined.empty()) break;
+                    model = vRefined.front();
+                }
+
+                const int nInliers = CountInliers(model, N, vbInliers, mParams.mfThreshold);
+                if (nInliers > nBest) {
+                    nBest = nInliers;
+                    bestModel = model;
+                    vbBestInliers = vbInliers;
+                }
+            }
+        }
+    }
+
+    // Samples needed to draw an all-inlier sample with the requested confidence
+    int RequiredIterations(float inlierRatio) const {
+        double pGood = std::pow(static_cast<double>(inlierRatio), Problem::kSampleSize);
+        // SPRT may reject a good model with probability 1/A
+        if (mParams.mbSprt) pGood *= 1.0 - 1.0 / mfA;
+        if (pGood <= 0.0) return mParams.mnMaxIterations;
+        if (pGood >= 1.0) return 1;
+        const double n = std::log(1.0 - mParams.mfConfidence) / std::log(1.0 - pGood);
+        return static_cast<int>(std::min<double>(std::ceil(n), mParams.mnMaxIterations));
+    }
+
+    void SampleUniform(int nRange, int m, std::vector<int> &vSample) {
+        std::uniform_int_distribution<int> dist(0, nRange - 1);
+        for (int k = 0; k < m; k++) {
+            int idx;
+            do {
+                idx = dist(mRng);
+            } while (std::find(vSample.begin(), vSample.begin() + k, idx) != vSample.begin() + k);
+            vSample[k] = idx;
+        }
+    }
+
+    // PROSAC growth function (Chum & Matas 2005)
+    void InitProsac(int N) {
+        const int m = Problem::kSampleSize;
+        mnProsacN = N;
+        mnProsacSubset = m;
+        mnProsacT = 0;
+        mfProsacTn = mParams.mnMaxIterations;
+        for (int i = 0; i < m; i++) mfProsacTn *= static_cast<double>(m - i) / (N - i);
+        mnProsacTnPrime = 1;
+    }
+
+    void SampleProsac(std::vector<int> &vSample) {
+        const int m = Problem::kSampleSize;
+        mnProsacT++;
+        if (mnProsacT > mnProsacTnPrime && mnProsacSubset < mnProsacN) {
+            const double TnNext = mfProsacTn * (mnProsacSubset + 1) / (mnProsacSubset + 1 - m);
+            mnProsacTnPrime += static_cast<int>(std::ceil(TnNext - mfProsacTn));
+            mfProsacTn = TnNext;
+            mnProsacSubset++;
+        }
+
+        if (mnProsacTnPrime < mnProsacT) {
+            // Schedule exhausted: plain sampling from the current prefix
+            SampleUniform(mnProsacSubset, m, vSample);
+        } else {
+            // The newest point of the prefix plus m - 1 from before it
+            SampleUniform(mnProsacSubset - 1, m - 1, vSample);
+            vSample[m - 1] = mnProsacSubset - 1;
+        }
+    }
+
+    // SPRT (Matas & Chum 2005). Starts pessimistic on the inlier ratio and
+    // adapts epsilon to the best model, delta to the rejected ones.
+    void InitSprt() {
+        mfEpsilon = 0.1;
+        mfDelta = 0.01;
+        mnModelsFitted = 0;
+        mnSamples = 0;
+        UpdateSprtThreshold();
+    }
+
+    void UpdateSprtEpsilon(float epsilon) {
+        if (!mParams.mbSprt || epsilon <= mfEpsilon) return;
+        mfEpsilon = std::min(0.99, static_cast<double>(epsilon));
+        UpdateSprtThreshold();
+    }
+
+    void UpdateSprtDelta(float observed) {
+        const double delta = std::max(1e-4, std::min(0.5 * mfEpsilon, 0.95 * mfDelta + 0.05 * observed));
+        // Recomputing A only pays off for a noticeable change
+        if (std::abs(delta - mfDelta) > 0.1 * mfDelta) {
+            mfDelta = delta;
+            UpdateSprtThreshold();
+        } else {
+            mfDelta = delta;
+        }
+    }
+
+    void UpdateSprtThreshold() {
+        if (mfDelta >= mfEpsilon) {
+            mfA = 1e30;
+            return;
+        }
+        const double C = (1.0 - mfDelta) * std::log((1.0 - mfDelta) / (1.0 - mfEpsilon)) +
+                         mfDelta * std::log(mfDelta / mfEpsilon);
+        const double modelsPerSample = mnSamples > 0 ? std::max(1.0, static_cast<double>(mnModelsFitted) / mnSamples) : 1.0;
+        const double K = kSprtModelCost * C / modelsPerSample + 1.0;
+        double A = K;
+        for (int i = 0; i < 10; i++) A = K + std::log(A);
+        mfA = A;
+    }
+
+    const Problem &mProblem;
+    RansacParams mParams;
+    std::mt19937 mRng;
+
+    double mfEpsilon = 0.1;
+    double mfDelta = 0.01;
+    double mfA = 1e30;
+    int mnModelsFitted = 0;
+    int mnSamples = 0;
+
+    int mnProsacN = 0;
+    int mnProsacSubset = 0;
+    int mnProsacT = 0;
+    double mfProsacTn = 0.0;
+    int mnProsacTnPrime = 0;
+};
+
+#endif // RANSAC_H
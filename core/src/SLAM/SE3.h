@@ -0,0 +1,289 @@
+#ifndef SE3_H
+#define SE3_H
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Fixed-size rigid transform (rotation + translation), stored on the stack.
+// Used for every pose inside the SLAM core; cv::Mat only appears at the
+// System API edge via FromMat/ToMat. Rotation is row-major.
+struct SE3f {
+    float R[9];
+    float t[3];
+
+    SE3f() {
+        SetIdentity();
+    }
+
+    SE3f(const float *R_, const float *t_) {
+        memcpy(R, R_, sizeof(R));
+        memcpy(t, t_, sizeof(t));
+    }
+
+    static SE3f Identity() { return SE3f(); }
+
+    void SetIdentity() {
+        static const float I[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+        memcpy(R, I, sizeof(R));
+        t[0] = t[1] = t[2] = 0.0f;
+    }
+
+    SE3f Inverse() const {
+        SE3f T;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) T.R[i * 3 + j] = R[j * 3 + i];
+        }
+        for (int i = 0; i < 3; i++) {
+            T.t[i] = -(T.R[i * 3 + 0] * t[0] + T.R[i * 3 + 1] * t[1] + T.R[i * 3 + 2] * t[2]);
+        }
+        return T;
+    }
+
+    SE3f operator*(const SE3f &o) const {
+        SE3f T;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                T.R[i * 3 + j] = R[i * 3 + 0] * o.R[0 * 3 + j] + R[i * 3 + 1] * o.R[1 * 3 + j] + R[i * 3 + 2] * o.R[2 * 3 + j];
+            }
+            T.t[i] = R[i * 3 + 0] * o.t[0] + R[i * 3 + 1] * o.t[1] + R[i * 3 + 2] * o.t[2] + t[i];
+        }
+        return T;
+    }
+
+    cv::Point3f operator*(const cv::Point3f &p) const {
+        return cv::Point3f(R[0] * p.x + R[1] * p.y + R[2] * p.z + t[0],
+                           R[3] * p.x + R[4] * p.y + R[5] * p.z + t[1],
+                           R[6] * p.x + R[7] * p.y + R[8] * p.z + t[2]);
+    }
+
+    // Rotation only (directions, bearings)
+    cv::Point3f Rotate(const cv::Point3f &p) const {
+        return cv::Point3f(R[0] * p.x + R[1] * p.y + R[2] * p.z,
+                           R[3] * p.x + R[4] * p.y + R[5] * p.z,
+                           R[6] * p.x + R[7] * p.y + R[8] * p.z);
+    }
+
+    // Camera centre in world coordinates when this is Tcw: -R^T t
+    cv::Point3f Center() const {
+        return cv::Point3f(-(R[0] * t[0] + R[3] * t[1] + R[6] * t[2]),
+                           -(R[1] * t[0] + R[4] * t[1] + R[7] * t[2]),
+                           -(R[2] * t[0] + R[5] * t[1] + R[8] * t[2]));
+    }
+
+    // Tangent vector xi = [omega, upsilon] (rotation first)
+    static SE3f Exp(const float *xi) {
+        const float *w = xi;
+        const float *v = xi + 3;
+        const float theta2 = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+        const float theta = std::sqrt(theta2);
+
+        // Coefficients of [w]x and [w]x^2 in R and in the left Jacobian V
+        float A, B, C;
+        if (theta < 1e-4f) {
+            A = 1.0f - theta2 / 6.0f;
+            B = 0.5f - theta2 / 24.0f;
+            C = 1.0f / 6.0f - theta2 / 120.0f;
+        } else {
+            A = std::sin(theta) / theta;
+            B = (1.0f - std::cos(theta)) / theta2;
+            C = (theta - std::sin(theta)) / (theta2 * theta);
+        }
+
+        float W[9], W2[9];
+        Hat(w, W);
+        MatMul3(W, W, W2);
+
+        SE3f T;
+        float V[9];
+        for (int i = 0; i < 9; i++) {
+            const float I = (i % 4 == 0) ? 1.0f : 0.0f;
+            T.R[i] = I + A * W[i] + B * W2[i];
+            V[i] = I + B * W[i] + C * W2[i];
+        }
+        for (int i = 0; i < 3; i++) {
+            T.t[i] = V[i * 3 + 0] * v[0] + V[i * 3 + 1] * v[1] + V[i * 3 + 2] * v[2];
+        }
+        return T;
+    }
+
+    void Log(float *xi) const {
+        float *w = xi;
+        float *v = xi + 3;
+
+        const float cosTheta = std::max(-1.0f, std::min(1.0f, 0.5f * (R[0] + R[4] + R[8] - 1.0f)));
+        const float theta = std::acos(cosTheta);
+
+        if (theta < 1e-4f) {
+            w[0] = 0.5f * (R[7] - R[5]);
+            w[1] = 0.5f * (R[2] - R[6]);
+            w[2] = 0.5f * (R[3] - R[1]);
+        } else if (theta > 3.14159f - 1e-3f) {
+            // Near pi the antisymmetric part vanishes; recover the axis from the diagonal
+            int k = 0;
+            if (R[4] > R[k * 4]) k = 1;
+            if (R[8] > R[k * 4]) k = 2;
+            float axis[3];
+            const float d = std::sqrt(std::max(0.0f, 0.5f * (R[k * 4] + 1.0f)));
+            for (int i = 0; i < 3; i++) axis[i] = (i == k) ? d : R[i * 3 + k] / (2.0f * d);
+            for (int i = 0; i < 3; i++) w[i] = theta * axis[i];
+        } else {
+            const float s = theta / (2.0f * std::sin(theta));
+            w[0] = s * (R[7] - R[5]);
+            w[1] = s * (R[2] - R[6]);
+            w[2] = s * (R[3] - R[1]);
+        }
+
+        // v = V^-1 t
+        const float theta2 = w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
+        float D;
+        if (theta2 < 1e-8f) {
+            D = 1.0f / 12.0f;
+        } else {
+            const float th = std::sqrt(theta2);
+            D = (1.0f - th * std::sin(th) / (2.0f * (1.0f - std::cos(th)))) / theta2;
+        }
+        float W[9], W2[9];
+        Hat(w, W);
+        MatMul3(W, W, W2);
+        for (int i = 0; i < 3; i++) {
+            float Vi[3];
+            for (int j = 0; j < 3; j++) {
+                Vi[j] = ((i == j) ? 1.0f : 0.0f) - 0.5f * W[i * 3 + j] + D * W2[i * 3 + j];
+            }
+            v[i] = Vi[0] * t[0] + Vi[1] * t[1] + Vi[2] * t[2];
+        }
+    }
+
+    // Unit quaternion of R as (x, y, z, w)
+    void ToQuaternion(float *q) const {
+        const float trace = R[0] + R[4] + R[8];
+        if (trace > 0.0f) {
+            const float S = std::sqrt(trace + 1.0f) * 2.0f;
+            q[3] = 0.25f * S;
+            q[0] = (R[7] - R[5]) / S;
+            q[1] = (R[2] - R[6]) / S;
+            q[2] = (R[3] - R[1]) / S;
+        } else if (R[0] > R[4] && R[0] > R[8]) {
+            const float S = std::sqrt(1.0f + R[0] - R[4] - R[8]) * 2.0f;
+            q[3] = (R[7] - R[5]) / S;
+            q[0] = 0.25f * S;
+            q[1] = (R[1] + R[3]) / S;
+            q[2] = (R[2] + R[6]) / S;
+        } else if (R[4] > R[8]) {
+            const float S = std::sqrt(1.0f + R[4] - R[0] - R[8]) * 2.0f;
+            q[3] = (R[2] - R[6]) / S;
+            q[0] = (R[1] + R[3]) / S;
+            q[1] = 0.25f * S;
+            q[2] = (R[5] + R[7]) / S;
+        } else {
+            const float S = std::sqrt(1.0f + R[8] - R[0] - R[4]) * 2.0f;
+            q[3] = (R[3] - R[1]) / S;
+            q[0] = (R[2] + R[6]) / S;
+            q[1] = (R[5] + R[7]) / S;
+            q[2] = 0.25f * S;
+        }
+    }
+
+    // Top 3x4 block, row-major (file formats)
+    void ToRowMajor34(float *out) const {
+        for (int i = 0; i < 3; i++) {
+            out[i * 4 + 0] = R[i * 3 + 0];
+            out[i * 4 + 1] = R[i * 3 + 1];
+            out[i * 4 + 2] = R[i * 3 + 2];
+            out[i * 4 + 3] = t[i];
+        }
+    }
+
+    static SE3f FromRowMajor34(const float *in) {
+        SE3f T;
+        for (int i = 0; i < 3; i++) {
+            T.R[i * 3 + 0] = in[i * 4 + 0];
+            T.R[i * 3 + 1] = in[i * 4 + 1];
+            T.R[i * 3 + 2] = in[i * 4 + 2];
+            T.t[i] = in[i * 4 + 3];
+        }
+        return T;
+    }
+
+    // cv::Mat conversion, for the System API edge and OpenCV calls only
+    static SE3f FromMat(const cv::Mat &T) {
+        cv::Mat Tf;
+        T.convertTo(Tf, CV_32F);
+        SE3f out;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) out.R[i * 3 + j] = Tf.at<float>(i, j);
+            out.t[i] = Tf.at<float>(i, 3);
+        }
+        return out;
+    }
+
+    cv::Mat ToMat() const {
+        cv::Mat T = cv::Mat::eye(4, 4, CV_32F);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) T.at<float>(i, j) = R[i * 3 + j];
+            T.at<float>(i, 3) = t[i];
+        }
+        return T;
+    }
+
+    static void Hat(const float *w, float *W) {
+        W[0] = 0.0f;  W[1] = -w[2]; W[2] = w[1];
+        W[3] = w[2];  W[4] = 0.0f;  W[5] = -w[0];
+        W[6] = -w[1]; W[7] = w[0];  W[8] = 0.0f;
+    }
+
+    static void MatMul3(const float *A, const float *B, float *C) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                C[i * 3 + j] = A[i * 3 + 0] * B[0 * 3 + j] + A[i * 3 + 1] * B[1 * 3 + j] + A[i * 3 + 2] * B[2 * 3 + j];
+            }
+        }
+    }
+};
+
+// Similarity transform: x' = s * R * x + t. Used for loop correction of monocular scale drift.
+struct Sim3f {
+    SE3f mT;   // R and t
+    float s;
+
+    Sim3f() : s(1.0f) {}
+    Sim3f(const SE3f &T, float scale) : mT(T), s(scale) {}
+
+    Sim3f Inverse() const {
+        Sim3f S;
+        S.s = 1.0f / s;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) S.mT.R[i * 3 + j] = mT.R[j * 3 + i];
+        }
+        for (int i = 0; i < 3; i++) {
+            S.mT.t[i] = -S.s * (S.mT.R[i * 3 + 0] * mT.t[0] + S.mT.R[i * 3 + 1] * mT.t[1] + S.mT.R[i * 3 + 2] * mT.t[2]);
+        }
+        return S;
+    }
+
+    Sim3f operator*(const Sim3f &o) const {
+        Sim3f S;
+        S.s = s * o.s;
+        SE3f::MatMul3(mT.R, o.mT.R, S.mT.R);
+        for (int i = 0; i < 3; i++) {
+            S.mT.t[i] = s * (mT.R[i * 3 + 0] * o.mT.t[0] + mT.R[i * 3 + 1] * o.mT.t[1] + mT.R[i * 3 + 2] * o.mT.t[2]) + mT.t[i];
+        }
+        return S;
+    }
+
+    cv::Point3f operator*(const cv::Point3f &p) const {
+        const cv::Point3f r = mT.Rotate(p);
+        return cv::Point3f(s * r.x + mT.t[0], s * r.y + mT.t[1], s * r.z + mT.t[2]);
+    }
+
+    // Rigid part with the translation rescaled, as applied to a corrected keyframe pose
+    SE3f ToSE3() const {
+        SE3f T = mT;
+        for (int i = 0; i < 3; i++) T.t[i] /= s;
+        return T;
+    }
+};
+
+#endif // SE3_H
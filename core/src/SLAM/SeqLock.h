@@ -0,0 +1,76 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+// Sequence lock around a small trivially copyable value.
+// Readers never block writers and never write shared state: they retry if a
+// write overlapped their copy. Writers are serialized by the odd/even
+// sequence itself, so no mutex is needed. Suited to data that is read far
+// more often than it is written (poses, positions).
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+    static_assert(sizeof(T) % sizeof(uint32_t) == 0, "SeqLock payload must be a whole number of words");
+
+public:
+    SeqLock() : mnSeq(0) {
+        for (auto &w : mWords) w.store(0, std::memory_order_relaxed);
+    }
+
+    explicit SeqLock(const T &value) : SeqLock() {
+        Store(value);
+    }
+
+    void Store(const T &value) {
+        // Take the write side: move the sequence from even to odd
+        uint32_t seq = mnSeq.load(std::memory_order_relaxed);
+        while (true) {
+            if ((seq & 1) == 0 &&
+                mnSeq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                break;
+            }
+            std::this_thread::yield();
+            seq = mnSeq.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint32_t words[kWords];
+        memcpy(words, &value, sizeof(T));
+        for (size_t i = 0; i < kWords; i++) mWords[i].store(words[i], std::memory_order_relaxed);
+
+        mnSeq.store(seq + 2, std::memory_order_release);
+    }
+
+    T Load() const {
+        uint32_t words[kWords];
+        uint32_t seq0, seq1;
+        do {
+            seq0 = mnSeq.load(std::memory_order_acquire);
+            while (seq0 & 1) {
+                std::this_thread::yield();
+                seq0 = mnSeq.load(std::memory_order_acquire);
+            }
+            for (size_t i = 0; i < kWords; i++) words[i] = mWords[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq1 = mnSeq.load(std::memory_order_relaxed);
+        } while (seq0 != seq1);
+
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+private:
+    static const size_t kWords = sizeof(T) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> mnSeq;
+    // Stored as relaxed atomic words so concurrent reads are well defined
+    std::atomic<uint32_t> mWords[kWords];
+};
+
+#endif // SEQLOCK_H
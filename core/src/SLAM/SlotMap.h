@@ -0,0 +1,129 @@
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Handle into a SlotMap. The generation is bumped every time a slot is
+// freed, so handles to erased elements never resolve to a newer element.
+struct SlotHandle {
+    uint32_t mnIndex = UINT32_MAX;
+    uint32_t mnGeneration = 0;
+
+    bool IsValid() const { return mnIndex != UINT32_MAX; }
+};
+
+// Generation-checked slot map. Values are stored densely so iteration is a
+// linear walk over a vector. Insert and erase are O(1) (erase swaps the last
+// element into the hole, so iteration order is not stable).
+// Not thread safe, except Size() which may be read without the owner's lock.
+template <typename T>
+class SlotMap {
+public:
+    SlotMap() : mnSize(0), mnFreeHead(kNone) {}
+
+    SlotHandle Insert(const T &value) {
+        uint32_t index;
+        if (mnFreeHead != kNone) {
+            index = mnFreeHead;
+            mnFreeHead = mvSlots[index].mnDense;
+        } else {
+            index = static_cast<uint32_t>(mvSlots.size());
+            mvSlots.push_back(Slot());
+        }
+
+        Slot &slot = mvSlots[index];
+        slot.mnDense = static_cast<uint32_t>(mvValues.size());
+        slot.mbOccupied = true;
+        mvValues.push_back(value);
+        mvDenseToSlot.push_back(index);
+        mnSize.store(mvValues.size(), std::memory_order_release);
+
+        SlotHandle handle;
+        handle.mnIndex = index;
+        handle.mnGeneration = slot.mnGeneration;
+        return handle;
+    }
+
+    bool Contains(const SlotHandle &handle) const {
+        return handle.mnIndex < mvSlots.size() && mvSlots[handle.mnIndex].mbOccupied &&
+               mvSlots[handle.mnIndex].mnGeneration == handle.mnGeneration;
+    }
+
+    // Returns nullptr if the handle is stale
+    T* Get(const SlotHandle &handle) {
+        if (!Contains(handle)) return nullptr;
+        return &mvValues[mvSlots[handle.mnIndex].mnDense];
+    }
+
+    bool Erase(const SlotHandle &handle) {
+        if (!Contains(handle)) return false;
+
+        Slot &slot = mvSlots[handle.mnIndex];
+        const uint32_t dense = slot.mnDense;
+        const uint32_t last = static_cast<uint32_t>(mvValues.size() - 1);
+        if (dense != last) {
+            mvValues[dense] = mvValues[last];
+            mvDenseToSlot[dense] = mvDenseToSlot[last];
+            mvSlots[mvDenseToSlot[dense]].mnDense = dense;
+        }
+        mvValues.pop_back();
+        mvDenseToSlot.pop_back();
+
+        slot.mbOccupied = false;
+        slot.mnGeneration++;
+        slot.mnDense = mnFreeHead;
+        mnFreeHead = handle.mnIndex;
+
+        mnSize.store(mvValues.size(), std::memory_order_release);
+        return true;
+    }
+
+    void Clear() {
+        for (uint32_t index : mvDenseToSlot) {
+            Slot &slot = mvSlots[index];
+            slot.mbOccupied = false;
+            slot.mnGeneration++;
+            slot.mnDense = mnFreeHead;
+            mnFreeHead = index;
+        }
+        mvValues.clear();
+        mvDenseToSlot.clear();
+        mnSize.store(0, std::memory_order_release);
+    }
+
+    void Reserve(size_t n) {
+        mvValues.reserve(n);
+        mvDenseToSlot.reserve(n);
+        mvSlots.reserve(n);
+    }
+
+    size_t Size() const { return mnSize.load(std::memory_order_acquire); }
+    bool Empty() const { return Size() == 0; }
+
+    // Dense storage, valid until the next Insert/Erase
+    const std::vector<T>& Values() const { return mvValues; }
+
+    typename std::vector<T>::const_iterator begin() const { return mvValues.begin(); }
+    typename std::vector<T>::const_iterator end() const { return mvValues.end(); }
+
+private:
+    static const uint32_t kNone = UINT32_MAX;
+
+    struct Slot {
+        // Index into mvValues while occupied, next free slot otherwise
+        uint32_t mnDense = kNone;
+        uint32_t mnGeneration = 0;
+        bool mbOccupied = false;
+    };
+
+    std::vector<T> mvValues;
+    std::vector<uint32_t> mvDenseToSlot;
+    std::vector<Slot> mvSlots;
+    std::atomic<size_t> mnSize;
+    uint32_t mnFreeHead;
+};
+
+#endif // SLOTMAP_H
@@ -2,17 +2,27 @@
 #include "Settings.h"
 #include "ORBVocabulary.h"
 #include "PhotosphereStitcher.h"
+#include "Optimizer.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
+#include <chrono>
 #include <cmath>
+#include <thread>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
+namespace {
+// Keyframes waiting for LocalMapping before the tracker starts skipping them
+const size_t kMaxQueuedKeyFrames = 3;
+}
+
 System::System(const std::string &strVocFile, const std::string &strSettingsFile, const eSensor sensor, Platform* pPlatform, const bool bUseViewer)
-    : mSensor(sensor), mpDensifier(nullptr), mpPlatform(pPlatform) {
+    : mSensor(sensor), mpDensifier(nullptr), mpPlatform(pPlatform), mpPipelineQueue(nullptr), mDropPolicy(DROP_OLDEST),
+      mptTracking(nullptr), mnDroppedFrames(0) {
 
     if (mpPlatform) {
         mpPlatform->Log(LogLevel::INFO, "System", "SphereSLAM System Initializing...");
@@ -37,17 +47,25 @@ System::System(const std::string &strVocFile, const std::string &strSettingsFile
     // Initialize Map
     mpMap = new Map();
 
+    // Initialize Map Saver (background writer)
+    mpMapSaver = new MapSaver(mpMap);
+
+    // Initialize Tile Manager (lazy loading of tiled maps)
+    mpTileManager = new MapTileManager(mpMap);
+
     // Initialize KeyFrame Database
     mpKeyFrameDatabase = new KeyFrameDatabase();
 
-    // Initialize Local Mapping
-    mpLocalMapper = new LocalMapping(this, mpMap);
+    // Initialize Local Mapping. Bounded queue: under sustained motion the
+    // tracker skips keyframes rather than letting mapping fall behind.
+    mpLocalMapper = new LocalMapping(this, mpMap, kMaxQueuedKeyFrames);
 
     // Initialize Loop Closing
     mpLoopCloser = new LoopClosing(this, mpMap, mpKeyFrameDatabase, false);
 
     // Initialize Tracking
     mpTracker = new Tracking(this, mpCamera, mpMap, mpLocalMapper);
+    mpTracker->SetTileManager(mpTileManager);
 
     // Start Threads
     mptLocalMapping = new std::thread(&LocalMapping::Run, mpLocalMapper);
@@ -60,12 +78,16 @@ System::~System() {
     if (mpTracker) delete mpTracker;
     if (mpLocalMapper) delete mpLocalMapper;
     if (mpLoopCloser) delete mpLoopCloser;
+    if (mpMapSaver) delete mpMapSaver;
+    if (mpTileManager) delete mpTileManager;
     if (mpMap) delete mpMap;
     if (mpKeyFrameDatabase) delete mpKeyFrameDatabase;
     if (mpCamera) delete mpCamera;
 
     if (mptLocalMapping) delete mptLocalMapping;
     if (mptLoopClosing) delete mptLoopClosing;
+    if (mptTracking) delete mptTracking;
+    if (mpPipelineQueue) delete mpPipelineQueue;
 }
 
 void System::SetDensifier(Densifier* pDensifier) {
@@ -75,7 +97,10 @@ void System::SetDensifier(Densifier* pDensifier) {
 cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp) {
     std::vector<cv::Mat> faces;
     faces.push_back(im);
-    return mpTracker->GrabImageCubeMap(faces, timestamp);
+
+    SE3f Tcw;
+    if (!mpTracker->GrabImageCubeMap(faces, timestamp, Tcw)) return cv::Mat();
+    return Tcw.ToMat();
 }
 
 cv::Mat System::TrackCubeMap(const std::vector<cv::Mat> &faces, const double &timestamp) {
@@ -89,19 +114,127 @@ cv::Mat System::TrackCubeMap(const std::vector<cv::Mat> &faces, const double &ti
     }
 
     // 1. Process queued IMU messages up to this timestamp
-    {
-        std::unique_lock<std::mutex> lock(mMutexImu);
-        while(!mImuQueue.empty()) {
-            IMUData d = mImuQueue.front();
-            if (d.timestamp > timestamp) break;
+    ConsumeImu(timestamp);
+
+    SE3f Tcw;
+    if (!mpTracker->GrabImageCubeMap(faces, timestamp, Tcw)) return cv::Mat();
+    return Tcw.ToMat();
+}
+
+void System::ConsumeImu(const double &timestamp) {
+    std::unique_lock<std::mutex> lock(mMutexImu);
+    while(!mImuQueue.empty()) {
+        IMUData d = mImuQueue.front();
+        if (d.timestamp > timestamp) break;
+
+        // Pass to tracker preintegrator
+        // mpTracker->GrabIMU(d.data, d.timestamp, d.type);
+        mImuQueue.pop();
+    }
+}
+
+void System::StartTrackingPipeline(size_t nCapacity, eDropPolicy policy) {
+    if (mpPipelineQueue || !mpTracker) return;
+    mDropPolicy = policy;
+    mpPipelineQueue = new BlockingQueue<PipelineFrame>(std::max<size_t>(1, nCapacity));
+    mptTracking = new std::thread(&System::RunTrackingPipeline, this);
+}
+
+std::future<System::TrackedPose> System::TrackCubeMapAsync(const std::vector<cv::Mat> &faces, const double &timestamp) {
+    std::unique_lock<std::mutex> lockPipeline(mMutexPipeline);
+    PipelineFrame item;
+    std::future<TrackedPose> future = item.mPromise.get_future();
+
+    TrackedPose pose;
+    pose.mTimestamp = timestamp;
+    if (!mpPipelineQueue) {
+        pose.mTcw = TrackCubeMap(faces, timestamp);
+        DeliverPose(item, pose);
+        return future;
+    }
 
-            // Pass to tracker preintegrator
-            // mpTracker->GrabIMU(d.data, d.timestamp, d.type);
-            mImuQueue.pop();
+    // Stage 1, in the caller's thread
+    {
+        std::unique_lock<std::mutex> lock(mMutexFaces);
+        mLastFaces.clear();
+        for (const auto& face : faces) {
+            mLastFaces.push_back(face.clone());
+        }
+    }
+    item.mFrame = mpTracker->ExtractFrame(faces, timestamp, item.mTiming);
+
+    // A frame the queue does not take still gets its (dropped) pose
+    pose.mbDropped = true;
+    if (mDropPolicy == DROP_NEWEST) {
+        if (!mpPipelineQueue->TryPush(std::move(item))) {
+            mnDroppedFrames++;
+            DeliverPose(item, pose);
         }
+    } else {
+        PipelineFrame dropped;
+        bool bDropped = false;
+        if (!mpPipelineQueue->PushDropOldest(std::move(item), dropped, bDropped)) {
+            mnDroppedFrames++;
+            DeliverPose(item, pose);
+        } else if (bDropped) {
+            mnDroppedFrames++;
+            pose.mTimestamp = dropped.mFrame.mTimeStamp;
+            DeliverPose(dropped, pose);
+        }
+    }
+    return future;
+}
+
+void System::SetPoseCallback(std::function<void(const TrackedPose&)> callback) {
+    std::unique_lock<std::mutex> lock(mMutexPoseCallback);
+    mPoseCallback = callback;
+}
+
+void System::RunTrackingPipeline() {
+    // Stage 2: tracks frames in the order they were extracted
+    PipelineFrame item;
+    while (mpPipelineQueue->Pop(item)) {
+        ConsumeImu(item.mFrame.mTimeStamp);
+
+        TrackedPose pose;
+        pose.mTimestamp = item.mFrame.mTimeStamp;
+        SE3f Tcw;
+        if (mpTracker->TrackFrame(item.mFrame, item.mTiming, Tcw)) pose.mTcw = Tcw.ToMat();
+        DeliverPose(item, pose);
+    }
+}
+
+size_t System::StopTrackingPipeline() {
+    if (!mpPipelineQueue) return 0;
+
+    // Frames still queued belong to the tracker being reset, so they are not tracked
+    mpPipelineQueue->Close();
+    std::vector<PipelineFrame> vQueued = mpPipelineQueue->Drain();
+    if (mptTracking->joinable()) mptTracking->join();
+    for (PipelineFrame &item : vQueued) {
+        TrackedPose pose;
+        pose.mTimestamp = item.mFrame.mTimeStamp;
+        pose.mbDropped = true;
+        mnDroppedFrames++;
+        DeliverPose(item, pose);
     }
 
-    return mpTracker->GrabImageCubeMap(faces, timestamp);
+    const size_t nCapacity = mpPipelineQueue->Capacity();
+    delete mptTracking;
+    mptTracking = nullptr;
+    delete mpPipelineQueue;
+    mpPipelineQueue = nullptr;
+    return nCapacity;
+}
+
+void System::DeliverPose(PipelineFrame &item, const TrackedPose &pose) {
+    item.mPromise.set_value(pose);
+    std::function<void(const TrackedPose&)> callback;
+    {
+        std::unique_lock<std::mutex> lock(mMutexPoseCallback);
+        callback = mPoseCallback;
+    }
+    if (callback) callback(pose);
 }
 
 void System::ProcessIMU(const cv::Point3f &data, const double &timestamp, int type) {
@@ -113,80 +246,81 @@ void System::ProcessIMU(const cv::Point3f &data, const double &timestamp, int ty
     mImuQueue.push(d);
 }
 
-void System::SaveMap(const std::string &filename) {
-    if (mpMap) {
-        mpMap->Serialize(filename);
-    }
+std::shared_ptr<MapSaveHandle> System::SaveMap(const std::string &filename, const MapEncoding &encoding) {
+    if (!mpMap || !mpMapSaver) return nullptr;
+
+    // Only the copy happens under the map lock; the write happens on the saver thread
+    std::unique_ptr<MapSnapshot> pSnapshot(new MapSnapshot());
+    mpMap->TakeSnapshot(*pSnapshot);
+    return mpMapSaver->Save(std::move(pSnapshot), filename, encoding);
 }
 
 bool System::LoadMap(const std::string &filename) {
-    if (mpMap) {
-        Reset();
-        return mpMap->Load(filename);
+    if (!mpMap) return false;
+
+    // No frame is tracked against the map while it is replaced
+    std::unique_lock<std::mutex> lockPipeline(mMutexPipeline);
+    const size_t nCapacity = StopTrackingPipeline();
+    ResetTracking();
+    // Any previously open tiled map must let go of its tiles before the map is replaced
+    if (mpTileManager) mpTileManager->Close();
+
+    // Pause mapping between steps so it does not work on the map being replaced
+    if (mpLocalMapper) {
+        mpLocalMapper->RequestStop();
+        while (!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
     }
-    return false;
-}
-
-// Helper for Rotation Matrix to Quaternion
-void toQuaternion(const cv::Mat& R, float& qx, float& qy, float& qz, float& qw) {
-    // Basic implementation for 3x3 CV_32F matrix
-    // Trace
-    float tr = R.at<float>(0,0) + R.at<float>(1,1) + R.at<float>(2,2);
-
-    if (tr > 0) {
-        float S = sqrt(tr+1.0) * 2; // S=4*qw
-        qw = 0.25 * S;
-        qx = (R.at<float>(2,1) - R.at<float>(1,2)) / S;
-        qy = (R.at<float>(0,2) - R.at<float>(2,0)) / S;
-        qz = (R.at<float>(1,0) - R.at<float>(0,1)) / S;
-    } else if ((R.at<float>(0,0) > R.at<float>(1,1))&(R.at<float>(0,0) > R.at<float>(2,2))) {
-        float S = sqrt(1.0 + R.at<float>(0,0) - R.at<float>(1,1) - R.at<float>(2,2)) * 2; // S=4*qx
-        qw = (R.at<float>(2,1) - R.at<float>(1,2)) / S;
-        qx = 0.25 * S;
-        qy = (R.at<float>(0,1) + R.at<float>(1,0)) / S;
-        qz = (R.at<float>(0,2) + R.at<float>(2,0)) / S;
-    } else if (R.at<float>(1,1) > R.at<float>(2,2)) {
-        float S = sqrt(1.0 + R.at<float>(1,1) - R.at<float>(0,0) - R.at<float>(2,2)) * 2; // S=4*qy
-        qw = (R.at<float>(0,2) - R.at<float>(2,0)) / S;
-        qx = (R.at<float>(0,1) + R.at<float>(1,0)) / S;
-        qy = 0.25 * S;
-        qz = (R.at<float>(1,2) + R.at<float>(2,1)) / S;
+
+    // Queued keyframes belong to the old map and do not survive a load
+    if (mpLocalMapper) mpLocalMapper->EmptyQueue();
+    if (mpLoopCloser) mpLoopCloser->EmptyQueue();
+
+    bool bLoaded;
+    if (mpTileManager && MapTileManager::IsTiledFile(filename)) {
+        mpMap->DisableJournal();
+        mpMap->Clear();
+        bLoaded = mpTileManager->Open(filename);
     } else {
-        float S = sqrt(1.0 + R.at<float>(2,2) - R.at<float>(0,0) - R.at<float>(1,1)) * 2; // S=4*qz
-        qw = (R.at<float>(1,0) - R.at<float>(0,1)) / S;
-        qx = (R.at<float>(0,2) + R.at<float>(2,0)) / S;
-        qy = (R.at<float>(1,2) + R.at<float>(2,1)) / S;
-        qz = 0.25 * S;
+        bLoaded = mpMap->Load(filename);
+    }
+
+    if (mpLocalMapper) mpLocalMapper->Release();
+    if (nCapacity > 0) StartTrackingPipeline(nCapacity, mDropPolicy);
+    return bLoaded;
+}
+
+bool System::EnableMapJournal(const std::string &filename) {
+    if (!mpMap) return false;
+    return mpMap->EnableJournal(filename);
+}
+
+bool System::AutosaveMap() {
+    if (!mpMap || !mpMap->IsJournalEnabled()) return false;
+    if (mpMap->JournalNeedsCompaction()) {
+        return mpMap->CompactJournal();
     }
+    return mpMap->SyncJournal();
 }
 
 void System::SaveTrajectoryTUM(const std::string &filename) {
-    std::vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    std::shared_ptr<const MapView> pView = mpMap->GetView();
 
     std::ofstream f;
     f.open(filename.c_str());
     f << std::fixed;
 
-    for(size_t i=0; i<vpKFs.size(); i++)
+    for(const MapView::KeyFrameView &kf : pView->mvKeyFrames)
     {
-        KeyFrame* pKF = vpKFs[i];
-        if(pKF)
-        {
-            cv::Mat Tcw = pKF->GetPose();
-            if (!Tcw.empty()) {
-                // Extract Rwc and twc
-                cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
-                cv::Mat twc = -Rwc * Tcw.rowRange(0,3).col(3);
-
-                float qx, qy, qz, qw;
-                toQuaternion(Rwc, qx, qy, qz, qw);
-
-                // Write timestamp tx ty tz qx qy qz qw
-                f << std::setprecision(6) << pKF->mTimeStamp << " "
-                  << twc.at<float>(0,0) << " " << twc.at<float>(1,0) << " " << twc.at<float>(2,0) << " "
-                  << qx << " " << qy << " " << qz << " " << qw << std::endl;
-            }
-        }
+        // Rotation of Twc; its translation is the camera centre
+        float q[4];
+        kf.mTcw.Inverse().ToQuaternion(q);
+
+        // Write timestamp tx ty tz qx qy qz qw
+        f << std::setprecision(6) << kf.mTimeStamp << " "
+          << kf.mOw.x << " " << kf.mOw.y << " " << kf.mOw.z << " "
+          << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << std::endl;
     }
     f.close();
     if (mpPlatform) {
@@ -230,6 +364,7 @@ void System::SavePhotosphere(const std::string &filename) {
     } else {
         // 2. Fallback: Create Photosphere from KeyFrames (Monocular Mosaic)
         if (mpPlatform) mpPlatform->Log(LogLevel::INFO, "System", "Stitching Photosphere from KeyFrames (Mosaic Mode)...");
+        EpochReclaimer::Guard guard;
         std::vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
         stitched = PhotosphereStitcher::StitchKeyFrames(vpKFs, equiImg);
     }
@@ -262,6 +397,14 @@ int System::GetTrackingState() {
 }
 
 void System::Reset() {
+    // The tracking thread must be idle, and no frame half extracted, while the tracker resets
+    std::unique_lock<std::mutex> lockPipeline(mMutexPipeline);
+    const size_t nCapacity = StopTrackingPipeline();
+    ResetTracking();
+    if (nCapacity > 0) StartTrackingPipeline(nCapacity, mDropPolicy);
+}
+
+void System::ResetTracking() {
     if (mpTracker) {
         mpTracker->Reset();
     }
@@ -281,17 +424,96 @@ std::vector<MapPoint*> System::GetAllMapPoints() {
     return {};
 }
 
+std::shared_ptr<const MapView> System::GetMapView() {
+    if (!mpMap) return std::make_shared<MapView>();
+    return mpMap->GetView();
+}
+
+void System::SetMapMemoryBudget(size_t nBytes) {
+    if (mpMap) mpMap->SetMemoryBudget(nBytes);
+}
+
+void System::SetLocalMapLimits(int nMaxKeyFrames, int nMaxMapPoints) {
+    if (mpTracker) mpTracker->SetLocalMapLimits(nMaxKeyFrames, nMaxMapPoints);
+}
+
+void System::SetFrameBudget(double ms) {
+    if (mpTracker) mpTracker->SetFrameBudget(ms);
+}
+
 std::string System::GetMapStats() {
     if (!mpMap) return "System Not Init";
     std::stringstream ss;
-    ss << "KF: " << mpMap->GetAllKeyFrames().size()
-       << " MP: " << mpMap->GetAllMapPoints().size();
+    const Map::KeyFramePool::Stats kfPool = mpMap->GetKeyFramePoolStats();
+    const Map::MapPointPool::Stats mpPool = mpMap->GetMapPointPoolStats();
+    ss << "KF: " << mpMap->KeyFramesInMap()
+       << " MP: " << mpMap->MapPointsInMap()
+       << " | KF pool: " << kfPool.mnLive << "/" << kfPool.mnCapacity << " (" << kfPool.mnAllocations << " allocs)"
+       << " MP pool: " << mpPool.mnLive << "/" << mpPool.mnCapacity << " (" << mpPool.mnAllocations << " allocs)";
+
+    const MapMemoryUsage usage = mpMap->GetMemoryUsage();
+    ss << " | Mem: " << usage.Total() / 1024 << " KB";
+    if (mpMap->GetMemoryBudget() > 0) ss << " / " << mpMap->GetMemoryBudget() / 1024 << " KB";
+    ss << " (" << usage.mnResidentPayloads << " KF payloads resident, " << usage.mnEvictedPayloads << " on disk)";
+
+    if (mpLocalMapper) {
+        const LocalMapping::LatencyStats latency = mpLocalMapper->GetInsertionLatency();
+        ss << " | KF->map: " << std::fixed << std::setprecision(2) << latency.mfMeanMs << " ms avg, "
+           << latency.mfMaxMs << " ms max, queue " << mpLocalMapper->KeyFramesInQueue();
+    }
+    if (mpTracker) {
+        ss << ", " << mpTracker->mnSkippedKeyFrames.load() << " KFs skipped, "
+           << mpTracker->GetKeyFramesPerMinute() << " KFs/min, "
+           << mpTracker->mnSharperKeyFrames.load() << " swapped for a sharper frame";
+        const Tracking::FrameTiming timing = mpTracker->GetLastFrameTiming();
+        ss << " | Frame: " << timing.mfTotalMs << " ms (extract " << timing.mfExtractMs << ", match " << timing.mfMatchMs
+           << ", optimize " << timing.mfOptimizeMs << "), degradation " << mpTracker->GetDegradation();
+        if (mpPipelineQueue) ss << ", " << mnDroppedFrames << " frames dropped";
+    }
     return ss.str();
 }
 
+std::string System::BenchmarkMapEncoding(float positionPrecision) {
+    if (!mpMap) return "System Not Init";
+
+    MapSnapshot snapshot;
+    mpMap->TakeSnapshot(snapshot);
+
+    MapEncoding encoding;
+    encoding.mFormat = MapEncoding::COMPRESSED;
+    encoding.mfPositionPrecision = positionPrecision;
+
+    std::string report = MapCodec::ToString(MapCodec::Benchmark(snapshot, encoding));
+    if (mpPlatform) mpPlatform->Log(LogLevel::INFO, "System", report);
+    else std::cout << report << std::endl;
+    return report;
+}
+
+std::string System::BenchmarkPoseOptimization(int nPoints, float outlierRatio) {
+    std::string report = Optimizer::ToString(Optimizer::BenchmarkPoseOptimization(nPoints, outlierRatio));
+    if (mpPlatform) mpPlatform->Log(LogLevel::INFO, "System", report);
+    else std::cout << report << std::endl;
+    return report;
+}
+
+std::string System::BenchmarkQueueWakeup(int nKeyFrames) {
+    std::string report = LocalMapping::ToString(LocalMapping::BenchmarkWakeup(nKeyFrames));
+    if (mpPlatform) mpPlatform->Log(LogLevel::INFO, "System", report);
+    else std::cout << report << std::endl;
+    return report;
+}
+
 void System::Shutdown() {
+    // Frames already queued are still tracked
+    if (mpPipelineQueue) mpPipelineQueue->Close();
+    if (mptTracking && mptTracking->joinable()) {
+        mptTracking->join();
+    }
+
     if (mpLocalMapper) mpLocalMapper->RequestFinish();
     if (mpLoopCloser) mpLoopCloser->RequestFinish();
+    if (mpMapSaver) mpMapSaver->Shutdown();
+    if (mpTileManager) mpTileManager->Close();
 
     if (mptLocalMapping && mptLocalMapping->joinable()) {
         mptLocalMapping->join();
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <thread>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <opencv2/core.hpp>
 #include <vector>
 #include <mutex>
@@ -14,7 +17,10 @@
 #include "LocalMapping.h"
 #include "LoopClosing.h"
 #include "KeyFrameDatabase.h"
+#include "MapSaver.h"
+#include "MapTileManager.h"
 #include "Platform.h"
+#include "BlockingQueue.h"
 
 // New forward declaration
 class Densifier;
@@ -36,6 +42,19 @@ public:
         int type; // 0: Accel, 1: Gyro
     };
 
+    // Pose of a frame given to TrackCubeMapAsync
+    struct TrackedPose {
+        double mTimestamp = 0.0;
+        cv::Mat mTcw;            // empty unless tracked
+        bool mbDropped = false;  // dropped by the queue, never tracked
+    };
+
+    // Which frame goes when tracking falls behind and the queue is full
+    enum eDropPolicy {
+        DROP_OLDEST = 0,  // the oldest queued frame: lowest latency
+        DROP_NEWEST = 1   // the incoming frame: no gaps in what is queued
+    };
+
     System(const std::string &strVocFile, const std::string &strSettingsFile, const eSensor sensor, Platform* pPlatform, const bool bUseViewer = true);
 
     ~System();
@@ -47,6 +66,18 @@ public:
     // New: Process CubeMap (6 faces)
     cv::Mat TrackCubeMap(const std::vector<cv::Mat> &faces, const double &timestamp);
 
+    // Pipelined tracking: feature extraction runs in the caller's thread and
+    // tracking on its own thread, so frame N+1 is extracted while frame N is
+    // tracked. nCapacity extracted frames may wait for tracking. Call from a
+    // single thread, and not mixed with TrackCubeMap.
+    void StartTrackingPipeline(size_t nCapacity, eDropPolicy policy);
+    // Returns once the frame is extracted and queued (serial without a
+    // pipeline). The pose comes through the future and the pose callback.
+    std::future<TrackedPose> TrackCubeMapAsync(const std::vector<cv::Mat> &faces, const double &timestamp);
+    // Called for every frame given to TrackCubeMapAsync: on the tracking
+    // thread, or on the caller's for frames dropped at the queue
+    void SetPoseCallback(std::function<void(const TrackedPose&)> callback);
+
     // New: Process IMU
     void ProcessIMU(const cv::Point3f &data, const double &timestamp, int type);
 
@@ -54,11 +85,34 @@ public:
     void SetDensifier(Densifier* pDensifier);
 
     // New: Save Map
-    void SaveMap(const std::string &filename);
+    // Snapshots the map and writes it on a background thread.
+    // The returned handle reports progress and completion (nullptr if there is no map).
+    std::shared_ptr<MapSaveHandle> SaveMap(const std::string &filename, const MapEncoding &encoding = MapEncoding());
 
     // New: Load Map
+    // Tiled files (MapEncoding::TILED) are opened lazily: only the tiles around
+    // the camera are resident, the rest are streamed in as tracking moves.
     bool LoadMap(const std::string &filename);
 
+    // Journal mode: filename becomes the base snapshot and edits are appended to
+    // filename.journal. AutosaveMap then only fsyncs the journal tail, compacting
+    // it into the base once it outgrows it.
+    bool EnableMapJournal(const std::string &filename);
+    bool AutosaveMap();
+
+    // Memory budget for the map in bytes (0 = unlimited). Over budget, the
+    // features of the least recently used keyframes are paged out to the cache dir.
+    void SetMapMemoryBudget(size_t nBytes);
+
+    // Local map tracked against every frame. Lower on slow devices; the
+    // per-frame search cost grows with the number of map points.
+    void SetLocalMapLimits(int nMaxKeyFrames, int nMaxMapPoints);
+
+    // Tracking latency budget per frame in ms (0: none). Over budget, tracking
+    // sheds work step by step (see Tracking::eDegradation) and restores it
+    // once there is headroom again.
+    void SetFrameBudget(double ms);
+
     // New: Save Trajectory
     void SaveTrajectoryTUM(const std::string &filename);
 
@@ -67,15 +121,25 @@ public:
 
     int GetTrackingState();
 
-    // Reset System
+    // Reset System. A running pipeline is stopped first, its queued frames
+    // are delivered as dropped, and it is restarted on the reset tracker.
     void Reset();
 
-    // Accessors
+    // Accessors (hold an EpochReclaimer::Guard while using the pointers)
     std::vector<MapPoint*> GetAllMapPoints();
+    // Latest published map view (lock-free, immutable)
+    std::shared_ptr<const MapView> GetMapView();
 
     // Statistics
     std::string GetMapStats();
 
+    // Compression ratio and encode/decode throughput of the compressed map encoding on the current map
+    std::string BenchmarkMapEncoding(float positionPrecision = 0.001f);
+    // Speed and accuracy of tracking's pose optimization on seeded synthetic bearings (map independent)
+    std::string BenchmarkPoseOptimization(int nPoints = 500, float outlierRatio = 0.2f);
+    // Keyframe queue wake-up latency, polling baseline vs BlockingQueue (blocks for a few seconds)
+    std::string BenchmarkQueueWakeup(int nKeyFrames = 200);
+
     void Shutdown();
 
     Platform* mpPlatform; // Made public or accessor needed? Keeping public for internal modules ease for now.
@@ -89,6 +153,8 @@ private:
     LoopClosing* mpLoopCloser;
     Map* mpMap;
     KeyFrameDatabase* mpKeyFrameDatabase;
+    MapSaver* mpMapSaver;
+    MapTileManager* mpTileManager;
 
     GeometricCamera* mpCamera;
 
@@ -102,6 +168,29 @@ private:
     // IMU Buffer
     std::queue<IMUData> mImuQueue;
     std::mutex mMutexImu;
+    // Queued IMU messages up to the frame timestamp go to the tracker
+    void ConsumeImu(const double &timestamp);
+
+    // Tracking pipeline (null until started)
+    struct PipelineFrame {
+        Frame mFrame;
+        Tracking::FrameTiming mTiming;
+        std::promise<TrackedPose> mPromise;
+    };
+    void RunTrackingPipeline();
+    void DeliverPose(PipelineFrame &item, const TrackedPose &pose);
+    // Returns the capacity of the stopped pipeline, 0 if none was running
+    size_t StopTrackingPipeline();
+    // Reset without touching the pipeline; callers stop it first
+    void ResetTracking();
+    BlockingQueue<PipelineFrame>* mpPipelineQueue;
+    eDropPolicy mDropPolicy;
+    std::thread* mptTracking;
+    // Held while a frame is extracted and queued, and while the pipeline is stopped
+    std::mutex mMutexPipeline;
+    std::atomic<size_t> mnDroppedFrames;
+    std::function<void(const TrackedPose&)> mPoseCallback;
+    std::mutex mMutexPoseCallback;
 
     // Photosphere Capture Cache
     std::vector<cv::Mat> mLastFaces;
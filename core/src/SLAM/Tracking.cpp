@@ -1,26 +1,153 @@
 #include "Tracking.h"
 #include "Optimizer.h"
+#include "ORBmatcher.h"
+#include "BearingSolvers.h"
+#include "Ransac.h"
 #include "Utils/Profiler.h"
 #include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+
+namespace {
+// Initialization: features for a reference frame, matches to keep trying
+const int kIniMinFeatures = 100;
+const int kIniMinMatches = 100;
+
+// Relocalization: keyframes tried, matches to attempt P3P, inliers to accept
+const size_t kRelocCandidates = 5;
+const int kRelocMinMatches = 15;
+const int kRelocMinInliers = 50;
+// Chi-square 95% with 2 dof, at 2 px (features up to the second pyramid level)
+const float kRelocChi2 = 5.991f;
+const float kRelocSigmaPx = 2.0f;
+
+// Rotation-only mode: initialization attempts explained by a rotation alone
+// and the angle turned before switching, matches and inliers to keep tracking
+const int kRotationOnlyFrames = 10;
+const float kRotationOnlyMinAngle = 3.0f * static_cast<float>(CV_PI) / 180.0f;
+const int kRotationMinMatches = 30;
+const int kRotationMinInliers = 30;
+const float kRotationChi2 = 5.991f;
+const float kRotationSigmaPx = 2.0f;
+// Frames between translation checks, and the search radius for them (the
+// rotation predicts the features up to their parallax)
+const long unsigned int kTranslationCheckInterval = 10;
+const float kTranslationSearchRadius = 15.0f;
+
+// Degradation ladder: frame time average weight, frames a rung is held before
+// stepping down / up, average below this share of the budget to step up
+const double kFrameMsAvgWeight = 0.2;
+const int kStepDownFrames = 10;
+const int kStepUpFrames = 30;
+const double kHeadroomRatio = 0.7;
+// Rung settings: share of the feature budget, pyramid levels dropped, faces kept
+const float kDegradedFeatureRatio = 0.6f;
+const int kDegradedLevelDrop = 3;
+const int kDegradedMaxFaces = 4;
+
+double ElapsedMs(const std::chrono::steady_clock::time_point &t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Angle of the relative rotation between two poses
+float RotationAngle(const SE3f &T1, const SE3f &T2) {
+    float R[9], R2t[9];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) R2t[i * 3 + j] = T2.R[j * 3 + i];
+    }
+    SE3f::MatMul3(T1.R, R2t, R);
+    const float c = 0.5f * (R[0] + R[4] + R[8] - 1.0f);
+    return std::acos(std::max(-1.0f, std::min(1.0f, c)));
+}
+}
 
 Tracking::Tracking(System* pSys, GeometricCamera* pCam, Map* pMap, LocalMapping* pLM)
-    : mpSystem(pSys), mpCamera(pCam), mpMap(pMap), mpLocalMapper(pLM), mState(NO_IMAGES_YET), mpInitializer(nullptr) {
+    : mpSystem(pSys), mpCamera(pCam), mpMap(pMap), mpLocalMapper(pLM), mState(NO_IMAGES_YET), mpInitializer(nullptr), mpTileManager(nullptr),
+      mbVelocityValid(false), mfMinKeyFrameInterval(0.1), mfMaxKeyFrameInterval(1.0), mfKeyFrameAngle(15.0f * CV_PI / 180.0f),
+      mfTrackedRatio(0.75f), mnMinFaceFeatures(50), mbFlowTracking(true), mfFlowMinFeatureRatio(0.5f), mnMatchesInliers(0), mbRotationOnly(false), mnMaxLocalKeyFrames(20), mnMaxLocalMapPoints(2000),
+      mLastKeyFrameTime(0.0), mnLastKeyFrameTracked(0), mnLastKeyFrameFaces(0), mnSkippedKeyFrames(0),
+      mfMinRelativeSharpness(0.7f), mnMaxDeferredFrames(5), mbKeyFrameDeferred(false),
+      mnDeferredRequestId(0), mfDeferredSharpness(0.0f), mnDeferredInliers(0), mnDeferredFrames(0), mnSharperKeyFrames(0),
+      mnPureRotationFrames(0), mnLastTranslationCheck(0), mnLastDetectedFeatures(0), mnAppliedDegradation(DEGRADE_NONE), mbDetectNextFrame(false), mbFlowAllowed(false),
+      mfFrameBudgetMs(0.0), mfFrameMsAvg(0.0), mnFramesAtDegradation(0), mnDegradation(DEGRADE_NONE),
+      mfOptimizeMs(0.0), mfRequestedBudgetMs(0.0), mbBudgetRequested(false) {
 
     // Initialize ORB Extractor
     // nFeatures, scaleFactor, nLevels, iniThFAST, minThFAST
     mpORBextractor = new ORBextractor(1000, 1.2f, 8, 20, 7);
+    mnBaseFeatures = mpORBextractor->GetFeatures();
+    mnBaseLevels = mpORBextractor->GetLevels();
 }
 
-cv::Mat Tracking::GrabImageCubeMap(const std::vector<cv::Mat>& faces, const double& timestamp) {
+bool Tracking::GrabImageCubeMap(const std::vector<cv::Mat>& faces, const double& timestamp, SE3f &Tcw) {
     SphereSLAM::Profiler p("GrabImageCubeMap");
+    FrameTiming timing;
+    Frame F = ExtractFrame(faces, timestamp, timing);
+    return TrackFrame(F, timing, Tcw);
+}
 
-    // 1. Create Frame
-    mCurrentFrame = Frame(faces, timestamp, mpORBextractor, mpCamera);
+Frame Tracking::ExtractFrame(const std::vector<cv::Mat>& faces, const double& timestamp, FrameTiming &timing) {
+    const auto tStart = std::chrono::steady_clock::now();
 
-    // 2. Track
+    // The ladder is applied here, where the extractor is used
+    const int level = mnDegradation;
+    if (level != mnAppliedDegradation) {
+        mpORBextractor->SetFeatures(level >= DEGRADE_FEWER_FEATURES ? static_cast<int>(kDegradedFeatureRatio * mnBaseFeatures)
+                                                                    : mnBaseFeatures);
+        mpORBextractor->SetLevels(level >= DEGRADE_COARSE_PYRAMID ? std::max(1, mnBaseLevels - kDegradedLevelDrop) : mnBaseLevels);
+        mnAppliedDegradation = level;
+    }
+
+    // Detect, or follow the last frame's features
+    Frame F;
+    if (NeedFeatureDetection()) {
+        const int nMaxFaces = level >= DEGRADE_SKIP_FACES ? kDegradedMaxFaces : 0;
+        F = Frame(faces, timestamp, mpORBextractor, mpCamera, nMaxFaces);
+        if (mbFlowTracking) F.BuildFlowPyramids();
+        mnLastDetectedFeatures = F.N;
+    } else {
+        F = Frame(faces, timestamp, mLastExtractedFrame, mpORBextractor, mpCamera);
+    }
+    if (mbFlowTracking) {
+        // Only what the next frame's optical flow needs
+        mLastExtractedFrame = Frame(F);
+        mLastExtractedFrame.mImgs.clear();
+    }
+
+    timing = FrameTiming();
+    timing.mfExtractMs = ElapsedMs(tStart);
+    return F;
+}
+
+bool Tracking::TrackFrame(const Frame &F, FrameTiming &timing, SE3f &Tcw) {
+    // Map entities reached during tracking stay valid until this returns
+    EpochReclaimer::Guard guard;
+
+    const auto tTrack = std::chrono::steady_clock::now();
+    mCurrentFrame = F;
+    if (!mCurrentFrame.mbFlowTracked) mbDetectNextFrame = false;
+
+    mfOptimizeMs = 0.0;
     Track();
+    timing.mfOptimizeMs = mfOptimizeMs;
+    timing.mfMatchMs = std::max(0.0, ElapsedMs(tTrack) - mfOptimizeMs);
+    timing.mfTotalMs = timing.mfExtractMs + ElapsedMs(tTrack);
+    UpdateDegradation(timing);
+
+    // Age out keyframe times here too, so a device that stops adding keyframes reports 0/min
+    {
+        std::unique_lock<std::mutex> lock(mMutexKeyFrameTimes);
+        while (!mdKeyFrameTimes.empty() && mdKeyFrameTimes.front() < F.mTimeStamp - 60.0) mdKeyFrameTimes.pop_front();
+    }
 
-    return mCurrentFrame.mTcw.clone();
+    // For the frame extraction builds next (one frame behind when pipelined)
+    mbFlowAllowed = mState == OK && mCurrentFrame.HasPose() && !mbDetectNextFrame && !mbKeyFrameDeferred;
+
+    Tcw = mCurrentFrame.mTcw;
+    return mCurrentFrame.HasPose();
 }
 
 void Tracking::Track() {
@@ -30,27 +157,52 @@ void Tracking::Track() {
 
     if (mState == NOT_INITIALIZED) {
         MonocularInitialization();
+        // The initial map is tracked from this frame on
+        if (mState == OK) UpdateLastFrame();
         return;
     }
 
     if (mState == OK) {
-        // Propagate pose (Motion Model)
-        if (!mLastFrame.mTcw.empty()) {
-            mCurrentFrame.SetPose(mLastFrame.mTcw);
+        // Points matched in earlier frames may have been culled since
+        mpMap->ValidateMapPoints(mLastFrame.mvpMapPoints, mvLastFrameSlots);
+        mpMap->ValidateMapPoints(mReferenceFrame.mvpMapPoints, mvReferenceSlots);
+
+        bool bOK = false;
+        if (mbRotationOnly) {
+            bOK = TrackRotationOnly(false);
         } else {
-             mCurrentFrame.SetPose(cv::Mat::eye(4, 4, CV_32F));
+            if (mbVelocityValid) bOK = TrackWithMotionModel();
+            if (!bOK) bOK = TrackReferenceKeyFrame();
+
+            // Nothing in view to match against (the map has no points yet): keep
+            // the motion model prediction rather than declaring the camera lost
+            if (!bOK && !HasMapPoints(mLastFrame) && !HasMapPoints(mReferenceFrame)) {
+                mCurrentFrame.SetPose(PredictPose());
+                bOK = true;
+            }
+
+            // Frame-to-frame tracking only sees what the last frame saw; pick up
+            // the rest of the nearby map before judging the pose
+            if (bOK && HasMapPoints(mCurrentFrame) && mnDegradation < DEGRADE_NO_LOCAL_MAP) bOK = TrackLocalMap();
         }
 
-        // Track Local Map / Optimize Pose
-        Optimizer::PoseOptimization(&mCurrentFrame);
+        if (bOK) {
+            if (mLastFrame.HasPose()) {
+                mVelocity = mCurrentFrame.mTcw * mLastFrame.GetPoseInverse();
+                mbVelocityValid = true;
+            }
 
-        // Simple Keyframe insertion policy (every 10 frames for blueprint)
-        static int frameCount = 0;
-        if (frameCount++ % 10 == 0) {
-            CreateNewKeyFrame();
+            if (mpTileManager) {
+                mpTileManager->UpdateActiveRegion(mCurrentFrame.GetCameraCenter());
+            }
+
+            ProcessKeyFrameCandidate(!mbKeyFrameDeferred && NeedNewKeyFrame());
+        } else {
+            mState = LOST;
+            mbVelocityValid = false;
         }
     } else if (mState == LOST) {
-        if (Relocalization()) {
+        if (mbRotationOnly ? TrackRotationOnly(true) : Relocalization()) {
             mState = OK;
         }
     }
@@ -60,69 +212,773 @@ void Tracking::Track() {
 
 void Tracking::MonocularInitialization() {
     if (!mpInitializer) {
-        // Set Reference Frame
-        if (mCurrentFrame.mvKeys.size() > 0 && mCurrentFrame.mvKeys[0].size() > 100) {
+        // Set Reference Frame: features on any face count
+        if (mCurrentFrame.N > kIniMinFeatures) {
             mpInitializer = new Initializer(mCurrentFrame, 1.0f, 200);
+            mvIniMatches.assign(mCurrentFrame.N, -1);
+            mvIniLastMatched.resize(mCurrentFrame.N);
+            for (int i = 0; i < mCurrentFrame.N; i++) mvIniLastMatched[i] = mCurrentFrame.GetKey(i).pt;
+        }
+        return;
+    }
+
+    const Frame& initialFrame = mpInitializer->GetReferenceFrame();
+    if (mCurrentFrame.N <= kIniMinFeatures) {
+        delete mpInitializer;
+        mpInitializer = nullptr;
+        return;
+    }
+
+    ORBmatcher matcher(0.9f, true);
+    const int nmatches = matcher.SearchForInitialization(initialFrame, mCurrentFrame, mvIniLastMatched, mvIniMatches, 100);
+
+    // Lost most of the reference view: start over from this frame
+    if (nmatches < kIniMinMatches) {
+        delete mpInitializer;
+        mpInitializer = nullptr;
+        mnPureRotationFrames = 0;
+        return;
+    }
+
+    SE3f T21;
+    std::vector<cv::Point3f> p3d;
+    std::vector<bool> triangulated;
+
+    if (mpInitializer->Initialize(mCurrentFrame, mvIniMatches, T21, p3d, triangulated)) {
+        for (size_t i = 0; i < mvIniMatches.size(); i++) {
+            if (mvIniMatches[i] >= 0 && !triangulated[i]) mvIniMatches[i] = -1;
         }
+        if (CreateInitialMapMonocular(T21, p3d)) {
+            mState = OK;
+            std::cout << "Tracking: Monocular Initialization successful" << std::endl;
+        }
+        delete mpInitializer;
+        mpInitializer = nullptr;
+        mnPureRotationFrames = 0;
         return;
     }
 
-    // Try to initialize
-    // We need real matches here for the initializer to work.
-    // For the blueprint, we'll simulate a perfect identity match if the camera hasn't moved much.
-    // But importantly, the size must match the number of keypoints in the INITIAL frame.
+    // Turning in place: no parallax will come, track the orientation alone
+    SE3f R21;
+    if (!mpInitializer->IsPureRotation(R21)) {
+        mnPureRotationFrames = 0;
+    } else if (++mnPureRotationFrames >= kRotationOnlyFrames &&
+               RotationAngle(R21, SE3f::Identity()) >= kRotationOnlyMinAngle) {
+        StartRotationOnly(R21);
+    }
+}
 
-    // Initializer stores mInitialFrame.
-    // matches vector size must be equal to mInitialFrame.mvKeys[0].size()
+bool Tracking::CreateInitialMapMonocular(const SE3f &T21, const std::vector<cv::Point3f> &vP3D) {
+    Frame initialFrame(mpInitializer->GetReferenceFrame());
+    // The world origin, unless rotation-only tracking already posed the reference
+    const bool bReferencePosed = initialFrame.HasPose();
+    const SE3f Tc1w = bReferencePosed ? initialFrame.mTcw : SE3f::Identity();
+    const SE3f Twc1 = Tc1w.Inverse();
 
-    const Frame& initialFrame = mpInitializer->GetReferenceFrame();
-    if (initialFrame.mvKeys.empty() || initialFrame.mvKeys[0].empty()) return;
+    // Unit median depth in the reference view
+    std::vector<float> vDepths;
+    for (size_t i = 0; i < mvIniMatches.size(); i++) {
+        if (mvIniMatches[i] >= 0) vDepths.push_back(std::sqrt(vP3D[i].dot(vP3D[i])));
+    }
+    if (vDepths.empty()) return false;
+    std::nth_element(vDepths.begin(), vDepths.begin() + vDepths.size() / 2, vDepths.end());
+    const float medianDepth = vDepths[vDepths.size() / 2];
+    if (medianDepth <= 0.0f) return false;
+    const float invMedianDepth = 1.0f / medianDepth;
+
+    SE3f Tc2c1 = T21;
+    for (int k = 0; k < 3; k++) Tc2c1.t[k] *= invMedianDepth;
+    const SE3f currentTcw = mCurrentFrame.mTcw;
+    const bool bCurrentPosed = mCurrentFrame.mbHasPose;
+    initialFrame.SetPose(Tc1w);
+    mCurrentFrame.SetPose(Tc2c1 * Tc1w);
+
+    std::fill(initialFrame.mvpMapPoints.begin(), initialFrame.mvpMapPoints.end(), nullptr);
+    std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+    std::vector<MapPoint*> vpNewMPs;
+    vpNewMPs.reserve(vDepths.size());
+    int nPoints = 0;
+    for (size_t i = 0; i < mvIniMatches.size(); i++) {
+        if (mvIniMatches[i] < 0) continue;
+        MapPoint* pMP = mpMap->NewMapPoint(Twc1 * (vP3D[i] * invMedianDepth), nullptr);
+        pMP->SetDescriptor(initialFrame.GetDescriptor(i));
+        mpMap->AddMapPoint(pMP);
+        vpNewMPs.push_back(pMP);
+        initialFrame.mvpMapPoints[i] = pMP;
+        mCurrentFrame.mvpMapPoints[mvIniMatches[i]] = pMP;
+        nPoints++;
+    }
 
-    std::vector<int> matches(initialFrame.mvKeys[0].size(), -1);
+    // A rotation-only keyframe of the reference view gets the points instead
+    // of a second keyframe of the same view (not found if still queued)
+    KeyFrame* pRefKF = nullptr;
+    if (bReferencePosed) {
+        for (KeyFrame* pKF : mpMap->GetAllKeyFrames()) {
+            if (pKF->mnFrameId == initialFrame.mnId) {
+                pRefKF = pKF;
+                break;
+            }
+        }
+    }
+
+    // Both views become keyframes, queued together so mapping never gets one
+    // without the other; local mapping links the observations
+    std::vector<KeyFrame*> vpNewKFs;
+    bool bInserted = mpLocalMapper->SetNotStop(true);
+    if (bInserted) {
+        if (!pRefKF) vpNewKFs.push_back(mpMap->NewKeyFrame(initialFrame, nullptr));
+        vpNewKFs.push_back(mpMap->NewKeyFrame(mCurrentFrame, nullptr));
+        bInserted = mpLocalMapper->InsertKeyFrames(vpNewKFs);
+        mpLocalMapper->SetNotStop(false);
+    }
 
-    // Simple proximity match for simulation
-    // In a real system, we'd use ORB matcher here.
-    const std::vector<cv::KeyPoint>& keys1 = initialFrame.mvKeys[0];
-    const std::vector<cv::KeyPoint>& keys2 = mCurrentFrame.mvKeys[0];
+    if (!bInserted) {
+        // Queue full or shutting down: nothing of this attempt may survive
+        for (KeyFrame* pKF : vpNewKFs) mpMap->DestroyKeyFrame(pKF);
+        mpMap->Retire(std::vector<KeyFrame*>(), vpNewMPs);
+        std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+        mCurrentFrame.mTcw = currentTcw;
+        mCurrentFrame.mbHasPose = bCurrentPosed;
+        return false;
+    }
 
-    for(size_t i=0; i<keys1.size(); ++i) {
-        // For simulation, match same index if within 5 pixels
-        if (i < keys2.size()) {
-             float dist = cv::norm(keys1[i].pt - keys2[i].pt);
-             if (dist < 10.0f) {
-                 matches[i] = i;
-             }
+    if (pRefKF) {
+        for (size_t i = 0; i < initialFrame.mvpMapPoints.size(); i++) {
+            if (initialFrame.mvpMapPoints[i]) pRefKF->AddMapPoint(initialFrame.mvpMapPoints[i], i);
         }
+        pRefKF->AddObservationsToMapPoints();
+    } else {
+        KeyFrameInserted(initialFrame, nPoints);
+    }
+    mnMatchesInliers = nPoints;
+    KeyFrameInserted(mCurrentFrame, nPoints);
+    return true;
+}
+
+void Tracking::StartRotationOnly(const SE3f &R21) {
+    // The reference view becomes the first keyframe, at the origin and without points
+    Frame initialFrame(mpInitializer->GetReferenceFrame());
+    initialFrame.SetPose(SE3f::Identity());
+    std::fill(initialFrame.mvpMapPoints.begin(), initialFrame.mvpMapPoints.end(), nullptr);
+    CreateNewKeyFrame(initialFrame, 0);
+    // Mapping did not take it: try again with the next frame
+    if (!mReferenceFrame.HasPose() || mReferenceFrame.mnId != initialFrame.mnId) return;
+
+    mCurrentFrame.SetPose(R21);
+    std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+    mbRotationOnly = true;
+    mState = OK;
+    mnPureRotationFrames = 0;
+    mnLastTranslationCheck = mCurrentFrame.mnId;
+    delete mpInitializer;
+    mpInitializer = nullptr;
+    std::cout << "Tracking: pure rotation, tracking orientation only" << std::endl;
+}
+
+bool Tracking::TrackRotationOnly(bool bRelocalize) {
+    if (!mReferenceFrame.HasPose()) return false;
+
+    ORBmatcher matcher(0.9f, false);
+    std::vector<int> vMatches;
+    int nmatches;
+    if (bRelocalize) {
+        nmatches = matcher.SearchByDescriptor(mReferenceFrame, mCurrentFrame, vMatches);
+    } else {
+        // Constant angular velocity; widen only if the prediction was off
+        mCurrentFrame.SetPose(PredictPose());
+        const float th = 7.0f;
+        nmatches = matcher.SearchByRotation(mReferenceFrame, mCurrentFrame, th, vMatches);
+        if (nmatches < kRotationMinMatches) nmatches = matcher.SearchByRotation(mReferenceFrame, mCurrentFrame, 2 * th, vMatches);
+    }
+    if (nmatches < kRotationMinMatches) {
+        mCurrentFrame.mbHasPose = false;
+        return false;
+    }
+
+    // World directions of the reference rays against the current bearings:
+    // the rotation between them is Rcw itself
+    const SE3f Twr = mReferenceFrame.GetPoseInverse();
+    RotationProblem problem;
+    for (size_t i = 0; i < vMatches.size(); i++) {
+        if (vMatches[i] < 0) continue;
+        const cv::Point3f b1 = mReferenceFrame.GetBearing(i);
+        const cv::Point3f b2 = mCurrentFrame.GetBearing(vMatches[i]);
+        if (b1.dot(b1) == 0.0f || b2.dot(b2) == 0.0f) continue;
+        problem.mvB1.push_back(Twr.Rotate(b1));
+        problem.mvB2.push_back(b2);
+    }
+
+    CubeMapCamera* pCubeCam = dynamic_cast<CubeMapCamera*>(mpCamera);
+    const float sigmaAngle = kRotationSigmaPx / (pCubeCam ? pCubeCam->GetFocal() : 1.0f);
+
+    // Local optimization refits the best rotation on all its inliers (least
+    // squares), which is the whole refinement a rotation needs
+    RansacParams params;
+    params.mfThreshold = kRotationChi2 * sigmaAngle * sigmaAngle;
+    params.mnMaxIterations = 200;
+    params.mnMinInliers = kRotationMinInliers;
+    Ransac<RotationProblem> ransac(problem, params);
+    RansacResult<SE3f> result;
+    if (!ransac.Run(result)) {
+        mCurrentFrame.mbHasPose = false;
+        return false;
+    }
+
+    mCurrentFrame.SetPose(result.mModel);
+    mnMatchesInliers = result.mnInliers;
+    if (bRelocalize) {
+        std::cout << "Tracking: Relocalized rotation against frame " << mReferenceFrame.mnId << " with "
+                  << result.mnInliers << " inliers" << std::endl;
+    } else if (mCurrentFrame.mnId >= mnLastTranslationCheck + kTranslationCheckInterval) {
+        mnLastTranslationCheck = mCurrentFrame.mnId;
+        CheckTranslation();
+    }
+    return true;
+}
+
+void Tracking::CheckTranslation() {
+    // The oldest reference still in view gives the widest baseline
+    ORBmatcher matcher(0.9f, false);
+    std::vector<int> vMatches;
+    if (mpInitializer &&
+        matcher.SearchByRotation(mpInitializer->GetReferenceFrame(), mCurrentFrame, kTranslationSearchRadius, vMatches) < kIniMinMatches) {
+        delete mpInitializer;
+        mpInitializer = nullptr;
+    }
+    if (!mpInitializer) {
+        mpInitializer = new Initializer(mReferenceFrame, 1.0f, 200);
+        if (matcher.SearchByRotation(mReferenceFrame, mCurrentFrame, kTranslationSearchRadius, vMatches) < kIniMinMatches) return;
     }
 
-    cv::Mat R, t;
+    SE3f T21;
     std::vector<cv::Point3f> p3d;
     std::vector<bool> triangulated;
+    if (!mpInitializer->Initialize(mCurrentFrame, vMatches, T21, p3d, triangulated)) return;
 
-    if (mpInitializer->Initialize(mCurrentFrame, matches, R, t, p3d, triangulated)) {
-        // Success
-        mCurrentFrame.SetPose(cv::Mat::eye(4, 4, CV_32F));
-        CreateNewKeyFrame();
-        mState = OK;
-        std::cout << "Tracking: Monocular Initialization successful" << std::endl;
+    mvIniMatches = vMatches;
+    for (size_t i = 0; i < mvIniMatches.size(); i++) {
+        if (mvIniMatches[i] >= 0 && !triangulated[i]) mvIniMatches[i] = -1;
+    }
+    if (CreateInitialMapMonocular(T21, p3d)) {
+        mbRotationOnly = false;
+        std::cout << "Tracking: translation observed, map initialized" << std::endl;
     }
+    delete mpInitializer;
+    mpInitializer = nullptr;
 }
 
 bool Tracking::Relocalization() {
-    return true;
+    SphereSLAM::Profiler p("Relocalization");
+    // With a tiled map, keyframes near where we were lost may not be resident.
+    // Use the tile index to find the closest one and load its neighbourhood first.
+    const cv::Point3f lastCenter = mLastFrame.HasPose() ? mLastFrame.GetCameraCenter() : mLastKeyFramePose.Center();
+    if (mpTileManager && mpTileManager->IsOpen()) {
+        MapTileManager::KeyFrameEntry entry;
+        if (mpTileManager->GetNearestKeyFrame(lastCenter, entry)) {
+            mpTileManager->LoadTilesAround(cv::Point3f(entry.mCenter[0], entry.mCenter[1], entry.mCenter[2]));
+        }
+    }
+
+    // Candidates: the keyframes nearest to where tracking was lost
+    std::vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    std::vector<std::pair<float, KeyFrame*>> vCandidates;
+    vCandidates.reserve(vpKFs.size());
+    for (KeyFrame* pKF : vpKFs) {
+        if (!pKF->HasPose()) continue;
+        const cv::Point3f d = pKF->GetCameraCenter() - lastCenter;
+        vCandidates.push_back(std::make_pair(d.dot(d), pKF));
+    }
+    const size_t nCandidates = std::min(kRelocCandidates, vCandidates.size());
+    std::partial_sort(vCandidates.begin(), vCandidates.begin() + nCandidates, vCandidates.end(),
+                      [](const std::pair<float, KeyFrame*> &a, const std::pair<float, KeyFrame*> &b) { return a.first < b.first; });
+
+    CubeMapCamera* pCubeCam = dynamic_cast<CubeMapCamera*>(mpCamera);
+    const float sigmaAngle = kRelocSigmaPx / (pCubeCam ? pCubeCam->GetFocal() : 1.0f);
+
+    ORBmatcher matcher(0.75f, false);
+    for (size_t c = 0; c < nCandidates; c++) {
+        KeyFrame* pKF = vCandidates[c].second;
+
+        std::vector<MapPoint*> vpMatches;
+        std::vector<int> vDistances;
+        if (matcher.SearchByDescriptor(pKF, mCurrentFrame, vpMatches, vDistances) < kRelocMinMatches) continue;
+
+        // Best matches first, for PROSAC
+        std::vector<int> vOrder;
+        for (int i = 0; i < mCurrentFrame.N; i++) {
+            if (vpMatches[i]) vOrder.push_back(i);
+        }
+        std::sort(vOrder.begin(), vOrder.end(), [&vDistances](int a, int b) { return vDistances[a] < vDistances[b]; });
+
+        AbsolutePoseProblem problem;
+        for (int i : vOrder) {
+            problem.mvXw.push_back(vpMatches[i]->GetWorldPos());
+            problem.mvB.push_back(mCurrentFrame.GetBearing(i));
+        }
+
+        RansacParams params;
+        params.mfThreshold = kRelocChi2 * sigmaAngle * sigmaAngle;
+        params.mnMaxIterations = 300;
+        params.mnMinInliers = kRelocMinMatches;
+        params.mbProsac = true;
+        Ransac<AbsolutePoseProblem> ransac(problem, params);
+        RansacResult<SE3f> result;
+        if (!ransac.Run(result)) continue;
+
+        mCurrentFrame.SetPose(result.mModel);
+        std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+        for (size_t k = 0; k < vOrder.size(); k++) {
+            if (result.mvbInliers[k]) mCurrentFrame.mvpMapPoints[vOrder[k]] = vpMatches[vOrder[k]];
+        }
+
+        OptimizePose();
+        int nGood = DiscardOutliers();
+        if (nGood < kRelocMinMatches) continue;
+
+        // Few inliers: look for the keyframe's other points with the pose found
+        if (nGood < kRelocMinInliers) {
+            std::vector<MapPoint*> vpKFPoints = pKF->GetMapPointMatches();
+            std::set<MapPoint*> sFound(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end());
+            vpKFPoints.erase(std::remove_if(vpKFPoints.begin(), vpKFPoints.end(),
+                                            [&sFound](MapPoint* pMP) { return !pMP || sFound.count(pMP); }),
+                             vpKFPoints.end());
+
+            std::vector<ProjectedMapPoint> vProjected;
+            mCurrentFrame.ProjectMapPoints(vpKFPoints, vProjected);
+            ORBmatcher projMatcher(0.9f);
+            if (projMatcher.SearchByProjection(mCurrentFrame, vProjected, 10.0f) + nGood >= kRelocMinInliers) {
+                OptimizePose();
+                nGood = DiscardOutliers();
+            }
+        }
+
+        if (nGood >= kRelocMinInliers) {
+            mnMatchesInliers = nGood;
+            std::cout << "Tracking: Relocalized against KF " << pKF->mnId << " with " << nGood << " inliers" << std::endl;
+            return true;
+        }
+    }
+
+    mCurrentFrame.mbHasPose = false;
+    std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+    return false;
+}
+
+void Tracking::SetTileManager(MapTileManager* pTileManager) {
+    mpTileManager = pTileManager;
+}
+
+bool Tracking::NeedFeatureDetection() const {
+    // Tracking asks for detection while initializing, lost, or for a keyframe
+    if (!mbFlowTracking || !mbFlowAllowed || mLastExtractedFrame.mvFlowPyramids.empty()) return true;
+    // Tracks only ever get lost; refresh once too few are left
+    return mLastExtractedFrame.N < mfFlowMinFeatureRatio * mnLastDetectedFeatures;
 }
 
 void Tracking::UpdateLastFrame() {
     mLastFrame = Frame(mCurrentFrame);
+    CaptureMapPointSlots(mLastFrame, mvLastFrameSlots);
+}
+
+SE3f Tracking::PredictPose() const {
+    if (!mLastFrame.HasPose()) return mLastKeyFramePose;
+    return mbVelocityValid ? mVelocity * mLastFrame.mTcw : mLastFrame.mTcw;
+}
+
+bool Tracking::TrackWithMotionModel() {
+    ORBmatcher matcher(0.9f, true);
+
+    // Constant velocity: the camera keeps moving as it did between the last two frames
+    mCurrentFrame.SetPose(PredictPose());
+    std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+
+    // Small window first; widen only if the prediction was off
+    const float th = 7.0f;
+    int nmatches = matcher.SearchByProjection(mCurrentFrame, mLastFrame, th);
+    if (nmatches < 20) {
+        std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+        nmatches = matcher.SearchByProjection(mCurrentFrame, mLastFrame, 2 * th);
+    }
+    if (nmatches < 20) return false;
+
+    // Optimize frame pose with all matches
+    OptimizePose();
+
+    mnMatchesInliers = DiscardOutliers();
+    return mnMatchesInliers >= 10;
+}
+
+bool Tracking::TrackReferenceKeyFrame() {
+    if (!HasMapPoints(mReferenceFrame)) return false;
+
+    ORBmatcher matcher(0.7f, true);
+
+    // No usable motion model: start from the last pose and search wide
+    mCurrentFrame.SetPose(mLastFrame.HasPose() ? mLastFrame.mTcw : mLastKeyFramePose);
+    std::fill(mCurrentFrame.mvpMapPoints.begin(), mCurrentFrame.mvpMapPoints.end(), nullptr);
+
+    const int nmatches = matcher.SearchByProjection(mCurrentFrame, mReferenceFrame, 15.0f);
+    if (nmatches < 15) return false;
+
+    OptimizePose();
+
+    mnMatchesInliers = DiscardOutliers();
+    return mnMatchesInliers >= 10;
+}
+
+bool Tracking::TrackLocalMap() {
+    SphereSLAM::Profiler p("TrackLocalMap");
+    UpdateLocalKeyFrames();
+    UpdateLocalPoints();
+
+    // No covisibility yet (first keyframes): the frame-to-frame result stands
+    if (mvpLocalMapPoints.empty()) return true;
+
+    std::vector<ProjectedMapPoint> vProjected;
+    mCurrentFrame.ProjectMapPoints(mvpLocalMapPoints, vProjected);
+
+    ORBmatcher matcher(0.8f);
+    // Poses just tracked are good; widen a little right after relocalization
+    const float th = mbVelocityValid ? 1.0f : 5.0f;
+    matcher.SearchByProjection(mCurrentFrame, vProjected, th);
+
+    OptimizePose();
+    mnMatchesInliers = DiscardOutliers();
+
+    mvpLocalKeyFrames.clear();
+    mvpLocalMapPoints.clear();
+    return mnMatchesInliers >= 30;
+}
+
+void Tracking::UpdateLocalKeyFrames() {
+    mvpLocalKeyFrames.clear();
+    // Frame ids start at 0, which is also the unmarked value
+    const long unsigned int nMark = mCurrentFrame.mnId + 1;
+
+    // Keyframes that observe the current matches, most shared points first
+    std::map<KeyFrame*, int> keyframeCounter;
+    for (MapPoint* pMP : mCurrentFrame.mvpMapPoints) {
+        if (!pMP) continue;
+        const std::map<KeyFrame*, size_t> observations = pMP->GetObservations();
+        for (const auto &obs : observations) keyframeCounter[obs.first]++;
+    }
+    if (keyframeCounter.empty()) return;
+
+    std::vector<std::pair<int, KeyFrame*>> vPairs;
+    vPairs.reserve(keyframeCounter.size());
+    for (const auto &kc : keyframeCounter) vPairs.push_back(std::make_pair(kc.second, kc.first));
+    std::sort(vPairs.begin(), vPairs.end(),
+              [](const std::pair<int, KeyFrame*> &a, const std::pair<int, KeyFrame*> &b) { return a.first > b.first; });
+
+    const size_t nMax = static_cast<size_t>(std::max(1, mnMaxLocalKeyFrames.load()));
+    for (const auto &pr : vPairs) {
+        if (mvpLocalKeyFrames.size() >= nMax) break;
+        pr.second->mnTrackReferenceForFrame = nMark;
+        mvpLocalKeyFrames.push_back(pr.second);
+    }
+
+    // Fill up with their strongest covisible neighbours
+    const size_t nDirect = mvpLocalKeyFrames.size();
+    for (size_t i = 0; i < nDirect && mvpLocalKeyFrames.size() < nMax; i++) {
+        const std::vector<KeyFrame*> vNeighs = mvpLocalKeyFrames[i]->GetBestCovisibilityKeyFrames(10);
+        for (KeyFrame* pNeighKF : vNeighs) {
+            if (mvpLocalKeyFrames.size() >= nMax) break;
+            if (pNeighKF->mnTrackReferenceForFrame == nMark) continue;
+            pNeighKF->mnTrackReferenceForFrame = nMark;
+            mvpLocalKeyFrames.push_back(pNeighKF);
+        }
+    }
+}
+
+void Tracking::UpdateLocalPoints() {
+    mvpLocalMapPoints.clear();
+    const long unsigned int nMark = mCurrentFrame.mnId + 1;
+
+    // Already matched points need no search
+    for (MapPoint* pMP : mCurrentFrame.mvpMapPoints) {
+        if (pMP) pMP->mnTrackReferenceForFrame = nMark;
+    }
+
+    // Keyframes are in order of relevance, so the cap drops the far ones
+    const size_t nMax = static_cast<size_t>(std::max(0, mnMaxLocalMapPoints.load()));
+    for (KeyFrame* pKF : mvpLocalKeyFrames) {
+        const std::vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+        for (MapPoint* pMP : vpMPs) {
+            if (mvpLocalMapPoints.size() >= nMax) return;
+            if (!pMP || pMP->mnTrackReferenceForFrame == nMark) continue;
+            pMP->mnTrackReferenceForFrame = nMark;
+            mvpLocalMapPoints.push_back(pMP);
+        }
+    }
+}
+
+void Tracking::SetLocalMapLimits(int nMaxKeyFrames, int nMaxMapPoints) {
+    mnMaxLocalKeyFrames = nMaxKeyFrames;
+    mnMaxLocalMapPoints = nMaxMapPoints;
+}
+
+void Tracking::SetFrameBudget(double ms) {
+    // Applied by UpdateDegradation on the tracking thread
+    std::unique_lock<std::mutex> lock(mMutexTiming);
+    mfRequestedBudgetMs = ms;
+    mbBudgetRequested = true;
+}
+
+int Tracking::GetDegradation() {
+    return mnDegradation;
+}
+
+Tracking::FrameTiming Tracking::GetLastFrameTiming() {
+    std::unique_lock<std::mutex> lock(mMutexTiming);
+    return mLastFrameTiming;
+}
+
+void Tracking::OptimizePose() {
+    const auto t0 = std::chrono::steady_clock::now();
+    Optimizer::PoseOptimization(&mCurrentFrame);
+    mfOptimizeMs += ElapsedMs(t0);
+}
+
+void Tracking::UpdateDegradation(const FrameTiming &timing) {
+    {
+        std::unique_lock<std::mutex> lock(mMutexTiming);
+        mLastFrameTiming = timing;
+        if (mbBudgetRequested) {
+            mbBudgetRequested = false;
+            mfFrameBudgetMs = mfRequestedBudgetMs;
+            mfFrameMsAvg = 0.0;
+            if (mfFrameBudgetMs <= 0.0) SetDegradation(DEGRADE_NONE);
+        }
+    }
+    if (mfFrameBudgetMs <= 0.0) return;
+
+    // Averaged, since flow-tracked frames are much cheaper than detected ones
+    mfFrameMsAvg = mfFrameMsAvg > 0.0 ? (1.0 - kFrameMsAvgWeight) * mfFrameMsAvg + kFrameMsAvgWeight * timing.mfTotalMs
+                                      : timing.mfTotalMs;
+    // A rung is held long enough for its effect to show in the average
+    mnFramesAtDegradation++;
+
+    const int level = mnDegradation;
+    if (mfFrameMsAvg > mfFrameBudgetMs && mnFramesAtDegradation >= kStepDownFrames && level < DEGRADE_SKIP_FACES) {
+        SetDegradation(level + 1);
+    } else if (mfFrameMsAvg < kHeadroomRatio * mfFrameBudgetMs && mnFramesAtDegradation >= kStepUpFrames && level > DEGRADE_NONE) {
+        SetDegradation(level - 1);
+    } else {
+        return;
+    }
+    std::cout << "Tracking: " << mfFrameMsAvg << " ms/frame for a " << mfFrameBudgetMs << " ms budget (extract "
+              << timing.mfExtractMs << ", match " << timing.mfMatchMs << ", optimize " << timing.mfOptimizeMs
+              << "), degradation " << level << " -> " << mnDegradation << std::endl;
+}
+
+void Tracking::SetDegradation(int level) {
+    // Extraction picks the new settings up with the next frame
+    mnDegradation = level;
+    mnFramesAtDegradation = 0;
+}
+
+int Tracking::DiscardOutliers() {
+    int nInliers = 0;
+    for (size_t i = 0; i < mCurrentFrame.mvpMapPoints.size(); i++) {
+        if (!mCurrentFrame.mvpMapPoints[i]) continue;
+        if (mCurrentFrame.mvbOutlier[i]) {
+            mCurrentFrame.mvpMapPoints[i] = nullptr;
+            mCurrentFrame.mvbOutlier[i] = false;
+        } else {
+            nInliers++;
+        }
+    }
+    return nInliers;
+}
+
+bool Tracking::HasMapPoints(const Frame &F) {
+    for (MapPoint* pMP : F.mvpMapPoints) {
+        if (pMP) return true;
+    }
+    return false;
+}
+
+void Tracking::CaptureMapPointSlots(const Frame &F, std::vector<SlotHandle> &vSlots) {
+    vSlots.assign(F.mvpMapPoints.size(), SlotHandle());
+    for (size_t i = 0; i < F.mvpMapPoints.size(); i++) {
+        if (F.mvpMapPoints[i]) vSlots[i] = F.mvpMapPoints[i]->mMapSlot;
+    }
+}
+
+bool Tracking::NeedNewKeyFrame() {
+    // Mapping is paused (map being replaced)
+    if (mpLocalMapper->isStopped() || mpLocalMapper->stopRequested()) return false;
+
+    const bool bMappingIdle = mpLocalMapper->AcceptKeyFrames();
+    const double dt = mCurrentFrame.mTimeStamp - mLastKeyFrameTime;
+
+    // Rotated far enough on the sphere that the view has changed
+    const float angle = RotationAngle(mCurrentFrame.mTcw, mLastKeyFramePose);
+    const bool cRotation = angle >= mfKeyFrameAngle;
+    // Losing track of what the last keyframe saw (only once tracking reports matches)
+    const bool cTracked = mnLastKeyFrameTracked > 0 &&
+                          mnMatchesInliers < mfTrackedRatio * mnLastKeyFrameTracked;
+    // A cube face gained texture the last keyframe did not cover
+    const bool cCoverage = (CoveredFaces(mCurrentFrame) & ~mnLastKeyFrameFaces) != 0;
+    // Long enough without a keyframe and not standing still
+    const bool cTimeout = dt >= mfMaxKeyFrameInterval && angle >= 0.1f * mfKeyFrameAngle;
+
+    if (!(cRotation || cTracked || cCoverage || cTimeout)) return false;
+    // Rate limit, unless mapping has nothing else to do
+    if (dt < mfMinKeyFrameInterval && !bMappingIdle) return false;
+
+    // Idle mapping takes it right away
+    if (bMappingIdle) return true;
+
+    // Busy: cut the running local BA short so the queue moves, and only queue
+    // while there is room. Otherwise skip; the next frame asks again.
+    mpLocalMapper->InterruptBA();
+    const size_t nCapacity = mpLocalMapper->QueueCapacity();
+    if (nCapacity == 0 || mpLocalMapper->KeyFramesInQueue() < nCapacity) return true;
+
+    mnSkippedKeyFrames++;
+    return false;
+}
+
+unsigned int Tracking::CoveredFaces(const Frame &F) const {
+    unsigned int mask = 0;
+    for (size_t f = 0; f < F.mvKeys.size() && f < 32; f++) {
+        if (static_cast<int>(F.mvKeys[f].size()) >= mnMinFaceFeatures) mask |= 1u << f;
+    }
+    return mask;
+}
+
+int Tracking::GetKeyFramesPerMinute() {
+    std::unique_lock<std::mutex> lock(mMutexKeyFrameTimes);
+    return static_cast<int>(mdKeyFrameTimes.size());
 }
 
 void Tracking::CreateNewKeyFrame() {
-    KeyFrame* pKF = new KeyFrame(mCurrentFrame, mpMap, nullptr);
-    mpLocalMapper->InsertKeyFrame(pKF);
+    CreateNewKeyFrame(mCurrentFrame, mnMatchesInliers);
+}
+
+void Tracking::CreateNewKeyFrame(Frame &F, int nMatchesInliers) {
+    // Keep mapping from pausing between creating the keyframe and queuing it
+    if (!mpLocalMapper->SetNotStop(true)) return;
+
+    KeyFrame* pKF = mpMap->NewKeyFrame(F, nullptr);
+    if (mpLocalMapper->InsertKeyFrame(pKF)) {
+        KeyFrameInserted(F, nMatchesInliers);
+    } else {
+        // Queue filled up (or shutting down) meanwhile: the next frame can try again
+        mpMap->DestroyKeyFrame(pKF);
+    }
+
+    mpLocalMapper->SetNotStop(false);
+}
+
+void Tracking::KeyFrameInserted(const Frame &F, int nMatchesInliers) {
+    mLastKeyFramePose = F.mTcw;
+    mLastKeyFrameTime = F.mTimeStamp;
+    mnLastKeyFrameTracked = nMatchesInliers;
+    mnLastKeyFrameFaces = CoveredFaces(F);
+
+    // What the keyframe saw, for TrackReferenceKeyFrame (no images needed)
+    mReferenceFrame = Frame(F);
+    mReferenceFrame.mImgs.clear();
+    mReferenceFrame.mvFlowPyramids.clear();
+    CaptureMapPointSlots(mReferenceFrame, mvReferenceSlots);
+
+    std::unique_lock<std::mutex> lock(mMutexKeyFrameTimes);
+    mdKeyFrameTimes.push_back(F.mTimeStamp);
+    while (mdKeyFrameTimes.front() < F.mTimeStamp - 60.0) mdKeyFrameTimes.pop_front();
+}
+
+void Tracking::ProcessKeyFrameCandidate(bool bNeeded) {
+    const float sharpness = UpdateSharpness(mCurrentFrame);
+
+    if (mbKeyFrameDeferred) {
+        // Keep the sharpest frame of the window
+        if (sharpness > mfDeferredSharpness) {
+            mDeferredFrame = Frame(mCurrentFrame);
+            CaptureMapPointSlots(mDeferredFrame, mvDeferredSlots);
+            mfDeferredSharpness = sharpness;
+            mnDeferredInliers = mnMatchesInliers;
+        }
+        if (mfDeferredSharpness < mfMinRelativeSharpness && ++mnDeferredFrames < mnMaxDeferredFrames) return;
+
+        // Sharp enough, or out of time: take the best we have
+        mbKeyFrameDeferred = false;
+        if (mDeferredFrame.mnId != mnDeferredRequestId) mnSharperKeyFrames++;
+        mpMap->ValidateMapPoints(mDeferredFrame.mvpMapPoints, mvDeferredSlots);
+        CreateNewKeyFrame(mDeferredFrame, mnDeferredInliers);
+        // Drop the images it holds
+        mDeferredFrame = Frame();
+        return;
+    }
+
+    if (!bNeeded) return;
+
+    // Keyframes get freshly detected features: the next frame is detected
+    // and, still needing a keyframe, asks again
+    if (mCurrentFrame.mbFlowTracked) {
+        mbDetectNextFrame = true;
+        return;
+    }
+
+    if (sharpness >= mfMinRelativeSharpness) {
+        CreateNewKeyFrame();
+        return;
+    }
+
+    // Motion blurred: worth neither storing, triangulating nor stitching. Wait a few frames.
+    mbKeyFrameDeferred = true;
+    mDeferredFrame = Frame(mCurrentFrame);
+    CaptureMapPointSlots(mDeferredFrame, mvDeferredSlots);
+    mnDeferredRequestId = mCurrentFrame.mnId;
+    mfDeferredSharpness = sharpness;
+    mnDeferredInliers = mnMatchesInliers;
+    mnDeferredFrames = 0;
+}
+
+float Tracking::UpdateSharpness(const Frame &F) {
+    if (mvSharpnessAvg.size() != F.mvSharpness.size()) mvSharpnessAvg = F.mvSharpness;
+
+    std::vector<float> vRelative;
+    vRelative.reserve(F.mvSharpness.size());
+    for (size_t f = 0; f < F.mvSharpness.size(); f++) {
+        float &avg = mvSharpnessAvg[f];
+        // Textureless faces (sky, walls) say nothing about blur
+        if (avg > 1e-3f) vRelative.push_back(F.mvSharpness[f] / avg);
+        avg = 0.9f * avg + 0.1f * F.mvSharpness[f];
+    }
+    if (vRelative.empty()) return 1.0f;
+
+    std::nth_element(vRelative.begin(), vRelative.begin() + vRelative.size() / 2, vRelative.end());
+    return vRelative[vRelative.size() / 2];
 }
 
 void Tracking::Reset() {
     mState = NO_IMAGES_YET;
+    mLastKeyFramePose = SE3f::Identity();
+    mLastKeyFrameTime = 0.0;
+    mnLastKeyFrameTracked = 0;
+    mnLastKeyFrameFaces = 0;
+    mbKeyFrameDeferred = false;
+    mDeferredFrame = Frame();
+    mvSharpnessAvg.clear();
+    mReferenceFrame = Frame();
+    mLastFrame = Frame();
+    mbVelocityValid = false;
+    mbRotationOnly = false;
+    mLastExtractedFrame = Frame();
+    mnLastDetectedFeatures = 0;
+    mbDetectNextFrame = false;
+    mbFlowAllowed = false;
+    mnPureRotationFrames = 0;
+    mnLastTranslationCheck = 0;
+
+    // Back to rung 0 and the base extraction settings; the budget stays
+    SetDegradation(DEGRADE_NONE);
+    mfFrameMsAvg = 0.0;
+    mpORBextractor->SetFeatures(mnBaseFeatures);
+    mpORBextractor->SetLevels(mnBaseLevels);
+    mnAppliedDegradation = DEGRADE_NONE;
     if (mpInitializer) {
         delete mpInitializer;
         mpInitializer = nullptr;
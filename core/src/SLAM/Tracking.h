@@ -2,6 +2,8 @@
 #define TRACKING_H
 
 #include <opencv2/core.hpp>
+#include <atomic>
+#include <deque>
 #include <mutex>
 #include "Frame.h"
 #include "GeometricCamera.h"
@@ -9,6 +11,7 @@
 #include "Map.h"
 #include "LocalMapping.h"
 #include "Initializer.h"
+#include "MapTileManager.h"
 
 class System;
 
@@ -22,16 +25,58 @@ public:
         LOST=3
     };
 
+    // Degradation ladder for the frame budget; each rung keeps the ones before it
+    enum eDegradation {
+        DEGRADE_NONE=0,
+        DEGRADE_FEWER_FEATURES=1,  // smaller extraction budget
+        DEGRADE_COARSE_PYRAMID=2,  // fewer ORB pyramid levels
+        DEGRADE_NO_LOCAL_MAP=3,    // frame-to-frame tracking only
+        DEGRADE_SKIP_FACES=4       // features on the most textured faces only
+    };
+
+    // Stage times of one frame (ms). Matching covers the rest of tracking.
+    struct FrameTiming {
+        double mfExtractMs = 0.0;
+        double mfMatchMs = 0.0;
+        double mfOptimizeMs = 0.0;
+        double mfTotalMs = 0.0;
+    };
+
     Tracking(System* pSys, GeometricCamera* pCam, Map* pMap, LocalMapping* pLM);
 
-    // Main tracking function for CubeMap
-    cv::Mat GrabImageCubeMap(const std::vector<cv::Mat>& faces, const double& timestamp);
+    // Main tracking function for CubeMap: ExtractFrame then TrackFrame.
+    // Returns false while there is no pose (not initialized / lost).
+    bool GrabImageCubeMap(const std::vector<cv::Mat>& faces, const double& timestamp, SE3f &Tcw);
+
+    // The two stages on their own, for a pipeline: frame N+1 may be extracted
+    // on one thread while frame N is tracked on another (one thread per stage,
+    // frames tracked in extraction order, dropped frames allowed).
+    // Extraction only reads tracking's requests (detect or follow, ladder
+    // rung), so they take effect one frame late when pipelined.
+    Frame ExtractFrame(const std::vector<cv::Mat>& faces, const double& timestamp, FrameTiming &timing);
+    bool TrackFrame(const Frame &F, FrameTiming &timing, SE3f &Tcw);
 
     void SetState(eTrackingState state);
     eTrackingState GetState();
 
     void Reset();
 
+    // Tiled maps: Tracking reports its position so the tiles around it stay resident
+    void SetTileManager(MapTileManager* pTileManager);
+
+    // Keyframes inserted during the last minute of capture time
+    int GetKeyFramesPerMinute();
+
+    // Bounds the local map searched every frame (keyframes / map points)
+    void SetLocalMapLimits(int nMaxKeyFrames, int nMaxMapPoints);
+
+    // Latency budget per frame in ms (0: none). Running over on average steps
+    // down the degradation ladder; with headroom again it steps back up.
+    void SetFrameBudget(double ms);
+    // Current rung (eDegradation)
+    int GetDegradation();
+    FrameTiming GetLastFrameTiming();
+
 public:
     eTrackingState mState;
 
@@ -55,8 +100,72 @@ public:
     // Initializer
     Initializer* mpInitializer;
 
+    // Tile Manager (may be null)
+    MapTileManager* mpTileManager;
+
     // Pose
-    cv::Mat mVelocity;
+    SE3f mVelocity;  // Tcw(current) * Twc(last), valid after two tracked frames
+    bool mbVelocityValid;
+
+    // Keyframe decision thresholds
+    double mfMinKeyFrameInterval;  // s between keyframes unless mapping is idle
+    double mfMaxKeyFrameInterval;  // s after which any motion is enough
+    float mfKeyFrameAngle;         // rad of rotation since the last keyframe
+    float mfTrackedRatio;          // tracked points relative to the last keyframe
+    int mnMinFaceFeatures;         // keypoints for a cube face to count as covered
+
+    // Hybrid front end: between detections the last frame's features are
+    // followed by optical flow (descriptors inherited). ORB runs while not
+    // tracking, for keyframes, and once fewer than mfFlowMinFeatureRatio of
+    // the last detection's features are left.
+    bool mbFlowTracking;
+    float mfFlowMinFeatureRatio;
+
+    // Map points tracked in the current frame (filled by local map tracking;
+    // in rotation-only mode, the features consistent with the rotation)
+    int mnMatchesInliers;
+
+    // Rotation-only mode: the camera turns about its centre (photosphere
+    // capture), so poses are orientations, keyframes carry no map points and
+    // nothing is triangulated until a translation becomes observable
+    bool mbRotationOnly;
+
+    // Local map size limits; the search cost grows with the points projected.
+    // Set from the UI thread, read every frame.
+    std::atomic<int> mnMaxLocalKeyFrames;
+    std::atomic<int> mnMaxLocalMapPoints;
+
+    // Last inserted keyframe, copied because the keyframe itself may be culled
+    SE3f mLastKeyFramePose;
+    double mLastKeyFrameTime;
+    int mnLastKeyFrameTracked;
+    unsigned int mnLastKeyFrameFaces;
+
+    // Keyframes wanted but skipped because mapping was backed up
+    std::atomic<long unsigned int> mnSkippedKeyFrames;
+
+    // Sharpness gating: a blurry keyframe candidate is held back for up to
+    // mnMaxDeferredFrames while a sharper neighbouring frame is looked for
+    float mfMinRelativeSharpness;  // vs the running per-face average
+    int mnMaxDeferredFrames;
+    std::vector<float> mvSharpnessAvg;
+    bool mbKeyFrameDeferred;
+    Frame mDeferredFrame;
+    long unsigned int mnDeferredRequestId;  // frame that asked for the keyframe
+    float mfDeferredSharpness;
+    int mnDeferredInliers;
+    int mnDeferredFrames;
+    std::vector<SlotHandle> mvDeferredSlots;
+    // Keyframes taken from a sharper frame than the one that asked for them
+    std::atomic<long unsigned int> mnSharperKeyFrames;
+
+    // Frame the last keyframe was made from, with its matched map points
+    Frame mReferenceFrame;
+
+    // Slots of the map points held by mLastFrame / mReferenceFrame, so points
+    // culled between frames can be dropped without dereferencing them
+    std::vector<SlotHandle> mvLastFrameSlots;
+    std::vector<SlotHandle> mvReferenceSlots;
 
 private:
     void Track();
@@ -64,10 +173,93 @@ private:
     bool TrackWithMotionModel();
     bool Relocalization();
 
+    // Searches the map points of the keyframes covisible with the current
+    // matches and refines the pose with them
+    bool TrackLocalMap();
+    void UpdateLocalKeyFrames();
+    void UpdateLocalPoints();
+
     void UpdateLastFrame();
+    // ORB detection for the next frame, or optical flow from the last one built
+    bool NeedFeatureDetection() const;
+    // Constant velocity prediction from the last frame
+    SE3f PredictPose() const;
+    // Drops the matches pose optimization rejected; returns those kept
+    int DiscardOutliers();
+    static bool HasMapPoints(const Frame &F);
+    static void CaptureMapPointSlots(const Frame &F, std::vector<SlotHandle> &vSlots);
+    // Decides on a keyframe given the mapping load; may interrupt local BA
+    bool NeedNewKeyFrame();
+    // Inserts now, or defers a blurry candidate and later inserts the sharpest frame seen
+    void ProcessKeyFrameCandidate(bool bNeeded);
     void CreateNewKeyFrame();
+    void CreateNewKeyFrame(Frame &F, int nMatchesInliers);
+    // Bookkeeping once mapping has taken the keyframe of F
+    void KeyFrameInserted(const Frame &F, int nMatchesInliers);
+    // Median over faces of sharpness relative to the running average; updates the average
+    float UpdateSharpness(const Frame &F);
+    // Bit f set if face f has at least mnMinFaceFeatures keypoints
+    unsigned int CoveredFaces(const Frame &F) const;
 
     void MonocularInitialization();
+    // Two keyframes and the triangulated points, scaled to unit median depth.
+    // A reference view posed in rotation-only mode keeps its pose and keyframe.
+    bool CreateInitialMapMonocular(const SE3f &T21, const std::vector<cv::Point3f> &vP3D);
+
+    // Rotation-only mode, entered from initialization once only a rotation has
+    // explained the matches for a while
+    void StartRotationOnly(const SE3f &R21);
+    // Rays of the reference keyframe against the current bearings: 2-point
+    // RANSAC on the rotation, refit on all inliers. bRelocalize: no
+    // prediction, brute-force matching.
+    bool TrackRotationOnly(bool bRelocalize);
+    // Two-view initialization against the oldest reference still in view;
+    // builds the map and leaves rotation-only mode once there is parallax
+    void CheckTranslation();
+    // Consecutive initialization attempts explained by a rotation alone
+    int mnPureRotationFrames;
+    long unsigned int mnLastTranslationCheck;
+
+    // Extraction side: the last frame built (for optical flow), the features
+    // of the last detection, and the ladder rung the extractor is set to
+    Frame mLastExtractedFrame;
+    int mnLastDetectedFeatures;
+    int mnAppliedDegradation;
+    // Tracking side: a keyframe waiting for a detection; whether the next
+    // frame may be followed by optical flow
+    bool mbDetectNextFrame;
+    std::atomic<bool> mbFlowAllowed;
+
+    // Initialization: match of each reference feature in the current frame,
+    // and where it was last seen (the search window follows it)
+    std::vector<int> mvIniMatches;
+    std::vector<cv::Point2f> mvIniLastMatched;
+
+    // Frame budget and the ladder. Extraction settings at rung 0 are kept to step back up.
+    void UpdateDegradation(const FrameTiming &timing);
+    void SetDegradation(int level);
+    // Pose optimization of the current frame, timed
+    void OptimizePose();
+    double mfFrameBudgetMs;
+    double mfFrameMsAvg;
+    int mnFramesAtDegradation;
+    std::atomic<int> mnDegradation;
+    int mnBaseFeatures;
+    int mnBaseLevels;
+    double mfOptimizeMs;
+    FrameTiming mLastFrameTiming;
+    // Budget asked for by SetFrameBudget, taken over by the tracking thread
+    double mfRequestedBudgetMs;
+    bool mbBudgetRequested;
+    std::mutex mMutexTiming;
+
+    // Rebuilt every frame; only dereferenced while the tracking guard is held
+    std::vector<KeyFrame*> mvpLocalKeyFrames;
+    std::vector<MapPoint*> mvpLocalMapPoints;
+
+    // Insertion times within the last minute of tracked frames
+    std::deque<double> mdKeyFrameTimes;
+    std::mutex mMutexKeyFrameTimes;
 };
 
 #endif // TRACKING_H
@@ -25,12 +25,10 @@ std::vector<Gaussian> Densifier::DensifyKeyFrame(KeyFrame* pKF, const std::vecto
     }
 
     // Get Camera Pose (World to Camera)
-    cv::Mat Tcw = pKF->GetPose();
-    if (Tcw.empty()) return newGaussians;
+    if (!pKF->HasPose()) return newGaussians;
 
     // We need Camera to World (Inverse)
-    cv::Mat Twc;
-    cv::invert(Tcw, Twc);
+    const SE3f Twc = pKF->GetPoseInverse();
 
     // Resize color image if it doesn't match depth map resolution (512x256)
     cv::Mat colorResized;
@@ -41,9 +39,9 @@ std::vector<Gaussian> Densifier::DensifyKeyFrame(KeyFrame* pKF, const std::vecto
     }
 
     // Extract Rotation (R) and Translation (t)
-    float r00 = Twc.at<float>(0,0); float r01 = Twc.at<float>(0,1); float r02 = Twc.at<float>(0,2); float tx = Twc.at<float>(0,3);
-    float r10 = Twc.at<float>(1,0); float r11 = Twc.at<float>(1,1); float r12 = Twc.at<float>(1,2); float ty = Twc.at<float>(1,3);
-    float r20 = Twc.at<float>(2,0); float r21 = Twc.at<float>(2,1); float r22 = Twc.at<float>(2,2); float tz = Twc.at<float>(2,3);
+    float r00 = Twc.R[0]; float r01 = Twc.R[1]; float r02 = Twc.R[2]; float tx = Twc.t[0];
+    float r10 = Twc.R[3]; float r11 = Twc.R[4]; float r12 = Twc.R[5]; float ty = Twc.t[1];
+    float r20 = Twc.R[6]; float r21 = Twc.R[7]; float r22 = Twc.R[8]; float tz = Twc.t[2];
 
     // Reserve memory
     newGaussians.reserve(EQUI_WIDTH * EQUI_HEIGHT);
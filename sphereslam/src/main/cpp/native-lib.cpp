@@ -69,6 +69,14 @@ Java_com_hereliesaz_sphereslam_SphereSLAM_initNative(JNIEnv* env, jobject thiz,
     renderer->initialize();
 
     slamSystem = new System("", "", System::IMU_MONOCULAR, platformAndroid, false);
+    // Poses arrive from the tracking thread; the camera callback only waits for extraction
+    slamSystem->SetPoseCallback([](const System::TrackedPose &pose) {
+        if (pose.mTcw.empty()) return;
+        std::unique_lock<std::mutex> lock(mMutexPose);
+        mCurrentPose = pose.mTcw.clone();
+        mUseManualPose = false;
+    });
+    slamSystem->StartTrackingPipeline(2, System::DROP_OLDEST);
     mosaicer = new lightcycle::Mosaic();
 
     __android_log_print(ANDROID_LOG_INFO, TAG, "LightCycle Native Initialized");
@@ -103,12 +111,7 @@ Java_com_hereliesaz_sphereslam_SphereSLAM_processFrame(JNIEnv* env, jobject thiz
     if (slamSystem) {
         std::vector<cv::Mat> faces;
         for(int i=0; i<6; ++i) faces.push_back(inputImage.clone());
-        cv::Mat Tcw = slamSystem->TrackCubeMap(faces, timestamp);
-        std::unique_lock<std::mutex> lock(mMutexPose);
-        if (!Tcw.empty()) {
-            mCurrentPose = Tcw.clone();
-            mUseManualPose = false;
-        }
+        slamSystem->TrackCubeMapAsync(faces, timestamp);
     }
 }
 
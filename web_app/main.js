@@ -250,7 +250,10 @@ function downloadFromMemFS(filename) {
 document.getElementById('save-map-btn').addEventListener('click', () => {
     if (!slamSystem) return;
     const filename = "map.bin";
-    slamSystem.saveMap(filename);
+    if (!slamSystem.saveMap(filename)) {
+        alert("Failed to Save Map.");
+        return;
+    }
     downloadFromMemFS(filename);
 });
 
@@ -101,8 +101,26 @@ public:
         if (mSystem) mSystem->SavePhotosphere(filename);
     }
 
-    void saveMap(std::string filename) {
-        if (mSystem) mSystem->SaveMap(filename);
+    bool saveMap(std::string filename) {
+        if (!mSystem) return false;
+        // The caller downloads the file right after this returns, so wait for the writer
+        std::shared_ptr<MapSaveHandle> pHandle = mSystem->SaveMap(filename);
+        return pHandle && pHandle->Wait();
+    }
+
+    std::string benchmarkMapEncoding() {
+        if (mSystem) return mSystem->BenchmarkMapEncoding();
+        return "Not Init";
+    }
+
+    std::string benchmarkPoseOptimization() {
+        if (mSystem) return mSystem->BenchmarkPoseOptimization();
+        return "Not Init";
+    }
+
+    std::string benchmarkQueueWakeup() {
+        if (mSystem) return mSystem->BenchmarkQueueWakeup();
+        return "Not Init";
     }
 
     bool loadMap(std::string filename) {
@@ -113,28 +131,17 @@ public:
     // Accessor for Points (Memory Safe)
     val getMapPointsFlat() {
         if (!mSystem) return val::null();
-        std::vector<MapPoint*> vMPs = mSystem->GetAllMapPoints();
-        size_t size = vMPs.size() * 3;
+        // The view is immutable and kept alive by pView, so no copy is needed
+        std::shared_ptr<const MapView> pView = mSystem->GetMapView();
+        const std::vector<float> &positions = pView->mvMapPointPositions;
 
         // Allocate JS Array
         val Float32Array = val::global("Float32Array");
-        val jsArray = Float32Array.new_(size);
-
-        // We need to copy data to it.
-        // Efficient way:
-        std::vector<float> temp;
-        temp.reserve(size);
-        for(auto mp : vMPs) {
-             if (!mp) continue;
-             cv::Point3f p = mp->GetWorldPos();
-             temp.push_back(p.x);
-             temp.push_back(p.y);
-             temp.push_back(p.z);
-        }
+        val jsArray = Float32Array.new_(positions.size());
 
         // Create a temporary view and call .set() on the JS array
         // The view is valid for the duration of the call.
-        jsArray.call<void>("set", val(typed_memory_view(temp.size(), temp.data())));
+        jsArray.call<void>("set", val(typed_memory_view(positions.size(), positions.data())));
 
         return jsArray;
     }
@@ -156,6 +163,9 @@ EMSCRIPTEN_BINDINGS(sphereslam_module) {
         .function("savePhotosphere", &SystemWrapper::savePhotosphere)
         .function("saveMap", &SystemWrapper::saveMap)
         .function("loadMap", &SystemWrapper::loadMap)
+        .function("benchmarkMapEncoding", &SystemWrapper::benchmarkMapEncoding)
+        .function("benchmarkPoseOptimization", &SystemWrapper::benchmarkPoseOptimization)
+        .function("benchmarkQueueWakeup", &SystemWrapper::benchmarkQueueWakeup)
         .function("getAllMapPoints", &SystemWrapper::getMapPointsFlat)
         .function("getPose", &SystemWrapper::getLastPose);
 